@@ -0,0 +1,681 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file 
+ * 
+ * \brief Benchmark of the library hot paths
+ * 
+ * Usage:
+ * 	- cbimage_bench [-s WIDTHxHEIGHT]... [-f rgba16|rgb8|rgba8|mono1]... [-r repeats] [-d directory] [-o output.json]
+ * 	- cbimage_bench compare baseline.json current.json [threshold_percent]
+ * 
+ * Results are printed as JSON, one result per line. Compare mode prints
+ * the change of the throughput of every benchmark found in both files and
+ * exits with status 1 if any of them became slower than the threshold allows.
+ */
+
+#include <cbimage.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MAX_SIZES 16
+#define BENCH_MAX_RESULTS 1024
+#define BENCH_DEFAULT_REPEATS 10
+#define BENCH_DEFAULT_THRESHOLD 5.0
+
+/** 
+ * \brief Single benchmark result
+ */
+typedef struct
+{
+	char		name[64];
+	char		format[16];
+	size_t	width;
+	size_t	height;
+	int			repeats;
+	double	min_ms;
+	double	median_ms;
+	double	p90_ms;
+	double	p99_ms;
+	double	mpix_s;
+	double	mb_s;
+} bench_result_t;
+
+/** 
+ * \brief Operation being measured, *state* is prepared by the caller
+ */
+typedef struct
+{
+	cbimage_t					*image;
+	cbimage_t					*other;
+	char							*filename;
+	cbimage_buffer_t	buffer;
+	int								argument;
+} bench_state_t;
+
+typedef void (*bench_fn)(bench_state_t *state);
+
+static const char *bench_format_names[] = {"rgba16", "rgb8", "rgba8", "mono1"};
+
+
+
+static double bench_now_ms(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+
+
+static int bench_compare_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	
+	return (x > y) - (x < y);
+}
+
+
+
+static double bench_percentile(const double *sorted, int count, double percent)
+{
+	int index = (int)(percent / 100.0 * (count - 1) + 0.5);
+	
+	return sorted[index];
+}
+
+
+
+/** 
+ * \brief Runs operation *repeats* times (after one warm-up run) and prints the result
+ */
+static void bench_run(FILE *output, const char *name, bench_fn fn, bench_state_t *state, int format, size_t pixels, size_t bytes, int repeats)
+{
+	bench_result_t	result;
+	double					*times = malloc(sizeof(double) * repeats);
+	int							i;
+	
+	if(!times)
+		return;
+	
+	memset(&result, 0, sizeof(result));
+	result.width = state->image->width;
+	result.height = state->image->height;
+	
+	fn(state);
+	
+	for(i = 0; i < repeats; i++)
+	{
+		double start = bench_now_ms();
+		
+		fn(state);
+		times[i] = bench_now_ms() - start;
+	}
+	
+	qsort(times, repeats, sizeof(double), bench_compare_double);
+	
+	snprintf(result.name, sizeof(result.name), "%s", name);
+	snprintf(result.format, sizeof(result.format), "%s", bench_format_names[format]);
+	result.repeats = repeats;
+	result.min_ms = times[0];
+	result.median_ms = bench_percentile(times, repeats, 50);
+	result.p90_ms = bench_percentile(times, repeats, 90);
+	result.p99_ms = bench_percentile(times, repeats, 99);
+	
+	/* Throughput is calculated from the median, so single slow runs do not distort it */
+	if(result.median_ms > 0)
+	{
+		result.mpix_s = pixels / 1e6 / (result.median_ms / 1e3);
+		result.mb_s = bytes / 1048576.0 / (result.median_ms / 1e3);
+	}
+	
+	fprintf(output, "\t{\"name\": \"%s\", \"format\": \"%s\", \"width\": %zu, \"height\": %zu, \"repeats\": %d, "
+		"\"min_ms\": %.4f, \"median_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"mpix_s\": %.3f, \"mb_s\": %.3f}",
+		result.name, result.format, result.width, result.height, result.repeats,
+		result.min_ms, result.median_ms, result.p90_ms, result.p99_ms, result.mpix_s, result.mb_s);
+	
+	free(times);
+}
+
+
+
+static void bench_load(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_load_bmp_format(state->filename, state->image->format));
+}
+
+/** 
+ * \brief Decodes the file saved by bench_save_buffer() straight from memory
+ */
+static void bench_load_mem(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_load_bmp_mem_format(state->buffer.data, state->buffer.size, state->image->format));
+}
+
+static void bench_load_scaled(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_load_bmp_scaled(state->filename, state->image->format, state->argument));
+}
+
+/** 
+ * \brief Loads the file *argument* times one after another, the baseline of bench_load_async()
+ */
+static void bench_load_many(bench_state_t *state)
+{
+	int i;
+	
+	for(i = 0; i < state->argument; i++)
+		cbimage_destroy(cbimage_load_bmp_format(state->filename, state->image->format));
+}
+
+static void bench_load_async_done(void *user, cbimage_t *image)
+{
+	(void)user;
+	cbimage_destroy(image);
+}
+
+static void bench_load_async(bench_state_t *state)
+{
+	cbimage_async_t	*async = cbimage_async_create(0);
+	int							i;
+	
+	for(i = 0; i < state->argument; i++)
+		cbimage_async_load_bmp(async, state->filename, state->image->format, bench_load_async_done, NULL);
+	cbimage_async_destroy(async);
+}
+
+static void bench_save(bench_state_t *state)
+{
+	cbimage_save_bmp(state->filename, *state->image, state->argument);
+}
+
+/** 
+ * \brief Saves into the same buffer every time, only the first run allocates
+ */
+static void bench_save_buffer(bench_state_t *state)
+{
+	state->buffer.size = 0;
+	cbimage_save_bmp_buffer(&state->buffer, *state->image, state->argument);
+}
+
+static void bench_load_pnm(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_load_pnm_format(state->filename, state->image->format));
+}
+
+static void bench_save_pnm(bench_state_t *state)
+{
+	cbimage_save_pnm(state->filename, *state->image, state->argument, 0);
+}
+
+static void bench_rotate(bench_state_t *state)
+{
+	cbimage_rotate(state->image, state->argument);
+}
+
+static void bench_mirror(bench_state_t *state)
+{
+	cbimage_mirror(state->image, state->argument);
+}
+
+static void bench_inverse(bench_state_t *state)
+{
+	cbimage_inverse(state->image, state->argument);
+}
+
+static void bench_insert(bench_state_t *state)
+{
+	cbimage_insert(state->image, state->other, state->image->width / 4, state->image->height / 4);
+}
+
+static void bench_bond(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_bond(state->argument, 2, state->image, state->other));
+}
+
+static void bench_chain(bench_state_t *state)
+{
+	cbimage_t *out = cbimage_rotate_copy(state->image, CBIMAGE_90_DEG);
+	
+	cbimage_mirror(out, CBIMAGE_MIRROR_HORIZONTALY);
+	cbimage_inverse(out, CBIMAGE_INVERSE_WITHOUT_ALPHA);
+	cbimage_insert(out, state->other, 0, 0);
+	cbimage_destroy(out);
+}
+
+static void bench_pipeline(bench_state_t *state)
+{
+	cbimage_pipeline_t *pipeline = cbimage_pipeline_create();
+	
+	cbimage_pipeline_rotate(pipeline, CBIMAGE_90_DEG);
+	cbimage_pipeline_mirror(pipeline, CBIMAGE_MIRROR_HORIZONTALY);
+	cbimage_pipeline_inverse(pipeline, CBIMAGE_INVERSE_WITHOUT_ALPHA);
+	cbimage_pipeline_insert(pipeline, state->other, 0, 0);
+	cbimage_destroy(cbimage_pipeline_run(pipeline, state->image));
+	cbimage_pipeline_destroy(pipeline);
+}
+
+
+static void bench_resize(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_resize(state->image, state->image->width / 2, state->image->height / 2, state->argument));
+}
+
+/** 
+ * \brief Per-pixel bilinear interpolation through cbimage_get_pixel(), the baseline of bench_resize()
+ */
+static void bench_resize_naive(bench_state_t *state)
+{
+	cbimage_t	*image = state->image;
+	cbimage_t	*out = cbimage_create_format(image->width / 2, image->height / 2, image->type, image->format);
+	size_t		x, y;
+	
+	for(y = 0; out && y < out->height; y++)
+	{
+		for(x = 0; x < out->width; x++)
+		{
+			double		fx = (x + 0.5) * image->width / out->width - 0.5, fy = (y + 0.5) * image->height / out->height - 0.5;
+			size_t		x0 = (fx > 0) ? ((size_t)fx) : (0), y0 = (fy > 0) ? ((size_t)fy) : (0);
+			size_t		x1 = (x0 + 1 < image->width) ? (x0 + 1) : (x0), y1 = (y0 + 1 < image->height) ? (y0 + 1) : (y0);
+			double		dx = (fx > x0) ? (fx - x0) : (0), dy = (fy > y0) ? (fy - y0) : (0);
+			cbpixel_t	p00 = cbimage_get_pixel(image, x0, y0), p10 = cbimage_get_pixel(image, x1, y0);
+			cbpixel_t	p01 = cbimage_get_pixel(image, x0, y1), p11 = cbimage_get_pixel(image, x1, y1), pixel;
+			
+			pixel.r = (p00.r * (1 - dx) + p10.r * dx) * (1 - dy) + (p01.r * (1 - dx) + p11.r * dx) * dy + 0.5;
+			pixel.g = (p00.g * (1 - dx) + p10.g * dx) * (1 - dy) + (p01.g * (1 - dx) + p11.g * dx) * dy + 0.5;
+			pixel.b = (p00.b * (1 - dx) + p10.b * dx) * (1 - dy) + (p01.b * (1 - dx) + p11.b * dx) * dy + 0.5;
+			pixel.a = (p00.a * (1 - dx) + p10.a * dx) * (1 - dy) + (p01.a * (1 - dx) + p11.a * dx) * dy + 0.5;
+			cbimage_set_pixel(out, x, y, pixel);
+		}
+	}
+	cbimage_destroy(out);
+}
+
+
+
+static void bench_gaussian(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_gaussian_blur(state->image, state->argument, CBIMAGE_BORDER_CLAMP));
+}
+
+/** 
+ * \brief Per-pixel 2D Gaussian (sigma 1, 7x7) through cbimage_get_pixel(), the baseline of bench_gaussian()
+ */
+static void bench_gaussian_naive(bench_state_t *state)
+{
+	cbimage_t	*image = state->image;
+	cbimage_t	*out = cbimage_create_format(image->width, image->height, image->type, image->format);
+	double		weights[7] = {0.011108997, 0.135335283, 0.606530660, 1.0, 0.606530660, 0.135335283, 0.011108997};
+	size_t		x, y, i, j;
+	
+	for(i = 0; i < 7; i++)
+		weights[i] /= 2.506608836;
+	
+	for(y = 0; out && y < out->height; y++)
+	{
+		for(x = 0; x < out->width; x++)
+		{
+			double		sum[4] = {0.5, 0.5, 0.5, 0.5};
+			cbpixel_t	pixel;
+			
+			for(j = 0; j < 7; j++)
+			{
+				for(i = 0; i < 7; i++)
+				{
+					size_t		sx = (x + i < 3) ? (0) : ((x + i - 3 < image->width) ? (x + i - 3) : (image->width - 1));
+					size_t		sy = (y + j < 3) ? (0) : ((y + j - 3 < image->height) ? (y + j - 3) : (image->height - 1));
+					cbpixel_t	from = cbimage_get_pixel(image, sx, sy);
+					double		weight = weights[i] * weights[j];
+					
+					sum[0] += weight * from.r;
+					sum[1] += weight * from.g;
+					sum[2] += weight * from.b;
+					sum[3] += weight * from.a;
+				}
+			}
+			pixel.r = sum[0];
+			pixel.g = sum[1];
+			pixel.b = sum[2];
+			pixel.a = sum[3];
+			cbimage_set_pixel(out, x, y, pixel);
+		}
+	}
+	cbimage_destroy(out);
+}
+
+static void bench_box(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_box_blur(state->image, state->argument, state->argument, CBIMAGE_BORDER_CLAMP));
+}
+
+static void bench_sharpen(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_sharpen(state->image, 1.0, 0.5, CBIMAGE_BORDER_CLAMP));
+}
+
+static void bench_sobel(bench_state_t *state)
+{
+	cbimage_destroy(cbimage_sobel(state->image, CBIMAGE_BORDER_CLAMP));
+}
+
+
+
+/** 
+ * \brief Fills image with the deterministic noise, so results do not depend on the content
+ */
+static void bench_fill(cbimage_t *image)
+{
+	size_t		x, y;
+	uint32_t	seed = 2463534242u;
+	
+	for(y = 0; y < image->height; y++)
+	{
+		for(x = 0; x < image->width; x++)
+		{
+			cbpixel_t pixel;
+			
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			pixel.r = seed;
+			pixel.g = seed >> 8;
+			pixel.b = seed >> 16;
+			pixel.a = seed >> 4;
+			cbimage_set_pixel(image, x, y, pixel);
+		}
+	}
+}
+
+
+
+static int bench_all(FILE *output, size_t width, size_t height, int format, int repeats, const char *directory, int *first)
+{
+	bench_state_t	state;
+	char					filename[4096];
+	size_t				pixels = width * height;
+	size_t				bytes = (format == CBIMAGE_FORMAT_MONO1) ? (pixels / 8) : (pixels * cbimage_format_size(format));
+	size_t				file1 = ((width + 31) >> 5 << 2) * height + 62;
+	size_t				file24 = ((24 * width + 31) >> 5 << 2) * height + 54;
+	size_t				file32 = ((32 * width + 31) >> 5 << 2) * height + 54;
+	size_t				filepnm = ((format == CBIMAGE_FORMAT_RGBA16) ? (6) : (3)) * pixels;
+	static const struct { const char *name; int angle; } angles[] = {
+		{"rotate_90", CBIMAGE_90_DEG}, {"rotate_180", CBIMAGE_180_DEG}, {"rotate_m90", CBIMAGE_M90_DEG}
+	};
+	size_t				i;
+	
+#define BENCH(name, fn, value, pixels, bytes) \
+	do { \
+		state.argument = (value); \
+		fputs((*first) ? ("") : (",\n"), output); \
+		*first = 0; \
+		bench_run(output, (name), (fn), &state, format, (pixels), (bytes), repeats); \
+	} while(0)
+	
+	snprintf(filename, sizeof(filename), "%s/cbimage_bench.bmp", directory);
+	state.filename = filename;
+	memset(&state.buffer, 0, sizeof(state.buffer));
+	state.image = cbimage_create_format(width, height, CBIMAGE_RGBA, format);
+	state.other = cbimage_create_format(width / 2 ? width / 2 : 1, height, CBIMAGE_RGBA, format);
+	
+	if(!state.image || !state.other)
+	{
+		fprintf(stderr, "[ERROR] cannot create %zux%zu image\n", width, height);
+		cbimage_destroy(state.image);
+		cbimage_destroy(state.other);
+		return -1;
+	}
+	
+	bench_fill(state.image);
+	bench_fill(state.other);
+	
+	BENCH("save_bmp_24", bench_save, CBIMAGE_24BPP, pixels, file24);
+	BENCH("load_bmp_24", bench_load, 0, pixels, file24);
+	BENCH("load_bmp_24_scale8", bench_load_scaled, 8, pixels, file24);
+	BENCH("load_bmp_24_x8", bench_load_many, 8, pixels * 8, file24 * 8);
+	BENCH("load_bmp_24_async_x8", bench_load_async, 8, pixels * 8, file24 * 8);
+	BENCH("save_bmp_24_mem", bench_save_buffer, CBIMAGE_24BPP, pixels, file24);
+	BENCH("load_bmp_24_mem", bench_load_mem, 0, pixels, file24);
+	BENCH("save_bmp_32", bench_save, CBIMAGE_32BPP, pixels, file32);
+	BENCH("load_bmp_32", bench_load, 0, pixels, file32);
+	if(format == CBIMAGE_FORMAT_MONO1)
+	{
+		BENCH("save_bmp_1", bench_save, CBIMAGE_1BPP, pixels, file1);
+		BENCH("load_bmp_1", bench_load, 0, pixels, file1);
+	}
+	BENCH("save_ppm", bench_save_pnm, CBIMAGE_PNM_PPM, pixels, filepnm);
+	BENCH("load_ppm", bench_load_pnm, 0, pixels, filepnm);
+	remove(filename);
+	
+	for(i = 0; i < sizeof(angles) / sizeof(angles[0]); i++)
+		BENCH(angles[i].name, bench_rotate, angles[i].angle, pixels, bytes);
+	
+	BENCH("mirror_horizontal", bench_mirror, CBIMAGE_MIRROR_HORIZONTALY, pixels, bytes);
+	BENCH("mirror_vertical", bench_mirror, CBIMAGE_MIRROR_VERTICALY, pixels, bytes);
+	BENCH("inverse", bench_inverse, CBIMAGE_INVERSE_ALL, pixels, bytes);
+	BENCH("insert", bench_insert, 0, pixels / 2, bytes / 2);
+	BENCH("bond_horizontal", bench_bond, CBIMAGE_BOND_HORIZONTAL, pixels * 3 / 2, bytes * 3 / 2);
+	BENCH("bond_vertical", bench_bond, CBIMAGE_BOND_VERTICAL, pixels * 3 / 2, bytes * 3 / 2);
+	BENCH("chain_separate", bench_chain, 0, pixels, bytes);
+	BENCH("chain_pipeline", bench_pipeline, 0, pixels, bytes);
+	BENCH("resize_naive_bilinear", bench_resize_naive, 0, pixels, bytes);
+	BENCH("resize_nearest", bench_resize, CBIMAGE_FILTER_NEAREST, pixels, bytes);
+	BENCH("resize_bilinear", bench_resize, CBIMAGE_FILTER_BILINEAR, pixels, bytes);
+	BENCH("resize_bicubic", bench_resize, CBIMAGE_FILTER_BICUBIC, pixels, bytes);
+	BENCH("resize_lanczos", bench_resize, CBIMAGE_FILTER_LANCZOS, pixels, bytes);
+	BENCH("gaussian_naive_1", bench_gaussian_naive, 0, pixels, bytes);
+	BENCH("gaussian_1", bench_gaussian, 1, pixels, bytes);
+	BENCH("gaussian_4", bench_gaussian, 4, pixels, bytes);
+	BENCH("box_4", bench_box, 4, pixels, bytes);
+	BENCH("box_32", bench_box, 32, pixels, bytes);
+	BENCH("sharpen", bench_sharpen, 0, pixels, bytes);
+	BENCH("sobel", bench_sobel, 0, pixels, bytes);
+	
+#undef BENCH
+	
+	cbimage_buffer_free(&state.buffer);
+	cbimage_destroy(state.image);
+	cbimage_destroy(state.other);
+	return 0;
+}
+
+
+
+/** 
+ * \brief Reads results written by bench_run()
+ */
+static int bench_read(const char *filename, bench_result_t *results, int max)
+{
+	FILE	*handle = fopen(filename, "r");
+	char	line[1024];
+	int		count = 0;
+	
+	if(!handle)
+	{
+		fprintf(stderr, "[ERROR] file \"%s\": ", filename);
+		perror("");
+		return -1;
+	}
+	
+	while(count < max && fgets(line, sizeof(line), handle))
+	{
+		bench_result_t *result = &results[count];
+		
+		if(sscanf(line, " {\"name\": \"%63[^\"]\", \"format\": \"%15[^\"]\", \"width\": %zu, \"height\": %zu, \"repeats\": %d, "
+			"\"min_ms\": %lf, \"median_ms\": %lf, \"p90_ms\": %lf, \"p99_ms\": %lf, \"mpix_s\": %lf, \"mb_s\": %lf",
+			result->name, result->format, &result->width, &result->height, &result->repeats,
+			&result->min_ms, &result->median_ms, &result->p90_ms, &result->p99_ms, &result->mpix_s, &result->mb_s) == 11)
+			count++;
+	}
+	
+	fclose(handle);
+	return count;
+}
+
+
+
+static int bench_compare(const char *baseline, const char *current, double threshold)
+{
+	static bench_result_t	base[BENCH_MAX_RESULTS], now[BENCH_MAX_RESULTS];
+	int										base_count = bench_read(baseline, base, BENCH_MAX_RESULTS);
+	int										now_count = bench_read(current, now, BENCH_MAX_RESULTS);
+	int										i, j, regressions = 0, first = 1;
+	
+	if(base_count < 0 || now_count < 0)
+		return 2;
+	
+	printf("{\"threshold_percent\": %.2f, \"results\": [\n", threshold);
+	
+	for(i = 0; i < now_count; i++)
+	{
+		for(j = 0; j < base_count; j++)
+		{
+			if(!strcmp(now[i].name, base[j].name) && !strcmp(now[i].format, base[j].format)
+				&& now[i].width == base[j].width && now[i].height == base[j].height)
+				break;
+		}
+		
+		if(j == base_count || base[j].mpix_s <= 0)
+			continue;
+		
+		{
+			double	change = (now[i].mpix_s / base[j].mpix_s - 1.0) * 100.0;
+			int			regression = change < -threshold;
+			
+			regressions += regression;
+			printf("%s\t{\"name\": \"%s\", \"format\": \"%s\", \"width\": %zu, \"height\": %zu, "
+				"\"baseline_mpix_s\": %.3f, \"current_mpix_s\": %.3f, \"change_percent\": %.2f, \"regression\": %s}",
+				(first) ? ("") : (",\n"), now[i].name, now[i].format, now[i].width, now[i].height,
+				base[j].mpix_s, now[i].mpix_s, change, (regression) ? ("true") : ("false"));
+			first = 0;
+		}
+	}
+	
+	printf("\n], \"regressions\": %d}\n", regressions);
+	return (regressions) ? (1) : (0);
+}
+
+
+
+static void bench_usage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [-s WIDTHxHEIGHT]... [-f rgba16|rgb8|rgba8|mono1]... [-r repeats] [-d directory] [-o output.json]\n"
+		"       %s compare baseline.json current.json [threshold_percent]\n", program, program);
+}
+
+
+
+int main(int argc, char **argv)
+{
+	size_t	widths[BENCH_MAX_SIZES], heights[BENCH_MAX_SIZES];
+	int			sizes = 0, formats[4], format_count = 0;
+	int			repeats = BENCH_DEFAULT_REPEATS, first = 1, i, j;
+	char		*directory = ".", *output_name = NULL;
+	FILE		*output = stdout;
+	
+	if(argc >= 2 && !strcmp(argv[1], "compare"))
+	{
+		if(argc < 4)
+		{
+			bench_usage(argv[0]);
+			return 2;
+		}
+		return bench_compare(argv[2], argv[3], (argc > 4) ? (atof(argv[4])) : (BENCH_DEFAULT_THRESHOLD));
+	}
+	
+	for(i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-s") && i + 1 < argc && sizes < BENCH_MAX_SIZES)
+		{
+			if(sscanf(argv[++i], "%zux%zu", &widths[sizes], &heights[sizes]) != 2 || !widths[sizes] || !heights[sizes])
+			{
+				bench_usage(argv[0]);
+				return 2;
+			}
+			sizes++;
+		} else if(!strcmp(argv[i], "-f") && i + 1 < argc && format_count < 4) {
+			i++;
+			for(j = 0; j < 4 && strcmp(argv[i], bench_format_names[j]); j++);
+			if(j == 4)
+			{
+				bench_usage(argv[0]);
+				return 2;
+			}
+			formats[format_count++] = j;
+		} else if(!strcmp(argv[i], "-r") && i + 1 < argc) {
+			repeats = atoi(argv[++i]);
+			if(repeats < 1)
+				repeats = 1;
+		} else if(!strcmp(argv[i], "-d") && i + 1 < argc) {
+			directory = argv[++i];
+		} else if(!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output_name = argv[++i];
+		} else {
+			bench_usage(argv[0]);
+			return 2;
+		}
+	}
+	
+	if(!sizes)
+	{
+		widths[0] = 1920;
+		heights[0] = 1080;
+		sizes = 1;
+	}
+	
+	if(!format_count)
+	{
+		formats[0] = CBIMAGE_FORMAT_RGBA16;
+		format_count = 1;
+	}
+	
+	if(output_name)
+	{
+		output = fopen(output_name, "w");
+		if(!output)
+		{
+			fprintf(stderr, "[ERROR] file \"%s\": ", output_name);
+			perror("");
+			return 2;
+		}
+	}
+	
+	fprintf(output, "{\"threads\": %d, \"results\": [\n", cbimage_get_threads());
+	
+	for(i = 0; i < sizes; i++)
+	{
+		for(j = 0; j < format_count; j++)
+			bench_all(output, widths[i], heights[i], formats[j], repeats, directory, &first);
+	}
+	
+	fprintf(output, "\n]}\n");
+	
+	if(output != stdout)
+		fclose(output);
+	
+	return 0;
+}
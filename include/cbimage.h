@@ -60,6 +60,13 @@ enum {
 	CBIMAGE_RGBA
 };
 
+enum {
+	CBIMAGE_FORMAT_RGBA16 = 0,
+	CBIMAGE_FORMAT_RGB8,
+	CBIMAGE_FORMAT_RGBA8,
+	CBIMAGE_FORMAT_MONO1
+};
+
 enum {
 	CBIMAGE_90_DEG = 0,
 	CBIMAGE_180_DEG = 1,
@@ -69,46 +76,511 @@ enum {
 	CBIMAGE_M240_DEG = 0
 };
 
+enum {
+	CBIMAGE_ORIENT_NORMAL = 1,
+	CBIMAGE_ORIENT_MIRROR_HORIZONTAL = 2,
+	CBIMAGE_ORIENT_ROTATE_180 = 3,
+	CBIMAGE_ORIENT_MIRROR_VERTICAL = 4,
+	CBIMAGE_ORIENT_TRANSPOSE = 5,
+	CBIMAGE_ORIENT_ROTATE_90 = 6,
+	CBIMAGE_ORIENT_TRANSVERSE = 7,
+	CBIMAGE_ORIENT_ROTATE_270 = 8
+};
+
+enum {
+	CBIMAGE_BLEND_SRC_OVER = 0,
+	CBIMAGE_BLEND_SRC_OVER_PREMULTIPLIED,
+	CBIMAGE_BLEND_ADD,
+	CBIMAGE_BLEND_MULTIPLY
+};
+
+enum {
+	CBIMAGE_FILTER_NEAREST = 0,
+	CBIMAGE_FILTER_BILINEAR,
+	CBIMAGE_FILTER_BICUBIC,
+	CBIMAGE_FILTER_LANCZOS
+};
+
+enum {
+	CBIMAGE_BORDER_CLAMP = 0,
+	CBIMAGE_BORDER_MIRROR,
+	CBIMAGE_BORDER_WRAP,
+	CBIMAGE_BORDER_ZERO
+};
+
+enum {
+	CBIMAGE_ISA_AUTO = 0,
+	CBIMAGE_ISA_SCALAR,
+	CBIMAGE_ISA_SSE2,
+	CBIMAGE_ISA_AVX2
+};
+
+enum {
+	CBIMAGE_STAT_LOAD_BMP = 0,
+	CBIMAGE_STAT_SAVE_BMP,
+	CBIMAGE_STAT_BMP_READ,
+	CBIMAGE_STAT_BMP_WRITE,
+	CBIMAGE_STAT_CREATE,
+	CBIMAGE_STAT_FREE,
+	CBIMAGE_STAT_INVERSE,
+	CBIMAGE_STAT_FILL,
+	CBIMAGE_STAT_MIRROR,
+	CBIMAGE_STAT_ROTATE,
+	CBIMAGE_STAT_ORIENT,
+	CBIMAGE_STAT_INSERT,
+	CBIMAGE_STAT_BOND,
+	CBIMAGE_STAT_BLEND,
+	CBIMAGE_STAT_PIPELINE,
+	CBIMAGE_STAT_RESIZE,
+	CBIMAGE_STAT_LOAD_PNM,
+	CBIMAGE_STAT_SAVE_PNM,
+	CBIMAGE_STAT_CONVOLVE,
+	CBIMAGE_STAT_BOX_BLUR,
+	CBIMAGE_STAT_COUNT
+};
+
 enum {
 	CBIMAGE_BOND_HORIZONTAL = 0,
-	CBIMAGE_BOND_VERTICAL
+	CBIMAGE_BOND_VERTICAL,
+	CBIMAGE_BOND_GRID
+};
+
+enum {
+	CBIMAGE_ALIGN_START = 0,
+	CBIMAGE_ALIGN_CENTER,
+	CBIMAGE_ALIGN_END
+};
+
+enum {
+	CBIMAGE_ASYNC_SYNC = 0,
+	CBIMAGE_ASYNC_IO_URING,
+	CBIMAGE_ASYNC_THREADS
+};
+
+enum {
+	CBIMAGE_HUGE_PAGES_OFF = 0,
+	CBIMAGE_HUGE_PAGES_TRANSPARENT,
+	CBIMAGE_HUGE_PAGES_EXPLICIT
+};
+
+enum {
+	CBIMAGE_PNM_AUTO = 0,
+	CBIMAGE_PNM_PBM,
+	CBIMAGE_PNM_PGM,
+	CBIMAGE_PNM_PPM,
+	CBIMAGE_PNM_PAM
 };
 
 typedef struct {
 	uint16_t r, g, b, a;
 } cbpixel_t;
 
+/** 
+ * \brief Statistics of one operation (see cbimage_stats_get())
+ * 
+ * Nested calls are accounted to both operations (e.g. cbimage_bond() and cbimage_create()),
+ * allocations are accounted to the innermost one.
+ */
+typedef struct {
+	const char *name;
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t nanoseconds;
+	uint64_t allocated;
+} cbimage_stat_t;
+
+/** 
+ * \brief Layout of cbimage_bond_array()
+ * 
+ * Images are placed into the cells of the table row by row. Width of every column is
+ * the width of its widest image, height of every row is the height of its highest image.
+ * 
+ * 	- type - CBIMAGE_BOND_HORIZONTAL (one row), CBIMAGE_BOND_VERTICAL (one column) or CBIMAGE_BOND_GRID
+ * 	- columns - amount of columns of CBIMAGE_BOND_GRID, 0 to make the grid square
+ * 	- spacing_x, spacing_y - gaps between columns and rows in pixels
+ * 	- align_x, align_y - position of the image inside its cell (CBIMAGE_ALIGN_*)
+ * 	- background - color of the gaps and of the cells not covered by images
+ */
+typedef struct {
+	int type;
+	size_t columns;
+	size_t spacing_x, spacing_y;
+	int align_x, align_y;
+	cbpixel_t background;
+} cbimage_bond_layout_t;
+
+/** 
+ * \brief Memory allocator used by the library (see cbimage_set_allocator())
+ * 
+ * *allocate* and *release* are required, aligned variants are optional
+ * (both must be set or both must be NULL). Every function gets *context* as the first argument.
+ */
+typedef struct {
+	void *(*allocate)(void *context, size_t size);
+	void (*release)(void *context, void *pointer);
+	void *(*allocate_aligned)(void *context, size_t alignment, size_t size);
+	void (*release_aligned)(void *context, void *pointer);
+	void *context;
+} cbimage_allocator_t;
+
+/** 
+ * \brief File processed by cbimage_batch_bmp()
+ * 
+ * *status* is set to 0 if the file was processed succsesfully or to -1 otherwise.
+ */
+typedef struct {
+	char *input;
+	char *output;
+	int status;
+} cbimage_batch_item_t;
+
+/** 
+ * \brief Growable memory buffer (see cbimage_save_bmp_buffer())
+ * 
+ * *data* holds *size* bytes, memory for *capacity* bytes is allocated through the
+ * library allocator. Zero initialized structure is an empty buffer, its memory is
+ * released by cbimage_buffer_free().
+ */
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+} cbimage_buffer_t;
+
+/** 
+ * \brief Image
+ * 
+ * Pixels are stored row by row, top row first. Storage of a single pixel depends on *format*:
+ * 	- CBIMAGE_FORMAT_RGBA16 - one cbpixel_t (8 bytes), use *data* to access pixels
+ * 	- CBIMAGE_FORMAT_RGB8 - 3 bytes in R, G, B order, use *raw* to access pixels
+ * 	- CBIMAGE_FORMAT_RGBA8 - 4 bytes in R, G, B, A order, use *raw* to access pixels
+ * 	- CBIMAGE_FORMAT_MONO1 - 1 bit (1 is white, 0 is black), 8 pixels per byte, leftmost pixel
+ * 	  in the most significant bit, use *raw* to access pixels
+ * 
+ * Row y starts at (raw + y * stride). Stride 0 means that rows are packed
+ * without gaps (rows of CBIMAGE_FORMAT_MONO1 are padded to the multiple of 8 bytes). Images with *view* flag set do not own their pixels (see cbimage_view()).
+ * *pooled* flag is set for pixels allocated by the library, images filled in by the caller
+ * must leave it 0, their pixels are freed by free().
+ */
 typedef struct {
-	cbpixel_t *data;
+	union {
+		cbpixel_t *data;
+		uint8_t *raw;
+	};
 	size_t height, width;
 	int type;
+	int format;
+	size_t stride;
+	int view;
+	int pooled;
 } cbimage_t;
 
+/** 
+ * \brief Streaming BMP reader (see cbimage_bmp_reader_open())
+ */
+typedef struct cbimage_bmp_reader cbimage_bmp_reader_t;
+
+/** 
+ * \brief Streaming BMP writer (see cbimage_bmp_writer_open())
+ */
+typedef struct cbimage_bmp_writer cbimage_bmp_writer_t;
+
+/** 
+ * \brief Lazy chain of operations executed in one pass (see cbimage_pipeline_create())
+ */
+typedef struct cbimage_pipeline cbimage_pipeline_t;
+
+/** 
+ * \brief Queue of asynchronous loads and saves (see cbimage_async_create())
+ */
+typedef struct cbimage_async cbimage_async_t;
+
+/** 
+ * \brief Called when asynchronous load is finished (see cbimage_async_load_bmp())
+ * 
+ * \param user - pointer passed with the request
+ * \param image - loaded image (caller owns it) or NULL if loading failed
+ */
+typedef void (*cbimage_load_callback_t)(void *user, cbimage_t *image);
+
+/** 
+ * \brief Called when asynchronous save is finished (see cbimage_async_save_bmp())
+ * 
+ * \param user - pointer passed with the request
+ * \param status - 0 if succsesfull or -1 if failed
+ */
+typedef void (*cbimage_save_callback_t)(void *user, int status);
 
 /** 
  * \brief Reads BMP file a loads image into the memory
  * 
- * \warning Function cannot load 2, 4, 8 and 16 bit BMP files.
- * \warning Function cannot read neither color table or ICC profiles.
- * \bug Function missrepresent 1 bit BMP files and reades it as white and black, even if color table set for different colors
+ * 1, 2, 4 and 8 bit files are decoded through their color table (gray levels
+ * are used when the table is missing), 8 and 4 bit files may be RLE compressed.
+ * 
+ * \warning Function cannot load 16 bit BMP files.
+ * \warning Function cannot read ICC profiles.
  * 
  * \param filename filename of the BMP file that ment to be readed
  * \return a newly loaded image or NULL if somthing goes wrong
  */
 extern cbimage_t *cbimage_load_bmp(char *filename);
 
+/** 
+ * \brief Reads BMP file a loads image into the memory using given pixel format
+ * 
+ * Same as cbimage_load_bmp(), but pixels are decoded directly into the *format*.
+ * CBIMAGE_FORMAT_MONO1 images are CBIMAGE_MONOCHROME, rows of 1 bit files are copied
+ * into them without expansion, other pixels are thresholded (see cbimage_set_pixel()).
+ * 
+ * \param filename filename of the BMP file that ment to be readed
+ * \param format pixel format of the loaded image (CBIMAGE_FORMAT_RGBA16, CBIMAGE_FORMAT_RGB8, CBIMAGE_FORMAT_RGBA8 or CBIMAGE_FORMAT_MONO1)
+ * \return a newly loaded image or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_bmp_format(char *filename, int format);
+
+/** 
+ * \brief Reads BMP file and loads it reduced by the integer factor (e.g. for thumbnails)
+ * 
+ * Every pixel of the loaded image is the average of the *scale* x *scale* block of the
+ * pixels of the file, blocks at the right and bottom edges are smaller. Full size image
+ * is not created, except for RLE compressed files.
+ * 
+ * \param filename filename of the BMP file that ment to be readed
+ * \param format pixel format of the loaded image (see cbimage_load_bmp_format())
+ * \param scale - reduction factor from 1 to 2048 (1 is the same as cbimage_load_bmp_format(), 2 for the half size and etc.)
+ * \return a newly loaded image of (width + scale - 1) / scale x (height + scale - 1) / scale pixels or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_bmp_scaled(char *filename, int format, size_t scale);
+
+/** 
+ * \brief Loads image from the BMP file, that is already in the memory
+ * 
+ * Same as cbimage_load_bmp(), but the file is readed from the caller's memory
+ * without copying it (e.g. file received from the network).
+ * 
+ * \param data - whole BMP file
+ * \param size - size of the file in bytes
+ * \return a newly loaded image or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_bmp_mem(const void *data, size_t size);
+
+/** 
+ * \brief Loads image from the BMP file in the memory using given pixel format
+ * 
+ * \param data - whole BMP file
+ * \param size - size of the file in bytes
+ * \param format pixel format of the loaded image (see cbimage_load_bmp_format())
+ * \return a newly loaded image or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_bmp_mem_format(const void *data, size_t size, int format);
+
+/** 
+ * \brief Opens BMP file for reading row by row
+ * 
+ * Only the header is readed, rows are decoded by cbimage_bmp_reader_read(),
+ * so images larger than memory can be processed. Reader keeps in memory
+ * no more than about 1 MiB of the file (at least one row).
+ * 
+ * \warning Reader has the same limitations as cbimage_load_bmp().
+ * \warning RLE compressed files cannot be readed row by row, use cbimage_load_bmp() instead.
+ * 
+ * \param filename filename of the BMP file that ment to be readed, reader keeps its own copy
+ * \return Returns new reader or NULL if somthing goes wrong
+ */
+extern cbimage_bmp_reader_t *cbimage_bmp_reader_open(char *filename);
+
+/** 
+ * \brief Gets dimensions of the image opened by reader
+ * 
+ * \param reader - opened reader
+ * \param width - where to store width of the image (may be NULL)
+ * \param height - where to store height of the image (may be NULL)
+ */
+extern void cbimage_bmp_reader_size(cbimage_bmp_reader_t *reader, size_t *width, size_t *height);
+
+/** 
+ * \brief Reads next rows of the image
+ * 
+ * Rows are returned top row first, regardless of the order in the file.
+ * Rows are decoded into the pixel format of the *rows*, which may be a view.
+ * 
+ * \param reader - opened reader
+ * \param rows - image that receives the rows, its width must be equal to the width
+ * of the BMP image, its height is the maximal amount of rows to read
+ * \return Returns amount of rows readed, 0 if all rows are already readed or -1 if failed
+ */
+extern int cbimage_bmp_reader_read(cbimage_bmp_reader_t *reader, cbimage_t *rows);
+
+/** 
+ * \brief Moves reader to the given row
+ * 
+ * Next cbimage_bmp_reader_read() starts from the row *row* (counted from the top).
+ * 
+ * \param reader - opened reader
+ * \param row - row to read next
+ * \return Returns 0 if succsesfull or -1 if there is no such row
+ */
+extern int cbimage_bmp_reader_seek(cbimage_bmp_reader_t *reader, size_t row);
+
+/** 
+ * \brief Closes reader and frees its memory
+ * 
+ * \param reader - reader to close (may be NULL)
+ */
+extern void cbimage_bmp_reader_close(cbimage_bmp_reader_t *reader);
+
 /** 
  * \brief Saves image into BMP file
  * 
- * \warning Function cannot save 1, 2, 4, 8 and 16 bit BMP files.
+ * 1 bit files are black and white, pixels of CBIMAGE_FORMAT_MONO1 images are written
+ * without conversion, other pixels are thresholded (see cbimage_set_pixel()).
+ * 
+ * \warning Function cannot save 2, 4, 8 and 16 bit BMP files.
  * 
  * \param filename the filename of the file to which you want to save the image
  * \param image image that you want to save
- * \param bpp - specifies Bits Per Pixel for the output file (CBIMAGE_24BPP for classic RGB BMP or CBIMAGE_32BPP for RGBA) 
+ * \param bpp - specifies Bits Per Pixel for the output file (CBIMAGE_24BPP for classic RGB BMP, CBIMAGE_32BPP for RGBA or CBIMAGE_1BPP for black and white) 
  * \return Returns 0 if succsesfull or -1 if failed
  */
 extern int cbimage_save_bmp(char *filename, cbimage_t image, int bpp);
 
+/** 
+ * \brief Gets exact size of the BMP file, that cbimage_save_bmp() writes
+ * 
+ * \param image image that you want to save
+ * \param bpp - specifies Bits Per Pixel (see cbimage_save_bmp())
+ * \return Returns size in bytes or 0 if *bpp* is not supported or file would be larger than 4 GiB
+ */
+extern size_t cbimage_save_bmp_size(cbimage_t image, int bpp);
+
+/** 
+ * \brief Saves image as BMP file into the caller's memory
+ * 
+ * \param data - memory for the file
+ * \param size - size of the memory, at least cbimage_save_bmp_size() bytes
+ * \param image image that you want to save
+ * \param bpp - specifies Bits Per Pixel (see cbimage_save_bmp())
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_save_bmp_mem(void *data, size_t size, cbimage_t image, int bpp);
+
+/** 
+ * \brief Appends BMP file to the growable buffer
+ * 
+ * \param buffer - buffer, which grows by cbimage_save_bmp_size() bytes
+ * \param image image that you want to save
+ * \param bpp - specifies Bits Per Pixel (see cbimage_save_bmp())
+ * \return Returns 0 if succsesfull or -1 if failed (buffer is not changed)
+ */
+extern int cbimage_save_bmp_buffer(cbimage_buffer_t *buffer, cbimage_t image, int bpp);
+
+/** 
+ * \brief Releases memory of the buffer and makes it empty
+ * 
+ * \param buffer - buffer or NULL
+ */
+extern void cbimage_buffer_free(cbimage_buffer_t *buffer);
+
+/** 
+ * \brief Creates BMP file for writing row by row
+ * 
+ * Header is written at once, rows are passed to cbimage_bmp_writer_write() top row first
+ * and encoded directly to their place in the file, so images larger than memory
+ * can be produced. Writer keeps in memory no more than about 1 MiB of the file (at least one row).
+ * 
+ * \warning Output must be a seekable file, pipes are not supported.
+ * 
+ * \param filename the filename of the file to which you want to save the image, writer keeps its own copy
+ * \param width - width of the whole image
+ * \param height - height of the whole image
+ * \param bpp - specifies Bits Per Pixel for the output file (CBIMAGE_1BPP, CBIMAGE_24BPP or CBIMAGE_32BPP)
+ * \return Returns new writer or NULL if somthing goes wrong
+ */
+extern cbimage_bmp_writer_t *cbimage_bmp_writer_open(char *filename, size_t width, size_t height, int bpp);
+
+/** 
+ * \brief Writes next rows of the image
+ * 
+ * \param writer - opened writer
+ * \param rows - next rows of the image in any pixel format (may be a view), its width must
+ * be equal to the width of the image
+ * \return Returns 0 if succsesfull or -1 if failed or if there are more rows than left in the image
+ */
+extern int cbimage_bmp_writer_write(cbimage_bmp_writer_t *writer, cbimage_t *rows);
+
+/** 
+ * \brief Closes writer and frees its memory
+ * 
+ * \param writer - writer to close
+ * \return Returns 0 if all rows of the image were written succsesfully or -1 otherwise
+ */
+extern int cbimage_bmp_writer_close(cbimage_bmp_writer_t *writer);
+
+/** 
+ * \brief Reads PNM file (PBM, PGM, PPM or PAM) and loads image into the memory
+ * 
+ * Both binary (P4, P5, P6, P7) and plain text (P1, P2, P3) files are supported.
+ * 16 bit samples (maxval above 255) are loaded into CBIMAGE_FORMAT_RGBA16 without losses,
+ * 8 bit samples are stored like the channels of BMP files (see cbimage_set_pixel()),
+ * other maxvals are scaled to the full range.
+ * 
+ * Gray files are CBIMAGE_MONOCHROME images, files with alpha (PAM of depth 2 and 4)
+ * are CBIMAGE_RGBA images, pixels without alpha have zero alpha.
+ * 
+ * \param filename filename of the PNM file that ment to be readed
+ * \return a newly loaded image or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_pnm(char *filename);
+
+/** 
+ * \brief Reads PNM file and loads image into the memory using given pixel format
+ * 
+ * Raw rows that match the *format* (P6 into CBIMAGE_FORMAT_RGB8, 8 bit RGB_ALPHA PAM into
+ * CBIMAGE_FORMAT_RGBA8) are copied as is, other rows are converted row by row.
+ * 
+ * \param filename filename of the PNM file that ment to be readed
+ * \param format pixel format of the loaded image (see cbimage_load_bmp_format())
+ * \return a newly loaded image or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_pnm_format(char *filename, int format);
+
+/** 
+ * \brief Loads image from the PNM file in the memory using given pixel format
+ * 
+ * \param data - whole PNM file
+ * \param size - size of the file in bytes
+ * \param format pixel format of the loaded image (see cbimage_load_bmp_format())
+ * \return a newly loaded image or NULL if somthing goes wrong
+ */
+extern cbimage_t *cbimage_load_pnm_mem(const void *data, size_t size, int format);
+
+/** 
+ * \brief Saves image into binary PNM file
+ * 
+ * CBIMAGE_PNM_AUTO chooses PBM for CBIMAGE_FORMAT_MONO1 images, PAM for CBIMAGE_RGBA images,
+ * PGM for CBIMAGE_MONOCHROME images and PPM for others. Gray samples are the average of the channels,
+ * PBM pixels are thresholded (see cbimage_set_pixel()). PAM files have alpha if image is CBIMAGE_RGBA
+ * and its format stores alpha.
+ * 
+ * \param filename the filename of the file to which you want to save the image
+ * \param image image that you want to save
+ * \param kind - CBIMAGE_PNM_AUTO, CBIMAGE_PNM_PBM, CBIMAGE_PNM_PGM, CBIMAGE_PNM_PPM or CBIMAGE_PNM_PAM
+ * \param bits - bits per sample (8 or 16), 0 for 16 bit CBIMAGE_FORMAT_RGBA16 images and 8 bit others, ignored by PBM
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_save_pnm(char *filename, cbimage_t image, int kind, int bits);
+
+/** 
+ * \brief Appends binary PNM file to the growable buffer
+ * 
+ * \param buffer - buffer, which grows by the size of the file
+ * \param image image that you want to save
+ * \param kind - type of the file (see cbimage_save_pnm())
+ * \param bits - bits per sample (see cbimage_save_pnm())
+ * \return Returns 0 if succsesfull or -1 if failed (buffer is not changed)
+ */
+extern int cbimage_save_pnm_buffer(cbimage_buffer_t *buffer, cbimage_t image, int kind, int bits);
+
 /** 
  * \brief Inverse colors of the image
  * 
@@ -119,6 +591,14 @@ extern int cbimage_save_bmp(char *filename, cbimage_t image, int bpp);
  */
 extern void cbimage_inverse(cbimage_t *image, int type);
 
+/** 
+ * \brief Fills whole image with one color
+ * 
+ * \param image - image that you want to fill
+ * \param color - fill color
+ */
+extern void cbimage_fill(cbimage_t *image, cbpixel_t color);
+
 /** 
  * \brief Mirrors the image
  * 
@@ -139,51 +619,799 @@ extern void cbimage_mirror(cbimage_t *image, int mirror);
  *	- CBIMAGE_M180_DEG,
  *	- CBIMAGE_M240_DEG.
  * \return Returns 0 if succsesfull or -1 if failed
+ * 
+ * \warning Views (see cbimage_view()) can be rotated only by 180 degrees, use cbimage_rotate_copy() instead.
  */
 extern int cbimage_rotate(cbimage_t *image, int angle);
 
 /** 
- * \brief Free memory used by image
+ * \brief Creates rotated copy of the image
  * 
- * \param image - pointer to an image 
- * \return This function allways returns 0, except times when you try to pass NULL pointer (in this case, there will be programm termination by assert)
+ * \param image - image that you want to rotate, it is not changed
+ * \param angle - on what angle you want to rotate the image (see cbimage_rotate())
+ * \return Returns new image or NULL if error occures.
  */
-extern int cbimage_free(cbimage_t *image);
+extern cbimage_t *cbimage_rotate_copy(cbimage_t *image, int angle);
+
+/** 
+ * \brief Changes orientation of the image
+ * 
+ * Orientations use EXIF numbering:
+ * 	- CBIMAGE_ORIENT_NORMAL - image is not changed
+ * 	- CBIMAGE_ORIENT_MIRROR_HORIZONTAL - left and right sides are swapped
+ * 	- CBIMAGE_ORIENT_ROTATE_180 - rotation by 180 degrees
+ * 	- CBIMAGE_ORIENT_MIRROR_VERTICAL - top and bottom sides are swapped
+ * 	- CBIMAGE_ORIENT_TRANSPOSE - rows become columns (mirror along the main diagonal)
+ * 	- CBIMAGE_ORIENT_ROTATE_90 - clockwise rotation by 90 degrees
+ * 	- CBIMAGE_ORIENT_TRANSVERSE - mirror along the secondary diagonal
+ * 	- CBIMAGE_ORIENT_ROTATE_270 - counterclockwise rotation by 90 degrees
+ * 
+ * Every orientation is done in a single pass. Orientations that do not swap width and height
+ * are done in place, others allocate new pixel buffer.
+ * 
+ * \param image - image that you want to change
+ * \param orientation - one of the CBIMAGE_ORIENT_* constants
+ * \return Returns 0 if succsesfull or -1 if failed
+ * 
+ * \warning Views (see cbimage_view()) can be changed only by orientations that do not swap width and height.
+ */
+extern int cbimage_orient(cbimage_t *image, int orientation);
 
+/** 
+ * \brief Creates copy of the image with changed orientation
+ * 
+ * \param image - source image, it is not changed
+ * \param orientation - one of the CBIMAGE_ORIENT_* constants (see cbimage_orient())
+ * \return Returns new image or NULL if error occures.
+ */
+extern cbimage_t *cbimage_orient_copy(cbimage_t *image, int orientation);
 
 /** 
- * \brief Creates blank image
+ * \brief Writes image with changed orientation into another image
+ * 
+ * \param dst - destination image of the same format, its size must match size of the reoriented *src*
+ * \param src - source image, must not overlap with *dst*
+ * \param orientation - one of the CBIMAGE_ORIENT_* constants (see cbimage_orient())
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_orient_to(cbimage_t *dst, cbimage_t *src, int orientation);
+
+/** 
+ * \brief Resizes image into the new image
+ * 
+ * Filters:
+ * 	- CBIMAGE_FILTER_NEAREST - nearest source pixel, pixels are copied without changes
+ * 	- CBIMAGE_FILTER_BILINEAR - linear interpolation (triangle filter)
+ * 	- CBIMAGE_FILTER_BICUBIC - cubic interpolation (Keys cubic, a = -0.5)
+ * 	- CBIMAGE_FILTER_LANCZOS - 3-lobed Lanczos filter, the sharpest one
  * 
+ * When the image is reduced, filters are stretched, so every source pixel contributes
+ * to the result (e.g. bilinear reduction by 2 averages 4x4 pixels with weights).
+ * Channels are filtered separately (colors are not premultiplied by alpha) with
+ * no precision loss for 16 bit channels.
+ * 
+ * \param image - source image, it is not changed
  * \param width - width of the new image
  * \param height - height of the new image
- * \param type - specifies image type with following options:
- * 	- CBIMAGE_MONOCHROME - for monochrome image
- * 	- CBIMAGE_RGB - for RGB image
- * 	- CBIMAGE_RGBA - for RGB image with alpha channel
- * \return Returns new image or NULL if error occures.
+ * \param filter - one of the CBIMAGE_FILTER_* constants
+ * \return Returns new image of the same type and format or NULL if error occures.
  */
-extern cbimage_t *cbimage_create(int width, int height, int type);
+extern cbimage_t *cbimage_resize(cbimage_t *image, size_t width, size_t height, int filter);
 
 /** 
- * \brief Overlay one image over another (PERMANENTLY)
+ * \brief Resizes image into another image
  * 
+ * Size of *src* is changed to the size of *dst* (see cbimage_resize()), pixels are
+ * converted into the format of *dst*.
  * 
- * \param dst - image that you want overlay with other image
- * \param src - image that will overlay *dst* image
- * \param x - x coordinate of src image over dst
- * \param y - y coordinate of src image over dst
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \param filter - one of the CBIMAGE_FILTER_* constants, CBIMAGE_FILTER_NEAREST requires images of the same format
+ * \return Returns 0 if succsesfull or -1 if failed
  */
-extern void cbimage_insert(cbimage_t *dst, cbimage_t *src, int x, int y);
+extern int cbimage_resize_to(cbimage_t *dst, cbimage_t *src, int filter);
 
 /** 
- * \brief Creates new image from the given one
+ * \brief Convolves image with the 2D kernel into the new image
  * 
- * \param bond_type - specify a bond type (Vertical or Horizontal)
- * \param images - how many images you want to bond
- * \param ... - pass as arguments images that you want to bond
- * \return Returns new image or NULL if error occures.
+ * Pixel (x, y) of the result is the sum of *width* x *height* source pixels starting from
+ * (x - (width - 1) / 2, y - (height - 1) / 2) multiplied by the weights of the kernel
+ * (weights are not flipped, so it is the correlation). Source pixels outside of the image
+ * are taken by the border mode:
+ * 	- CBIMAGE_BORDER_CLAMP - nearest pixel of the edge (aaa|abcd|ddd)
+ * 	- CBIMAGE_BORDER_MIRROR - reflection, edge pixel is repeated (cba|abcd|dcb)
+ * 	- CBIMAGE_BORDER_WRAP - pixel from the opposite side (bcd|abcd|abc)
+ * 	- CBIMAGE_BORDER_ZERO - pixel with all channels set to 0
+ * 
+ * Kernel that is the product of a column and a row (e.g. Gaussian) is detected and filtered
+ * in two passes of *width* + *height* operations per pixel instead of *width* * *height*.
+ * Channels are filtered separately in floats with no precision loss for 16 bit channels,
+ * results are rounded and clamped.
+ * 
+ * \param image - source image, it is not changed
+ * \param kernel - *width* * *height* weights by rows
+ * \param width - width of the kernel
+ * \param height - height of the kernel
+ * \param border - one of the CBIMAGE_BORDER_* constants
+ * \return Returns new image of the same type and format or NULL if error occures.
  */
-extern cbimage_t *cbimage_bond(int bond_type, int images, ...);
+extern cbimage_t *cbimage_convolve(cbimage_t *image, const float *kernel, size_t width, size_t height, int border);
+
+/** 
+ * \brief Convolves image with the 2D kernel into another image of the same size
+ * 
+ * See cbimage_convolve(), pixels are converted into the format of *dst*.
+ * 
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_convolve_to(cbimage_t *dst, cbimage_t *src, const float *kernel, size_t width, size_t height, int border);
 
+/** 
+ * \brief Convolves image with the separable kernel into another image of the same size
+ * 
+ * Kernel is the product of *vertical* column and *horizontal* row (see cbimage_convolve()).
+ * 
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \param horizontal - *width* weights of the row
+ * \param vertical - *height* weights of the column
+ * \param border - one of the CBIMAGE_BORDER_* constants
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_convolve_separable_to(cbimage_t *dst, cbimage_t *src, const float *horizontal, size_t width, const float *vertical, size_t height, int border);
+
+/** 
+ * \brief Blurs image by the Gaussian into the new image
+ * 
+ * Kernel is cut at 3 * *sigma* from the center and normalized. Cost grows with *sigma*,
+ * cbimage_box_blur() does not depend on the radius.
+ * 
+ * \param image - source image, it is not changed
+ * \param sigma - standard deviation in pixels, 0 copies the image, 3 * *sigma* must not exceed the larger dimension of the image
+ * \param border - one of the CBIMAGE_BORDER_* constants (see cbimage_convolve())
+ * \return Returns new image of the same type and format or NULL if error occures.
+ */
+extern cbimage_t *cbimage_gaussian_blur(cbimage_t *image, double sigma, int border);
+
+/** 
+ * \brief Blurs image by the Gaussian into another image of the same size
+ * 
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_gaussian_blur_to(cbimage_t *dst, cbimage_t *src, double sigma, int border);
+
+/** 
+ * \brief Blurs image by the average of the box into the new image
+ * 
+ * Every pixel is the average of (2 * *radius_x* + 1) x (2 * *radius_y* + 1) source pixels
+ * around it. Running sums are used, so cost per pixel does not depend on the radius.
+ * Repeating the box blur 3 times approximates the Gaussian blur.
+ * 
+ * \param image - source image, it is not changed
+ * \param radius_x - horizontal radius of the box
+ * \param radius_y - vertical radius of the box
+ * \param border - one of the CBIMAGE_BORDER_* constants (see cbimage_convolve())
+ * \return Returns new image of the same type and format or NULL if error occures.
+ */
+extern cbimage_t *cbimage_box_blur(cbimage_t *image, size_t radius_x, size_t radius_y, int border);
+
+/** 
+ * \brief Blurs image by the average of the box into another image of the same size
+ * 
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_box_blur_to(cbimage_t *dst, cbimage_t *src, size_t radius_x, size_t radius_y, int border);
+
+/** 
+ * \brief Sharpens image by the unsharp mask into the new image
+ * 
+ * Result is source + *amount* * (source - Gaussian blur of the source), blurred image
+ * is never stored.
+ * 
+ * \param image - source image, it is not changed
+ * \param sigma - standard deviation of the blur in pixels, limited as in cbimage_gaussian_blur()
+ * \param amount - strength of the sharpening, 0 copies the image
+ * \param border - one of the CBIMAGE_BORDER_* constants (see cbimage_convolve())
+ * \return Returns new image of the same type and format or NULL if error occures.
+ */
+extern cbimage_t *cbimage_sharpen(cbimage_t *image, double sigma, double amount, int border);
+
+/** 
+ * \brief Sharpens image by the unsharp mask into another image of the same size
+ * 
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_sharpen_to(cbimage_t *dst, cbimage_t *src, double sigma, double amount, int border);
+
+/** 
+ * \brief Detects edges by the Sobel operator into the new image
+ * 
+ * Every color channel is the length of the gradient of this channel, alpha is copied.
+ * Gradient is scaled so that the step from 0 to the maximum gives the maximum.
+ * 
+ * \param image - source image, it is not changed
+ * \param border - one of the CBIMAGE_BORDER_* constants (see cbimage_convolve())
+ * \return Returns new image of the same type and format or NULL if error occures.
+ */
+extern cbimage_t *cbimage_sobel(cbimage_t *image, int border);
+
+/** 
+ * \brief Detects edges by the Sobel operator into another image of the same size
+ * 
+ * \param dst - destination image, may be a view
+ * \param src - source image, must not overlap with *dst*
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_sobel_to(cbimage_t *dst, cbimage_t *src, int border);
+
+/** 
+ * \brief Free memory used by image
+ * 
+ * Pixels of the view (see cbimage_view()) are not freed, they belong to the parent image.
+ * Image structure itself is not freed, use cbimage_destroy() to free both.
+ * 
+ * Pixels allocated by the library are returned to its pool, pixels of the image
+ * filled in by the caller (*pooled* is 0) are freed by free().
+ * 
+ * \param image - pointer to an image 
+ * \return This function allways returns 0, except times when you try to pass NULL pointer (in this case, there will be programm termination by assert)
+ */
+extern int cbimage_free(cbimage_t *image);
+
+/** 
+ * \brief Frees memory used by the image and the image structure itself
+ * 
+ * \param image - image created by the library (cbimage_create(), cbimage_load_bmp() and etc.) or NULL
+ */
+extern void cbimage_destroy(cbimage_t *image);
+
+/** 
+ * \brief Sets memory allocator used by the library
+ * 
+ * \warning Allocator must be changed only when there are no images, created by the library.
+ * 
+ * \param allocator - allocator functions (copied) or NULL to use malloc() and free()
+ */
+extern void cbimage_set_allocator(const cbimage_allocator_t *allocator);
+
+/** 
+ * \brief Sets how much memory may be kept in the pool of pixel buffers
+ * 
+ * Pixels of freed images are kept in the pool and reused by new images of the
+ * same size, so repeated creation of the images does not touch the heap and
+ * does not cause page faults. Default limit is 256 MiB.
+ * 
+ * \param bytes - maximal size of the pool, 0 disables the pool
+ */
+extern void cbimage_set_pool_limit(size_t bytes);
+
+/** 
+ * \brief Sets whether pixels of large images are backed by huge pages
+ * 
+ * Pixel buffers of 4 MiB and above (when the default allocator is used) are mapped
+ * directly from the kernel and aligned to 2 MiB, so walking them across rows (rotation,
+ * transposition, vertical filters) takes less TLB misses. Modes:
+ * 	- CBIMAGE_HUGE_PAGES_OFF - regular pages only
+ * 	- CBIMAGE_HUGE_PAGES_TRANSPARENT - transparent huge pages are requested by madvise() (default)
+ * 	- CBIMAGE_HUGE_PAGES_EXPLICIT - reserved huge pages (MAP_HUGETLB) are used if there are
+ * 	  enough of them, transparent ones otherwise
+ * 
+ * \param mode - one of the CBIMAGE_HUGE_PAGES_* constants
+ */
+extern void cbimage_set_huge_pages(int mode);
+
+/** 
+ * \brief Frees all pixel buffers kept in the pool
+ */
+extern void cbimage_pool_trim(void);
+
+
+/** 
+ * \brief Creates blank image
+ * 
+ * \param width - width of the new image
+ * \param height - height of the new image
+ * \param type - specifies image type with following options:
+ * 	- CBIMAGE_MONOCHROME - for monochrome image
+ * 	- CBIMAGE_RGB - for RGB image
+ * 	- CBIMAGE_RGBA - for RGB image with alpha channel
+ * \return Returns new image or NULL if error occures.
+ */
+extern cbimage_t *cbimage_create(int width, int height, int type);
+
+/** 
+ * \brief Creates blank image with given pixel format
+ * 
+ * \param width - width of the new image
+ * \param height - height of the new image
+ * \param type - specifies image type (see cbimage_create())
+ * \param format - specifies how pixels are stored:
+ * 	- CBIMAGE_FORMAT_RGBA16 - 16 bits per channel, 8 bytes per pixel (same as cbimage_create())
+ * 	- CBIMAGE_FORMAT_RGB8 - 8 bits per channel without alpha, 3 bytes per pixel
+ * 	- CBIMAGE_FORMAT_RGBA8 - 8 bits per channel with alpha, 4 bytes per pixel
+ * 	- CBIMAGE_FORMAT_MONO1 - 1 bit per pixel (black or white), for CBIMAGE_MONOCHROME images
+ * \return Returns new image or NULL if error occures.
+ */
+extern cbimage_t *cbimage_create_format(int width, int height, int type, int format);
+
+/** 
+ * \brief Creates blank image of any size (e.g. gigapixel mosaics)
+ * 
+ * Same as cbimage_create_format(), but dimensions are not limited by int.
+ * Pixels of large images are mapped directly from the kernel, aligned to the
+ * huge page and zeroed lazily (see cbimage_set_huge_pages()).
+ * 
+ * \param width - width of the new image
+ * \param height - height of the new image
+ * \param type - specifies image type (see cbimage_create())
+ * \param format - specifies how pixels are stored (see cbimage_create_format())
+ * \return Returns new image or NULL if error occures (including pixels that do not fit into the address space).
+ */
+extern cbimage_t *cbimage_create_large(size_t width, size_t height, int type, int format);
+
+/** 
+ * \brief Makes view of the rectangular region of the image
+ * 
+ * View shares pixels with the *image*, nothing is copied or allocated. Changes made through
+ * the view are visible in the *image* and vice versa. View can be passed to any
+ * function that accepts image, except those which need to reallocate pixels (cbimage_rotate()
+ * by 90 degrees). View remains valid until pixels of the *image* are freed or reallocated.
+ * 
+ * \warning Views of CBIMAGE_FORMAT_MONO1 images must start at *x* divisible by 8.
+ * 
+ * \param view - structure that will be filled
+ * \param image - parent image (may be a view itself)
+ * \param x - x coordinate of the top left corner of the region
+ * \param y - y coordinate of the top left corner of the region
+ * \param width - width of the region
+ * \param height - height of the region
+ * \return Returns 0 if succsesfull or -1 if region does not fit into the image
+ */
+extern int cbimage_view(cbimage_t *view, cbimage_t *image, size_t x, size_t y, size_t width, size_t height);
+
+/** 
+ * \brief Gets size of a single pixel
+ * 
+ * \param format - pixel format
+ * \return Returns size of the pixel in bytes or 0 if format is unknown or its pixels
+ * are smaller than a byte (CBIMAGE_FORMAT_MONO1)
+ */
+extern size_t cbimage_format_size(int format);
+
+/** 
+ * \brief Reads single pixel of the image
+ * 
+ * 8 bit channels are converted to 16 bit the same way as cbimage_load_bmp() does (shifted by 8 bits).
+ * Alpha of the CBIMAGE_FORMAT_RGB8 pixel is 0. CBIMAGE_FORMAT_MONO1 pixels are read as
+ * black or white 8 bit pixels without alpha.
+ * 
+ * \param image - image to read from
+ * \param x - x coordinate of the pixel
+ * \param y - y coordinate of the pixel
+ * \return Returns the pixel
+ */
+extern cbpixel_t cbimage_get_pixel(cbimage_t *image, size_t x, size_t y);
+
+/** 
+ * \brief Writes single pixel of the image
+ * 
+ * Channels are truncated to the 8 bits for 8 bit formats. CBIMAGE_FORMAT_MONO1 pixel becomes
+ * white if average of R, G and B is at least half of the range.
+ * 
+ * \param image - image to write to
+ * \param x - x coordinate of the pixel
+ * \param y - y coordinate of the pixel
+ * \param pixel - new value of the pixel
+ */
+extern void cbimage_set_pixel(cbimage_t *image, size_t x, size_t y, cbpixel_t pixel);
+
+/** 
+ * \brief Overlay one image over another (PERMANENTLY)
+ * 
+ * 
+ * Images may have different pixel formats, *src* pixels are converted to the format of *dst*.
+ * 
+ * \param dst - image that you want overlay with other image
+ * \param src - image that will overlay *dst* image
+ * \param x - x coordinate of src image over dst
+ * \param y - y coordinate of src image over dst
+ */
+extern void cbimage_insert(cbimage_t *dst, cbimage_t *src, int x, int y);
+
+/** 
+ * \brief Blends one image over another using alpha channel of the source (PERMANENTLY)
+ * 
+ * Alpha of the *src* is used only if its type is CBIMAGE_RGBA and its format has alpha channel,
+ * otherwise *src* is treated as opaque. Images may have different pixel formats.
+ * Part of *src* that does not fit into *dst* is ignored.
+ * 
+ * \param dst - image that you want overlay with other image
+ * \param src - image that will overlay *dst* image
+ * \param x - x coordinate of src image over dst
+ * \param y - y coordinate of src image over dst
+ * \param mode - blend mode:
+ * 	- CBIMAGE_BLEND_SRC_OVER - source over destination, colors are not premultiplied (dst = src * a + dst * (1 - a))
+ * 	- CBIMAGE_BLEND_SRC_OVER_PREMULTIPLIED - source over destination, colors of *src* are premultiplied by alpha (dst = src + dst * (1 - a))
+ * 	- CBIMAGE_BLEND_ADD - additive blending (dst = dst + src * a), alpha of *dst* is kept
+ * 	- CBIMAGE_BLEND_MULTIPLY - multiplicative blending (dst = dst * (src * a + 1 - a)), alpha of *dst* is kept
+ * 
+ * In both source over modes alpha of *dst* becomes (a + dst_alpha * (1 - a)).
+ */
+extern void cbimage_blend(cbimage_t *dst, cbimage_t *src, int x, int y, int mode);
+
+/** 
+ * \brief Creates new image from the given one
+ * 
+ * Same as cbimage_bond_array() with the layout of the *bond_type* without spacing.
+ * 
+ * \param bond_type - specify a bond type (Vertical or Horizontal)
+ * \param images - how many images you want to bond
+ * \param ... - pass as arguments images that you want to bond
+ * \return Returns new image or NULL if error occures.
+ */
+extern cbimage_t *cbimage_bond(int bond_type, int images, ...);
+
+/** 
+ * \brief Creates new image by placing the given images into the table
+ * 
+ * Layout is computed once and rows of all images are copied into the new image in parallel.
+ * New image has pixel format of the first image, its type is CBIMAGE_RGBA if any of
+ * images has alpha channel and CBIMAGE_RGB otherwise.
+ * 
+ * \param images - array of images
+ * \param count - amount of images
+ * \param layout - layout of the images (see cbimage_bond_layout_t) or NULL to place them horizontaly
+ * \return Returns new image or NULL if error occures.
+ */
+extern cbimage_t *cbimage_bond_array(cbimage_t **images, size_t count, const cbimage_bond_layout_t *layout);
+
+/** 
+ * \brief Creates empty pipeline
+ * 
+ * Operations added to the pipeline are only recorded. They are executed by
+ * cbimage_pipeline_run(), cbimage_pipeline_run_to() or cbimage_pipeline_run_bmp()
+ * in one pass over the image: all orientation changes are folded into one
+ * and the rest of operations are applied to each band of rows while it is in cache.
+ * Result is the same as if operations were applied one by one.
+ * 
+ * \return Returns new pipeline or NULL if there is not enough memory
+ */
+extern cbimage_pipeline_t *cbimage_pipeline_create(void);
+
+/** 
+ * \brief Frees pipeline
+ * 
+ * \param pipeline - pipeline to free (may be NULL)
+ */
+extern void cbimage_pipeline_destroy(cbimage_pipeline_t *pipeline);
+
+/** 
+ * \brief Adds orientation change to the pipeline (see cbimage_orient())
+ * 
+ * \param pipeline - pipeline
+ * \param orientation - one of the CBIMAGE_ORIENT_* constants
+ * \return Returns 0 if succsesfull or -1 if orientation is unknown
+ */
+extern int cbimage_pipeline_orient(cbimage_pipeline_t *pipeline, int orientation);
+
+/** 
+ * \brief Adds rotation to the pipeline (see cbimage_rotate())
+ * 
+ * \param pipeline - pipeline
+ * \param angle - one of the CBIMAGE_*_DEG constants
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_pipeline_rotate(cbimage_pipeline_t *pipeline, int angle);
+
+/** 
+ * \brief Adds mirroring to the pipeline (see cbimage_mirror())
+ * 
+ * \param pipeline - pipeline
+ * \param mirror - CBIMAGE_MIRROR_HORIZONTALY, CBIMAGE_MIRROR_VERTICALY or both
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_pipeline_mirror(cbimage_pipeline_t *pipeline, int mirror);
+
+/** 
+ * \brief Adds color inversion to the pipeline (see cbimage_inverse())
+ * 
+ * \param pipeline - pipeline
+ * \param type - CBIMAGE_INVERSE_WITHOUT_ALPHA or CBIMAGE_INVERSE_ALL
+ * \return Returns 0 if succsesfull or -1 if there is not enough memory
+ */
+extern int cbimage_pipeline_inverse(cbimage_pipeline_t *pipeline, int type);
+
+/** 
+ * \brief Adds overlay of another image to the pipeline (see cbimage_insert())
+ * 
+ * Coordinates are given in the image as it looks after the operations added before.
+ * 
+ * \warning *src* is not copied, it must stay valid and unchanged until the pipeline is run.
+ * 
+ * \param pipeline - pipeline
+ * \param src - image that will overlay the processed image
+ * \param x - x coordinate of src image
+ * \param y - y coordinate of src image
+ * \return Returns 0 if succsesfull or -1 if there is not enough memory
+ */
+extern int cbimage_pipeline_insert(cbimage_pipeline_t *pipeline, cbimage_t *src, int x, int y);
+
+/** 
+ * \brief Adds blending of another image to the pipeline (see cbimage_blend())
+ * 
+ * Coordinates are given in the image as it looks after the operations added before.
+ * 
+ * \warning *src* is not copied, it must stay valid and unchanged until the pipeline is run.
+ * 
+ * \param pipeline - pipeline
+ * \param src - image that will be blended over the processed image
+ * \param x - x coordinate of src image
+ * \param y - y coordinate of src image
+ * \param mode - one of the CBIMAGE_BLEND_* constants
+ * \return Returns 0 if succsesfull or -1 if there is not enough memory
+ */
+extern int cbimage_pipeline_blend(cbimage_pipeline_t *pipeline, cbimage_t *src, int x, int y, int mode);
+
+/** 
+ * \brief Runs pipeline on the image and returns the result as a new image
+ * 
+ * \param pipeline - pipeline
+ * \param image - source image, it is not changed
+ * \return Returns new image or NULL if error occures.
+ */
+extern cbimage_t *cbimage_pipeline_run(cbimage_pipeline_t *pipeline, cbimage_t *image);
+
+/** 
+ * \brief Runs pipeline on the image and writes the result into another image
+ * 
+ * \param pipeline - pipeline
+ * \param dst - destination image of the same format, its size must match size of the result
+ * \param src - source image, must not overlap with *dst*
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_pipeline_run_to(cbimage_pipeline_t *pipeline, cbimage_t *dst, cbimage_t *src);
+
+/** 
+ * \brief Runs pipeline on the BMP file and saves the result into another BMP file
+ * 
+ * Rows are streamed from the decoder through the pipeline to the encoder, so only
+ * about 1 MiB of pixels is kept in memory. Pipelines that swap width and height
+ * (rotation by 90 degrees, transposition) load the whole source image, but the result is still streamed.
+ * 
+ * \param pipeline - pipeline
+ * \param input - filename of the source BMP file
+ * \param output - filename of the resulting BMP file, must not refer to the input file
+ * \param bpp - specifies Bits Per Pixel for the output file (CBIMAGE_24BPP or CBIMAGE_32BPP)
+ * \return Returns 0 if succsesfull or -1 if failed (output referring to the input file is refused)
+ */
+extern int cbimage_pipeline_run_bmp(cbimage_pipeline_t *pipeline, char *input, char *output, int bpp);
+
+/** 
+ * \brief Runs pipeline on many BMP files in parallel
+ * 
+ * Every file is processed by cbimage_pipeline_run_bmp() on the threads of the library
+ * pool (or of the executor), one file per thread, so reading and writing of some files
+ * overlaps with processing of others. Input of the next file is prefetched while the
+ * current one is processed. Files are started only while their estimated memory fits
+ * into *memory* (one file is always allowed). Failure of one file does not stop the batch.
+ * 
+ * \param pipeline - pipeline applied to every file, must not be changed while the batch runs
+ * \param items - files to process, their *status* is set
+ * \param count - amount of files
+ * \param bpp - specifies Bits Per Pixel for the output files (CBIMAGE_24BPP or CBIMAGE_32BPP)
+ * \param memory - how much memory files processed at once may use, 0 for default (512 MiB)
+ * \return Returns amount of files that failed
+ */
+extern size_t cbimage_batch_bmp(cbimage_pipeline_t *pipeline, cbimage_batch_item_t *items, size_t count, int bpp, size_t memory);
+
+/** 
+ * \brief Creates queue for loading and saving BMP files without blocking the caller
+ * 
+ * Files are readed and written through io_uring, so many requests are in flight at once,
+ * and decoded (encoded) by the library thread while the kernel transfers other files.
+ * If io_uring is not available (or environment variable CBIMAGE_ASYNC is "threads"),
+ * requests are processed by a few library threads with the blocking calls instead.
+ * Without threads support requests are processed at once, when they are submitted.
+ * 
+ * Callbacks are never called by the library threads, they are called by cbimage_async_poll(),
+ * so event loop may wait for cbimage_async_fd() and then call cbimage_async_poll() on its thread.
+ * 
+ * \param depth - how many files may be readed or written at once, 0 for default (64)
+ * \return Returns new queue or NULL if somthing goes wrong
+ */
+extern cbimage_async_t *cbimage_async_create(size_t depth);
+
+/** 
+ * \brief Gets how the queue processes requests
+ * 
+ * \param async - queue
+ * \return Returns CBIMAGE_ASYNC_IO_URING, CBIMAGE_ASYNC_THREADS or CBIMAGE_ASYNC_SYNC
+ */
+extern int cbimage_async_backend(cbimage_async_t *async);
+
+/** 
+ * \brief Submits loading of the BMP file
+ * 
+ * \param async - queue
+ * \param filename - filename of the BMP file (copied)
+ * \param format - pixel format of the loaded image (see cbimage_load_bmp_format())
+ * \param callback - function called by cbimage_async_poll() when image is loaded or loading failed
+ * \param user - pointer passed to the *callback*
+ * \return Returns 0 if succsesfull or -1 if request cannot be submitted (callback won't be called)
+ */
+extern int cbimage_async_load_bmp(cbimage_async_t *async, char *filename, int format, cbimage_load_callback_t callback, void *user);
+
+/** 
+ * \brief Submits saving of the image into the BMP file
+ * 
+ * \warning Image must not be changed or destroyed until the *callback* is called.
+ * 
+ * \param async - queue
+ * \param filename - filename of the BMP file (copied)
+ * \param image - image to save
+ * \param bpp - specifies Bits Per Pixel of the file (see cbimage_save_bmp())
+ * \param callback - function called by cbimage_async_poll() when image is saved or saving failed, may be NULL
+ * \param user - pointer passed to the *callback*
+ * \return Returns 0 if succsesfull or -1 if request cannot be submitted (callback won't be called)
+ */
+extern int cbimage_async_save_bmp(cbimage_async_t *async, char *filename, cbimage_t *image, int bpp, cbimage_save_callback_t callback, void *user);
+
+/** 
+ * \brief Gets file descriptor, that becomes readable when some requests are finished
+ * 
+ * Descriptor stays readable until cbimage_async_poll() is called. It must not be readed or closed by the caller.
+ * 
+ * \param async - queue
+ * \return Returns file descriptor or -1 for CBIMAGE_ASYNC_SYNC queue (requests are finished at once)
+ */
+extern int cbimage_async_fd(cbimage_async_t *async);
+
+/** 
+ * \brief Calls callbacks of the finished requests
+ * 
+ * \param async - queue
+ * \param wait - nonzero to wait until at least one request is finished (if any is pending)
+ * \return Returns amount of callbacks called
+ */
+extern size_t cbimage_async_poll(cbimage_async_t *async, int wait);
+
+/** 
+ * \brief Gets amount of requests, which callbacks are not called yet
+ * 
+ * \param async - queue
+ * \return Returns amount of pending requests
+ */
+extern size_t cbimage_async_pending(cbimage_async_t *async);
+
+/** 
+ * \brief Waits for all requests, calls their callbacks and destroys the queue
+ * 
+ * \param async - queue or NULL
+ */
+extern void cbimage_async_destroy(cbimage_async_t *async);
+
+/** 
+ * \brief Task that is run by an executor
+ * 
+ * \param argument - argument passed to the executor
+ */
+typedef void (*cbimage_task_t)(void *argument);
+
+/** 
+ * \brief Executor, that runs library tasks on the caller's thread pool
+ * 
+ * Executor should run *task(argument)* *count* times (in parallel, if possible)
+ * and return only when all of them are finished.
+ * 
+ * \param context - context passed to cbimage_set_executor()
+ * \param task - task to run
+ * \param argument - argument of the task
+ * \param count - how many times the task should be run
+ */
+typedef void (*cbimage_executor_t)(void *context, cbimage_task_t task, void *argument, int count);
+
+/** 
+ * \brief Sets how many threads library may use for processing of a single image
+ * 
+ * All parallel operations (loading, saving, inverse, fill, orientation, insert, blend)
+ * share one pool of worker threads, that is created at the first use.
+ * Changing the number of threads stops the current workers.
+ * 
+ * \param threads - number of threads, 0 (default) to use all online processors
+ */
+extern void cbimage_set_threads(int threads);
+
+/** 
+ * \brief Gets how many threads library may use for processing of a single image
+ * 
+ * \return Returns number of threads (at least 1)
+ */
+extern int cbimage_get_threads(void);
+
+/** 
+ * \brief Makes library run its parallel work on the caller's thread pool
+ * 
+ * While executor is set, library does not keep its own worker threads.
+ * 
+ * \param executor - executor function or NULL to use the library pool again
+ * \param context - pointer that will be passed to the *executor*
+ */
+extern void cbimage_set_executor(cbimage_executor_t executor, void *context);
+
+/** 
+ * \brief Sets the smallest image that is processed in parallel
+ * 
+ * Operations on images with less pixels are done by the calling thread,
+ * as waking the workers costs more than the work itself.
+ * 
+ * \param pixels - amount of pixels, default is 65536
+ */
+extern void cbimage_set_parallel_threshold(size_t pixels);
+
+/** 
+ * \brief Selects instruction set used by the pixel processing kernels
+ * 
+ * By default the best instruction set supported by the CPU is detected at the first use.
+ * Environment variable CBIMAGE_ISA ("scalar", "sse2" or "avx2") overrides the detection.
+ * 
+ * \param isa - one of the following:
+ * 	- CBIMAGE_ISA_AUTO - detect the best supported instruction set
+ * 	- CBIMAGE_ISA_SCALAR - plain C kernels
+ * 	- CBIMAGE_ISA_SSE2 - SSE2 kernels
+ * 	- CBIMAGE_ISA_AVX2 - AVX2 kernels
+ * \return Returns 0 if succsesfull or -1 if instruction set is not supported by CPU or by the library build
+ */
+extern int cbimage_set_isa(int isa);
+
+/** 
+ * \brief Gets instruction set used by the pixel processing kernels
+ * 
+ * \return Returns one of the CBIMAGE_ISA_* constants (except CBIMAGE_ISA_AUTO)
+ */
+extern int cbimage_get_isa(void);
+
+/** 
+ * \brief Gets statistics of the library operations
+ * 
+ * Statistics are collected only if library is built with CBIMAGE_ENABLE_STATS
+ * CMake option, otherwise the instrumentation is not compiled at all.
+ * For every operation it contains amount of finished calls, bytes of pixels
+ * (or of the file) processed, total wall time and amount of memory allocated.
+ * 
+ * \param stats - array that receives statistics, indexed by CBIMAGE_STAT_* constants
+ * \return Returns 0 if succsesfull or -1 if library is built without statistics (counters are zeros)
+ */
+extern int cbimage_stats_get(cbimage_stat_t stats[CBIMAGE_STAT_COUNT]);
+
+/** 
+ * \brief Resets statistics of all operations to zero
+ */
+extern void cbimage_stats_reset(void);
+
+/** 
+ * \brief Starts writing every operation call into the trace file
+ * 
+ * Trace is written in Chrome trace event format (JSON), that can be opened in
+ * chrome://tracing or Perfetto. Requires CBIMAGE_ENABLE_STATS CMake option.
+ * 
+ * \param filename the filename of the trace file
+ * \return Returns 0 if succsesfull or -1 if failed
+ */
+extern int cbimage_trace_start(char *filename);
+
+/** 
+ * \brief Stops tracing and closes the trace file
+ * 
+ * \return Returns 0 if succsesfull or -1 if trace was not started or cannot be written
+ */
+extern int cbimage_trace_stop(void);
 
 #endif /* LIB_C_BASIC_IMAGE_HEADER */
@@ -23,7 +23,7 @@
 
 /** @file */ 
 
-#include <cbimage.h>
+#include "cbimage_internal.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -31,20 +31,56 @@
 #include <stdlib.h>
 
 
-void cbimage_inverse(cbimage_t *image, int type)
+/** 
+ * \brief Context of the pattern kernel applied to the rows of an image
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
 {
-	size_t i;
-	assert(image != NULL);
+	cbimage_t			*image;
+	void					(*kernel)(uint8_t*, size_t, const uint8_t*);
+	const uint8_t	*pattern;
+	size_t				bytes;
+	size_t				tail;
+} cbimage_pattern_job_t;
+
+
+
+
+
+/** 
+ * \brief Applies pattern kernel to the band of rows
+ * 
+ * Bands of packed images are processed as one long row. Bits of the last
+ * partial byte of the bit packed row are merged, so pixels outside of the view are kept.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pattern_band(void *context, size_t begin, size_t end)
+{
+	cbimage_pattern_job_t	*job = context;
+	size_t								y;
+	
+	if(job->bytes == cbimage_stride(job->image) && !job->tail)
+	{
+		job->kernel(cbimage_row(job->image, begin), job->bytes * (end - begin), job->pattern);
+		return;
+	}
 	
-	for(i = 0; i < image->height * image->width; i++)
+	for(y = begin; y < end; y++)
 	{
-		image->data[i].r = 0xFFFF - image->data[i].r;
-		image->data[i].g = 0xFFFF - image->data[i].g;
-		image->data[i].b = 0xFFFF - image->data[i].b;
+		uint8_t *row = cbimage_row(job->image, y);
 		
-		if(type == CBIMAGE_INVERSE_ALL)
+		job->kernel(row, job->bytes, job->pattern);
+		
+		if(job->tail)
 		{
-			image->data[i].a = 0xFFFF - image->data[i].a;
+			uint8_t value = row[job->bytes];
+			uint8_t mask = (uint8_t)(0xFF00 >> job->tail);
+			
+			job->kernel(&value, 1, job->pattern);
+			row[job->bytes] = (row[job->bytes] & ~mask) | (value & mask);
 		}
 	}
 }
@@ -53,148 +89,173 @@ void cbimage_inverse(cbimage_t *image, int type)
 
 
 
-void cbimage_mirror(cbimage_t *image, int mirror)
+/** 
+ * \brief Applies per-row kernel that works with the repeated pixel pattern to the whole image
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pattern_rows(cbimage_t *image, void (*kernel)(uint8_t*, size_t, const uint8_t*), const uint8_t pattern[CBIMAGE_PATTERN])
 {
-	size_t i,t;
+	cbimage_pattern_job_t job;
 	
-	assert(image != NULL);
-	if(mirror & CBIMAGE_MIRROR_HORIZONTALY)
-	{
-		for(i = 0; i < image->height; i++)
-		{
-			for(t = 0; t < (image->width >> 1); t++)
-			{
-				cbpixel_t pixel = image->data[t + i * image->width];
-				
-				image->data[t + i * image->width] = image->data[(image->width - t - 1) + i * image->width];
-				image->data[(image->width - t - 1) + i * image->width] = pixel;
-
-			}
-		}
-	} 
+	job.image = image;
+	job.kernel = kernel;
+	job.pattern = pattern;
+	job.bytes = image->width * cbimage_pixel_size(image->format);
+	job.tail = 0;
 	
-	if(mirror & CBIMAGE_MIRROR_VERTICALY)
+	/* Bit packed rows are processed by whole bytes, pattern holds the same value in every byte */
+	if(image->format == CBIMAGE_FORMAT_MONO1)
 	{
-		for(t = 0; t < image->width; t++)
-		{
-			for(i = 0; i < (image->height >> 1); i++)
-			{
-				
-				cbpixel_t pixel = image->data[t + i * image->width];
-				
-				image->data[t + i * image->width] = image->data[t + (image->height - i - 1) * image->width];
-				image->data[t + (image->height - i - 1) * image->width] = pixel;
-
-			}
-		}
+		job.bytes = image->width >> 3;
+		job.tail = image->width & 7;
 	}
+	
+	cbimage_parallel_rows(image->height, image->width, cbimage_pattern_band, &job);
 }
 
 
 
 
 
-int cbimage_rotate(cbimage_t *image, int angle)
+void cbimage_inverse(cbimage_t *image, int type)
 {
+	cbpixel_t	mask = {0xFFFF, 0xFFFF, 0xFFFF, 0x0};
+	uint8_t		pixel[sizeof(cbpixel_t)];
+	uint8_t		pattern[CBIMAGE_PATTERN];
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_INVERSE);
 	assert(image != NULL);
-	if(angle == CBIMAGE_180_DEG || angle == CBIMAGE_M180_DEG) 
-	{
-		cbimage_mirror(image,  CBIMAGE_MIRROR_VERTICALY | CBIMAGE_MIRROR_HORIZONTALY);
-	} 
-	else 
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
+	
+	if(type == CBIMAGE_INVERSE_ALL)
+		mask.a = 0xFFFF;
+	
+	/* Inversion of every channel is XOR with all ones, so whole rows are XORed with the mask */
+	if(image->format == CBIMAGE_FORMAT_MONO1)
 	{
-		cbpixel_t *new_image = calloc(1, sizeof(cbpixel_t) * image->width * image->height);
-		
-		if(!new_image)
-			return -1;
-		
-		size_t x,y;
-		
-		for(x = 0; x < image->width; x++)
-		{
-			for(y = 0; y < image->height; y++)
-			{
-				new_image[image->height * x + y] = image->data[y * image->width + x];
-			}
-		}
-		
-		free(image->data);
-		image->data = new_image;
-		image->width = y;
-		image->height = x;
-		
-		if(angle == CBIMAGE_90_DEG || angle == CBIMAGE_M240_DEG)
-		{
-			cbimage_mirror(image, CBIMAGE_MIRROR_HORIZONTALY);
-		} else {
-			cbimage_mirror(image, CBIMAGE_MIRROR_VERTICALY);
-		}
+		memset(pattern, 0xFF, CBIMAGE_PATTERN);
+	} else {
+		cbimage_pixel_store(pixel, image->format, mask);
+		cbimage_pattern(pattern, pixel, cbimage_pixel_size(image->format));
 	}
-	return 0;
+	cbimage_pattern_rows(image, cbimage_kernels()->xor_bytes, pattern);
 }
 
 
 
 
 
-cbimage_t *cbimage_bond(int bond_type, int num_images, ...) {
-	cbimage_t **images = calloc(num_images, sizeof(cbimage_t*));
-	size_t i = 0, width_sum = 0, height_sum = 0, width_max = 0, height_max = 0;
-	va_list args;
-	va_start(args, num_images);
-	
-	while(i < num_images)
-	{
-		images[i] = va_arg(args, cbimage_t *);
-		
-		if(images[i]->width > width_max)
-			width_max = images[i]->width;
-			
-		if(images[i]->height > height_max)
-			height_max = images[i]->height;
-			
-		width_sum += images[i]->width;
-		height_sum += images[i]->height;
-			
-		i++;
-	} 
-	
-	va_end(args);
+void cbimage_fill(cbimage_t *image, cbpixel_t color)
+{
+	uint8_t pixel[sizeof(cbpixel_t)];
+	uint8_t pattern[CBIMAGE_PATTERN];
 	
-	cbimage_t *out;
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_FILL);
+	assert(image != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
 	
-	if(bond_type == CBIMAGE_BOND_HORIZONTAL) {
-		out = cbimage_create(width_sum, height_max, CBIMAGE_RGB);
-		width_sum = 0;
-		for(i = 0; i < num_images; i++) {
-			cbimage_insert(out, images[i], width_sum, 0);
-			width_sum += images[i]->width;
-		}
+	if(image->format == CBIMAGE_FORMAT_MONO1)
+	{
+		memset(pattern, (cbimage_mono_level(color.r >> 8, color.g >> 8, color.b >> 8)) ? (0xFF) : (0), CBIMAGE_PATTERN);
 	} else {
-		out = cbimage_create(width_max, height_sum, CBIMAGE_RGB);
-		height_sum = 0;
-		for(i = 0; i < num_images; i++) {
-			cbimage_insert(out, images[i], 0, height_sum);
-			height_sum += images[i]->height;
-		}
+		cbimage_pixel_store(pixel, image->format, color);
+		cbimage_pattern(pattern, pixel, cbimage_pixel_size(image->format));
 	}
-	free(images);
-	return out;
+	cbimage_pattern_rows(image, cbimage_kernels()->fill_bytes, pattern);
 }
+
+
+
+
+
+void cbimage_mirror(cbimage_t *image, int mirror)
+{
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_MIRROR);
+	assert(image != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
 	
+	cbimage_orient(image, cbimage_mirror_orientation(mirror));
+}
+
+
+
+
+
+int cbimage_mirror_orientation(int mirror)
+{
+	switch(mirror & (CBIMAGE_MIRROR_HORIZONTALY | CBIMAGE_MIRROR_VERTICALY))
+	{
+		case CBIMAGE_MIRROR_HORIZONTALY:
+			return CBIMAGE_ORIENT_MIRROR_HORIZONTAL;
+		case CBIMAGE_MIRROR_VERTICALY:
+			return CBIMAGE_ORIENT_MIRROR_VERTICAL;
+		case CBIMAGE_MIRROR_HORIZONTALY | CBIMAGE_MIRROR_VERTICALY:
+			return CBIMAGE_ORIENT_ROTATE_180;
+	}
+	return CBIMAGE_ORIENT_NORMAL;
+}
+
+
+
+
+
+int cbimage_angle_orientation(int angle)
+{
+	switch(angle)
+	{
+		case CBIMAGE_90_DEG:
+			return CBIMAGE_ORIENT_ROTATE_90;
+		case CBIMAGE_180_DEG:
+			return CBIMAGE_ORIENT_ROTATE_180;
+		case CBIMAGE_M90_DEG:
+			return CBIMAGE_ORIENT_ROTATE_270;
+	}
+	return 0;
+}
+
+
+
+
+
+int cbimage_rotate(cbimage_t *image, int angle)
+{
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_ROTATE);
+	assert(image != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
+	return cbimage_orient(image, cbimage_angle_orientation(angle));
+}
+
+
 
 
 
+cbimage_t *cbimage_rotate_copy(cbimage_t *image, int angle)
+{
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_ROTATE);
+	assert(image != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
+	return cbimage_orient_copy(image, cbimage_angle_orientation(angle));
+}
+
 
 
 
 
 int cbimage_free(cbimage_t *image)
 {
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_FREE);
 	assert(image != NULL);
 	assert(image->data != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
 	
-	free(image->data);
+	if(!image->view)
+	{
+		if(image->pooled)
+			cbimage_pixels_release(image->raw);
+		else
+			free(image->data);
+	}
 	image->data = NULL;
 	return 0;
 }
@@ -205,15 +266,55 @@ int cbimage_free(cbimage_t *image)
 
 cbimage_t *cbimage_create(int width, int height, int type)
 {
-	cbimage_t *new_image = calloc(1, sizeof(cbimage_t));
-	assert(new_image != NULL);
+	return cbimage_create_format(width, height, type, CBIMAGE_FORMAT_RGBA16);
+}
+
+
+
+
+
+/** 
+ * \brief Creates image with pixels from the pool
+ * 
+ * Sizes are computed in size_t, images which pixels do not fit into the address space are rejected.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_t *cbimage_create_pixels(size_t width, size_t height, int type, int format, int zero)
+{
+	cbimage_t	*new_image;
+	size_t		size;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_CREATE);
+	
+	if(!cbimage_pixel_size(format) && format != CBIMAGE_FORMAT_MONO1)
+		return NULL;
+	
+	if(width > (SIZE_MAX >> 4) || (height && cbimage_row_bytes(format, width) > CBIMAGE_MAX_PIXELS / height))
+		return NULL;
+	
+	size = cbimage_row_bytes(format, width);
+	
+	CBIMAGE_STAT_BYTES(height * size);
+	
+	new_image = cbimage_alloc(sizeof(cbimage_t));
+	if(!new_image)
+		return NULL;
+	memset(new_image, 0, sizeof(cbimage_t));
 
 	new_image->height = height;
 	new_image->width = width;
 	new_image->type = type;
-	new_image->data = calloc(height * width, sizeof(cbpixel_t));
-
-	assert(new_image->data != NULL);
+	new_image->format = format;
+	new_image->stride = size;
+	new_image->raw = cbimage_pixels_alloc(height * size, zero);
+	new_image->pooled = 1;
+	
+	if(!new_image->raw)
+	{
+		cbimage_release(new_image);
+		return NULL;
+	}
 	return new_image;
 }
 
@@ -221,19 +322,244 @@ cbimage_t *cbimage_create(int width, int height, int type)
 
 
 
-void cbimage_insert(cbimage_t *dst, cbimage_t *src, int x, int y) {
-	size_t ix, iy;
+cbimage_t *cbimage_create_format(int width, int height, int type, int format)
+{
+	if(width < 0 || height < 0)
+		return NULL;
+	
+	return cbimage_create_pixels(width, height, type, format, 1);
+}
+
+
+
 
-	for(ix = 0; ix < src->width; ix++) 
+
+cbimage_t *cbimage_create_large(size_t width, size_t height, int type, int format)
+{
+	return cbimage_create_pixels(width, height, type, format, 1);
+}
+
+
+
+
+
+cbimage_t *cbimage_create_uninitialized(size_t width, size_t height, int type, int format)
+{
+	return cbimage_create_pixels(width, height, type, format, 0);
+}
+
+
+
+
+
+void cbimage_destroy(cbimage_t *image)
+{
+	if(!image)
+		return;
+	
+	if(image->data)
+		cbimage_free(image);
+	cbimage_release(image);
+}
+
+
+
+
+
+int cbimage_view(cbimage_t *view, cbimage_t *image, size_t x, size_t y, size_t width, size_t height)
+{
+	assert(view != NULL);
+	assert(image != NULL);
+	
+	if(x > image->width || width > image->width - x || y > image->height || height > image->height - y)
+		return -1;
+	
+	/* Pixels of the bit packed image have no byte address, except every eighth one */
+	if(image->format == CBIMAGE_FORMAT_MONO1 && (x & 7))
+		return -1;
+	
+	*view = *image;
+	view->raw = cbimage_row(image, y) + ((image->format == CBIMAGE_FORMAT_MONO1) ? (x >> 3) : (x * cbimage_pixel_size(image->format)));
+	view->width = width;
+	view->height = height;
+	view->stride = cbimage_stride(image);
+	view->view = 1;
+	return 0;
+}
+
+
+
+
+
+size_t cbimage_format_size(int format)
+{
+	return cbimage_pixel_size(format);
+}
+
+
+
+
+
+cbpixel_t cbimage_get_pixel(cbimage_t *image, size_t x, size_t y)
+{
+	assert(image != NULL);
+	assert(x < image->width && y < image->height);
+	
+	if(image->format == CBIMAGE_FORMAT_MONO1)
 	{
-		for(iy = 0; iy < src->height; iy++)
-		{
-			if(((ix + x) < dst->width) && ((iy + y) < dst->height) && ((iy + y) >= 0) && ((iy + y) >= 0))
-			{
-				dst->data[(ix + x) + (iy + y) * dst->width] = src->data[ix + iy * src->width];
-			}
-		}
+		uint8_t		level = (cbimage_mono_get(cbimage_row(image, y), x)) ? (0xFF) : (0);
+		cbpixel_t	pixel = {level << 8, level << 8, level << 8, 0};
+		
+		return pixel;
+	}
+	
+	return cbimage_pixel_load(cbimage_row(image, y) + x * cbimage_pixel_size(image->format), image->format);
+}
+
+
+
+
+
+void cbimage_set_pixel(cbimage_t *image, size_t x, size_t y, cbpixel_t pixel)
+{
+	assert(image != NULL);
+	assert(x < image->width && y < image->height);
+	
+	if(image->format == CBIMAGE_FORMAT_MONO1)
+	{
+		cbimage_mono_set(cbimage_row(image, y), x, cbimage_mono_level(pixel.r >> 8, pixel.g >> 8, pixel.b >> 8));
+		return;
+	}
+	
+	cbimage_pixel_store(cbimage_row(image, y) + x * cbimage_pixel_size(image->format), image->format, pixel);
+}
+
+
+
+
+
+int cbimage_clip(cbimage_t *dst, cbimage_t *src, int x, int y, cbimage_clip_t *clip)
+{
+	size_t skip_x = (x < 0) ? (-(size_t)x) : (0);
+	size_t skip_y = (y < 0) ? (-(size_t)y) : (0);
+	
+	clip->dst_x = (x < 0) ? (0) : (x);
+	clip->dst_y = (y < 0) ? (0) : (y);
+	
+	if(skip_x >= src->width || skip_y >= src->height || clip->dst_x >= dst->width || clip->dst_y >= dst->height)
+		return -1;
+	
+	clip->src_x = skip_x;
+	clip->src_y = skip_y;
+	clip->width = src->width - skip_x;
+	clip->height = src->height - skip_y;
+	
+	if(clip->width > dst->width - clip->dst_x)
+		clip->width = dst->width - clip->dst_x;
+	if(clip->height > dst->height - clip->dst_y)
+		clip->height = dst->height - clip->dst_y;
+	
+	return 0;
+}
+
+
+
+
+
+void cbimage_convert_row(uint8_t *dst, int dst_format, const uint8_t *src, int src_format, size_t width)
+{
+	size_t dst_size = cbimage_pixel_size(dst_format);
+	size_t src_size = cbimage_pixel_size(src_format);
+	size_t i;
+	
+	if(dst_format == CBIMAGE_FORMAT_MONO1 || src_format == CBIMAGE_FORMAT_MONO1)
+	{
+		cbimage_mono_convert(dst, dst_format, 0, src, src_format, 0, width);
+		return;
+	}
+	
+	if(dst_format == src_format)
+	{
+		memcpy(dst, src, width * dst_size);
+		return;
+	}
+	
+	for(i = 0; i < width; i++, dst += dst_size, src += src_size)
+		cbimage_pixel_store(dst, dst_format, cbimage_pixel_load(src, src_format));
+}
+
+
+
+
+
+void cbimage_convert_span(uint8_t *dst, int dst_format, size_t dst_x, const uint8_t *src, int src_format, size_t src_x, size_t width)
+{
+	if(dst_format == CBIMAGE_FORMAT_MONO1 || src_format == CBIMAGE_FORMAT_MONO1)
+		cbimage_mono_convert(dst, dst_format, dst_x, src, src_format, src_x, width);
+	else
+		cbimage_convert_row(dst + dst_x * cbimage_pixel_size(dst_format), dst_format, src + src_x * cbimage_pixel_size(src_format), src_format, width);
+}
+
+
+
+
+
+/** 
+ * \brief Context of cbimage_insert()
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t			*dst;
+	cbimage_t			*src;
+	cbimage_clip_t	clip;
+} cbimage_insert_job_t;
+
+
+
+
+
+/** 
+ * \brief Copies the band of rows of the clipped source into the destination
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_insert_band(void *context, size_t begin, size_t end)
+{
+	cbimage_insert_job_t		*job = context;
+	size_t									iy;
+	size_t									src_size = cbimage_pixel_size(job->src->format);
+	size_t									dst_size = cbimage_pixel_size(job->dst->format);
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	
+	for(iy = begin; iy < end; iy++)
+	{
+		uint8_t *to = cbimage_row(job->dst, job->clip.dst_y + iy);
+		uint8_t *from = cbimage_row(job->src, job->clip.src_y + iy);
+		
+		if(job->src->format == job->dst->format && dst_size)
+			kernels->copy(to + job->clip.dst_x * dst_size, from + job->clip.src_x * src_size, job->clip.width * dst_size);
+		else
+			cbimage_convert_span(to, job->dst->format, job->clip.dst_x, from, job->src->format, job->clip.src_x, job->clip.width);
 	}
 }
 
 
+
+
+
+void cbimage_insert(cbimage_t *dst, cbimage_t *src, int x, int y) {
+	cbimage_insert_job_t job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_INSERT);
+	
+	if(cbimage_clip(dst, src, x, y, &job.clip))
+		return;
+	
+	CBIMAGE_STAT_BYTES(job.clip.height * cbimage_row_bytes(dst->format, job.clip.width));
+	
+	job.dst = dst;
+	job.src = src;
+	cbimage_parallel_rows(job.clip.height, job.clip.width, cbimage_insert_band, &job);
+}
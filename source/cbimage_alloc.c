@@ -0,0 +1,524 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef CBIMAGE_HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+/** 
+ * \brief Alignment of the pixel buffers, enough for the widest vector and a cache line
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_ALIGNMENT 64
+
+/** 
+ * \brief Maximal amount of buffers kept by the pool
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_POOL_SLOTS 32
+
+/** 
+ * \brief Size of the huge page, mapped buffers are aligned to it
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_HUGE_PAGE ((size_t)2 << 20)
+
+/** 
+ * \brief Smallest pixel buffer, that is mapped directly from the kernel
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_MAP_THRESHOLD ((size_t)4 << 20)
+
+/** 
+ * \brief Bookkeeping stored right before every pixel buffer
+ * 
+ * *mapped* is the length of the anonymous mapping of the *block* or 0 if
+ * block was given by the allocator.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	void		*block;
+	size_t	bytes;
+	size_t	mapped;
+} cbimage_buffer_header_t;
+
+/** 
+ * \brief Bytes allocated in addition to the pixels of every buffer
+ * 
+ * Allocators only have to return pointer-aligned blocks, so the space for the header
+ * is reserved explicitly and the pixels start at the next aligned address after it.
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_BUFFER_OVERHEAD (CBIMAGE_ALIGNMENT + sizeof(cbimage_buffer_header_t))
+
+
+
+static void *cbimage_default_allocate(void *context, size_t size)
+{
+	(void)context;
+	return malloc(size);
+}
+
+
+
+static void cbimage_default_release(void *context, void *pointer)
+{
+	(void)context;
+	free(pointer);
+}
+
+
+
+/** 
+ * \brief Allocator used by the library, default one uses the C library heap
+ */
+static cbimage_allocator_t cbimage_allocator = {
+	cbimage_default_allocate,
+	cbimage_default_release,
+	NULL,
+	NULL,
+	NULL
+};
+
+/** 
+ * \brief Pool of the released pixel buffers
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+static struct
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_t	lock;
+#endif
+	uint8_t					*buffers[CBIMAGE_POOL_SLOTS];
+	int							count;
+	size_t					cached;
+	size_t					limit;
+} cbimage_pool = {
+#ifdef CBIMAGE_HAVE_PTHREAD
+	PTHREAD_MUTEX_INITIALIZER,
+#endif
+	{NULL}, 0, 0, CBIMAGE_DEFAULT_POOL
+};
+
+/** 
+ * \brief Huge pages mode of the mapped buffers (see cbimage_set_huge_pages())
+ */
+static int cbimage_huge_pages = CBIMAGE_HUGE_PAGES_TRANSPARENT;
+
+
+
+static void cbimage_pool_lock(void)
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&cbimage_pool.lock);
+#endif
+}
+
+
+
+static void cbimage_pool_unlock(void)
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_unlock(&cbimage_pool.lock);
+#endif
+}
+
+
+
+/** 
+ * \brief Gets header of the pixel buffer
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_buffer_header_t *cbimage_buffer_header(uint8_t *pixels)
+{
+	return (cbimage_buffer_header_t*)(pixels - sizeof(cbimage_buffer_header_t));
+}
+
+
+
+/** 
+ * \brief Rounds size of the buffer up to its size class
+ * 
+ * Classes are 1/8 of the power of two apart, so no more than 12.5% of the
+ * buffer is wasted, while images of the same dimensions always share the class.
+ * 
+ * \return Returns size of the class or 0 if *bytes* is more than CBIMAGE_MAX_PIXELS
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static size_t cbimage_size_class(size_t bytes)
+{
+	size_t step = CBIMAGE_ALIGNMENT;
+	
+	if(bytes > CBIMAGE_MAX_PIXELS)
+		return 0;
+	
+	while(step * 16 <= bytes)
+		step <<= 1;
+	
+	return (bytes + step - 1) & ~(step - 1);
+}
+
+
+
+/** 
+ * \brief Returns pixel buffer to the allocator
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_buffer_destroy(uint8_t *pixels)
+{
+	void *block = cbimage_buffer_header(pixels)->block;
+	
+#ifdef CBIMAGE_HAVE_MMAP
+	if(cbimage_buffer_header(pixels)->mapped)
+	{
+		munmap(block, cbimage_buffer_header(pixels)->mapped);
+		return;
+	}
+#endif
+	
+	if(cbimage_allocator.release_aligned)
+		cbimage_allocator.release_aligned(cbimage_allocator.context, block);
+	else
+		cbimage_allocator.release(cbimage_allocator.context, block);
+}
+
+
+
+#ifdef CBIMAGE_HAVE_MMAP
+/** 
+ * \brief Maps anonymous memory for the large pixel buffer
+ * 
+ * Mapping is aligned to the huge page, so the kernel is able to back it by huge pages:
+ * explicit (MAP_HUGETLB) ones if they are reserved, or transparent ones. Pages of the
+ * fresh mapping are zeroed by the kernel on the first touch.
+ * 
+ * \param bytes - size of the mapping, multiple of CBIMAGE_HUGE_PAGE
+ * \param huge_pages - huge pages mode (see cbimage_set_huge_pages())
+ * \return Returns the mapping or NULL if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint8_t *cbimage_map_pixels(size_t bytes, int huge_pages)
+{
+	uint8_t	*block;
+	size_t	head;
+	
+#ifdef MAP_HUGETLB
+	if(huge_pages == CBIMAGE_HUGE_PAGES_EXPLICIT)
+	{
+		block = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(block != MAP_FAILED)
+			return block;
+	}
+#endif
+	
+	/* Mapping is longer by one huge page, unaligned head and tail are unmapped */
+	block = mmap(NULL, bytes + CBIMAGE_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(block == MAP_FAILED)
+		return NULL;
+	
+	head = (CBIMAGE_HUGE_PAGE - ((uintptr_t)block & (CBIMAGE_HUGE_PAGE - 1))) & (CBIMAGE_HUGE_PAGE - 1);
+	if(head)
+		munmap(block, head);
+	munmap(block + head + bytes, CBIMAGE_HUGE_PAGE - head);
+	block += head;
+	
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+	madvise(block, bytes, (huge_pages == CBIMAGE_HUGE_PAGES_OFF) ? (MADV_NOHUGEPAGE) : (MADV_HUGEPAGE));
+#endif
+	return block;
+}
+#endif
+
+
+
+void *cbimage_alloc(size_t bytes)
+{
+	void *pointer = cbimage_allocator.allocate(cbimage_allocator.context, bytes);
+	
+	if(pointer)
+		CBIMAGE_STAT_ALLOC(bytes);
+	return pointer;
+}
+
+
+
+void cbimage_release(void *pointer)
+{
+	if(pointer)
+		cbimage_allocator.release(cbimage_allocator.context, pointer);
+}
+
+
+
+/** 
+ * Buffer of the same size class is taken from the pool, if there is one.
+ * New buffers are over-allocated by CBIMAGE_BUFFER_OVERHEAD bytes, so the header
+ * fits before the aligned pixels. Large buffers of the default allocator
+ * are mapped directly (see cbimage_map_pixels()).
+ */
+uint8_t *cbimage_pixels_alloc(size_t bytes, int zero)
+{
+	size_t	class_bytes = cbimage_size_class(bytes ? bytes : 1);
+	uint8_t	*pixels = NULL, *block;
+	int			i, huge_pages;
+	
+	if(!class_bytes)
+		return NULL;
+	
+	cbimage_pool_lock();
+	huge_pages = cbimage_huge_pages;
+	for(i = 0; i < cbimage_pool.count; i++)
+	{
+		if(cbimage_buffer_header(cbimage_pool.buffers[i])->bytes == class_bytes)
+		{
+			pixels = cbimage_pool.buffers[i];
+			cbimage_pool.buffers[i] = cbimage_pool.buffers[--cbimage_pool.count];
+			cbimage_pool.cached -= class_bytes;
+			break;
+		}
+	}
+	cbimage_pool_unlock();
+	
+	if(pixels)
+	{
+		if(zero)
+			memset(pixels, 0, bytes);
+		return pixels;
+	}
+	
+	if(class_bytes > SIZE_MAX - CBIMAGE_BUFFER_OVERHEAD - CBIMAGE_HUGE_PAGE * 2)
+		return NULL;
+	
+#ifdef CBIMAGE_HAVE_MMAP
+	if(class_bytes >= CBIMAGE_MAP_THRESHOLD && cbimage_allocator.allocate == cbimage_default_allocate && !cbimage_allocator.allocate_aligned)
+	{
+		size_t mapped = (class_bytes + CBIMAGE_ALIGNMENT + CBIMAGE_HUGE_PAGE - 1) & ~(CBIMAGE_HUGE_PAGE - 1);
+		
+		block = cbimage_map_pixels(mapped, huge_pages);
+		if(block)
+		{
+			/* Fresh mapping is already zeroed, mapping is page aligned, so the header
+			 * fits into the first CBIMAGE_ALIGNMENT bytes */
+			pixels = block + CBIMAGE_ALIGNMENT;
+			CBIMAGE_STAT_ALLOC(mapped);
+			cbimage_buffer_header(pixels)->block = block;
+			cbimage_buffer_header(pixels)->bytes = class_bytes;
+			cbimage_buffer_header(pixels)->mapped = mapped;
+			return pixels;
+		}
+	}
+#endif
+	
+	if(cbimage_allocator.allocate_aligned)
+	{
+		block = cbimage_allocator.allocate_aligned(cbimage_allocator.context, CBIMAGE_ALIGNMENT, class_bytes + CBIMAGE_BUFFER_OVERHEAD);
+	} else if(cbimage_allocator.allocate == cbimage_default_allocate && zero) {
+		/* Fresh memory of the C library is usually zeroed by the kernel lazily */
+		block = calloc(1, class_bytes + CBIMAGE_BUFFER_OVERHEAD);
+		zero = 0;
+	} else {
+		block = cbimage_allocator.allocate(cbimage_allocator.context, class_bytes + CBIMAGE_BUFFER_OVERHEAD);
+	}
+	
+	if(!block)
+		return NULL;
+	
+	/* Pixels start at the first aligned address after the header */
+	pixels = block + sizeof(cbimage_buffer_header_t);
+	pixels += (CBIMAGE_ALIGNMENT - ((uintptr_t)pixels & (CBIMAGE_ALIGNMENT - 1))) & (CBIMAGE_ALIGNMENT - 1);
+	CBIMAGE_STAT_ALLOC(class_bytes + CBIMAGE_BUFFER_OVERHEAD);
+	cbimage_buffer_header(pixels)->block = block;
+	cbimage_buffer_header(pixels)->bytes = class_bytes;
+	cbimage_buffer_header(pixels)->mapped = 0;
+	
+	if(zero)
+		memset(pixels, 0, bytes);
+	return pixels;
+}
+
+
+
+void cbimage_pixels_release(uint8_t *pixels)
+{
+	size_t class_bytes;
+	
+	if(!pixels)
+		return;
+	
+	class_bytes = cbimage_buffer_header(pixels)->bytes;
+	
+	cbimage_pool_lock();
+	if(cbimage_pool.count < CBIMAGE_POOL_SLOTS && cbimage_pool.cached + class_bytes <= cbimage_pool.limit)
+	{
+		cbimage_pool.buffers[cbimage_pool.count++] = pixels;
+		cbimage_pool.cached += class_bytes;
+		pixels = NULL;
+	}
+	cbimage_pool_unlock();
+	
+	if(pixels)
+		cbimage_buffer_destroy(pixels);
+}
+
+
+
+void cbimage_pool_trim(void)
+{
+	uint8_t	*buffers[CBIMAGE_POOL_SLOTS];
+	int			i, count;
+	
+	cbimage_pool_lock();
+	count = cbimage_pool.count;
+	memcpy(buffers, cbimage_pool.buffers, sizeof(uint8_t*) * count);
+	cbimage_pool.count = 0;
+	cbimage_pool.cached = 0;
+	cbimage_pool_unlock();
+	
+	for(i = 0; i < count; i++)
+		cbimage_buffer_destroy(buffers[i]);
+}
+
+
+
+void cbimage_set_pool_limit(size_t bytes)
+{
+	cbimage_pool_lock();
+	cbimage_pool.limit = bytes;
+	cbimage_pool_unlock();
+	
+	/* Buffers over the new limit are not needed anymore */
+	cbimage_pool_trim();
+}
+
+
+
+/** 
+ * Mode applies to the buffers mapped after the call, pooled buffers keep their pages.
+ */
+void cbimage_set_huge_pages(int mode)
+{
+	assert(mode == CBIMAGE_HUGE_PAGES_OFF || mode == CBIMAGE_HUGE_PAGES_TRANSPARENT || mode == CBIMAGE_HUGE_PAGES_EXPLICIT);
+	
+	cbimage_pool_lock();
+	cbimage_huge_pages = mode;
+	cbimage_pool_unlock();
+}
+
+
+
+void cbimage_set_allocator(const cbimage_allocator_t *allocator)
+{
+	assert(allocator == NULL || (allocator->allocate != NULL && allocator->release != NULL));
+	assert(allocator == NULL || (allocator->allocate_aligned == NULL) == (allocator->release_aligned == NULL));
+	
+	/* Cached buffers belong to the previous allocator */
+	cbimage_pool_trim();
+	
+	if(allocator)
+	{
+		cbimage_allocator = *allocator;
+	} else {
+		cbimage_allocator.allocate = cbimage_default_allocate;
+		cbimage_allocator.release = cbimage_default_release;
+		cbimage_allocator.allocate_aligned = NULL;
+		cbimage_allocator.release_aligned = NULL;
+		cbimage_allocator.context = NULL;
+	}
+}
+
+
+
+/** 
+ * Buffer grows at least twice, so appending many small parts takes linear time.
+ */
+uint8_t *cbimage_buffer_append(cbimage_buffer_t *buffer, size_t bytes)
+{
+	size_t	capacity;
+	uint8_t	*data;
+	
+	assert(buffer != NULL);
+	
+	capacity = buffer->capacity;
+	if(bytes > SIZE_MAX - buffer->size)
+		return NULL;
+	
+	if(buffer->size + bytes > capacity)
+	{
+		capacity = (capacity > SIZE_MAX / 2) ? (SIZE_MAX) : (capacity * 2);
+		if(capacity < buffer->size + bytes)
+			capacity = buffer->size + bytes;
+		
+		data = cbimage_alloc(capacity);
+		if(!data)
+			return NULL;
+		
+		if(buffer->size)
+			memcpy(data, buffer->data, buffer->size);
+		cbimage_release(buffer->data);
+		
+		buffer->data = data;
+		buffer->capacity = capacity;
+	}
+	
+	data = buffer->data + buffer->size;
+	buffer->size += bytes;
+	return data;
+}
+
+
+
+void cbimage_buffer_free(cbimage_buffer_t *buffer)
+{
+	if(!buffer)
+		return;
+	
+	cbimage_release(buffer->data);
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->capacity = 0;
+}
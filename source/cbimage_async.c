@@ -0,0 +1,1012 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(CBIMAGE_HAVE_IO_URING) && defined(CBIMAGE_HAVE_PTHREAD)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#ifdef __NR_io_uring_setup
+#define CBIMAGE_ASYNC_RING
+#endif
+#endif
+
+/** 
+ * \brief Default amount of files readed or written at once
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_ASYNC_DEPTH 64
+
+/** 
+ * \brief Maximal amount of threads of CBIMAGE_ASYNC_THREADS queue
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_ASYNC_WORKERS 4
+
+/** 
+ * \brief Largest read or write submitted to io_uring at once
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_ASYNC_CHUNK ((size_t)1 << 30)
+
+/** 
+ * \brief Kinds of the asynchronous requests
+ * 
+ * \warning These constants ment to be used *ONLY* internaly.
+ */
+enum {
+	CBIMAGE_REQUEST_LOAD = 0,
+	CBIMAGE_REQUEST_SAVE
+};
+
+/** 
+ * \brief Single load or save
+ * 
+ * *image* is the image to save or the loaded image. *buffer* holds the whole file
+ * while it is transferred by io_uring, *done* bytes of it are already transferred.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct cbimage_request
+{
+	struct cbimage_request	*next;
+	int											kind;
+	char										*filename;
+	int											format;
+	int											bpp;
+	cbimage_t								*image;
+	int											status;
+	cbimage_load_callback_t	loaded;
+	cbimage_save_callback_t	saved;
+	void										*user;
+	int											fd;
+	uint8_t									*buffer;
+	size_t									size;
+	size_t									done;
+#ifdef CBIMAGE_ASYNC_RING
+	struct iovec						vector;
+#endif
+} cbimage_request_t;
+
+#ifdef CBIMAGE_ASYNC_RING
+/** 
+ * \brief io_uring instance mapped into the memory
+ * 
+ * *lock* serializes submissions of the worker and of the threads that wake it.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	int									fd;
+	unsigned						*sq_head;
+	unsigned						*sq_tail;
+	unsigned						*sq_mask;
+	unsigned						*sq_array;
+	unsigned						*cq_head;
+	unsigned						*cq_tail;
+	unsigned						*cq_mask;
+	struct io_uring_sqe	*sqes;
+	struct io_uring_cqe	*cqes;
+	void								*sq_map;
+	void								*cq_map;
+	size_t							sq_map_size;
+	size_t							cq_map_size;
+	size_t							sqes_size;
+	pthread_mutex_t			lock;
+} cbimage_ring_t;
+#endif
+
+/** 
+ * \brief Queue of asynchronous requests
+ * 
+ * Submitted requests wait in *queue*, finished ones wait in *done* for cbimage_async_poll().
+ * *notify* pipe is readable while *notified* is set. *woken* is set while the wake up
+ * of the io_uring worker is submitted, but not seen by it yet.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+struct cbimage_async
+{
+	int									backend;
+	size_t							depth;
+	size_t							pending;
+	cbimage_request_t		*queue;
+	cbimage_request_t		*queue_tail;
+	cbimage_request_t		*done;
+	cbimage_request_t		*done_tail;
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_t			lock;
+	pthread_cond_t			wake;
+	pthread_cond_t			finished;
+	pthread_t						threads[CBIMAGE_ASYNC_WORKERS];
+	int									workers;
+	int									shutdown;
+	int									notify[2];
+	int									notified;
+	int									woken;
+#endif
+#ifdef CBIMAGE_ASYNC_RING
+	cbimage_ring_t			ring;
+#endif
+};
+
+
+
+/** 
+ * \brief Frees request and everything it owns, except the image
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_request_free(cbimage_request_t *request)
+{
+	cbimage_pixels_release(request->buffer);
+	cbimage_release(request->filename);
+	cbimage_release(request);
+}
+
+
+
+/** 
+ * \brief Processes request by the blocking calls
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_request_run(cbimage_request_t *request)
+{
+	if(request->kind == CBIMAGE_REQUEST_LOAD)
+	{
+		request->image = cbimage_load_bmp_format(request->filename, request->format);
+		request->status = (request->image) ? (0) : (-1);
+	} else {
+		request->status = cbimage_save_bmp(request->filename, *request->image, request->bpp);
+	}
+}
+
+
+
+/** 
+ * \brief Moves request into the finished ones and makes the descriptor readable
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_async_finish(cbimage_async_t *async, cbimage_request_t *request)
+{
+	request->next = NULL;
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&async->lock);
+#endif
+	if(async->done_tail)
+		async->done_tail->next = request;
+	else
+		async->done = request;
+	async->done_tail = request;
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_cond_broadcast(&async->finished);
+	
+	if(!async->notified && async->notify[1] >= 0)
+	{
+		uint8_t byte = 1;
+		
+		async->notified = (write(async->notify[1], &byte, 1) == 1);
+	}
+	pthread_mutex_unlock(&async->lock);
+#endif
+}
+
+
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+/** 
+ * \brief Thread of CBIMAGE_ASYNC_THREADS queue, processes requests one by one
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void *cbimage_async_worker(void *argument)
+{
+	cbimage_async_t *async = argument;
+	
+	pthread_mutex_lock(&async->lock);
+	
+	for(;;)
+	{
+		cbimage_request_t *request;
+		
+		while(!async->queue && !async->shutdown)
+			pthread_cond_wait(&async->wake, &async->lock);
+		
+		if(!async->queue)
+			break;
+		
+		request = async->queue;
+		async->queue = request->next;
+		if(!async->queue)
+			async->queue_tail = NULL;
+		pthread_mutex_unlock(&async->lock);
+		
+		cbimage_request_run(request);
+		cbimage_async_finish(async, request);
+		
+		pthread_mutex_lock(&async->lock);
+	}
+	
+	pthread_mutex_unlock(&async->lock);
+	return NULL;
+}
+#endif
+
+
+
+#ifdef CBIMAGE_ASYNC_RING
+/** 
+ * \brief Unmaps the ring and closes it
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_ring_teardown(cbimage_ring_t *ring)
+{
+	if(ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if(ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+		munmap(ring->cq_map, ring->cq_map_size);
+	if(ring->sq_map != MAP_FAILED)
+		munmap(ring->sq_map, ring->sq_map_size);
+	close(ring->fd);
+}
+
+
+
+/** 
+ * \brief Creates io_uring instance and maps its queues
+ * 
+ * liburing is not required, the ring is set up by the system calls directly.
+ * 
+ * \return Returns 0 if succsesfull or -1 if io_uring is not available
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_ring_setup(cbimage_ring_t *ring, unsigned entries)
+{
+	struct io_uring_params	params;
+	uint8_t									*sq, *cq;
+	
+	memset(&params, 0, sizeof(params));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if(ring->fd < 0)
+		return -1;
+	
+	ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	
+	/* Newer kernels map both queues at once */
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+	
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP) ? (ring->sq_map) :
+		(mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING));
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	
+	if(ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		cbimage_ring_teardown(ring);
+		return -1;
+	}
+	
+	sq = ring->sq_map;
+	cq = ring->cq_map;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	
+	pthread_mutex_init(&ring->lock, NULL);
+	return 0;
+}
+
+
+
+/** 
+ * \brief Submits single operation
+ * 
+ * Submission queue is consumed by the kernel during the submission, so it is never full,
+ * while there are less operations in flight than queue entries.
+ * 
+ * \param user - pointer returned with the completion, NULL for the wake up
+ * \return Returns 0 if succsesfull or -1 if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_ring_submit(cbimage_ring_t *ring, int opcode, int fd, const struct iovec *vector, size_t offset, void *user)
+{
+	struct io_uring_sqe	*sqe;
+	unsigned						tail, index;
+	int									result;
+	
+	pthread_mutex_lock(&ring->lock);
+	
+	tail = *ring->sq_tail;
+	if(tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) > *ring->sq_mask)
+	{
+		pthread_mutex_unlock(&ring->lock);
+		return -1;
+	}
+	
+	index = tail & *ring->sq_mask;
+	sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)vector;
+	sqe->len = (vector) ? (1) : (0);
+	sqe->off = offset;
+	sqe->user_data = (uintptr_t)user;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	
+	do
+	{
+		result = syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0);
+	} while(result < 0 && errno == EINTR);
+	
+	pthread_mutex_unlock(&ring->lock);
+	return (result == 1) ? (0) : (-1);
+}
+
+
+
+/** 
+ * \brief Submits wake up of the worker, unless it is already submitted
+ * 
+ * Must be called with the queue lock held.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_ring_wake(cbimage_async_t *async)
+{
+	if(async->woken)
+		return;
+	
+	async->woken = 1;
+	cbimage_ring_submit(&async->ring, IORING_OP_NOP, -1, NULL, 0, NULL);
+}
+
+
+
+/** 
+ * \brief Finishes request, that was taken by the io_uring worker
+ * 
+ * Loaded file is decoded here, while other files are still transferred by the kernel.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_ring_end(cbimage_async_t *async, cbimage_request_t *request, int status)
+{
+	if(request->fd >= 0 && close(request->fd) && request->kind == CBIMAGE_REQUEST_SAVE && !status)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",request->filename);
+		perror("");
+		status = -1;
+	}
+	request->fd = -1;
+	
+	if(request->kind == CBIMAGE_REQUEST_LOAD && !status)
+	{
+		request->image = cbimage_bmp_decode(request->buffer, request->size, request->format, 1, request->filename);
+		status = (request->image) ? (0) : (-1);
+	}
+	
+	cbimage_pixels_release(request->buffer);
+	request->buffer = NULL;
+	request->status = status;
+	cbimage_async_finish(async, request);
+}
+
+
+
+/** 
+ * \brief Submits transfer of the rest of the file
+ * 
+ * \return Returns 0 if succsesfull or -1 if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_ring_transfer(cbimage_async_t *async, cbimage_request_t *request)
+{
+	size_t length = request->size - request->done;
+	
+	request->vector.iov_base = request->buffer + request->done;
+	request->vector.iov_len = (length < CBIMAGE_ASYNC_CHUNK) ? (length) : (CBIMAGE_ASYNC_CHUNK);
+	
+	return cbimage_ring_submit(&async->ring, (request->kind == CBIMAGE_REQUEST_LOAD) ? (IORING_OP_READV) : (IORING_OP_WRITEV),
+		request->fd, &request->vector, request->done, request);
+}
+
+
+
+/** 
+ * \brief Opens the file and submits its first transfer
+ * 
+ * Saved image is encoded into the memory before the file is opened.
+ * 
+ * \return Returns 0 if request is in flight or -1 if it is already finished
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_ring_start(cbimage_async_t *async, cbimage_request_t *request)
+{
+	struct stat status;
+	
+	request->fd = -1;
+	
+	if(request->kind == CBIMAGE_REQUEST_LOAD)
+	{
+		request->fd = open(request->filename, O_RDONLY | O_CLOEXEC);
+		
+		if(request->fd < 0 || fstat(request->fd, &status))
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": ",request->filename);
+			perror("");
+			cbimage_ring_end(async, request, -1);
+			return -1;
+		}
+		
+		request->size = status.st_size;
+		posix_fadvise(request->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	} else {
+		request->size = cbimage_bmp_encoded_size(request->image, request->bpp);
+		
+		/* Size fields of the header have 32 bits */
+		if(request->size > UINT32_MAX)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": image %zux%zu does not fit into BMP\n",request->filename, request->image->width, request->image->height);
+			cbimage_ring_end(async, request, -1);
+			return -1;
+		}
+	}
+	
+	/* Buffers are taken from the pixel pool, so memory of the previous files is reused */
+	request->buffer = cbimage_pixels_alloc(request->size, 0);
+	if(!request->buffer)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",request->filename);
+		cbimage_ring_end(async, request, -1);
+		return -1;
+	}
+	
+	if(request->kind == CBIMAGE_REQUEST_SAVE)
+	{
+		cbimage_bmp_encode(request->buffer, request->image, request->bpp);
+		
+		request->fd = open(request->filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		if(request->fd < 0)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": ",request->filename);
+			perror("");
+			cbimage_ring_end(async, request, -1);
+			return -1;
+		}
+	}
+	
+	if(!request->size)
+	{
+		cbimage_ring_end(async, request, 0);
+		return -1;
+	}
+	
+	if(cbimage_ring_transfer(async, request))
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": io_uring submission failed\n",request->filename);
+		cbimage_ring_end(async, request, -1);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Handles completion of the transfer
+ * 
+ * Short transfers are continued from where they stopped.
+ * 
+ * \return Returns 0 if request is still in flight or -1 if it is finished
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_ring_complete(cbimage_async_t *async, cbimage_request_t *request, int result)
+{
+	if(result == -EINTR || result == -EAGAIN)
+		result = 0;
+	else if(result < 0 || (!result && request->kind == CBIMAGE_REQUEST_LOAD))
+	{
+		if(result < 0)
+		{
+			errno = -result;
+			fprintf(stderr,"[ERROR] file \"%s\": ",request->filename);
+			perror("");
+		} else {
+			fprintf(stderr,"[ERROR] file \"%s\": read failed\n",request->filename);
+		}
+		cbimage_ring_end(async, request, -1);
+		return -1;
+	}
+	
+	request->done += result;
+	
+	if(request->done == request->size)
+	{
+		cbimage_ring_end(async, request, 0);
+		return -1;
+	}
+	
+	if(cbimage_ring_transfer(async, request))
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": io_uring submission failed\n",request->filename);
+		cbimage_ring_end(async, request, -1);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Thread of CBIMAGE_ASYNC_IO_URING queue
+ * 
+ * Worker keeps up to *depth* files in flight, it sleeps in the kernel until
+ * some transfer is finished or new request wakes it up.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void *cbimage_ring_worker(void *argument)
+{
+	cbimage_async_t	*async = argument;
+	cbimage_ring_t	*ring = &async->ring;
+	size_t					inflight = 0;
+	
+	pthread_mutex_lock(&async->lock);
+	
+	for(;;)
+	{
+		unsigned head, tail;
+		
+		while(async->queue && inflight < async->depth)
+		{
+			cbimage_request_t *request = async->queue;
+			
+			async->queue = request->next;
+			if(!async->queue)
+				async->queue_tail = NULL;
+			pthread_mutex_unlock(&async->lock);
+			
+			if(!cbimage_ring_start(async, request))
+				inflight++;
+			
+			pthread_mutex_lock(&async->lock);
+		}
+		
+		if(async->shutdown && !async->queue && !inflight)
+			break;
+		
+		async->woken = 0;
+		pthread_mutex_unlock(&async->lock);
+		
+		while(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno == EINTR);
+		
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		
+		while(head != tail)
+		{
+			struct io_uring_cqe	*cqe = &ring->cqes[head & *ring->cq_mask];
+			cbimage_request_t		*request = (cbimage_request_t*)(uintptr_t)cqe->user_data;
+			int									result = cqe->res;
+			
+			/* Entry is released before the request submits the next transfer */
+			__atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+			
+			if(request && cbimage_ring_complete(async, request, result))
+				inflight--;
+			
+			if(head == tail)
+				tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		}
+		
+		pthread_mutex_lock(&async->lock);
+	}
+	
+	pthread_mutex_unlock(&async->lock);
+	return NULL;
+}
+#endif
+
+
+
+cbimage_async_t *cbimage_async_create(size_t depth)
+{
+	cbimage_async_t	*async = cbimage_alloc(sizeof(cbimage_async_t));
+#ifdef CBIMAGE_HAVE_PTHREAD
+	const char		*forced;
+	int				i, workers;
+#endif
+	
+	if(!async)
+	{
+		fprintf(stderr,"[ERROR] not enough memory\n");
+		return NULL;
+	}
+	memset(async, 0, sizeof(cbimage_async_t));
+	
+	async->backend = CBIMAGE_ASYNC_SYNC;
+	async->depth = (depth) ? (depth) : (CBIMAGE_ASYNC_DEPTH);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	forced = getenv("CBIMAGE_ASYNC");
+	
+	pthread_mutex_init(&async->lock, NULL);
+	pthread_cond_init(&async->wake, NULL);
+	pthread_cond_init(&async->finished, NULL);
+	
+	if(pipe(async->notify))
+	{
+		async->notify[0] = async->notify[1] = -1;
+	} else {
+		for(i = 0; i < 2; i++)
+		{
+			fcntl(async->notify[i], F_SETFL, fcntl(async->notify[i], F_GETFL) | O_NONBLOCK);
+			fcntl(async->notify[i], F_SETFD, FD_CLOEXEC);
+		}
+	}
+	
+#ifdef CBIMAGE_ASYNC_RING
+	/* Ring has room for every transfer in flight and for the wake ups */
+	if(async->notify[0] >= 0 && !(forced && !strcmp(forced, "threads")) && async->depth < (1 << 16)
+		&& !cbimage_ring_setup(&async->ring, async->depth + 2))
+	{
+		if(!pthread_create(&async->threads[0], NULL, cbimage_ring_worker, async))
+		{
+			async->workers = 1;
+			async->backend = CBIMAGE_ASYNC_IO_URING;
+		} else {
+			pthread_mutex_destroy(&async->ring.lock);
+			cbimage_ring_teardown(&async->ring);
+		}
+	}
+#else
+	(void)forced;
+#endif
+	
+	if(async->notify[0] >= 0 && async->backend == CBIMAGE_ASYNC_SYNC)
+	{
+		workers = (async->depth < CBIMAGE_ASYNC_WORKERS) ? (async->depth) : (CBIMAGE_ASYNC_WORKERS);
+		
+		while(async->workers < workers && !pthread_create(&async->threads[async->workers], NULL, cbimage_async_worker, async))
+			async->workers++;
+		
+		if(async->workers)
+			async->backend = CBIMAGE_ASYNC_THREADS;
+	}
+#endif
+	
+	return async;
+}
+
+
+
+int cbimage_async_backend(cbimage_async_t *async)
+{
+	assert(async != NULL);
+	
+	return async->backend;
+}
+
+
+
+/** 
+ * \brief Queues request or processes it at once, if queue has no threads
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_async_submit(cbimage_async_t *async, cbimage_request_t *request)
+{
+	request->next = NULL;
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&async->lock);
+	async->pending++;
+	
+	if(async->backend != CBIMAGE_ASYNC_SYNC)
+	{
+		if(async->queue_tail)
+			async->queue_tail->next = request;
+		else
+			async->queue = request;
+		async->queue_tail = request;
+		
+#ifdef CBIMAGE_ASYNC_RING
+		if(async->backend == CBIMAGE_ASYNC_IO_URING)
+			cbimage_ring_wake(async);
+#endif
+		pthread_cond_signal(&async->wake);
+		pthread_mutex_unlock(&async->lock);
+		return;
+	}
+	pthread_mutex_unlock(&async->lock);
+#else
+	async->pending++;
+#endif
+	
+	cbimage_request_run(request);
+	cbimage_async_finish(async, request);
+}
+
+
+
+/** 
+ * \brief Creates request with the copy of the filename
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_request_t *cbimage_request_create(char *filename, int kind, void *user)
+{
+	cbimage_request_t	*request = cbimage_alloc(sizeof(cbimage_request_t));
+	size_t						length = strlen(filename) + 1;
+	
+	if(!request)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		return NULL;
+	}
+	memset(request, 0, sizeof(cbimage_request_t));
+	
+	request->filename = cbimage_alloc(length);
+	if(!request->filename)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		cbimage_release(request);
+		return NULL;
+	}
+	memcpy(request->filename, filename, length);
+	
+	request->kind = kind;
+	request->user = user;
+	request->fd = -1;
+	return request;
+}
+
+
+
+int cbimage_async_load_bmp(cbimage_async_t *async, char *filename, int format, cbimage_load_callback_t callback, void *user)
+{
+	cbimage_request_t *request;
+	
+	assert(async != NULL);
+	assert(filename != NULL);
+	assert(callback != NULL);
+	
+	if(!cbimage_pixel_size(format) && format != CBIMAGE_FORMAT_MONO1)
+	{
+		fprintf(stderr,"[ERROR] pixel format %d is not supported!\n", format);
+		return -1;
+	}
+	
+	request = cbimage_request_create(filename, CBIMAGE_REQUEST_LOAD, user);
+	if(!request)
+		return -1;
+	
+	request->format = format;
+	request->loaded = callback;
+	cbimage_async_submit(async, request);
+	return 0;
+}
+
+
+
+int cbimage_async_save_bmp(cbimage_async_t *async, char *filename, cbimage_t *image, int bpp, cbimage_save_callback_t callback, void *user)
+{
+	cbimage_request_t *request;
+	
+	assert(async != NULL);
+	assert(filename != NULL);
+	assert(image != NULL);
+	
+	if((bpp != CBIMAGE_1BPP) && (bpp != CBIMAGE_24BPP) && (bpp != CBIMAGE_32BPP)) {
+		fprintf(stderr,"[ERROR] bpp format %d is not supported!\n", bpp);
+		return -1;
+	}
+	
+	request = cbimage_request_create(filename, CBIMAGE_REQUEST_SAVE, user);
+	if(!request)
+		return -1;
+	
+	request->image = image;
+	request->bpp = bpp;
+	request->saved = callback;
+	cbimage_async_submit(async, request);
+	return 0;
+}
+
+
+
+int cbimage_async_fd(cbimage_async_t *async)
+{
+	assert(async != NULL);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	if(async->backend != CBIMAGE_ASYNC_SYNC)
+		return async->notify[0];
+#endif
+	return -1;
+}
+
+
+
+size_t cbimage_async_poll(cbimage_async_t *async, int wait)
+{
+	cbimage_request_t	*done, *request;
+	size_t						count = 0;
+	
+	assert(async != NULL);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&async->lock);
+	
+	while(wait && !async->done && async->pending)
+		pthread_cond_wait(&async->finished, &async->lock);
+	
+	if(async->notified)
+	{
+		uint8_t bytes[16];
+		
+		while(read(async->notify[0], bytes, sizeof(bytes)) > 0);
+		async->notified = 0;
+	}
+#else
+	(void)wait;
+#endif
+	
+	done = async->done;
+	async->done = async->done_tail = NULL;
+	
+	for(request = done; request; request = request->next)
+		count++;
+	async->pending -= count;
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_unlock(&async->lock);
+#endif
+	
+	/* Callbacks may submit new requests, so they are called without the lock */
+	while(done)
+	{
+		cbimage_request_t *next = done->next;
+		
+		if(done->kind == CBIMAGE_REQUEST_LOAD)
+			done->loaded(done->user, done->image);
+		else if(done->saved)
+			done->saved(done->user, done->status);
+		
+		cbimage_request_free(done);
+		done = next;
+	}
+	
+	return count;
+}
+
+
+
+size_t cbimage_async_pending(cbimage_async_t *async)
+{
+	size_t pending;
+	
+	assert(async != NULL);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&async->lock);
+	pending = async->pending;
+	pthread_mutex_unlock(&async->lock);
+#else
+	pending = async->pending;
+#endif
+	return pending;
+}
+
+
+
+void cbimage_async_destroy(cbimage_async_t *async)
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	int	i;
+	
+#endif
+	if(!async)
+		return;
+	
+	while(cbimage_async_pending(async))
+		cbimage_async_poll(async, 1);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&async->lock);
+	async->shutdown = 1;
+#ifdef CBIMAGE_ASYNC_RING
+	if(async->backend == CBIMAGE_ASYNC_IO_URING)
+		cbimage_ring_wake(async);
+#endif
+	pthread_cond_broadcast(&async->wake);
+	pthread_mutex_unlock(&async->lock);
+	
+	for(i = 0; i < async->workers; i++)
+		pthread_join(async->threads[i], NULL);
+	
+#ifdef CBIMAGE_ASYNC_RING
+	if(async->backend == CBIMAGE_ASYNC_IO_URING)
+	{
+		pthread_mutex_destroy(&async->ring.lock);
+		cbimage_ring_teardown(&async->ring);
+	}
+#endif
+	
+	if(async->notify[0] >= 0)
+	{
+		close(async->notify[0]);
+		close(async->notify[1]);
+	}
+	pthread_cond_destroy(&async->finished);
+	pthread_cond_destroy(&async->wake);
+	pthread_mutex_destroy(&async->lock);
+#endif
+	
+	cbimage_release(async);
+}
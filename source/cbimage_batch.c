@@ -0,0 +1,214 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef CBIMAGE_HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/** 
+ * \brief Context of cbimage_batch_bmp()
+ * 
+ * *reserved* is the memory estimated for the files that are processed now.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_pipeline_t		*pipeline;
+	cbimage_batch_item_t	*items;
+	size_t								count;
+	int										bpp;
+	size_t								memory;
+	size_t								reserved;
+	atomic_size_t					failed;
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_t				lock;
+	pthread_cond_t				released;
+#endif
+} cbimage_batch_job_t;
+
+
+
+/** 
+ * \brief Asks the kernel to read the file into the page cache in background
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_batch_prefetch(char *filename)
+{
+#ifdef CBIMAGE_HAVE_MMAP
+	int fd = open(filename, O_RDONLY);
+	
+	if(fd < 0)
+		return;
+	
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+#else
+	(void)filename;
+#endif
+}
+
+
+
+/** 
+ * \brief Waits until the file fits into the memory limit and reserves its memory
+ * 
+ * The file is always started if nothing else is processed, so large files do not wait forever.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_batch_reserve(cbimage_batch_job_t *job, size_t bytes)
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&job->lock);
+	while(job->reserved && job->reserved + bytes > job->memory)
+		pthread_cond_wait(&job->released, &job->lock);
+	job->reserved += bytes;
+	pthread_mutex_unlock(&job->lock);
+#else
+	job->reserved += bytes;
+#endif
+}
+
+
+
+/** 
+ * \brief Returns memory reserved by cbimage_batch_reserve()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_batch_release(cbimage_batch_job_t *job, size_t bytes)
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&job->lock);
+	job->reserved -= bytes;
+	pthread_cond_broadcast(&job->released);
+	pthread_mutex_unlock(&job->lock);
+#else
+	job->reserved -= bytes;
+#endif
+}
+
+
+
+/** 
+ * \brief Processes one file
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_batch_file(cbimage_batch_job_t *job, cbimage_batch_item_t *item)
+{
+	cbimage_bmp_reader_t	*reader;
+	size_t								width, height, bytes;
+	int										result;
+	
+	if(!item->input || !item->output)
+		return -1;
+	
+	/* Only the header is readed, to estimate the memory */
+	reader = cbimage_bmp_reader_open(item->input);
+	if(!reader)
+		return -1;
+	cbimage_bmp_reader_size(reader, &width, &height);
+	cbimage_bmp_reader_close(reader);
+	
+	bytes = cbimage_pipeline_bmp_memory(job->pipeline, width, height);
+	
+	cbimage_batch_reserve(job, bytes);
+	result = cbimage_pipeline_run_bmp(job->pipeline, item->input, item->output, job->bpp);
+	cbimage_batch_release(job, bytes);
+	
+	return result;
+}
+
+
+
+/** 
+ * \brief Processes the band of files, prefetching the next file
+ * 
+ * Loops started by the pipeline are nested, so each file is processed by one thread.
+ * Next file is usually taken by this or another thread soon, so its input is prefetched.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_batch_band(void *context, size_t begin, size_t end)
+{
+	cbimage_batch_job_t	*job = context;
+	size_t							i;
+	
+	for(i = begin; i < end; i++)
+	{
+		if(i + 1 < job->count && job->items[i + 1].input)
+			cbimage_batch_prefetch(job->items[i + 1].input);
+		
+		job->items[i].status = cbimage_batch_file(job, &job->items[i]);
+		if(job->items[i].status)
+			atomic_fetch_add(&job->failed, 1);
+	}
+}
+
+
+
+size_t cbimage_batch_bmp(cbimage_pipeline_t *pipeline, cbimage_batch_item_t *items, size_t count, int bpp, size_t memory)
+{
+	cbimage_batch_job_t job;
+	
+	assert(pipeline != NULL);
+	assert(items != NULL || !count);
+	
+	job.pipeline = pipeline;
+	job.items = items;
+	job.count = count;
+	job.bpp = bpp;
+	job.memory = (memory) ? (memory) : (CBIMAGE_DEFAULT_BATCH_MEMORY);
+	job.reserved = 0;
+	atomic_init(&job.failed, 0);
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.released, NULL);
+#endif
+	
+	cbimage_parallel_for(count, 1, cbimage_batch_band, &job);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_cond_destroy(&job.released);
+	pthread_mutex_destroy(&job.lock);
+#endif
+	return atomic_load(&job.failed);
+}
@@ -0,0 +1,243 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+/** 
+ * \brief Maximal amount of pixels converted at once
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_BLEND_CHUNK 256
+
+
+
+/** 
+ * \brief Multiplies channel by alpha
+ * 
+ * Computes (x * (a + 1)) >> bits, which is exact for a = 0 and a = max and never exceeds x.
+ * SIMD kernels use the same formula, so results do not depend on instruction set.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint32_t cbimage_blend_mul(uint32_t x, uint32_t a, int bits)
+{
+	return (x * (a + 1)) >> bits;
+}
+
+
+
+/** 
+ * \brief Blends one channel
+ * 
+ * \param d - destination channel
+ * \param s - source channel
+ * \param a - source alpha
+ * \param max - maximal value of the channel
+ * \param bits - bits per channel
+ * \param mode - blend mode
+ * \param alpha - nonzero if channel is alpha channel
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint32_t cbimage_blend_channel(uint32_t d, uint32_t s, uint32_t a, uint32_t max, int bits, int mode, int alpha)
+{
+	uint32_t out;
+	
+	switch(mode)
+	{
+		case CBIMAGE_BLEND_SRC_OVER:
+			return ((alpha) ? (s) : (cbimage_blend_mul(s, a, bits))) + cbimage_blend_mul(d, max - a, bits);
+		case CBIMAGE_BLEND_SRC_OVER_PREMULTIPLIED:
+			out = s + cbimage_blend_mul(d, max - a, bits);
+			return (out > max) ? (max) : (out);
+		case CBIMAGE_BLEND_ADD:
+			if(alpha)
+				return d;
+			out = d + cbimage_blend_mul(s, a, bits);
+			return (out > max) ? (max) : (out);
+		case CBIMAGE_BLEND_MULTIPLY:
+			if(alpha)
+				return d;
+			return cbimage_blend_mul(d, cbimage_blend_mul(s, a, bits) + max - a, bits);
+	}
+	return d;
+}
+
+
+
+void cbimage_scalar_blend(uint8_t *dst, const uint8_t *src, size_t width, int format, int mode, int opaque)
+{
+	size_t i, c;
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+		{
+			uint16_t				*d = (uint16_t*)dst;
+			const uint16_t	*s = (const uint16_t*)src;
+			
+			for(i = 0; i < width; i++, d += 4, s += 4)
+			{
+				uint32_t a = (opaque) ? (0xFFFF) : (s[3]);
+				
+				for(c = 0; c < 4; c++)
+					d[c] = cbimage_blend_channel(d[c], (c == 3) ? (a) : (s[c]), a, 0xFFFF, 16, mode, c == 3);
+			}
+			break;
+		}
+		case CBIMAGE_FORMAT_RGBA8:
+			for(i = 0; i < width; i++, dst += 4, src += 4)
+			{
+				uint32_t a = (opaque) ? (0xFF) : (src[3]);
+				
+				for(c = 0; c < 4; c++)
+					dst[c] = cbimage_blend_channel(dst[c], (c == 3) ? (a) : (src[c]), a, 0xFF, 8, mode, c == 3);
+			}
+			break;
+		case CBIMAGE_FORMAT_RGB8:
+			for(i = 0; i < width; i++, dst += 3, src += 3)
+			{
+				for(c = 0; c < 3; c++)
+					dst[c] = cbimage_blend_channel(dst[c], src[c], 0xFF, 0xFF, 8, mode, 0);
+			}
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Context of cbimage_blend()
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t			*dst;
+	cbimage_t			*src;
+	cbimage_clip_t	clip;
+	int						format;
+	int						mode;
+	int						opaque;
+} cbimage_blend_job_t;
+
+
+
+/** 
+ * \brief Blends the band of rows of the clipped source into the destination
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_blend_band(void *context, size_t begin, size_t end)
+{
+	cbimage_blend_job_t			*job = context;
+	size_t									iy, ix, i;
+	size_t									src_size = cbimage_pixel_size(job->src->format);
+	size_t									dst_size = cbimage_pixel_size(job->dst->format);
+	int											format = job->format;
+	uint8_t									src_chunk[CBIMAGE_BLEND_CHUNK * sizeof(cbpixel_t)];
+	uint8_t									dst_chunk[CBIMAGE_BLEND_CHUNK * sizeof(cbpixel_t)];
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	
+	for(iy = begin; iy < end; iy++)
+	{
+		uint8_t				*to = cbimage_row(job->dst, job->clip.dst_y + iy);
+		const uint8_t	*from = cbimage_row(job->src, job->clip.src_y + iy);
+		
+		if(job->src->format == format && job->dst->format == format)
+		{
+			kernels->blend(to + job->clip.dst_x * dst_size, from + job->clip.src_x * src_size, job->clip.width, format, job->mode, job->opaque);
+			continue;
+		}
+		
+		/* Bit packed pixels have no byte address, so they are located by the pixel index */
+		for(ix = 0; ix < job->clip.width; ix += CBIMAGE_BLEND_CHUNK)
+		{
+			size_t				chunk = (job->clip.width - ix < CBIMAGE_BLEND_CHUNK) ? (job->clip.width - ix) : (CBIMAGE_BLEND_CHUNK);
+			uint8_t				*d = to + (job->clip.dst_x + ix) * dst_size;
+			const uint8_t	*s = from + (job->clip.src_x + ix) * src_size;
+			
+			if(job->src->format != format)
+			{
+				cbimage_convert_span(src_chunk, format, 0, from, job->src->format, job->clip.src_x + ix, chunk);
+				
+				/* 8 bit alpha is stretched to the full 16 bit range, so opaque stays opaque */
+				if(job->src->format == CBIMAGE_FORMAT_RGBA8 && format == CBIMAGE_FORMAT_RGBA16)
+				{
+					for(i = 0; i < chunk; i++)
+						((cbpixel_t*)src_chunk)[i].a = s[i * 4 + 3] * 0x101;
+				}
+				s = src_chunk;
+			}
+			
+			if(job->dst->format != format)
+			{
+				cbimage_convert_span(dst_chunk, format, 0, to, job->dst->format, job->clip.dst_x + ix, chunk);
+				kernels->blend(dst_chunk, s, chunk, format, job->mode, job->opaque);
+				cbimage_convert_span(to, job->dst->format, job->clip.dst_x + ix, dst_chunk, format, 0, chunk);
+			} else {
+				kernels->blend(d, s, chunk, format, job->mode, job->opaque);
+			}
+		}
+	}
+}
+
+
+
+/** 
+ * This function clips the source once and blends it by bands of rows in parallel.
+ * Rows are converted into the common format by chunks when formats differ.
+ */
+void cbimage_blend(cbimage_t *dst, cbimage_t *src, int x, int y, int mode)
+{
+	cbimage_blend_job_t job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_BLEND);
+	assert(dst != NULL);
+	assert(src != NULL);
+	
+	if(cbimage_clip(dst, src, x, y, &job.clip))
+		return;
+	
+	CBIMAGE_STAT_BYTES(job.clip.height * cbimage_row_bytes(dst->format, job.clip.width));
+	
+	job.dst = dst;
+	job.src = src;
+	job.mode = mode;
+	job.opaque = (src->type != CBIMAGE_RGBA) || (src->format == CBIMAGE_FORMAT_RGB8) || (src->format == CBIMAGE_FORMAT_MONO1);
+	
+	/* RGB8 destination is blended as RGBA8, so alpha of the source is not lost,
+	 * monochrome destination is blended as RGBA8 and thresholded back */
+	job.format = dst->format;
+	if((job.format == CBIMAGE_FORMAT_RGB8 && !job.opaque) || job.format == CBIMAGE_FORMAT_MONO1)
+		job.format = CBIMAGE_FORMAT_RGBA8;
+	
+	cbimage_parallel_rows(job.clip.height, job.clip.width, cbimage_blend_band, &job);
+}
@@ -23,13 +23,44 @@
 
 /** @file */ 
 
-#include <cbimage.h>
+#include "cbimage_internal.h"
 
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef CBIMAGE_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+/** 
+ * \brief Compression methods of the BMP pixel array
+ * 
+ * \warning These constants ment to be used *ONLY* internaly.
+ */
+enum {
+	CBMP_RGB = 0,
+	CBMP_RLE8 = 1,
+	CBMP_RLE4 = 2,
+	CBMP_BITFIELDS = 3
+};
+
+/** 
+ * \brief Largest color table of the BMP file
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBMP_MAX_COLORS 256
+
+/** 
+ * \brief Size of the lookup table entry: 8 pixels of 1 bit image in the widest format
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBMP_LUT_BYTES (8 * sizeof(cbpixel_t))
+
 /** 
  * \brief BMP header container structure.
  * 
@@ -37,6 +68,7 @@
  * 	- Width and Height
  * 	- Bits Per Pixel
  * 	- Pointer where pixel array begins
+ * 	- Compression method and color table (B, G, R, reserved) of indexed images
  * 	- Valid flag
  * 
  * \warning This structure provides only *BASIC* handling of the bmp file.
@@ -47,7 +79,9 @@ typedef struct
 	uint32_t	width;
 	uint32_t	height;
 	uint16_t	bpp;
+	uint32_t	compression;
 	off_t 		pointer_data;
+	uint8_t		palette[CBMP_MAX_COLORS][4];
 	int				valid;
 } cbmp_header;
 
@@ -77,13 +111,171 @@ off_t get_file_size(FILE *handle)
 
 
 /** 
- * \brief Gets BMP header and returns it as structure
+ * \brief Reads color table of the indexed BMP file
+ * 
+ * Table follows the DIB header and has *colors used* entries (2^bpp if 0).
+ * If file has no table, gray levels are used.
+ * 
+ * \param data - beginning of the file
+ * \param size - how many bytes of the file are available at *data*
+ * \param info - header, which table is filled
+ * \return Returns 0 if succsesfull or -1 if table cannot be readed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbmp_read_palette(const uint8_t *data, size_t size, cbmp_header *info)
+{
+	off_t		table = 14 + (off_t)*((uint32_t*)&data[14]);
+	size_t	colors = *((uint32_t*)&data[46]);
+	size_t	available, i;
+	
+	if(!colors || colors > ((size_t)1 << info->bpp))
+		colors = (size_t)1 << info->bpp;
+	
+	available = (info->pointer_data > table) ? ((info->pointer_data - table) / 4) : (0);
+	if(colors > available)
+		colors = available;
+	
+	if(!colors)
+	{
+		for(i = 0; i < ((size_t)1 << info->bpp); i++)
+			memset(info->palette[i], i * 255 / (((size_t)1 << info->bpp) - 1), 4);
+		return 0;
+	}
+	
+	if((size_t)table > size || colors > (size - table) / 4)
+		return -1;
+	
+	memcpy(info->palette, data + table, colors * 4);
+	return 0;
+}
+
+
+
+/** 
+ * \brief Checks channel masks of the 32 bit CBMP_BITFIELDS file
+ * 
+ * Decoder reads 32 bit pixels as A, B, G, R bytes (the layout written by cbimage_save_bmp()),
+ * so only masks of this layout are accepted. Alpha mask may be zero or absent (BITMAPINFOHEADER
+ * has only 3 masks after it), then the first byte is readed the same way as in CBMP_RGB files.
+ * 
+ * \param data - beginning of the file
+ * \param size - how many bytes of the file are available at *data*
+ * \return Returns 0 if masks match the layout or -1 if not
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbmp_check_masks(const uint8_t *data, size_t size)
+{
+	uint32_t alpha = 0;
+	
+	if(size < 66)
+		return -1;
+	
+	if(*((uint32_t*)&data[54]) != 0xFF000000 || *((uint32_t*)&data[58]) != 0x00FF0000 || *((uint32_t*)&data[62]) != 0x0000FF00)
+		return -1;
+	
+	/* BITMAPV3INFOHEADER and later keep the alpha mask right after the color masks */
+	if(*((uint32_t*)&data[14]) >= 56)
+	{
+		if(size < 70)
+			return -1;
+		alpha = *((uint32_t*)&data[66]);
+	}
+	return (alpha == 0 || alpha == 0x000000FF) ? (0) : (-1);
+}
+
+
+
+/** 
+ * \brief Parses BMP header from the memory
  * 
  * Function that retrives important information from the BMP file
  * 	- Width and Height
  * 	- Bits Per Pixel
  * 	- Pointer where pixel array begins
  * 
+ * \param data - beginning of the file
+ * \param size - how many bytes of the file are available at *data* (headers and color table)
+ * \param file_size - size of the whole file
+ * \return Returns BMP header
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbmp_header cbmp_parse_info(const uint8_t *data, size_t size, off_t file_size)
+{
+	cbmp_header info = {0};
+	
+	if(file_size < 54 || size < 54)
+	{
+		return info;
+	}
+	
+	if(strncmp((char*)data, "BM", 2))
+	{
+		return info;
+	}
+	
+	if(*((uint32_t*)&data[2]) != file_size)
+	{
+		return info;
+	}
+	
+	info.pointer_data = *((uint32_t*)&data[10]);
+	info.width = *((uint32_t*)&data[18]);
+	info.height = *((uint32_t*)&data[22]);
+	info.bpp = *((uint16_t*)&data[28]);
+	info.compression = *((uint32_t*)&data[30]);
+	
+	/* Older BITMAPCOREHEADER has 16 bit dimensions and 3 byte colors */
+	if(*((uint32_t*)&data[14]) < 40)
+	{
+		return info;
+	}
+	
+	switch(info.bpp)
+	{
+		case CBIMAGE_1BPP:
+		case CBIMAGE_2BPP:
+			if(info.compression != CBMP_RGB)
+				return info;
+			break;
+		case CBIMAGE_4BPP:
+			if(info.compression != CBMP_RGB && info.compression != CBMP_RLE4)
+				return info;
+			break;
+		case CBIMAGE_8BPP:
+			if(info.compression != CBMP_RGB && info.compression != CBMP_RLE8)
+				return info;
+			break;
+		case CBIMAGE_24BPP:
+			if(info.compression != CBMP_RGB)
+				return info;
+			break;
+		case CBIMAGE_32BPP:
+			if(info.compression != CBMP_RGB && (info.compression != CBMP_BITFIELDS || cbmp_check_masks(data, size)))
+				return info;
+			break;
+		default:
+			return info;
+	}
+	
+	if(info.bpp <= CBIMAGE_8BPP && cbmp_read_palette(data, size, &info))
+	{
+		return info;
+	}
+	
+	info.valid = 1;
+	return info;
+}
+
+
+
+/** 
+ * \brief Gets BMP header and returns it as structure
+ * 
+ * Only the headers and the color table are readed, see cbmp_parse_info().
+ * 
  * \param *handle pass succsesfully opened file handle
  * \return Returns BMP header
  * 
@@ -98,43 +290,79 @@ cbmp_header cbmp_get_info(FILE *handle)
 	off_t		file_size 		= get_file_size(handle);
 	off_t 	cur_position 	= ftell(handle);
 	
-	uint8_t bmp_header[54];
+	uint8_t bmp_header[54], *prefix = bmp_header;
+	size_t	size = 54;
 	
 	if(file_size < 54)
 	{
 		return info;
 	}
-		
 	
 	fseek(handle, 0, SEEK_SET);
-	fread(bmp_header, 54, 1, handle);
-	
-	if(strncmp((char*)bmp_header, "BM", 2))
+	if(fread(bmp_header, 54, 1, handle) != 1)
 	{
 		return info;
 	}
 	
-	if(*((uint32_t*)&bmp_header[2]) != file_size)
+	/* Color table or channel masks lie between the headers and the pixel array */
+	if(*((uint16_t*)&bmp_header[28]) <= CBIMAGE_8BPP || *((uint32_t*)&bmp_header[30]) == CBMP_BITFIELDS)
 	{
-		return info;
+		off_t end = 14 + (off_t)*((uint32_t*)&bmp_header[14]) + CBMP_MAX_COLORS * 4;
+		
+		if(end > (off_t)*((uint32_t*)&bmp_header[10]))
+			end = *((uint32_t*)&bmp_header[10]);
+		if(end > file_size)
+			end = file_size;
+		
+		if(end > 54)
+		{
+			size = end;
+			prefix = cbimage_alloc(size);
+			if(!prefix)
+			{
+				return info;
+			}
+			
+			memcpy(prefix, bmp_header, 54);
+			if(fread(prefix + 54, size - 54, 1, handle) != 1)
+				size = 54;
+		}
 	}
 	
-	info.pointer_data = *((uint32_t*)&bmp_header[10]);
-	info.width = *((uint32_t*)&bmp_header[18]);
-	info.height = *((uint32_t*)&bmp_header[22]);
-	info.bpp = *((uint16_t*)&bmp_header[28]);
+	info = cbmp_parse_info(prefix, size, file_size);
 	
-	if((info.bpp != CBIMAGE_24BPP) && (info.bpp != CBIMAGE_32BPP) && (info.bpp != CBIMAGE_1BPP)) {
-		return info;
-	}
+	if(prefix != bmp_header)
+		cbimage_release(prefix);
 	
-	info.valid = 1;
 	fseek(handle, cur_position, SEEK_SET);
 	return info;
 }
 
 
 
+/** 
+ * \brief Size of the longest BMP header written by the library
+ * 
+ * 1 bit files have the color table of 2 colors (8 bytes) after the 54 bytes of headers.
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBMP_HEADER_MAX (54 + 8)
+
+
+
+/** 
+ * \brief Gets size of the BMP header written for the given Bits Per Pixel
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline size_t cbmp_header_size(int bpp)
+{
+	return (bpp == CBIMAGE_1BPP) ? (CBMP_HEADER_MAX) : (54);
+}
+
+
+
 /** 
  * \brief Creates semi-valid BMP header
  * 
@@ -142,23 +370,26 @@ cbmp_header cbmp_get_info(FILE *handle)
  * 	- Width and Height
  * 	- Bits Per Pixel
  * 
- * \param form[54] - byte array that represents BMP header with DIB
+ * Header of 1 bit file is followed by black and white color table.
+ * 
+ * \param form - byte array that represents BMP header with DIB (cbmp_header_size() bytes)
  * \param info - image, from it we gets several attributes such as width and height 
  * \param bpp - in what Bits Per Pixel format we need to save our image
  * 
  * \warning This function ment to be used *ONLY* internaly.
  */
-void cbmp_form_info(uint8_t form[54], cbimage_t info, int bpp)
+void cbmp_form_info(uint8_t form[CBMP_HEADER_MAX], cbimage_t info, int bpp)
 {
 	assert(form != NULL);
 	off_t bmp_row = (((bpp * info.width + 31) >> 5) << 2);
 	size_t bmp_data = bmp_row * info.height;
+	size_t header_size = cbmp_header_size(bpp);
 	
-	memset(form, 0, 54);
+	memset(form, 0, header_size);
 	
 	strncpy((char*)form,"BM",2);
-	*((uint32_t*)&form[2]) = bmp_data + 54;
-	*((uint32_t*)&form[10]) = 54;
+	*((uint32_t*)&form[2]) = bmp_data + header_size;
+	*((uint32_t*)&form[10]) = header_size;
 	*((uint32_t*)&form[14]) = 40;
 	*((uint32_t*)&form[18]) = info.width;
 	*((uint32_t*)&form[22]) = info.height;
@@ -166,206 +397,1643 @@ void cbmp_form_info(uint8_t form[54], cbimage_t info, int bpp)
 	*((uint16_t*)&form[28]) = bpp;
 	*((int32_t*)&form[38])	= 64;
 	*((int32_t*)&form[42])	= 64;
+	
+	if(bpp == CBIMAGE_1BPP)
+	{
+		*((uint32_t*)&form[46]) = 2;
+		memset(form + 58, 0xFF, 3);
+	}
 }
 
 
 
 /** 
- * This function reads BMP file and tries to load it into the memory.
+ * \brief Context of the band-parallel BMP decoder
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
  */
-cbimage_t *cbimage_load_bmp(char *filename) 
+typedef struct
 {
-	/* Optimize in futher implementations
-	 * 
-	 * uint8_t	bmp_buffer[LIBCBMP_BUFFER];
-	 * */
-	size_t 	current_row, current_col;
-	off_t		bmp_padding;
-	
-	cbimage_t			*loaded_image;
-	cbmp_header 	header;
-	
-	FILE *handle;
-	
-	assert(filename != NULL);
-	
-	handle = fopen(filename, "rb");
-	if(!handle)
-	{
-		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
-		perror("");
-		return NULL;
-	}
-	
-	header = cbmp_get_info(handle);
-	if(!header.valid) {
-		fprintf(stderr,"[ERROR] file \"%s\": not valid or unsupported\n",filename);
-		fclose(handle);
-		return NULL;
-	}
+	const uint8_t	*pixels;
+	size_t				bmp_row;
+	size_t				bottom_row;
+	cbmp_header		header;
+	cbimage_t			*image;
+	const cbimage_t	*source;
+	size_t				scale;
+	size_t				lut_pixels;
+	int						lut_copy;
+	uint8_t				lut[256][CBMP_LUT_BYTES];
+} cbmp_decoder;
+
+
+
+/** 
+ * \brief Builds table that expands byte of the indexed pixel array into pixels of the image
+ * 
+ * Entry of every byte value holds all pixels packed into this byte (8 for 1 bit,
+ * 4 for 2 bit, 2 for 4 bit and 1 for 8 bit images), already converted into the *format*,
+ * so the decoder copies whole bytes instead of unpacking bits.
+ * 
+ * For CBIMAGE_FORMAT_MONO1 entry is a single byte with the thresholded pixels in
+ * its most significant bits. *lut_copy* is set when it maps every 1 bit
+ * pixel array byte onto itself, so rows are copied without decoding.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbmp_build_lut(cbmp_decoder *decoder, int format)
+{
+	size_t	bpp = decoder->header.bpp, size = cbimage_pixel_size(format);
+	size_t	mask = ((size_t)1 << bpp) - 1, value, i;
 	
-	bmp_padding = (((header.bpp * header.width + 31) >> 5) << 2) - (header.width * (header.bpp >> 3));
+	decoder->lut_copy = 0;
 	
-	fseek(handle, header.pointer_data, SEEK_SET);
+	if(bpp > CBIMAGE_8BPP)
+		return;
 	
-	loaded_image = cbimage_create(header.width, header.height, CBIMAGE_RGB);
+	decoder->lut_pixels = 8 / bpp;
 	
-	for(current_row = 0; current_row < header.height; current_row++)
+	for(value = 0; value < 256; value++)
 	{
-		for(current_col = 0; current_col < header.width; current_col++)
+		if(format == CBIMAGE_FORMAT_MONO1)
+			decoder->lut[value][0] = 0;
+		
+		for(i = 0; i < decoder->lut_pixels; i++)
 		{
-			uint8_t color[4];
-			
-			
-			switch(header.bpp)
-			{
-				case CBIMAGE_1BPP:
-					fread(color, sizeof(uint8_t), 1, handle);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = (color[0] >> 7) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = (color[0] >> 7) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = (color[0] >> 7) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0] >> 6) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0] >> 6) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0] >> 6) & 0x1) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0] >> 5) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0] >> 5) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0] >> 5) & 0x1) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0] >> 4) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0] >> 4) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0] >> 4) & 0x1) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0] >> 3) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0] >> 3) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0] >> 3) & 0x1) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0] >> 2) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0] >> 2) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0] >> 2) & 0x1) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0] >> 1) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0] >> 1) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0] >> 1) & 0x1) ? (0xFFFF) : (0x0);
-					current_col++;
-					if(!(current_col < header.width))
-						break;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = ((color[0]) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = ((color[0]) & 0x1) ? (0xFFFF) : (0x0);
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = ((color[0]) & 0x1) ? (0xFFFF) : (0x0);
-					break;
-				case CBIMAGE_24BPP:
-					fread(color, sizeof(uint8_t), 3, handle);
-					
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = color[0] << 8;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = color[1] << 8;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = color[2] << 8;
-					fseek(handle, bmp_padding, SEEK_CUR);
-					break;
-				case CBIMAGE_32BPP:
-					fread(color, sizeof(uint8_t), 4, handle);
-					
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].a = color[0] << 8;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].b = color[1] << 8;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].g = color[2] << 8;
-					loaded_image->data[(header.height - current_row - 1) * header.width + current_col].r = color[3] << 8;
-					fseek(handle, bmp_padding, SEEK_CUR);
-					break;
-				default:
-					fprintf(stderr, "[CRITICAL ERROR] Unsupported BMP format during reading! THIS IS A BUG!\n");
-					exit(-1);
-					break;
-			}
+			const uint8_t *color = decoder->header.palette[(value >> (8 - bpp * (i + 1))) & mask];
 			
+			if(format == CBIMAGE_FORMAT_MONO1)
+				decoder->lut[value][0] |= cbimage_mono_level(color[2], color[1], color[0]) << (7 - i);
+			else
+				cbimage_pixel_store8(decoder->lut[value] + i * size, format, color[2], color[1], color[0], 0);
 		}
-		
 	}
 	
-	fclose(handle);
-	
-	return loaded_image;
+	if(format == CBIMAGE_FORMAT_MONO1 && bpp == CBIMAGE_1BPP)
+		decoder->lut_copy = (decoder->lut[0x55][0] == 0x55);
 }
 
 
 
+/** 
+ * \brief Gets color of the palette index, converted into the format of the image
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline const uint8_t *cbmp_lut_color(cbmp_decoder *decoder, uint8_t index)
+{
+	/* Both nibbles of the byte are the same index, so its first pixel is the color */
+	return (decoder->header.bpp == CBIMAGE_4BPP) ? (decoder->lut[(index & 0xF) * 0x11]) : (decoder->lut[index]);
+}
+
+
 
 /** 
- * This function save image from the memory to the disk. You may specify 
- * BPP option to choose in what format you want to save image.
+ * \brief Decodes one row of the BMP pixel array into the bit packed row
+ * 
+ * 1 bit rows are copied (or translated byte by byte), other indexed rows
+ * collect bits from the lookup table, true color rows are thresholded.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
  */
-int cbimage_save_bmp(char *filename, cbimage_t image, int bpp)
+static void cbmp_decode_mono(cbmp_decoder *decoder, const uint8_t *color, uint8_t *row)
 {
-	FILE 		*handle;
-	uint8_t header[54];
-	uint8_t zeros[3] = {0};
-	off_t 	bmp_padding = (((bpp * image.width + 31) >> 5) << 2) - (image.width * (bpp >> 3));
-	size_t	current_row, current_col;
-	uint64_t mono_color = 0;
-	uint8_t write_mono = 0, mono_wroten = 0;
+	size_t		width = decoder->header.width, bpp = decoder->header.bpp, x = 0, i;
+	size_t		step = (bpp <= CBIMAGE_8BPP) ? (decoder->lut_pixels) : (1);
+	uint64_t	word = 0;
+	size_t		bits = 0;
+	uint8_t		packed[8];
 	
-	if((bpp != CBIMAGE_24BPP) && (bpp != CBIMAGE_32BPP)) {
-		fprintf(stderr,"[ERROR] bpp format %d is not supported!\n", bpp);
-		return -1;
+	if(bpp == CBIMAGE_1BPP)
+	{
+		if(decoder->lut_copy)
+		{
+			cbimage_mono_copy(row, 0, color, 0, width);
+		} else {
+			for(i = 0; i < (width >> 3); i++)
+				row[i] = decoder->lut[color[i]][0];
+			if(width & 7)
+				cbimage_mono_copy(row, width & ~(size_t)7, decoder->lut[color[i]], 0, width & 7);
+		}
+		return;
 	}
 	
-	handle = fopen(filename, "wb");
-	
-	if(!handle)
+	/* Pixels are collected into the word, which is stored when it is full */
+	for(; x < width; x += step)
 	{
-		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
-		perror("");
-		return -1;
+		size_t count = (width - x < step) ? (width - x) : (step);
+		
+		switch(bpp)
+		{
+			case CBIMAGE_24BPP:
+				word |= (uint64_t)cbimage_mono_level(color[2], color[1], color[0]) << (63 - bits);
+				color += 3;
+				break;
+			case CBIMAGE_32BPP:
+				word |= (uint64_t)cbimage_mono_level(color[3], color[2], color[1]) << (63 - bits);
+				color += 4;
+				break;
+			default:
+				word |= ((uint64_t)decoder->lut[*color++][0] << 56) >> bits;
+				break;
+		}
+		
+		bits += count;
+		if(bits == 64 || x + count >= width)
+		{
+			for(i = 0; i < 8; i++)
+				packed[i] = (uint8_t)(word >> (56 - 8 * i));
+			cbimage_mono_copy(row, x + count - bits, packed, 0, bits);
+			word = 0;
+			bits = 0;
+		}
 	}
+}
+
+
+
+/** 
+ * \brief Decodes band of the rows from the BMP pixel array
+ * 
+ * BMP rows are stored bottom-up with fixed stride, so every row of the band
+ * is located directly without reading previous ones. Row *bottom_row* of the
+ * image is stored at the beginning of the *pixels*.
+ * 
+ * \param context - pointer to the cbmp_decoder
+ * \param begin - first row of the band (top-down order)
+ * \param end - row after the last row of the band
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbmp_decode_band(void *context, size_t begin, size_t end)
+{
+	cbmp_decoder	*decoder = context;
+	size_t				current_row, current_col, width = decoder->header.width;
 	
-	cbmp_form_info(header, image, bpp);
-	
-	fwrite(header,sizeof(uint8_t), 54, handle);
-	for(current_row = 0; current_row < image.height; current_row++)
+	for(current_row = begin; current_row < end; current_row++)
 	{
-		for(current_col = 0; current_col < image.width; current_col++)
+		const uint8_t	*color = decoder->pixels + (decoder->bottom_row - current_row) * decoder->bmp_row;
+		uint8_t				*pixel = cbimage_row(decoder->image, current_row);
+		int						format = decoder->image->format;
+		size_t				size = cbimage_pixel_size(format);
+		
+		if(format == CBIMAGE_FORMAT_MONO1)
+		{
+			cbmp_decode_mono(decoder, color, pixel);
+			continue;
+		}
+		
+		switch(decoder->header.bpp)
 		{
-			mono_wroten = 0;
-			write_mono = 0;
-			switch(bpp) 
+			case CBIMAGE_1BPP:
+			case CBIMAGE_2BPP:
+			case CBIMAGE_4BPP:
+			case CBIMAGE_8BPP:
 			{
-				case CBIMAGE_24BPP:
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].b >> 8,handle);
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].g >> 8,handle);
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].r >> 8,handle);
-					fwrite(zeros,sizeof(uint8_t), bmp_padding, handle);
-					break;
-				case CBIMAGE_32BPP:
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].a >> 8,handle);
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].b >> 8,handle);
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].g >> 8,handle);
-					fputc(image.data[(image.height - current_row - 1) * image.width + current_col].r >> 8,handle);
-					fwrite(zeros,sizeof(uint8_t), bmp_padding, handle);
-					break;
-				default:
-					fprintf(stderr, "[CRITICAL ERROR] Unsupported BMP format during writing! THIS IS A BUG!\n");
-					exit(-1);
-					break;
+				size_t chunk = decoder->lut_pixels * size;
+				
+				for(current_col = 0; current_col + decoder->lut_pixels <= width; current_col += decoder->lut_pixels, pixel += chunk)
+				{
+					memcpy(pixel, decoder->lut[*color++], chunk);
+				}
+				if(current_col < width)
+					memcpy(pixel, decoder->lut[*color], (width - current_col) * size);
+				break;
 			}
-			
+			case CBIMAGE_24BPP:
+				for(current_col = 0; current_col < width; current_col++, pixel += size, color += 3)
+				{
+					cbimage_pixel_store8(pixel, format, color[2], color[1], color[0], 0);
+				}
+				break;
+			case CBIMAGE_32BPP:
+				for(current_col = 0; current_col < width; current_col++, pixel += size, color += 4)
+				{
+					cbimage_pixel_store8(pixel, format, color[3], color[2], color[1], color[0]);
+				}
+				break;
 		}
-		
 	}
-	fclose(handle);
-	return 0;
 }
 
 
+
+/** 
+ * \brief Amount of the pixels of the scaled image converted at once by cbmp_scale_band()
+ */
+#define CBMP_SCALE_CHUNK 256
+
+/** 
+ * \brief Maximal scale of cbimage_load_bmp_scaled()
+ * 
+ * Sums of 8 bit channels of (2048 x 2048) pixels fit into 32 bits, and
+ * the division by the reciprocal of cbmp_scale_average() stays exact.
+ */
+#define CBMP_SCALE_MAX 2048
+
+
+
+/** 
+ * \brief Gets reciprocal of the amount of the averaged pixels for cbmp_scale_average()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint64_t cbmp_scale_reciprocal(uint32_t count)
+{
+	return ((uint64_t)1 << 56) / count + 1;
+}
+
+
+
+/** 
+ * \brief Divides sum of the channel by the amount of the pixels with rounding
+ * 
+ * Multiplication by the reciprocal is exact while sum * count is less than 2^56
+ * (sum is less than 256 * count and count is not greater than CBMP_SCALE_MAX^2).
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint8_t cbmp_scale_average(uint32_t sum, uint32_t count, uint64_t reciprocal)
+{
+	return (uint8_t)(((uint64_t)(sum + count / 2) * reciprocal) >> 56);
+}
+
+
+
+/** 
+ * \brief Averages blocks of the source pixels into the scaled pixels
+ * 
+ * Called with constant layout of the pixel, so the loop is specialized for every layout.
+ * 
+ * \param color - first source row
+ * \param x - first source column
+ * \param size - size of the source pixel
+ * \param r, g, b, a - offsets of the channels in the source pixel (*a* is negative if there is no alpha)
+ * \param lut - lookup table of the indexed pixels (see cbmp_build_lut()) or NULL
+ * \param lut_pixels - amount of the indexed pixels in one byte
+ * \param step - distance between the source rows
+ * \param rows - amount of the source rows of every block
+ * \param average - receives *count* scaled pixels in CBIMAGE_FORMAT_RGBA8
+ * \param scale - width of the block
+ * \param tail - width of the last block
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbmp_scale_sum(const uint8_t *color, size_t x, size_t size, int r, int g, int b, int a,
+	const uint8_t (*lut)[CBMP_LUT_BYTES], size_t lut_pixels, ptrdiff_t step, size_t rows,
+	uint8_t *average, size_t count, size_t scale, size_t tail)
+{
+	uint32_t	divisor = 0;
+	uint64_t	reciprocal = 0;
+	size_t		i, k, y;
+	
+	for(i = 0; i < count; i++, x += scale, average += 4)
+	{
+		uint32_t	sum_r = 0, sum_g = 0, sum_b = 0, sum_a = 0;
+		size_t		width = (i + 1 < count) ? (scale) : (tail);
+		uint32_t	pixels = (uint32_t)(width * rows);
+		
+		for(y = 0; y < rows; y++)
+		{
+			const uint8_t *line = color + (ptrdiff_t)y * step;
+			
+			for(k = x; k < x + width; k++)
+			{
+				const uint8_t *from = (lut) ? (lut[line[k / lut_pixels]] + 4 * (k % lut_pixels)) : (line + k * size);
+				
+				sum_r += from[r];
+				sum_g += from[g];
+				sum_b += from[b];
+				if(a >= 0)
+					sum_a += from[a];
+			}
+		}
+		
+		/* Only the last block of the row has different amount of pixels */
+		if(pixels != divisor)
+		{
+			divisor = pixels;
+			reciprocal = cbmp_scale_reciprocal(pixels);
+		}
+		
+		average[0] = cbmp_scale_average(sum_r, pixels, reciprocal);
+		average[1] = cbmp_scale_average(sum_g, pixels, reciprocal);
+		average[2] = cbmp_scale_average(sum_b, pixels, reciprocal);
+		average[3] = cbmp_scale_average(sum_a, pixels, reciprocal);
+	}
+}
+
+
+
+/** 
+ * \brief Decodes band of the rows of the scaled image
+ * 
+ * Every pixel is the average of the *scale* x *scale* block of the source pixels
+ * (blocks at the right and bottom edges may be smaller), so the full size image
+ * is never stored. Source rows are either rows of the BMP pixel array (pixels of the
+ * indexed files are taken from the lookup table, built for CBIMAGE_FORMAT_RGBA8)
+ * or rows of the already decoded *source* image. Scaled pixels are collected
+ * by CBMP_SCALE_CHUNK and converted into the format of the image.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbmp_scale_band(void *context, size_t begin, size_t end)
+{
+	cbmp_decoder	*decoder = context;
+	cbimage_t			*image = decoder->image;
+	size_t				scale = decoder->scale, height = decoder->header.height, width = decoder->header.width;
+	size_t				y, chunk;
+	uint8_t				average[CBMP_SCALE_CHUNK * 4];
+	
+	for(y = begin; y < end; y++)
+	{
+		size_t				first = y * scale, rows = (first + scale < height) ? (scale) : (height - first);
+		const uint8_t	*color;
+		ptrdiff_t			step;
+		
+		if(decoder->source)
+		{
+			color = cbimage_row(decoder->source, first);
+			step = (ptrdiff_t)cbimage_stride(decoder->source);
+		} else {
+			color = decoder->pixels + (decoder->bottom_row - first) * decoder->bmp_row;
+			step = -(ptrdiff_t)decoder->bmp_row;
+		}
+		
+		for(chunk = 0; chunk < image->width; chunk += CBMP_SCALE_CHUNK)
+		{
+			size_t count = (image->width - chunk < CBMP_SCALE_CHUNK) ? (image->width - chunk) : (CBMP_SCALE_CHUNK);
+			size_t x = chunk * scale, tail = ((x + count * scale < width) ? (x + count * scale) : (width)) - (x + (count - 1) * scale);
+			
+			if(decoder->source)
+				cbmp_scale_sum(color, x, 4, 0, 1, 2, 3, NULL, 1, step, rows, average, count, scale, tail);
+			else if(decoder->header.bpp == CBIMAGE_24BPP)
+				cbmp_scale_sum(color, x, 3, 2, 1, 0, -1, NULL, 1, step, rows, average, count, scale, tail);
+			else if(decoder->header.bpp == CBIMAGE_32BPP)
+				cbmp_scale_sum(color, x, 4, 3, 2, 1, 0, NULL, 1, step, rows, average, count, scale, tail);
+			else
+				cbmp_scale_sum(color, x, 4, 0, 1, 2, 3, (const uint8_t (*)[CBMP_LUT_BYTES])decoder->lut, decoder->lut_pixels, step, rows, average, count, scale, tail);
+			
+			cbimage_convert_span(cbimage_row(image, y), image->format, chunk, average, CBIMAGE_FORMAT_RGBA8, 0, count);
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Writes *count* pixels of one color into the row, clipped by the image width
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbmp_rle_put(cbmp_decoder *decoder, size_t x, size_t y, const uint8_t *color, size_t count)
+{
+	size_t	size = cbimage_pixel_size(decoder->image->format);
+	uint8_t	*pixel;
+	
+	if(y >= decoder->header.height || x >= decoder->header.width)
+		return;
+	if(count > decoder->header.width - x)
+		count = decoder->header.width - x;
+	
+	/* RLE rows are bottom-up, as in the uncompressed pixel array */
+	pixel = cbimage_row(decoder->image, decoder->header.height - y - 1);
+	
+	if(decoder->image->format == CBIMAGE_FORMAT_MONO1)
+	{
+		cbimage_mono_fill(pixel, x, count, color[0] >> 7);
+		return;
+	}
+	
+	pixel += x * size;
+	for(; count; count--, pixel += size)
+		memcpy(pixel, color, size);
+}
+
+
+
+/** 
+ * \brief Fills pixels skipped by the end of line, delta or end of bitmap escapes by color 0
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbmp_rle_skip(cbmp_decoder *decoder, size_t *x, size_t *y, size_t to_x, size_t to_y)
+{
+	while(*y < decoder->header.height && (*y < to_y || (*y == to_y && *x < to_x)))
+	{
+		size_t end = (*y < to_y) ? (decoder->header.width) : (to_x);
+		
+		if(end > *x)
+			cbmp_rle_put(decoder, *x, *y, cbmp_lut_color(decoder, 0), end - *x);
+		
+		if(*y < to_y)
+		{
+			*x = 0;
+			(*y)++;
+		} else {
+			*x = end;
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Decodes RLE8 or RLE4 compressed pixel array
+ * 
+ * Compressed rows have different lengths, so the array is decoded sequentially.
+ * Pixels are taken from the lookup table of the palette.
+ * 
+ * \param decoder - decoder with the lookup table
+ * \param length - size of the compressed data
+ * \return Returns 0 if succsesfull or -1 if data is corrupted
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbmp_decode_rle(cbmp_decoder *decoder, size_t length)
+{
+	const uint8_t	*data = decoder->pixels, *end = decoder->pixels + length;
+	size_t				x = 0, y = 0, i;
+	int						rle4 = decoder->header.compression == CBMP_RLE4;
+	
+	while(data + 2 <= end && y < decoder->header.height)
+	{
+		size_t	count = data[0];
+		uint8_t	value = data[1];
+		
+		data += 2;
+		
+		if(count)
+		{
+			/* Encoded run, RLE4 alternates both nibbles of the value */
+			if(rle4 && (value >> 4) != (value & 0xF))
+			{
+				for(i = 0; i < count; i++)
+					cbmp_rle_put(decoder, x + i, y, cbmp_lut_color(decoder, (i & 1) ? (value & 0xF) : (value >> 4)), 1);
+			} else {
+				cbmp_rle_put(decoder, x, y, cbmp_lut_color(decoder, (rle4) ? (value & 0xF) : (value)), count);
+			}
+			x += count;
+			continue;
+		}
+		
+		switch(value)
+		{
+			case 0:
+				cbmp_rle_skip(decoder, &x, &y, 0, y + 1);
+				break;
+			case 1:
+				cbmp_rle_skip(decoder, &x, &y, 0, decoder->header.height);
+				return 0;
+			case 2:
+				if(data + 2 > end)
+					return -1;
+				cbmp_rle_skip(decoder, &x, &y, x + data[0], y + data[1]);
+				data += 2;
+				break;
+			default:
+			{
+				/* Absolute mode, data is padded to 16 bits */
+				size_t bytes = (rle4) ? ((value + 1) / 2) : (value);
+				
+				if(data + bytes > end)
+					return -1;
+				
+				for(i = 0; i < value; i++)
+				{
+					uint8_t index = (rle4) ? ((i & 1) ? (data[i / 2] & 0xF) : (data[i / 2] >> 4)) : (data[i]);
+					
+					cbmp_rle_put(decoder, x + i, y, cbmp_lut_color(decoder, index), 1);
+				}
+				x += value;
+				data += (bytes + 1) & ~(size_t)1;
+				break;
+			}
+		}
+	}
+	
+	/* Missing end of bitmap is tolerated */
+	cbmp_rle_skip(decoder, &x, &y, 0, decoder->header.height);
+	return 0;
+}
+
+
+
+cbimage_t *cbimage_bmp_decode(const uint8_t *data, size_t size, int format, size_t scale, const char *name)
+{
+	size_t 	bmp_row;
+	
+	cbimage_t			*loaded_image;
+	cbmp_header 	header;
+	cbmp_decoder	decoder;
+	
+	assert(data != NULL || !size);
+	
+	if(!cbimage_pixel_size(format) && format != CBIMAGE_FORMAT_MONO1)
+	{
+		fprintf(stderr,"[ERROR] pixel format %d is not supported!\n", format);
+		return NULL;
+	}
+	
+	if(!scale || scale > CBMP_SCALE_MAX)
+	{
+		fprintf(stderr,"[ERROR] scale %zu is not supported!\n", scale);
+		return NULL;
+	}
+	
+	header = cbmp_parse_info(data, size, size);
+	if(!header.valid) {
+		fprintf(stderr,"[ERROR] file \"%s\": not valid or unsupported\n",name);
+		return NULL;
+	}
+	
+	bmp_row = (((header.bpp * (size_t)header.width + 31) >> 5) << 2);
+	
+	if((size_t)header.pointer_data > size || (header.compression != CBMP_RLE8 && header.compression != CBMP_RLE4
+		&& header.height && bmp_row > (size - header.pointer_data) / header.height))
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": pixel array is truncated\n",name);
+		return NULL;
+	}
+	
+	loaded_image = cbimage_create_uninitialized((header.width + scale - 1) / scale, (header.height + scale - 1) / scale,
+		(format == CBIMAGE_FORMAT_MONO1) ? (CBIMAGE_MONOCHROME) : (CBIMAGE_RGB), format);
+	
+	if(!loaded_image)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",name);
+		return NULL;
+	}
+	
+	decoder.pixels = data + header.pointer_data;
+	decoder.bmp_row = bmp_row;
+	decoder.bottom_row = header.height - 1;
+	decoder.header = header;
+	decoder.image = loaded_image;
+	decoder.source = NULL;
+	decoder.scale = scale;
+	
+	/* Scaled pixels are averaged in 8 bit channels and converted at the end */
+	cbmp_build_lut(&decoder, (scale > 1) ? (CBIMAGE_FORMAT_RGBA8) : (format));
+	
+	if(header.compression == CBMP_RLE8 || header.compression == CBMP_RLE4)
+	{
+		/* Compressed rows are decoded sequentially, so scaled image is averaged from the full one */
+		cbimage_t	*full = (scale > 1) ? (cbimage_create_uninitialized(header.width, header.height, CBIMAGE_RGB, CBIMAGE_FORMAT_RGBA8)) : (loaded_image);
+		int				failed = 1;
+		
+		decoder.image = full;
+		
+		if(!full)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",name);
+		} else if(cbmp_decode_rle(&decoder, size - header.pointer_data)) {
+			fprintf(stderr,"[ERROR] file \"%s\": compressed pixel array is corrupted\n",name);
+		} else {
+			failed = 0;
+		}
+		
+		if(!failed && full != loaded_image)
+		{
+			decoder.image = loaded_image;
+			decoder.source = full;
+			cbimage_parallel_rows(loaded_image->height, header.width * scale, cbmp_scale_band, &decoder);
+		}
+		
+		if(full != loaded_image)
+			cbimage_destroy(full);
+		if(failed)
+		{
+			cbimage_destroy(loaded_image);
+			loaded_image = NULL;
+		}
+	} else if(scale > 1) {
+		cbimage_parallel_rows(loaded_image->height, header.width * scale, cbmp_scale_band, &decoder);
+	} else {
+		cbimage_parallel_rows(header.height, header.width, cbmp_decode_band, &decoder);
+	}
+	
+	return loaded_image;
+}
+
+
+
+/** 
+ * This function reads BMP file and tries to load it into the memory.
+ */
+cbimage_t *cbimage_load_bmp(char *filename) 
+{
+	return cbimage_load_bmp_format(filename, CBIMAGE_FORMAT_RGBA16);
+}
+
+
+
+
+/** 
+ * This function reads BMP file and tries to load it into the memory.
+ * 
+ * Whole file is mapped into the memory (or readed at once if mapping is not
+ * available) and decoded in horizontal bands by several threads.
+ */
+cbimage_t *cbimage_load_bmp_format(char *filename, int format) 
+{
+	return cbimage_load_bmp_scaled(filename, format, 1);
+}
+
+
+
+
+/** 
+ * File is mapped with MADV_SEQUENTIAL, files that cannot be mapped are readed at once.
+ */
+int cbimage_source_open(cbimage_source_t *source, char *filename, size_t min_size)
+{
+	FILE	*handle;
+	off_t	file_size;
+	
+	memset(source, 0, sizeof(cbimage_source_t));
+	
+	handle = fopen(filename, "rb");
+	if(!handle)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
+		perror("");
+		return -1;
+	}
+	
+	file_size = get_file_size(handle);
+	
+	if(file_size < 0 || (size_t)file_size < min_size)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not valid or unsupported\n",filename);
+		fclose(handle);
+		return -1;
+	}
+	
+	source->size = file_size;
+	
+#ifdef CBIMAGE_HAVE_MMAP
+	void *file_data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(handle), 0);
+	
+	if(file_data != MAP_FAILED)
+	{
+		madvise(file_data, file_size, MADV_SEQUENTIAL);
+		source->data = file_data;
+		source->mapped = 1;
+		fclose(handle);
+		return 0;
+	}
+#endif
+	
+	source->owned = cbimage_alloc(file_size);
+	
+	if(!source->owned)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		fclose(handle);
+		return -1;
+	}
+	
+	fseek(handle, 0, SEEK_SET);
+	if(fread(source->owned, 1, file_size, handle) != (size_t)file_size)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": read failed\n",filename);
+		cbimage_release(source->owned);
+		fclose(handle);
+		return -1;
+	}
+	
+	source->data = source->owned;
+	fclose(handle);
+	return 0;
+}
+
+
+
+void cbimage_source_close(cbimage_source_t *source)
+{
+#ifdef CBIMAGE_HAVE_MMAP
+	if(source->mapped)
+		munmap((void*)source->data, source->size);
+#endif
+	cbimage_release(source->owned);
+}
+
+
+
+/** 
+ * This function reads BMP file and loads it reduced by *scale*.
+ * 
+ * Uncompressed pixel arrays are averaged directly from the file, compressed
+ * ones are decoded into the temporary full size image first.
+ */
+cbimage_t *cbimage_load_bmp_scaled(char *filename, int format, size_t scale) 
+{
+	cbimage_source_t	source;
+	cbimage_t					*loaded_image;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_LOAD_BMP);
+	assert(filename != NULL);
+	
+	if(cbimage_source_open(&source, filename, 54))
+		return NULL;
+	
+	CBIMAGE_STAT_BYTES(source.size);
+	loaded_image = cbimage_bmp_decode(source.data, source.size, format, scale, filename);
+	
+	cbimage_source_close(&source);
+	return loaded_image;
+}
+
+
+
+
+/** 
+ * Pixels are decoded straight from the caller's memory, which is not copied or changed.
+ */
+cbimage_t *cbimage_load_bmp_mem(const void *data, size_t size)
+{
+	return cbimage_load_bmp_mem_format(data, size, CBIMAGE_FORMAT_RGBA16);
+}
+
+
+
+
+/** 
+ * Pixels are decoded straight from the caller's memory, which is not copied or changed.
+ */
+cbimage_t *cbimage_load_bmp_mem_format(const void *data, size_t size, int format)
+{
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_LOAD_BMP);
+	CBIMAGE_STAT_BYTES(size);
+	
+	if(!data)
+		size = 0;
+	
+	return cbimage_bmp_decode(data, size, format, 1, "(memory)");
+}
+
+
+
+
+/** 
+ * \brief Size of the buffer used by streaming BMP reader
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBMP_STREAM_BUFFER (1 << 20)
+
+
+
+/** 
+ * \brief State of the streaming BMP reader
+ * 
+ * Copy of the *filename* is stored right after the structure.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+struct cbimage_bmp_reader
+{
+	FILE				*handle;
+	char				*filename;
+	cbmp_header	header;
+	size_t			bmp_row;
+	size_t			row;
+	uint8_t			*buffer;
+	size_t			buffer_rows;
+};
+
+
+
+cbimage_bmp_reader_t *cbimage_bmp_reader_open(char *filename)
+{
+	cbimage_bmp_reader_t	*reader;
+	off_t									file_size;
+	
+	assert(filename != NULL);
+	
+	reader = cbimage_alloc(sizeof(cbimage_bmp_reader_t) + strlen(filename) + 1);
+	if(!reader)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		return NULL;
+	}
+	memset(reader, 0, sizeof(cbimage_bmp_reader_t));
+	
+	reader->filename = strcpy((char*)(reader + 1), filename);
+	reader->handle = fopen(filename, "rb");
+	if(!reader->handle)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
+		perror("");
+		cbimage_release(reader);
+		return NULL;
+	}
+	
+	reader->header = cbmp_get_info(reader->handle);
+	if(!reader->header.valid) {
+		fprintf(stderr,"[ERROR] file \"%s\": not valid or unsupported\n",filename);
+		cbimage_bmp_reader_close(reader);
+		return NULL;
+	}
+	
+	if(reader->header.compression == CBMP_RLE8 || reader->header.compression == CBMP_RLE4)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": compressed files cannot be readed row by row\n",filename);
+		cbimage_bmp_reader_close(reader);
+		return NULL;
+	}
+	
+	file_size = get_file_size(reader->handle);
+	reader->bmp_row = (((reader->header.bpp * (size_t)reader->header.width + 31) >> 5) << 2);
+	
+	if(reader->header.pointer_data > file_size || (reader->header.height
+		&& reader->bmp_row > (size_t)(file_size - reader->header.pointer_data) / reader->header.height))
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": pixel array is truncated\n",filename);
+		cbimage_bmp_reader_close(reader);
+		return NULL;
+	}
+	
+	/* Buffer holds at least one row, so memory does not depend on the image height */
+	reader->buffer_rows = CBMP_STREAM_BUFFER / reader->bmp_row;
+	if(!reader->buffer_rows)
+		reader->buffer_rows = 1;
+	if(reader->buffer_rows > reader->header.height)
+		reader->buffer_rows = reader->header.height;
+	
+	reader->buffer = cbimage_alloc(reader->buffer_rows * reader->bmp_row + 1);
+	if(!reader->buffer)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		cbimage_bmp_reader_close(reader);
+		return NULL;
+	}
+	
+	return reader;
+}
+
+
+
+void cbimage_bmp_reader_size(cbimage_bmp_reader_t *reader, size_t *width, size_t *height)
+{
+	assert(reader != NULL);
+	
+	if(width)
+		*width = reader->header.width;
+	if(height)
+		*height = reader->header.height;
+}
+
+
+
+/** 
+ * Rows of the chunk are stored in the file in reversed order one after another,
+ * so every chunk is readed by one call and decoded in parallel.
+ */
+int cbimage_bmp_reader_read(cbimage_bmp_reader_t *reader, cbimage_t *rows)
+{
+	cbmp_decoder	decoder;
+	size_t				done = 0, wanted;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_BMP_READ);
+	assert(reader != NULL);
+	assert(rows != NULL);
+	
+	if(rows->width != reader->header.width)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": rows width does not match the image\n",reader->filename);
+		return -1;
+	}
+	
+	wanted = reader->header.height - reader->row;
+	if(wanted > rows->height)
+		wanted = rows->height;
+	
+	decoder.bmp_row = reader->bmp_row;
+	decoder.header = reader->header;
+	decoder.image = rows;
+	cbmp_build_lut(&decoder, rows->format);
+	
+	while(done < wanted)
+	{
+		size_t		chunk = (wanted - done < reader->buffer_rows) ? (wanted - done) : (reader->buffer_rows);
+		size_t		last = reader->row + chunk - 1;
+		cbimage_t	band = *rows;
+		
+		if(fseeko(reader->handle, reader->header.pointer_data + (off_t)(reader->header.height - last - 1) * reader->bmp_row, SEEK_SET)
+			|| fread(reader->buffer, reader->bmp_row, chunk, reader->handle) != chunk)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": read failed\n",reader->filename);
+			return -1;
+		}
+		
+		band.raw = cbimage_row(rows, done);
+		band.height = chunk;
+		band.stride = cbimage_stride(rows);
+		
+		decoder.pixels = reader->buffer;
+		decoder.bottom_row = chunk - 1;
+		decoder.image = &band;
+		cbimage_parallel_rows(chunk, rows->width, cbmp_decode_band, &decoder);
+		
+		reader->row += chunk;
+		done += chunk;
+		CBIMAGE_STAT_BYTES(done * reader->bmp_row);
+	}
+	
+	return (int)done;
+}
+
+
+
+int cbimage_bmp_reader_seek(cbimage_bmp_reader_t *reader, size_t row)
+{
+	assert(reader != NULL);
+	
+	if(row > reader->header.height)
+		return -1;
+	
+	reader->row = row;
+	return 0;
+}
+
+
+
+void cbimage_bmp_reader_close(cbimage_bmp_reader_t *reader)
+{
+	if(!reader)
+		return;
+	
+	if(reader->handle)
+		fclose(reader->handle);
+	
+	cbimage_release(reader->buffer);
+	cbimage_release(reader);
+}
+
+
+
+
+/** 
+ * \brief Size of the buffer used by buffered BMP writer
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBMP_WRITE_BUFFER (4 << 20)
+
+
+
+/** 
+ * \brief Context of the band-parallel BMP encoder
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	uint8_t		*pixels;
+	size_t		bmp_row;
+	size_t		first_row;
+	size_t		image_row;
+	int				bpp;
+	cbimage_t	*image;
+} cbmp_encoder;
+
+
+
+/** 
+ * \brief Encodes band of the rows into BMP pixel array
+ * 
+ * Image row (*image_row* + i) is written at (height - image_row - i - 1) row of
+ * the pixel array, where *pixels* points to the *first_row* of the pixel array.
+ * Row padding is filled by zeros. 1 bit rows are thresholded (or copied from
+ * CBIMAGE_FORMAT_MONO1 images), monochrome pixels become black or white.
+ * 
+ * \param context - pointer to the cbmp_encoder
+ * \param begin - first row of the band, relatively to the *image_row*
+ * \param end - row after the last row of the band
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbmp_encode_band(void *context, size_t begin, size_t end)
+{
+	cbmp_encoder	*encoder = context;
+	size_t				current_row, current_col, width = encoder->image->width;
+	size_t				bmp_data = width * (encoder->bpp >> 3);
+	
+	for(current_row = encoder->image_row + begin; current_row < encoder->image_row + end; current_row++)
+	{
+		uint8_t					*color = encoder->pixels + (encoder->image->height - current_row - 1 - encoder->first_row) * encoder->bmp_row;
+		const uint8_t		*pixel = cbimage_row(encoder->image, current_row);
+		int							format = encoder->image->format;
+		size_t					size = cbimage_pixel_size(format);
+		uint8_t					rgba[4];
+		
+		if(encoder->bpp == CBIMAGE_1BPP)
+		{
+			memset(color, 0, encoder->bmp_row);
+			cbimage_convert_span(color, CBIMAGE_FORMAT_MONO1, 0, pixel, format, 0, width);
+			continue;
+		}
+		
+		memset(color + bmp_data, 0, encoder->bmp_row - bmp_data);
+		
+		if(format == CBIMAGE_FORMAT_MONO1)
+		{
+			/* 32 bit pixel is stored as A, B, G, R, monochrome pixels have no alpha */
+			for(current_col = 0; current_col < width; current_col++, color += encoder->bpp >> 3)
+			{
+				uint8_t level = (cbimage_mono_get(pixel, current_col)) ? (0xFF) : (0);
+				
+				if(encoder->bpp == CBIMAGE_32BPP)
+				{
+					color[0] = 0;
+					memset(color + 1, level, 3);
+				} else {
+					memset(color, level, 3);
+				}
+			}
+			continue;
+		}
+		
+		switch(encoder->bpp) 
+		{
+			case CBIMAGE_24BPP:
+				for(current_col = 0; current_col < width; current_col++, pixel += size, color += 3)
+				{
+					cbimage_pixel_load8(pixel, format, rgba);
+					color[0] = rgba[2];
+					color[1] = rgba[1];
+					color[2] = rgba[0];
+				}
+				break;
+			case CBIMAGE_32BPP:
+				for(current_col = 0; current_col < width; current_col++, pixel += size, color += 4)
+				{
+					cbimage_pixel_load8(pixel, format, rgba);
+					color[0] = rgba[3];
+					color[1] = rgba[2];
+					color[2] = rgba[1];
+					color[3] = rgba[0];
+				}
+				break;
+		}
+	}
+}
+
+
+
+size_t cbimage_bmp_encoded_size(cbimage_t *image, int bpp)
+{
+	assert(image != NULL);
+	
+	return cbmp_header_size(bpp) + (((bpp * image->width + 31) >> 5) << 2) * image->height;
+}
+
+
+
+void cbimage_bmp_encode(uint8_t *data, cbimage_t *image, int bpp)
+{
+	cbmp_encoder encoder;
+	
+	assert(data != NULL && image != NULL);
+	
+	cbmp_form_info(data, *image, bpp);
+	
+	encoder.pixels = data + cbmp_header_size(bpp);
+	encoder.bmp_row = (((bpp * image->width + 31) >> 5) << 2);
+	encoder.first_row = 0;
+	encoder.image_row = 0;
+	encoder.bpp = bpp;
+	encoder.image = image;
+	cbimage_parallel_rows(image->height, image->width, cbmp_encode_band, &encoder);
+}
+
+
+
+/** 
+ * \brief Destination of the encoded BMP file
+ * 
+ * Sink either gives the memory for the whole file at once, so rows are encoded in place
+ * by several threads, or accepts the file in parts:
+ * 	- map - returns memory for the whole file of *bytes* or NULL if sink cannot provide it
+ * 	- write - appends *bytes* of the file, returns 0 if succsesfull or -1 if failed (may be NULL)
+ * 	- finish - called when the whole file is written, returns 0 if succsesfull or -1 if failed (may be NULL)
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct cbmp_sink
+{
+	uint8_t						*(*map)(struct cbmp_sink *sink, size_t bytes);
+	int								(*write)(struct cbmp_sink *sink, const uint8_t *data, size_t bytes);
+	int								(*finish)(struct cbmp_sink *sink);
+	FILE							*handle;
+	uint8_t						*data;
+	size_t						size;
+	cbimage_buffer_t	*buffer;
+} cbmp_sink;
+
+
+
+#ifdef CBIMAGE_HAVE_MMAP
+/** 
+ * \brief Maps the output file into the memory
+ * 
+ * Output file is preallocated to its final size, so writing into the mapping won't fail with SIGBUS.
+ * Files that cannot be mapped (pipes, special files) are written by cbmp_file_write().
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint8_t *cbmp_file_map(cbmp_sink *sink, size_t bytes)
+{
+	int		fd = fileno(sink->handle);
+	void	*data;
+	
+	if(posix_fallocate(fd, 0, bytes))
+		return NULL;
+	
+	data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	
+	if(data == MAP_FAILED)
+		return NULL;
+	
+	sink->data = data;
+	sink->size = bytes;
+	return sink->data;
+}
+#endif
+
+
+
+/** 
+ * \brief Appends part of the file to the output file
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbmp_file_write(cbmp_sink *sink, const uint8_t *data, size_t bytes)
+{
+	return (fwrite(data, sizeof(uint8_t), bytes, sink->handle) == bytes) ? (0) : (-1);
+}
+
+
+
+/** 
+ * \brief Unmaps the output file
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbmp_file_finish(cbmp_sink *sink)
+{
+#ifdef CBIMAGE_HAVE_MMAP
+	if(sink->data)
+		munmap(sink->data, sink->size);
+#endif
+	sink->data = NULL;
+	return 0;
+}
+
+
+
+/** 
+ * \brief Gives the caller's memory, if the file fits into it
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint8_t *cbmp_memory_map(cbmp_sink *sink, size_t bytes)
+{
+	return (bytes <= sink->size) ? (sink->data) : (NULL);
+}
+
+
+
+/** 
+ * \brief Grows the caller's buffer and gives its new end
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint8_t *cbmp_buffer_map(cbmp_sink *sink, size_t bytes)
+{
+	return cbimage_buffer_append(sink->buffer, bytes);
+}
+
+
+
+/** 
+ * \brief Writes BMP file into the sink through the large row buffer
+ * 
+ * Rows are encoded into the buffer of CBMP_WRITE_BUFFER bytes (at least one row)
+ * and written with one call per buffer.
+ * 
+ * \param sink - destination of the file, that accepts it in parts
+ * \param image - image to save
+ * \param bpp - Bits Per Pixel of the file
+ * \return Returns 0 if succsesfull or -1 if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbmp_write_buffered(cbmp_sink *sink, cbimage_t *image, int bpp)
+{
+	uint8_t				header[CBMP_HEADER_MAX];
+	cbmp_encoder	encoder;
+	size_t				height = image->height;
+	size_t				rows, written;
+	uint8_t				*buffer;
+	
+	encoder.bmp_row = (((bpp * image->width + 31) >> 5) << 2);
+	encoder.bpp = bpp;
+	encoder.image = image;
+	
+	rows = CBMP_WRITE_BUFFER / encoder.bmp_row;
+	if(rows < 1)
+		rows = 1;
+	if(rows > height)
+		rows = height;
+	
+	buffer = cbimage_alloc(rows * encoder.bmp_row + 1);
+	if(!buffer)
+		return -1;
+	
+	cbmp_form_info(header, *image, bpp);
+	if(sink->write(sink, header, cbmp_header_size(bpp)))
+	{
+		cbimage_release(buffer);
+		return -1;
+	}
+	
+	encoder.pixels = buffer;
+	
+	/* Pixel array is bottom-up, so the last image rows are written first */
+	for(written = 0; written < height; written += rows)
+	{
+		size_t chunk = (height - written < rows) ? (height - written) : (rows);
+		
+		encoder.first_row = written;
+		encoder.image_row = height - written - chunk;
+		cbimage_parallel_rows(chunk, image->width, cbmp_encode_band, &encoder);
+		
+		if(sink->write(sink, buffer, encoder.bmp_row * chunk))
+		{
+			cbimage_release(buffer);
+			return -1;
+		}
+	}
+	
+	cbimage_release(buffer);
+	return 0;
+}
+
+
+
+/** 
+ * \brief Encodes image into the sink
+ * 
+ * \param sink - destination of the file
+ * \param image - image to save
+ * \param bpp - Bits Per Pixel of the file, must be supported
+ * \return Returns size of the file in bytes if succsesfull or 0 if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static size_t cbmp_save(cbmp_sink *sink, cbimage_t *image, int bpp)
+{
+	size_t	bytes = cbimage_bmp_encoded_size(image, bpp);
+	uint8_t	*data = (sink->map) ? (sink->map(sink, bytes)) : (NULL);
+	int			result = 0;
+	
+	if(data)
+	{
+		cbimage_bmp_encode(data, image, bpp);
+	} else if(sink->write) {
+		result = cbmp_write_buffered(sink, image, bpp);
+	} else {
+		result = -1;
+	}
+	
+	if(sink->finish && sink->finish(sink))
+		result = -1;
+	return (result) ? (0) : (bytes);
+}
+
+
+
+/** 
+ * This function save image from the memory to the disk. You may specify 
+ * BPP option to choose in what format you want to save image.
+ * 
+ * Output file is preallocated and filled through the memory mapping by several
+ * threads. If file cannot be mapped (pipes, special files, no mmap support),
+ * image is written by large buffered chunks.
+ */
+int cbimage_save_bmp(char *filename, cbimage_t image, int bpp)
+{
+	cbmp_sink	sink = {0};
+	size_t		bytes;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_SAVE_BMP);
+	
+	if((bpp != CBIMAGE_1BPP) && (bpp != CBIMAGE_24BPP) && (bpp != CBIMAGE_32BPP)) {
+		fprintf(stderr,"[ERROR] bpp format %d is not supported!\n", bpp);
+		return -1;
+	}
+	
+	/* Size fields of the header have 32 bits */
+	if(cbimage_bmp_encoded_size(&image, bpp) > UINT32_MAX)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": image %zux%zu does not fit into BMP\n", filename, image.width, image.height);
+		return -1;
+	}
+	
+	sink.handle = fopen(filename, "wb");
+	
+	if(!sink.handle)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
+		perror("");
+		return -1;
+	}
+	
+#ifdef CBIMAGE_HAVE_MMAP
+	sink.map = cbmp_file_map;
+#endif
+	sink.write = cbmp_file_write;
+	sink.finish = cbmp_file_finish;
+	bytes = cbmp_save(&sink, &image, bpp);
+	CBIMAGE_STAT_BYTES(bytes);
+	
+	if(fclose(sink.handle))
+		bytes = 0;
+	
+	if(!bytes)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": write failed\n",filename);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/** 
+ * Size is taken from the header formed by cbmp_form_info(), which size field has 32 bits.
+ */
+size_t cbimage_save_bmp_size(cbimage_t image, int bpp)
+{
+	uint8_t header[CBMP_HEADER_MAX];
+	
+	if((bpp != CBIMAGE_1BPP) && (bpp != CBIMAGE_24BPP) && (bpp != CBIMAGE_32BPP))
+		return 0;
+	
+	if(cbimage_bmp_encoded_size(&image, bpp) > UINT32_MAX)
+		return 0;
+	
+	cbmp_form_info(header, image, bpp);
+	return *((uint32_t*)&header[2]);
+}
+
+
+
+/** 
+ * Rows are encoded directly into the caller's memory by several threads.
+ */
+int cbimage_save_bmp_mem(void *data, size_t size, cbimage_t image, int bpp)
+{
+	cbmp_sink	sink = {0};
+	size_t		bytes = cbimage_save_bmp_size(image, bpp);
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_SAVE_BMP);
+	assert(data != NULL || !size);
+	
+	if(!bytes)
+	{
+		fprintf(stderr,"[ERROR] bpp format %d is not supported or image is too large!\n", bpp);
+		return -1;
+	}
+	
+	if(bytes > size)
+	{
+		fprintf(stderr,"[ERROR] buffer of %zu bytes is too small for %zu bytes\n", size, bytes);
+		return -1;
+	}
+	
+	sink.map = cbmp_memory_map;
+	sink.data = data;
+	sink.size = size;
+	bytes = cbmp_save(&sink, &image, bpp);
+	CBIMAGE_STAT_BYTES(bytes);
+	return (bytes) ? (0) : (-1);
+}
+
+
+
+/** 
+ * Buffer is grown once to the exact size of the file, then rows are encoded into it by several threads.
+ */
+int cbimage_save_bmp_buffer(cbimage_buffer_t *buffer, cbimage_t image, int bpp)
+{
+	cbmp_sink	sink = {0};
+	size_t		bytes;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_SAVE_BMP);
+	assert(buffer != NULL);
+	
+	if(!cbimage_save_bmp_size(image, bpp))
+	{
+		fprintf(stderr,"[ERROR] bpp format %d is not supported or image is too large!\n", bpp);
+		return -1;
+	}
+	
+	sink.map = cbmp_buffer_map;
+	sink.buffer = buffer;
+	
+	bytes = cbmp_save(&sink, &image, bpp);
+	CBIMAGE_STAT_BYTES(bytes);
+	
+	if(!bytes)
+	{
+		fprintf(stderr,"[ERROR] not enough memory\n");
+		return -1;
+	}
+	return 0;
+}
+
+
+
+
+/** 
+ * \brief State of the streaming BMP writer
+ * 
+ * Copy of the *filename* is stored right after the structure.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+struct cbimage_bmp_writer
+{
+	FILE		*handle;
+	char		*filename;
+	size_t	width;
+	size_t	height;
+	int			bpp;
+	size_t	bmp_row;
+	size_t	row;
+	int			failed;
+	uint8_t	*buffer;
+	size_t	buffer_rows;
+};
+
+
+
+cbimage_bmp_writer_t *cbimage_bmp_writer_open(char *filename, size_t width, size_t height, int bpp)
+{
+	cbimage_bmp_writer_t	*writer;
+	cbimage_t							info = {{NULL}, 0, 0, 0, 0, 0, 0, 0};
+	uint8_t								header[CBMP_HEADER_MAX];
+	
+	assert(filename != NULL);
+	
+	if((bpp != CBIMAGE_1BPP) && (bpp != CBIMAGE_24BPP) && (bpp != CBIMAGE_32BPP)) {
+		fprintf(stderr,"[ERROR] bpp format %d is not supported!\n", bpp);
+		return NULL;
+	}
+	
+	if(!width || !height || width > INT32_MAX || ((((bpp * width + 31) >> 5) << 2) * height) > UINT32_MAX - CBMP_HEADER_MAX)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": image %zux%zu does not fit into BMP\n", filename, width, height);
+		return NULL;
+	}
+	
+	writer = cbimage_alloc(sizeof(cbimage_bmp_writer_t) + strlen(filename) + 1);
+	if(!writer)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		return NULL;
+	}
+	memset(writer, 0, sizeof(cbimage_bmp_writer_t));
+	
+	writer->filename = strcpy((char*)(writer + 1), filename);
+	writer->width = width;
+	writer->height = height;
+	writer->bpp = bpp;
+	writer->bmp_row = (((bpp * width + 31) >> 5) << 2);
+	
+	writer->buffer_rows = CBMP_STREAM_BUFFER / writer->bmp_row;
+	if(!writer->buffer_rows)
+		writer->buffer_rows = 1;
+	if(writer->buffer_rows > height)
+		writer->buffer_rows = height;
+	
+	writer->buffer = cbimage_alloc(writer->buffer_rows * writer->bmp_row + 1);
+	if(!writer->buffer)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		cbimage_release(writer);
+		return NULL;
+	}
+	
+	writer->handle = fopen(filename, "wb");
+	if(!writer->handle)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
+		perror("");
+		cbimage_release(writer->buffer);
+		cbimage_release(writer);
+		return NULL;
+	}
+	
+	info.width = width;
+	info.height = height;
+	cbmp_form_info(header, info, bpp);
+	
+	if(fwrite(header, sizeof(uint8_t), cbmp_header_size(bpp), writer->handle) != cbmp_header_size(bpp))
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": write failed\n",filename);
+		writer->failed = 1;
+	}
+	
+	return writer;
+}
+
+
+
+/** 
+ * Every chunk is encoded bottom-up into the buffer and written by one fwrite
+ * at its final offset, so rows never have to be kept until the end.
+ */
+int cbimage_bmp_writer_write(cbimage_bmp_writer_t *writer, cbimage_t *rows)
+{
+	cbmp_encoder	encoder;
+	size_t				done = 0;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_BMP_WRITE);
+	assert(writer != NULL);
+	assert(rows != NULL);
+	
+	if(writer->failed)
+		return -1;
+	
+	if(rows->width != writer->width || rows->height > writer->height - writer->row)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": rows do not match the image\n",writer->filename);
+		return -1;
+	}
+	
+	encoder.pixels = writer->buffer;
+	encoder.bmp_row = writer->bmp_row;
+	encoder.first_row = 0;
+	encoder.image_row = 0;
+	encoder.bpp = writer->bpp;
+	
+	while(done < rows->height)
+	{
+		size_t		chunk = (rows->height - done < writer->buffer_rows) ? (rows->height - done) : (writer->buffer_rows);
+		cbimage_t	band = *rows;
+		
+		band.raw = cbimage_row(rows, done);
+		band.height = chunk;
+		band.stride = cbimage_stride(rows);
+		encoder.image = &band;
+		cbimage_parallel_rows(chunk, rows->width, cbmp_encode_band, &encoder);
+		
+		/* Last row of the chunk is the first one in the file */
+		if(fseeko(writer->handle, cbmp_header_size(writer->bpp) + (off_t)(writer->height - writer->row - chunk) * writer->bmp_row, SEEK_SET)
+			|| fwrite(writer->buffer, writer->bmp_row, chunk, writer->handle) != chunk)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": write failed\n",writer->filename);
+			writer->failed = 1;
+			return -1;
+		}
+		
+		writer->row += chunk;
+		done += chunk;
+		CBIMAGE_STAT_BYTES(done * writer->bmp_row);
+	}
+	
+	return 0;
+}
+
+
+
+int cbimage_bmp_writer_close(cbimage_bmp_writer_t *writer)
+{
+	int result;
+	
+	if(!writer)
+		return -1;
+	
+	result = writer->failed ? -1 : 0;
+	
+	if(!result && writer->row != writer->height)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": only %zu of %zu rows were written\n",writer->filename, writer->row, writer->height);
+		result = -1;
+	}
+	
+	if(fclose(writer->handle) && !result)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": write failed\n",writer->filename);
+		result = -1;
+	}
+	
+	cbimage_release(writer->buffer);
+	cbimage_release(writer);
+	return result;
+}
@@ -0,0 +1,308 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+/** 
+ * \brief Position of the image in the bonded image
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	size_t x, y;
+} cbimage_bond_place_t;
+
+/** 
+ * \brief Context of cbimage_bond_array()
+ * 
+ * Row *r* of the table starts at *row_y[r]* and contains images *r * columns*..
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t							*out;
+	cbimage_t							**images;
+	size_t								count;
+	size_t								columns;
+	size_t								rows;
+	size_t								*row_y;
+	size_t								*row_height;
+	cbimage_bond_place_t	*places;
+} cbimage_bond_job_t;
+
+
+
+/** 
+ * \brief Gets offset of the image inside the cell
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static size_t cbimage_bond_align(int align, size_t cell, size_t size)
+{
+	switch(align)
+	{
+		case CBIMAGE_ALIGN_CENTER:
+			return (cell - size) / 2;
+		case CBIMAGE_ALIGN_END:
+			return cell - size;
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Copies rows of the images into the band of rows of the bonded image
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_bond_band(void *context, size_t begin, size_t end)
+{
+	cbimage_bond_job_t			*job = context;
+	size_t									size = cbimage_pixel_size(job->out->format);
+	size_t									low = 0, high = job->rows, y, i;
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	
+	/* Last row of the table that starts at or above the band */
+	while(high - low > 1)
+	{
+		size_t middle = (low + high) / 2;
+		
+		if(job->row_y[middle] <= begin)
+			low = middle;
+		else
+			high = middle;
+	}
+	
+	for(y = begin; y < end; y++)
+	{
+		uint8_t *to = cbimage_row(job->out, y);
+		
+		while(low + 1 < job->rows && job->row_y[low + 1] <= y)
+			low++;
+		
+		if(y >= job->row_y[low] + job->row_height[low])
+			continue;
+		
+		for(i = low * job->columns; i < job->count && i < (low + 1) * job->columns; i++)
+		{
+			cbimage_t	*image = job->images[i];
+			size_t		line = y - job->places[i].y;
+			
+			if(y < job->places[i].y || line >= image->height)
+				continue;
+			
+			if(image->format == job->out->format && size)
+				kernels->copy(to + job->places[i].x * size, cbimage_row(image, line), image->width * size);
+			else
+				cbimage_convert_span(to, job->out->format, job->places[i].x, cbimage_row(image, line), image->format, 0, image->width);
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Computes positions of the images, widths of the columns and heights of the rows
+ * 
+ * \param job - context with allocated arrays
+ * \param layout - layout of the images
+ * \param column_x - receives offsets of the columns
+ * \param column_width - receives widths of the columns
+ * \param width - receives width of the bonded image
+ * \param height - receives height of the bonded image
+ * \return Returns type of the bonded image or -1 if its size does not fit into size_t
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_bond_layout(cbimage_bond_job_t *job, const cbimage_bond_layout_t *layout, size_t *column_x, size_t *column_width, size_t *width, size_t *height)
+{
+	size_t	i;
+	int			type = CBIMAGE_RGB;
+	
+	memset(column_width, 0, sizeof(size_t) * job->columns);
+	memset(job->row_height, 0, sizeof(size_t) * job->rows);
+	
+	for(i = 0; i < job->count; i++)
+	{
+		cbimage_t	*image = job->images[i];
+		size_t		column = i % job->columns, row = i / job->columns;
+		
+		assert(image != NULL);
+		
+		if(image->width > column_width[column])
+			column_width[column] = image->width;
+		if(image->height > job->row_height[row])
+			job->row_height[row] = image->height;
+		if(image->type == CBIMAGE_RGBA)
+			type = CBIMAGE_RGBA;
+	}
+	
+	*width = 0;
+	for(i = 0; i < job->columns; i++)
+	{
+		size_t spacing = (i + 1 < job->columns) ? (layout->spacing_x) : (0);
+		
+		column_x[i] = *width;
+		if(column_width[i] > SIZE_MAX - *width || spacing > SIZE_MAX - *width - column_width[i])
+			return -1;
+		*width += column_width[i] + spacing;
+	}
+	
+	*height = 0;
+	for(i = 0; i < job->rows; i++)
+	{
+		size_t spacing = (i + 1 < job->rows) ? (layout->spacing_y) : (0);
+		
+		job->row_y[i] = *height;
+		if(job->row_height[i] > SIZE_MAX - *height || spacing > SIZE_MAX - *height - job->row_height[i])
+			return -1;
+		*height += job->row_height[i] + spacing;
+	}
+	
+	for(i = 0; i < job->count; i++)
+	{
+		size_t column = i % job->columns, row = i / job->columns;
+		
+		job->places[i].x = column_x[column] + cbimage_bond_align(layout->align_x, column_width[column], job->images[i]->width);
+		job->places[i].y = job->row_y[row] + cbimage_bond_align(layout->align_y, job->row_height[row], job->images[i]->height);
+	}
+	
+	return type;
+}
+
+
+
+/** 
+ * Layout is computed once. Rows of the result are filled in parallel, each row
+ * is assembled from the rows of the images of one row of the table.
+ */
+cbimage_t *cbimage_bond_array(cbimage_t **images, size_t count, const cbimage_bond_layout_t *layout)
+{
+	cbimage_bond_layout_t	horizontal;
+	cbimage_bond_job_t		job;
+	size_t								*column_x, *column_width, width = 0, height = 0;
+	int										type;
+	cbpixel_t							zero = {0};
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_BOND);
+	assert(images != NULL || !count);
+	
+	if(!layout)
+	{
+		memset(&horizontal, 0, sizeof(horizontal));
+		horizontal.type = CBIMAGE_BOND_HORIZONTAL;
+		layout = &horizontal;
+	}
+	
+	switch(layout->type)
+	{
+		case CBIMAGE_BOND_HORIZONTAL:
+			job.columns = count;
+			break;
+		case CBIMAGE_BOND_VERTICAL:
+			job.columns = 1;
+			break;
+		default:
+			/* Square grid is the smallest one, that fits all images */
+			for(job.columns = layout->columns; !layout->columns && job.columns * job.columns < count; job.columns++);
+			break;
+	}
+	if(!job.columns)
+		job.columns = 1;
+	
+	job.images = images;
+	job.count = count;
+	job.rows = (count + job.columns - 1) / job.columns;
+	if(!job.rows)
+		job.rows = 1;
+	job.out = NULL;
+	
+	column_x = cbimage_alloc(sizeof(size_t) * job.columns);
+	column_width = cbimage_alloc(sizeof(size_t) * job.columns);
+	job.row_y = cbimage_alloc(sizeof(size_t) * job.rows);
+	job.row_height = cbimage_alloc(sizeof(size_t) * job.rows);
+	job.places = cbimage_alloc(sizeof(cbimage_bond_place_t) * (count ? count : 1));
+	
+	if(column_x && column_width && job.row_y && job.row_height && job.places)
+	{
+		type = cbimage_bond_layout(&job, layout, column_x, column_width, &width, &height);
+		if(type >= 0)
+			job.out = cbimage_create_large(width, height, type, (count) ? (images[0]->format) : (CBIMAGE_FORMAT_RGBA16));
+	}
+	
+	if(job.out)
+	{
+		if(memcmp(&layout->background, &zero, sizeof(cbpixel_t)))
+			cbimage_fill(job.out, layout->background);
+		
+		cbimage_parallel_rows(height, width, cbimage_bond_band, &job);
+		CBIMAGE_STAT_BYTES(cbimage_bytes(job.out));
+	}
+	
+	cbimage_release(column_x);
+	cbimage_release(column_width);
+	cbimage_release(job.row_y);
+	cbimage_release(job.row_height);
+	cbimage_release(job.places);
+	return job.out;
+}
+
+
+
+cbimage_t *cbimage_bond(int bond_type, int num_images, ...)
+{
+	cbimage_bond_layout_t	layout;
+	cbimage_t							**images, *out;
+	va_list								args;
+	int										i;
+	
+	if(num_images < 0)
+		return NULL;
+	
+	images = cbimage_alloc(sizeof(cbimage_t*) * (num_images > 0 ? num_images : 1));
+	if(!images)
+		return NULL;
+	
+	va_start(args, num_images);
+	for(i = 0; i < num_images; i++)
+		images[i] = va_arg(args, cbimage_t *);
+	va_end(args);
+	
+	memset(&layout, 0, sizeof(layout));
+	layout.type = (bond_type == CBIMAGE_BOND_HORIZONTAL) ? (CBIMAGE_BOND_HORIZONTAL) : (CBIMAGE_BOND_VERTICAL);
+	
+	out = cbimage_bond_array(images, num_images, &layout);
+	cbimage_release(images);
+	return out;
+}
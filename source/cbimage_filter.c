@@ -0,0 +1,913 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/** 
+ * \brief Size of the intermediate lines of one tile of the convolution
+ * 
+ * Tile of the destination rows is computed from the source rows of the tile, that
+ * are kept in the cache while vertical pass reads them.
+ */
+#define CBIMAGE_FILTER_CACHE (256 * 1024)
+
+/** 
+ * \brief Minimal height of the band of cbimage_box_blur_to()
+ * 
+ * Every band sums its first window from scratch, so bands are at least as high as
+ * the window.
+ */
+#define CBIMAGE_FILTER_BOX_BAND 64
+
+/** 
+ * \brief How the sums of the kernels are written into the destination
+ * 
+ * 	- CBIMAGE_FILTER_COMBINE_NONE - sum of the first kernel
+ * 	- CBIMAGE_FILTER_COMBINE_SHARPEN - source + amount * (source - sum of the first kernel)
+ * 	- CBIMAGE_FILTER_COMBINE_MAGNITUDE - length of the vector of the sums of both kernels,
+ * 	  alpha is copied from the source
+ * 
+ * \warning These constants ment to be used *ONLY* internaly.
+ */
+enum {
+	CBIMAGE_FILTER_COMBINE_NONE = 0,
+	CBIMAGE_FILTER_COMBINE_SHARPEN,
+	CBIMAGE_FILTER_COMBINE_MAGNITUDE
+};
+
+/** 
+ * \brief Weights of one kernel
+ * 
+ * Separable kernel keeps *width* horizontal weights followed by *height* vertical
+ * weights, other kernels keep *width* * *height* weights by rows.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	float	*weights;
+	float	*vertical;
+	int		separable;
+} cbimage_filter_kernel_t;
+
+/** 
+ * \brief Context of the convolution
+ * 
+ * All kernels have the same size, pixel (x, y) of the result is the sum of the source
+ * pixels from (x - (width - 1) / 2, y - (height - 1) / 2) multiplied by the weights.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t								*dst;
+	cbimage_t								*src;
+	cbimage_filter_kernel_t	kernels[2];
+	size_t									count;
+	size_t									width;
+	size_t									height;
+	int											border;
+	int											combine;
+	float										amount;
+	size_t									tile;
+	atomic_int							failed;
+} cbimage_filter_job_t;
+
+/** 
+ * \brief Context of cbimage_box_blur_to()
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t		*dst;
+	cbimage_t		*src;
+	size_t			radius_x;
+	size_t			radius_y;
+	int					border;
+	size_t			band;
+	atomic_int	failed;
+} cbimage_box_job_t;
+
+
+
+void cbimage_scalar_convolve_row(float *dst, const float *src, const float *weights, size_t taps, size_t count)
+{
+	size_t i, k;
+	
+	for(i = 0; i < count; i++)
+	{
+		const float	*from = src + i;
+		float				sum = dst[i];
+		
+		for(k = 0; k < taps; k++, from += 4)
+			sum += weights[k] * *from;
+		
+		dst[i] = sum;
+	}
+}
+
+
+
+/** 
+ * \brief Maps coordinate outside of the image into the image by the border mode
+ * 
+ * \param size - size of the image along the axis (not 0)
+ * \return Returns coordinate inside of the image or -1 if pixel is zero (CBIMAGE_BORDER_ZERO)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static ptrdiff_t cbimage_filter_border(ptrdiff_t i, size_t size, int border)
+{
+	ptrdiff_t n = (ptrdiff_t)size;
+	
+	if(i >= 0 && i < n)
+		return i;
+	
+	switch(border)
+	{
+		case CBIMAGE_BORDER_MIRROR:
+			i %= 2 * n;
+			if(i < 0)
+				i += 2 * n;
+			return (i < n) ? (i) : (2 * n - 1 - i);
+		case CBIMAGE_BORDER_WRAP:
+			i %= n;
+			return (i < 0) ? (i + n) : (i);
+		case CBIMAGE_BORDER_ZERO:
+			return -1;
+	}
+	return (i < 0) ? (0) : (n - 1);
+}
+
+
+
+/** 
+ * \brief Converts source row into floats with *left* and *right* border pixels
+ * 
+ * \param dst - receives 4 * (left + width + right) floats
+ * \param y - row, rows outside of the image are mapped by the border mode
+ * \param pixels - buffer of the image width for 16 bit channels
+ * \return Returns 0 if row is loaded or -1 if row is zero (it is not written)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_filter_load(float *dst, const cbimage_t *src, ptrdiff_t y, size_t left, size_t right, int border, cbpixel_t *pixels)
+{
+	ptrdiff_t	row = cbimage_filter_border(y, src->height, border), column;
+	float			*pixel = dst;
+	size_t		x;
+	
+	if(row < 0)
+		return -1;
+	
+	cbimage_float_row_load(dst + 4 * left, src, row, pixels);
+	
+	for(x = 0; x < left + right; x++, pixel += 4)
+	{
+		/* Border pixels are copied from the loaded part of the row */
+		if(x == left)
+			pixel += 4 * src->width;
+		
+		column = cbimage_filter_border((ptrdiff_t)((x < left) ? (x) : (x + src->width)) - (ptrdiff_t)left, src->width, border);
+		if(column < 0)
+			memset(pixel, 0, 4 * sizeof(float));
+		else
+			memcpy(pixel, dst + 4 * (left + column), 4 * sizeof(float));
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Convolves band of the tiles of the destination rows
+ * 
+ * Source rows of the tile are converted into floats with border pixels. Separable
+ * kernels filter them horizontally into the intermediate lines, then every destination
+ * row is the weighted sum of the lines (same as cbimage_resize() does). Other kernels
+ * keep the source rows as lines and add every row of the weights separately.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_filter_band(void *context, size_t begin, size_t end)
+{
+	cbimage_filter_job_t		*job = context;
+	cbimage_t								*dst = job->dst;
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	size_t									left = (job->width - 1) / 2, top = (job->height - 1) / 2;
+	size_t									values = 4 * dst->width, padded = values + 4 * (job->width - 1);
+	size_t									rows = job->tile + job->height - 1, strides[2], tile, y, i, k;
+	size_t									floats = padded + job->count * values;
+	cbpixel_t								*pixels;
+	float										*row, *sums[2], *lines[2];
+	
+	for(k = 0; k < job->count; k++)
+	{
+		strides[k] = (job->kernels[k].separable) ? (values) : (padded);
+		floats += rows * strides[k];
+	}
+	
+	pixels = cbimage_alloc(dst->width * sizeof(cbpixel_t) + floats * sizeof(float));
+	if(!pixels)
+	{
+		atomic_store(&job->failed, 1);
+		return;
+	}
+	row = (float*)(pixels + dst->width);
+	sums[0] = row + padded;
+	lines[0] = sums[0] + job->count * values;
+	if(job->count > 1)
+	{
+		sums[1] = sums[0] + values;
+		lines[1] = lines[0] + rows * strides[0];
+	}
+	
+	for(tile = begin; tile < end; tile++)
+	{
+		size_t first = tile * job->tile, last = (first + job->tile < dst->height) ? (first + job->tile) : (dst->height);
+		
+		for(i = 0; i < last - first + job->height - 1; i++)
+		{
+			ptrdiff_t	source = (ptrdiff_t)(first + i) - (ptrdiff_t)top;
+			float			*loaded = NULL;
+			
+			/* Row is loaded once, kernels without the horizontal pass copy it */
+			for(k = 0; k < job->count; k++)
+			{
+				float *line = lines[k] + i * strides[k];
+				
+				if(!loaded)
+				{
+					loaded = (job->kernels[k].separable) ? (row) : (line);
+					if(cbimage_filter_load(loaded, job->src, source, left, job->width - 1 - left, job->border, pixels))
+						memset(loaded, 0, padded * sizeof(float));
+				} else if(!job->kernels[k].separable) {
+					memcpy(line, loaded, padded * sizeof(float));
+				}
+				
+				if(job->kernels[k].separable)
+				{
+					memset(line, 0, values * sizeof(float));
+					kernels->convolve_row(line, loaded, job->kernels[k].weights, job->width, values);
+				}
+			}
+		}
+		
+		for(y = first; y < last; y++)
+		{
+			for(k = 0; k < job->count; k++)
+			{
+				const float *line = lines[k] + (y - first) * strides[k];
+				
+				if(job->kernels[k].separable)
+				{
+					kernels->resample_lines(sums[k], line, values, job->kernels[k].vertical, job->height, values);
+					continue;
+				}
+				
+				memset(sums[k], 0, values * sizeof(float));
+				for(i = 0; i < job->height; i++, line += padded)
+				{
+					const float	*weights = job->kernels[k].weights + i * job->width;
+					size_t			x;
+					
+					/* Zero rows of the weights (e.g. middle row of the derivative) are skipped */
+					for(x = 0; x < job->width && weights[x] == 0.0f; x++);
+					if(x < job->width)
+						kernels->convolve_row(sums[k], line, weights, job->width, values);
+				}
+			}
+			
+			switch(job->combine)
+			{
+				case CBIMAGE_FILTER_COMBINE_SHARPEN:
+					cbimage_float_row_load(row, job->src, y, pixels);
+					for(i = 0; i < values; i++)
+						row[i] += job->amount * (row[i] - sums[0][i]);
+					cbimage_float_row_store(dst, y, row, pixels);
+					break;
+				case CBIMAGE_FILTER_COMBINE_MAGNITUDE:
+					cbimage_float_row_load(row, job->src, y, pixels);
+					for(i = 0; i < values; i += 4)
+					{
+						for(k = 0; k < 3; k++)
+							row[i + k] = sqrtf(sums[0][i + k] * sums[0][i + k] + sums[1][i + k] * sums[1][i + k]);
+					}
+					cbimage_float_row_store(dst, y, row, pixels);
+					break;
+				default:
+					cbimage_float_row_store(dst, y, sums[0], pixels);
+					break;
+			}
+		}
+	}
+	
+	cbimage_release(pixels);
+}
+
+
+
+/** 
+ * \brief Sets separable kernel
+ * 
+ * \return Returns 0 if succsesfull or -1 if there is not enough memory
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_filter_separable(cbimage_filter_kernel_t *kernel, const float *horizontal, size_t width, const float *vertical, size_t height)
+{
+	kernel->weights = cbimage_alloc((width + height) * sizeof(float));
+	if(!kernel->weights)
+		return -1;
+	
+	kernel->vertical = kernel->weights + width;
+	kernel->separable = 1;
+	memcpy(kernel->weights, horizontal, width * sizeof(float));
+	memcpy(kernel->vertical, vertical, height * sizeof(float));
+	return 0;
+}
+
+
+
+/** 
+ * \brief Sets 2D kernel, kernel is made separable when it is possible
+ * 
+ * Kernel is separable when it is the product of its column and its row crossing
+ * at the largest weight (up to the rounding errors of the weights).
+ * 
+ * \return Returns 0 if succsesfull or -1 if there is not enough memory
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_filter_kernel(cbimage_filter_kernel_t *kernel, const float *weights, size_t width, size_t height)
+{
+	size_t	i, j, peak = 0;
+	float		*horizontal, *vertical;
+	double	tolerance;
+	
+	kernel->weights = cbimage_alloc((width * height + width + height) * sizeof(float));
+	if(!kernel->weights)
+		return -1;
+	
+	for(i = 1; i < width * height; i++)
+	{
+		if(fabsf(weights[i]) > fabsf(weights[peak]))
+			peak = i;
+	}
+	tolerance = fabsf(weights[peak]) * FLT_EPSILON * 16.0;
+	
+	horizontal = kernel->weights;
+	vertical = horizontal + width;
+	kernel->vertical = vertical;
+	kernel->separable = (weights[peak] != 0.0f);
+	
+	for(j = 0; j < width && kernel->separable; j++)
+		horizontal[j] = weights[peak - peak % width + j] / weights[peak];
+	for(i = 0; i < height && kernel->separable; i++)
+		vertical[i] = weights[i * width + peak % width];
+	
+	for(i = 0; i < height && kernel->separable; i++)
+	{
+		for(j = 0; j < width; j++)
+		{
+			if(fabs((double)vertical[i] * horizontal[j] - weights[i * width + j]) > tolerance)
+			{
+				kernel->separable = 0;
+				break;
+			}
+		}
+	}
+	
+	if(!kernel->separable)
+	{
+		kernel->vertical = NULL;
+		memcpy(kernel->weights, weights, width * height * sizeof(float));
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Runs the convolution and releases the kernels
+ * 
+ * Kernels of the job must be set (*count* of them), the rest of the job is filled here.
+ * 
+ * \return Returns 0 if succsesfull or -1 if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_filter_run(cbimage_filter_job_t *job, cbimage_t *dst, cbimage_t *src, int border)
+{
+	size_t line = 0, lines, k;
+	
+	job->dst = dst;
+	job->src = src;
+	job->border = border;
+	
+	for(k = 0; k < job->count; k++)
+		line += (job->kernels[k].separable) ? (4 * dst->width) : (4 * (dst->width + job->width - 1));
+	
+	/* Tile is as high as its lines fit into the cache, but there are always several
+	 * times more lines than the kernel rows, so few of them are loaded twice */
+	lines = CBIMAGE_FILTER_CACHE / (line * sizeof(float));
+	if(lines < 4 * job->height)
+		lines = 4 * job->height;
+	job->tile = lines - (job->height - 1);
+	if(job->tile > dst->height)
+		job->tile = dst->height;
+	
+	atomic_init(&job->failed, 0);
+	cbimage_parallel_rows((dst->height + job->tile - 1) / job->tile, dst->width * job->tile, cbimage_filter_band, job);
+	
+	for(k = 0; k < job->count; k++)
+		cbimage_release(job->kernels[k].weights);
+	return (atomic_load(&job->failed)) ? (-1) : (0);
+}
+
+
+
+/** 
+ * \brief Checks arguments shared by all filters
+ * 
+ * \return Returns 0 if arguments are valid or -1 if not
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_filter_check(cbimage_t *dst, cbimage_t *src, int border)
+{
+	if(border < CBIMAGE_BORDER_CLAMP || border > CBIMAGE_BORDER_ZERO)
+		return -1;
+	if(dst->width != src->width || dst->height != src->height)
+		return -1;
+	if(!src->width || !src->height || dst->raw == src->raw)
+		return -1;
+	return 0;
+}
+
+
+
+/** 
+ * \brief Computes normalized weights of the Gaussian with the radius of 3 sigma
+ * 
+ * \param image - image to filter, radius must not be larger than its larger dimension
+ * \param taps - receives count of the weights
+ * \return Returns weights (must be released by cbimage_release()) or NULL if sigma is not valid or failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static float *cbimage_filter_gaussian(const cbimage_t *image, double sigma, size_t *taps)
+{
+	size_t	limit = (image->width > image->height) ? (image->width) : (image->height), radius, i;
+	double	total = 0.0;
+	float		*weights;
+	
+	/* Radius is not larger than the image, so the weights always fit into size_t */
+	if(limit > (SIZE_MAX / sizeof(float) - 1) / 2)
+		limit = (SIZE_MAX / sizeof(float) - 1) / 2;
+	if(!(sigma >= 0.0) || ceil(3.0 * sigma) > (double)limit)
+		return NULL;
+	
+	radius = (size_t)ceil(3.0 * sigma);
+	*taps = 2 * radius + 1;
+	weights = cbimage_alloc(*taps * sizeof(float));
+	if(!weights)
+		return NULL;
+	
+	if(!radius)
+	{
+		weights[0] = 1.0f;
+		return weights;
+	}
+	
+	for(i = 0; i < *taps; i++)
+	{
+		double x = (double)i - radius, weight = exp(-x * x / (2.0 * sigma * sigma));
+		
+		weights[i] = (float)weight;
+		total += weight;
+	}
+	for(i = 0; i < *taps; i++)
+		weights[i] = (float)(weights[i] / total);
+	return weights;
+}
+
+
+
+/** 
+ * \brief Creates image for the result of the filter
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_t *cbimage_filter_create(cbimage_t *image)
+{
+	return cbimage_create_uninitialized(image->width, image->height, image->type, image->format);
+}
+
+
+
+/** 
+ * Kernel is checked for separability once, then tiles of the destination rows
+ * are filtered in parallel.
+ */
+int cbimage_convolve_to(cbimage_t *dst, cbimage_t *src, const float *kernel, size_t width, size_t height, int border)
+{
+	cbimage_filter_job_t job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_CONVOLVE);
+	assert(dst != NULL);
+	assert(src != NULL);
+	assert(kernel != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(cbimage_filter_check(dst, src, border) || !width || !height)
+		return -1;
+	
+	job.count = 1;
+	job.width = width;
+	job.height = height;
+	job.combine = CBIMAGE_FILTER_COMBINE_NONE;
+	if(cbimage_filter_kernel(&job.kernels[0], kernel, width, height))
+		return -1;
+	return cbimage_filter_run(&job, dst, src, border);
+}
+
+
+
+cbimage_t *cbimage_convolve(cbimage_t *image, const float *kernel, size_t width, size_t height, int border)
+{
+	cbimage_t *out;
+	
+	assert(image != NULL);
+	
+	out = cbimage_filter_create(image);
+	if(!out)
+		return NULL;
+	
+	if(cbimage_convolve_to(out, image, kernel, width, height, border))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+
+
+int cbimage_convolve_separable_to(cbimage_t *dst, cbimage_t *src, const float *horizontal, size_t width, const float *vertical, size_t height, int border)
+{
+	cbimage_filter_job_t job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_CONVOLVE);
+	assert(dst != NULL);
+	assert(src != NULL);
+	assert(horizontal != NULL);
+	assert(vertical != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(cbimage_filter_check(dst, src, border) || !width || !height)
+		return -1;
+	
+	job.count = 1;
+	job.width = width;
+	job.height = height;
+	job.combine = CBIMAGE_FILTER_COMBINE_NONE;
+	if(cbimage_filter_separable(&job.kernels[0], horizontal, width, vertical, height))
+		return -1;
+	return cbimage_filter_run(&job, dst, src, border);
+}
+
+
+
+int cbimage_gaussian_blur_to(cbimage_t *dst, cbimage_t *src, double sigma, int border)
+{
+	float		*weights;
+	size_t	taps;
+	int			result;
+	
+	assert(dst != NULL);
+	assert(src != NULL);
+	
+	if(cbimage_filter_check(dst, src, border))
+		return -1;
+	
+	weights = cbimage_filter_gaussian(src, sigma, &taps);
+	if(!weights)
+		return -1;
+	
+	result = cbimage_convolve_separable_to(dst, src, weights, taps, weights, taps, border);
+	cbimage_release(weights);
+	return result;
+}
+
+
+
+cbimage_t *cbimage_gaussian_blur(cbimage_t *image, double sigma, int border)
+{
+	cbimage_t *out;
+	
+	assert(image != NULL);
+	
+	out = cbimage_filter_create(image);
+	if(!out)
+		return NULL;
+	
+	if(cbimage_gaussian_blur_to(out, image, sigma, border))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+
+
+/** 
+ * Blurred rows are never stored, every destination row is combined with its source
+ * row right after the vertical pass.
+ */
+int cbimage_sharpen_to(cbimage_t *dst, cbimage_t *src, double sigma, double amount, int border)
+{
+	cbimage_filter_job_t	job;
+	float									*weights;
+	size_t								taps;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_CONVOLVE);
+	assert(dst != NULL);
+	assert(src != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(cbimage_filter_check(dst, src, border) || !isfinite(amount))
+		return -1;
+	
+	weights = cbimage_filter_gaussian(src, sigma, &taps);
+	if(!weights)
+		return -1;
+	
+	job.count = 1;
+	job.width = taps;
+	job.height = taps;
+	job.combine = CBIMAGE_FILTER_COMBINE_SHARPEN;
+	job.amount = (float)amount;
+	if(cbimage_filter_separable(&job.kernels[0], weights, taps, weights, taps))
+	{
+		cbimage_release(weights);
+		return -1;
+	}
+	cbimage_release(weights);
+	return cbimage_filter_run(&job, dst, src, border);
+}
+
+
+
+cbimage_t *cbimage_sharpen(cbimage_t *image, double sigma, double amount, int border)
+{
+	cbimage_t *out;
+	
+	assert(image != NULL);
+	
+	out = cbimage_filter_create(image);
+	if(!out)
+		return NULL;
+	
+	if(cbimage_sharpen_to(out, image, sigma, amount, border))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+
+
+/** 
+ * Both derivatives are separable ([-1 0 1] along the axis and [1 2 1] / 4 across it),
+ * they are computed from the same source rows of the tile.
+ */
+int cbimage_sobel_to(cbimage_t *dst, cbimage_t *src, int border)
+{
+	static const float		derivative[3] = {-1.0f, 0.0f, 1.0f}, smooth[3] = {0.25f, 0.5f, 0.25f};
+	cbimage_filter_job_t	job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_CONVOLVE);
+	assert(dst != NULL);
+	assert(src != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(cbimage_filter_check(dst, src, border))
+		return -1;
+	
+	job.count = 2;
+	job.width = 3;
+	job.height = 3;
+	job.combine = CBIMAGE_FILTER_COMBINE_MAGNITUDE;
+	if(cbimage_filter_separable(&job.kernels[0], derivative, 3, smooth, 3))
+		return -1;
+	if(cbimage_filter_separable(&job.kernels[1], smooth, 3, derivative, 3))
+	{
+		cbimage_release(job.kernels[0].weights);
+		return -1;
+	}
+	return cbimage_filter_run(&job, dst, src, border);
+}
+
+
+
+cbimage_t *cbimage_sobel(cbimage_t *image, int border)
+{
+	cbimage_t *out;
+	
+	assert(image != NULL);
+	
+	out = cbimage_filter_create(image);
+	if(!out)
+		return NULL;
+	
+	if(cbimage_sobel_to(out, image, border))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+
+
+/** 
+ * \brief Blurs band of the destination rows by the running sums
+ * 
+ * Columns of the window are summed first: row entering the window is added and row
+ * leaving it is subtracted. Then the sums of the columns get border pixels and
+ * the running sum along the row gives the sum of the window. Sums are kept in doubles,
+ * they are exact for 16 bit channels, so no error is accumulated along the image.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_box_band(void *context, size_t begin, size_t end)
+{
+	cbimage_box_job_t	*job = context;
+	cbimage_t					*dst = job->dst, *src = job->src;
+	size_t						values = 4 * dst->width, rx = job->radius_x, ry = job->radius_y;
+	size_t						first = begin * job->band, last = (end * job->band < dst->height) ? (end * job->band) : (dst->height);
+	double						scale = 1.0 / ((double)(2 * rx + 1) * (double)(2 * ry + 1));
+	double						*columns, *padded;
+	cbpixel_t					*pixels;
+	float							*row;
+	ptrdiff_t					j;
+	size_t						x, y, c;
+	
+	/* Sums of the columns are kept between the border pixels, padded sums have one more
+	 * pixel, so the running sum may read one pixel past the window */
+	pixels = cbimage_alloc(dst->width * sizeof(cbpixel_t) + values * sizeof(float) + (values + 4 * (2 * rx + 1)) * sizeof(double));
+	if(!pixels)
+	{
+		atomic_store(&job->failed, 1);
+		return;
+	}
+	row = (float*)(pixels + dst->width);
+	padded = (double*)(row + values);
+	columns = padded + 4 * rx;
+	
+	memset(columns, 0, values * sizeof(double));
+	for(j = (ptrdiff_t)first - (ptrdiff_t)ry; j <= (ptrdiff_t)(first + ry); j++)
+	{
+		if(cbimage_filter_load(row, src, j, 0, 0, job->border, pixels))
+			continue;
+		for(x = 0; x < values; x++)
+			columns[x] += row[x];
+	}
+	
+	for(y = first; y < last; y++)
+	{
+		double sum[4] = {0.0, 0.0, 0.0, 0.0};
+		
+		for(x = 0; x < 2 * rx + 1; x++)
+		{
+			ptrdiff_t column = cbimage_filter_border((ptrdiff_t)((x < rx) ? (x) : (x + dst->width)) - (ptrdiff_t)rx, dst->width, job->border);
+			double		*pixel = padded + 4 * ((x < rx) ? (x) : (x + dst->width));
+			
+			if(x == 2 * rx)
+				column = -1;
+			if(column < 0)
+				memset(pixel, 0, 4 * sizeof(double));
+			else
+				memcpy(pixel, columns + 4 * column, 4 * sizeof(double));
+		}
+		
+		for(x = 0; x < 4 * (2 * rx + 1); x += 4)
+		{
+			for(c = 0; c < 4; c++)
+				sum[c] += padded[x + c];
+		}
+		
+		for(x = 0; x < values; x += 4)
+		{
+			const double *enter = padded + x + 4 * (2 * rx + 1), *leave = padded + x;
+			
+			for(c = 0; c < 4; c++)
+			{
+				row[x + c] = (float)(sum[c] * scale);
+				sum[c] += enter[c] - leave[c];
+			}
+		}
+		cbimage_float_row_store(dst, y, row, pixels);
+		
+		if(y + 1 == last)
+			break;
+		
+		if(!cbimage_filter_load(row, src, (ptrdiff_t)(y + ry + 1), 0, 0, job->border, pixels))
+		{
+			for(x = 0; x < values; x++)
+				columns[x] += row[x];
+		}
+		if(!cbimage_filter_load(row, src, (ptrdiff_t)y - (ptrdiff_t)ry, 0, 0, job->border, pixels))
+		{
+			for(x = 0; x < values; x++)
+				columns[x] -= row[x];
+		}
+	}
+	
+	cbimage_release(pixels);
+}
+
+
+
+/** 
+ * Rows are split into bands not lower than the window, every band keeps its own
+ * sums of the columns.
+ */
+int cbimage_box_blur_to(cbimage_t *dst, cbimage_t *src, size_t radius_x, size_t radius_y, int border)
+{
+	cbimage_box_job_t job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_BOX_BLUR);
+	assert(dst != NULL);
+	assert(src != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(cbimage_filter_check(dst, src, border))
+		return -1;
+	if(radius_x > (SIZE_MAX / 64 - dst->width) / 2 || radius_y > (size_t)PTRDIFF_MAX / 4)
+		return -1;
+	
+	job.dst = dst;
+	job.src = src;
+	job.radius_x = radius_x;
+	job.radius_y = radius_y;
+	job.border = border;
+	job.band = (2 * radius_y + 1 > CBIMAGE_FILTER_BOX_BAND) ? (2 * radius_y + 1) : (CBIMAGE_FILTER_BOX_BAND);
+	atomic_init(&job.failed, 0);
+	
+	cbimage_parallel_rows((dst->height + job.band - 1) / job.band, dst->width * job.band, cbimage_box_band, &job);
+	return (atomic_load(&job.failed)) ? (-1) : (0);
+}
+
+
+
+cbimage_t *cbimage_box_blur(cbimage_t *image, size_t radius_x, size_t radius_y, int border)
+{
+	cbimage_t *out;
+	
+	assert(image != NULL);
+	
+	out = cbimage_filter_create(image);
+	if(!out)
+		return NULL;
+	
+	if(cbimage_box_blur_to(out, image, radius_x, radius_y, border))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
@@ -0,0 +1,674 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#ifndef LIB_C_BASIC_IMAGE_INTERNAL_HEADER
+#define LIB_C_BASIC_IMAGE_INTERNAL_HEADER
+
+#include <cbimage.h>
+
+#include <string.h>
+#include <stddef.h>
+
+/** 
+ * \brief Default value of cbimage_set_parallel_threshold()
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_DEFAULT_THRESHOLD 65536
+
+/** 
+ * \brief Band worker
+ * 
+ * Function that processes items (usually rows) from *begin* (inclusive) to *end* (exclusive).
+ * 
+ * \warning This type ment to be used *ONLY* internaly.
+ */
+typedef void (*cbimage_band_fn)(void *context, size_t begin, size_t end);
+
+/** 
+ * \brief Processes *count* items in parallel on the shared thread pool
+ * 
+ * Items are claimed by threads in chunks of *grain* items, threads that finished
+ * their share take chunks of others. Function returns only when all items are processed.
+ * Loops started from inside of a band function are processed by the calling thread.
+ * 
+ * \param count - total amount of items
+ * \param grain - amount of items claimed at once
+ * \param band - function that processes a range of items
+ * \param context - pointer that will be passed to the *band* function
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_parallel_for(size_t count, size_t grain, cbimage_band_fn band, void *context);
+
+/** 
+ * \brief Processes rows of an image in parallel
+ * 
+ * Chooses the grain from the row length and processes images smaller than
+ * the threshold (see cbimage_set_parallel_threshold()) in the calling thread.
+ * 
+ * \param rows - total amount of rows
+ * \param row_pixels - amount of pixels in a row
+ * \param band - function that processes a range of rows
+ * \param context - pointer that will be passed to the *band* function
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_parallel_rows(size_t rows, size_t row_pixels, cbimage_band_fn band, void *context);
+
+/** 
+ * \brief Default value of cbimage_set_pool_limit()
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_DEFAULT_POOL (256 << 20)
+
+/** 
+ * \brief Allocates memory through the allocator set by cbimage_set_allocator()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void *cbimage_alloc(size_t bytes);
+
+/** 
+ * \brief Releases memory allocated by cbimage_alloc()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_release(void *pointer);
+
+/** 
+ * \brief Largest pixel buffer, size classes of the bigger ones do not fit into size_t
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_MAX_PIXELS (SIZE_MAX >> 2)
+
+/** 
+ * \brief Allocates aligned pixel buffer, reusing buffers from the pool
+ * 
+ * \param bytes - size of the buffer, no more than CBIMAGE_MAX_PIXELS
+ * \param zero - nonzero if buffer must be filled by zeros, buffers that will
+ * be fully overwritten should not be zeroed
+ * \return Returns buffer aligned to 64 bytes or NULL if there is not enough memory
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+uint8_t *cbimage_pixels_alloc(size_t bytes, int zero);
+
+/** 
+ * \brief Returns pixel buffer allocated by cbimage_pixels_alloc() to the pool
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_pixels_release(uint8_t *pixels);
+
+/** 
+ * \brief Grows the buffer by *bytes*
+ * 
+ * \return Returns memory of the appended bytes or NULL if there is not enough memory (buffer is not changed)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+uint8_t *cbimage_buffer_append(cbimage_buffer_t *buffer, size_t bytes);
+
+/** 
+ * \brief Creates image, which pixels are not initialized
+ * 
+ * Same as cbimage_create_format(), but for images that will be fully overwritten.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+cbimage_t *cbimage_create_uninitialized(size_t width, size_t height, int type, int format);
+
+/** 
+ * \brief Default memory limit of cbimage_batch_bmp()
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_DEFAULT_BATCH_MEMORY ((size_t)512 << 20)
+
+/** 
+ * \brief Estimates memory used by cbimage_pipeline_run_bmp() for the image of given size
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+size_t cbimage_pipeline_bmp_memory(cbimage_pipeline_t *pipeline, size_t width, size_t height);
+
+/** 
+ * \brief Contiguous bytes of the whole file
+ * 
+ * File is mapped into the memory (or readed at once if mapping is not available).
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	const uint8_t	*data;
+	size_t				size;
+	uint8_t				*owned;
+	int						mapped;
+} cbimage_source_t;
+
+/** 
+ * \brief Makes the whole file available in the memory
+ * 
+ * \param source - source to fill
+ * \param filename - filename of the file
+ * \param min_size - files shorter than *min_size* bytes are rejected as not valid
+ * \return Returns 0 if succsesfull or -1 if failed (error is printed)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+int cbimage_source_open(cbimage_source_t *source, char *filename, size_t min_size);
+
+/** 
+ * \brief Releases the memory of the file opened by cbimage_source_open()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_source_close(cbimage_source_t *source);
+
+/** 
+ * \brief Decodes BMP file that is already in the memory (see cbimage_load_bmp_scaled())
+ * 
+ * \param data - whole file
+ * \param size - size of the file in bytes
+ * \param name - name of the file for the error messages
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+cbimage_t *cbimage_bmp_decode(const uint8_t *data, size_t size, int format, size_t scale, const char *name);
+
+/** 
+ * \brief Gets size of the BMP file written by cbimage_bmp_encode()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+size_t cbimage_bmp_encoded_size(cbimage_t *image, int bpp);
+
+/** 
+ * \brief Encodes the whole BMP file into the memory (*bpp* must be supported by cbimage_save_bmp())
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_bmp_encode(uint8_t *data, cbimage_t *image, int bpp);
+
+/** 
+ * \brief Length of the pixel pattern used by kernels
+ * 
+ * Divisible by every pixel size (3, 4 and 8 bytes) and by the widest vector (32 bytes).
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_PATTERN 96
+
+/** 
+ * \brief Table of the per-row kernels implemented for one instruction set
+ * 
+ * 	- xor_bytes - XORs *bytes* of *dst* with the repeated *pattern*
+ * 	- fill_bytes - fills *bytes* of *dst* with the repeated *pattern*
+ * 	- mirror - reverses order of *width* pixels of *size* bytes in place
+ * 	- mirror_copy - writes *width* pixels of *src* into *dst* in reverse order
+ * 	- copy - copies *bytes* from *src* to *dst* (regions do not overlap)
+ * 	- blend - blends *width* pixels of *src* over *dst*, both in *format* (see cbimage_blend()),
+ * 	  *opaque* makes source alpha maximal
+ * 	- resample_row - computes *width* pixels of 4 floats, pixel *x* is the sum of *taps* pixels
+ * 	  of *src* starting from *first[x]* multiplied by *weights[x * taps]*.. (see cbimage_resize())
+ * 	- resample_lines - computes *count* floats, float *i* is the sum of floats *i* of *taps* lines
+ * 	  (*stride* floats apart) multiplied by *weights*
+ * 	- convolve_row - adds to *count* floats of *dst* the sum of *taps* floats of *src* starting
+ * 	  from the same float, 4 floats (one pixel) apart, multiplied by *weights* (see cbimage_convolve())
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	void (*xor_bytes)(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN]);
+	void (*fill_bytes)(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN]);
+	void (*mirror)(uint8_t *row, size_t width, size_t size);
+	void (*mirror_copy)(uint8_t *dst, const uint8_t *src, size_t width, size_t size);
+	void (*copy)(uint8_t *dst, const uint8_t *src, size_t bytes);
+	void (*blend)(uint8_t *dst, const uint8_t *src, size_t width, int format, int mode, int opaque);
+	void (*resample_row)(float *dst, const float *src, size_t width, const size_t *first, const float *weights, size_t taps);
+	void (*resample_lines)(float *dst, const float *lines, size_t stride, const float *weights, size_t taps, size_t count);
+	void (*convolve_row)(float *dst, const float *src, const float *weights, size_t taps, size_t count);
+} cbimage_kernels_t;
+
+extern const cbimage_kernels_t cbimage_kernels_scalar;
+extern const cbimage_kernels_t cbimage_kernels_sse2;
+extern const cbimage_kernels_t cbimage_kernels_avx2;
+
+/** 
+ * \brief Gets kernels of the instruction set selected for this CPU
+ * 
+ * Instruction set is detected once (see cbimage_set_isa()).
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+const cbimage_kernels_t *cbimage_kernels(void);
+
+/** 
+ * \brief Fills pattern by repeating the pixel
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_pattern(uint8_t pattern[CBIMAGE_PATTERN], const uint8_t *pixel, size_t size);
+
+/** 
+ * \brief Scalar kernels, SIMD kernels use them for the tails
+ * 
+ * \warning These functions ment to be used *ONLY* internaly.
+ */
+void cbimage_scalar_xor_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN]);
+void cbimage_scalar_fill_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN]);
+void cbimage_scalar_mirror(uint8_t *row, size_t width, size_t size);
+void cbimage_scalar_mirror_copy(uint8_t *dst, const uint8_t *src, size_t width, size_t size);
+void cbimage_scalar_blend(uint8_t *dst, const uint8_t *src, size_t width, int format, int mode, int opaque);
+void cbimage_scalar_resample_row(float *dst, const float *src, size_t width, const size_t *first, const float *weights, size_t taps);
+void cbimage_scalar_resample_lines(float *dst, const float *lines, size_t stride, const float *weights, size_t taps, size_t count);
+void cbimage_scalar_convolve_row(float *dst, const float *src, const float *weights, size_t taps, size_t count);
+
+/** 
+ * \brief Converts row of the image into 4 floats per pixel (channels of 16 bit range)
+ * 
+ * \param dst - receives 4 * width floats
+ * \param pixels - buffer of the image width for 16 bit channels
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_float_row_load(float *dst, const cbimage_t *image, size_t y, cbpixel_t *pixels);
+
+/** 
+ * \brief Writes row of 4 floats per pixel into the image, channels are rounded and clamped
+ * 
+ * \param pixels - buffer of the image width for 16 bit channels
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_float_row_store(cbimage_t *image, size_t y, const float *src, cbpixel_t *pixels);
+
+/** 
+ * \brief Part of the source image that lands inside the destination image
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	size_t src_x, src_y;
+	size_t dst_x, dst_y;
+	size_t width, height;
+} cbimage_clip_t;
+
+/** 
+ * \brief Clips *src* placed at (x, y) by the bounds of *dst*
+ * 
+ * \return Returns 0 if something is left or -1 if nothing is left
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+int cbimage_clip(cbimage_t *dst, cbimage_t *src, int x, int y, cbimage_clip_t *clip);
+
+/** 
+ * \brief Converts row of pixels from one format to another
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_convert_row(uint8_t *dst, int dst_format, const uint8_t *src, int src_format, size_t width);
+
+/** 
+ * \brief Converts *width* pixels, starting from pixel *src_x* of the row *src*, into the row *dst* at pixel *dst_x*
+ * 
+ * Unlike cbimage_convert_row() works with the bit packed rows, which pixels have no byte address.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_convert_span(uint8_t *dst, int dst_format, size_t dst_x, const uint8_t *src, int src_format, size_t src_x, size_t width);
+
+/** 
+ * \brief Converts CBIMAGE_MIRROR_* flags into the orientation
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+int cbimage_mirror_orientation(int mirror);
+
+/** 
+ * \brief Converts CBIMAGE_*_DEG angle into the orientation, 0 for unknown angles
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+int cbimage_angle_orientation(int angle);
+
+/** 
+ * \brief Checks whether orientation swaps width and height
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+int cbimage_orient_transposed(int orientation);
+
+/** 
+ * \brief Gets source addressing of the orientation
+ * 
+ * Pixel (x, y) of the reoriented image is located at (origin + x * step_x + y * step_y) of the *src*.
+ * 
+ * \param src - source image
+ * \param orientation - one of the CBIMAGE_ORIENT_* constants
+ * \param origin - returns address of the source pixel for (0, 0)
+ * \param step_x - returns distance between source pixels for neighbouring x
+ * \param step_y - returns distance between source pixels for neighbouring y
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_orient_walk(cbimage_t *src, int orientation, const uint8_t **origin, ptrdiff_t *step_x, ptrdiff_t *step_y);
+
+/** 
+ * \brief Gets size of the pixel in bytes, 0 for unknown formats
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline size_t cbimage_pixel_size(int format)
+{
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			return sizeof(cbpixel_t);
+		case CBIMAGE_FORMAT_RGB8:
+			return 3;
+		case CBIMAGE_FORMAT_RGBA8:
+			return 4;
+	}
+	return 0;
+}
+
+/** 
+ * \brief Gets size of the packed row of *width* pixels in bytes
+ * 
+ * Bit packed rows are padded to whole 64 bit words, so they are processed word by word.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline size_t cbimage_row_bytes(int format, size_t width)
+{
+	if(format == CBIMAGE_FORMAT_MONO1)
+		return ((width + 63) >> 6) << 3;
+	return width * cbimage_pixel_size(format);
+}
+
+/** 
+ * \brief Gets distance between rows of the image in bytes
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline size_t cbimage_stride(const cbimage_t *image)
+{
+	return (image->stride) ? (image->stride) : (cbimage_row_bytes(image->format, image->width));
+}
+
+/** 
+ * \brief Gets size of the image pixels without row gaps
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline size_t cbimage_bytes(const cbimage_t *image)
+{
+	return image->height * cbimage_row_bytes(image->format, image->width);
+}
+
+/** 
+ * \brief Gets pointer to the first pixel of the row
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint8_t *cbimage_row(const cbimage_t *image, size_t y)
+{
+	return image->raw + y * cbimage_stride(image);
+}
+
+/** 
+ * \brief Converts pixel stored in given format into the cbpixel_t
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline cbpixel_t cbimage_pixel_load(const uint8_t *src, int format)
+{
+	cbpixel_t pixel = {0};
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			memcpy(&pixel, src, sizeof(cbpixel_t));
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			pixel.a = src[3] << 8;
+			/* fall through */
+		case CBIMAGE_FORMAT_RGB8:
+			pixel.r = src[0] << 8;
+			pixel.g = src[1] << 8;
+			pixel.b = src[2] << 8;
+			break;
+	}
+	return pixel;
+}
+
+/** 
+ * \brief Converts cbpixel_t into the pixel stored in given format
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_pixel_store(uint8_t *dst, int format, cbpixel_t pixel)
+{
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			memcpy(dst, &pixel, sizeof(cbpixel_t));
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			dst[3] = pixel.a >> 8;
+			/* fall through */
+		case CBIMAGE_FORMAT_RGB8:
+			dst[0] = pixel.r >> 8;
+			dst[1] = pixel.g >> 8;
+			dst[2] = pixel.b >> 8;
+			break;
+	}
+}
+
+/** 
+ * \brief Stores 8 bit channels into the pixel of given format
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_pixel_store8(uint8_t *dst, int format, uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+	cbpixel_t *pixel = (cbpixel_t*)dst;
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			pixel->r = r << 8;
+			pixel->g = g << 8;
+			pixel->b = b << 8;
+			pixel->a = a << 8;
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			dst[3] = a;
+			/* fall through */
+		case CBIMAGE_FORMAT_RGB8:
+			dst[0] = r;
+			dst[1] = g;
+			dst[2] = b;
+			break;
+	}
+}
+
+/** 
+ * \brief Reads 8 bit channels (R, G, B, A order) from the pixel of given format
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_pixel_load8(const uint8_t *src, int format, uint8_t color[4])
+{
+	const cbpixel_t *pixel = (const cbpixel_t*)src;
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			color[0] = pixel->r >> 8;
+			color[1] = pixel->g >> 8;
+			color[2] = pixel->b >> 8;
+			color[3] = pixel->a >> 8;
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			memcpy(color, src, 4);
+			break;
+		case CBIMAGE_FORMAT_RGB8:
+			memcpy(color, src, 3);
+			color[3] = 0;
+			break;
+	}
+}
+
+/** 
+ * \brief Reads pixel *x* of the bit packed row
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline int cbimage_mono_get(const uint8_t *row, size_t x)
+{
+	return (row[x >> 3] >> (7 - (x & 7))) & 1;
+}
+
+/** 
+ * \brief Writes pixel *x* of the bit packed row
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_mono_set(uint8_t *row, size_t x, int bit)
+{
+	uint8_t mask = 0x80 >> (x & 7);
+	
+	row[x >> 3] = (bit) ? (row[x >> 3] | mask) : (row[x >> 3] & ~mask);
+}
+
+/** 
+ * \brief Converts 8 bit color into the monochrome pixel
+ * 
+ * Pixel is white if average of the channels is at least half of the range.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline int cbimage_mono_level(uint8_t r, uint8_t g, uint8_t b)
+{
+	return (unsigned)r + g + b >= 3 * 128;
+}
+
+/** 
+ * \brief Copies *width* pixels between bit packed rows
+ * 
+ * Pixels outside of the destination span are not changed. Rows must not overlap.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_mono_copy(uint8_t *dst, size_t dst_x, const uint8_t *src, size_t src_x, size_t width);
+
+/** 
+ * \brief Sets *width* pixels of the bit packed row starting from *x* to *bit*
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_mono_fill(uint8_t *row, size_t x, size_t width, int bit);
+
+/** 
+ * \brief Converts pixels from or into the bit packed row
+ * 
+ * Same as cbimage_convert_span(), used when one of the formats is CBIMAGE_FORMAT_MONO1.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_mono_convert(uint8_t *dst, int dst_format, size_t dst_x, const uint8_t *src, int src_format, size_t src_x, size_t width);
+
+/** 
+ * \brief Changes orientation of the bit packed image in place (orientations that keep rows as rows)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_mono_orient(cbimage_t *image, int orientation);
+
+/** 
+ * \brief Writes bit packed image with changed orientation into another image (see cbimage_orient_to())
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_mono_orient_to(cbimage_t *dst, cbimage_t *src, int orientation);
+
+#ifdef CBIMAGE_STATS
+/** 
+ * \brief Measurement of one call of the public function
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	int				operation;
+	int				outer;
+	uint64_t	start;
+	uint64_t	bytes;
+} cbimage_stat_scope_t;
+
+/** 
+ * \brief Starts measurement of the operation (one of CBIMAGE_STAT_*)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_stats_enter(cbimage_stat_scope_t *scope, int operation);
+
+/** 
+ * \brief Finishes measurement, adds it to the statistics and to the trace
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_stats_leave(cbimage_stat_scope_t *scope);
+
+/** 
+ * \brief Accounts allocation to the operation executed by the calling thread
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+void cbimage_stats_alloc(size_t bytes);
+
+/* Scope is finished automaticaly on every return of the function, so the
+ * instrumentation requires compiler with the cleanup attribute (GCC, Clang) */
+#define CBIMAGE_STAT_SCOPE(operation) \
+	cbimage_stat_scope_t cbimage_stat_scope __attribute__((cleanup(cbimage_stats_leave))); \
+	cbimage_stats_enter(&cbimage_stat_scope, (operation))
+#define CBIMAGE_STAT_BYTES(count) (cbimage_stat_scope.bytes = (count))
+#define CBIMAGE_STAT_ALLOC(bytes) cbimage_stats_alloc(bytes)
+#else
+#define CBIMAGE_STAT_SCOPE(operation) do {} while(0)
+#define CBIMAGE_STAT_BYTES(count) do {} while(0)
+#define CBIMAGE_STAT_ALLOC(bytes) do {} while(0)
+#endif
+
+#endif /* LIB_C_BASIC_IMAGE_INTERNAL_HEADER */
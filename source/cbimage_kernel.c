@@ -0,0 +1,322 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+/** 
+ * \brief Kernels used by the library, NULL until the first use
+ */
+static _Atomic(const cbimage_kernels_t *) cbimage_active_kernels = NULL;
+
+/** 
+ * \brief Instruction set of the cbimage_active_kernels
+ */
+static atomic_int cbimage_active_isa = CBIMAGE_ISA_SCALAR;
+
+
+
+void cbimage_pattern(uint8_t pattern[CBIMAGE_PATTERN], const uint8_t *pixel, size_t size)
+{
+	size_t i;
+	
+	assert(size && !(CBIMAGE_PATTERN % size));
+	
+	for(i = 0; i < CBIMAGE_PATTERN; i += size)
+		memcpy(pattern + i, pixel, size);
+}
+
+
+
+void cbimage_scalar_xor_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN])
+{
+	uint64_t	words[CBIMAGE_PATTERN / 8];
+	size_t		i, t;
+	
+	memcpy(words, pattern, CBIMAGE_PATTERN);
+	
+	for(i = 0; i + CBIMAGE_PATTERN <= bytes; i += CBIMAGE_PATTERN)
+	{
+		for(t = 0; t < CBIMAGE_PATTERN / 8; t++)
+		{
+			uint64_t word;
+			
+			memcpy(&word, dst + i + t * 8, 8);
+			word ^= words[t];
+			memcpy(dst + i + t * 8, &word, 8);
+		}
+	}
+	
+	for(t = 0; i < bytes; i++, t++)
+		dst[i] ^= pattern[t];
+}
+
+
+
+void cbimage_scalar_fill_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN])
+{
+	size_t i;
+	
+	for(i = 0; i + CBIMAGE_PATTERN <= bytes; i += CBIMAGE_PATTERN)
+		memcpy(dst + i, pattern, CBIMAGE_PATTERN);
+	
+	memcpy(dst + i, pattern, bytes - i);
+}
+
+
+
+/** 
+ * \brief Reverses row in place
+ * 
+ * Kernel is generated for every pixel size, so the pixel swap is a fixed size move.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_SCALAR_MIRROR(size) \
+static void cbimage_scalar_mirror##size(uint8_t *row, size_t width) \
+{ \
+	uint8_t	pixel[size]; \
+	uint8_t	*end = row + width * size; \
+	\
+	while(end - row >= 2 * size) \
+	{ \
+		end -= size; \
+		memcpy(pixel, row, size); \
+		memcpy(row, end, size); \
+		memcpy(end, pixel, size); \
+		row += size; \
+	} \
+}
+
+/** 
+ * \brief Copies row in reverse pixel order
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_SCALAR_MIRROR_COPY(size) \
+static void cbimage_scalar_mirror_copy##size(uint8_t *dst, const uint8_t *src, size_t width) \
+{ \
+	const uint8_t *from = src + width * size; \
+	\
+	while(from != src) \
+	{ \
+		from -= size; \
+		memcpy(dst, from, size); \
+		dst += size; \
+	} \
+}
+
+CBIMAGE_SCALAR_MIRROR(3)
+CBIMAGE_SCALAR_MIRROR(4)
+CBIMAGE_SCALAR_MIRROR(8)
+
+CBIMAGE_SCALAR_MIRROR_COPY(3)
+CBIMAGE_SCALAR_MIRROR_COPY(4)
+CBIMAGE_SCALAR_MIRROR_COPY(8)
+
+
+
+void cbimage_scalar_mirror(uint8_t *row, size_t width, size_t size)
+{
+	switch(size)
+	{
+		case 3:
+			cbimage_scalar_mirror3(row, width);
+			break;
+		case 4:
+			cbimage_scalar_mirror4(row, width);
+			break;
+		case 8:
+			cbimage_scalar_mirror8(row, width);
+			break;
+	}
+}
+
+
+
+void cbimage_scalar_mirror_copy(uint8_t *dst, const uint8_t *src, size_t width, size_t size)
+{
+	switch(size)
+	{
+		case 3:
+			cbimage_scalar_mirror_copy3(dst, src, width);
+			break;
+		case 4:
+			cbimage_scalar_mirror_copy4(dst, src, width);
+			break;
+		case 8:
+			cbimage_scalar_mirror_copy8(dst, src, width);
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Scalar copy kernel
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_scalar_copy(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+	memcpy(dst, src, bytes);
+}
+
+
+
+const cbimage_kernels_t cbimage_kernels_scalar = {
+	cbimage_scalar_xor_bytes,
+	cbimage_scalar_fill_bytes,
+	cbimage_scalar_mirror,
+	cbimage_scalar_mirror_copy,
+	cbimage_scalar_copy,
+	cbimage_scalar_blend,
+	cbimage_scalar_resample_row,
+	cbimage_scalar_resample_lines,
+	cbimage_scalar_convolve_row
+};
+
+
+
+/** 
+ * \brief Checks whether CPU and the library build support instruction set
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_isa_supported(int isa)
+{
+	switch(isa)
+	{
+		case CBIMAGE_ISA_SCALAR:
+			return 1;
+#ifdef CBIMAGE_HAVE_SSE2
+		case CBIMAGE_ISA_SSE2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("sse2");
+#endif
+#ifdef CBIMAGE_HAVE_AVX2
+		case CBIMAGE_ISA_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2");
+#endif
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Gets kernel table of the instruction set
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static const cbimage_kernels_t *cbimage_isa_kernels(int isa)
+{
+	switch(isa)
+	{
+#ifdef CBIMAGE_HAVE_SSE2
+		case CBIMAGE_ISA_SSE2:
+			return &cbimage_kernels_sse2;
+#endif
+#ifdef CBIMAGE_HAVE_AVX2
+		case CBIMAGE_ISA_AVX2:
+			return &cbimage_kernels_avx2;
+#endif
+	}
+	return &cbimage_kernels_scalar;
+}
+
+
+
+/** 
+ * \brief Picks the best instruction set, CBIMAGE_ISA environment variable may override it
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_isa_detect(void)
+{
+	const char	*forced = getenv("CBIMAGE_ISA");
+	int					isa = CBIMAGE_ISA_AUTO;
+	
+	if(forced)
+	{
+		if(!strcmp(forced, "scalar"))
+			isa = CBIMAGE_ISA_SCALAR;
+		else if(!strcmp(forced, "sse2"))
+			isa = CBIMAGE_ISA_SSE2;
+		else if(!strcmp(forced, "avx2"))
+			isa = CBIMAGE_ISA_AVX2;
+		
+		if(isa != CBIMAGE_ISA_AUTO && cbimage_isa_supported(isa))
+			return isa;
+	}
+	
+	if(cbimage_isa_supported(CBIMAGE_ISA_AVX2))
+		return CBIMAGE_ISA_AVX2;
+	if(cbimage_isa_supported(CBIMAGE_ISA_SSE2))
+		return CBIMAGE_ISA_SSE2;
+	return CBIMAGE_ISA_SCALAR;
+}
+
+
+
+const cbimage_kernels_t *cbimage_kernels(void)
+{
+	const cbimage_kernels_t *kernels = atomic_load_explicit(&cbimage_active_kernels, memory_order_acquire);
+	
+	if(!kernels)
+	{
+		cbimage_set_isa(CBIMAGE_ISA_AUTO);
+		kernels = atomic_load_explicit(&cbimage_active_kernels, memory_order_acquire);
+	}
+	return kernels;
+}
+
+
+
+int cbimage_set_isa(int isa)
+{
+	if(isa == CBIMAGE_ISA_AUTO)
+		isa = cbimage_isa_detect();
+	
+	if(!cbimage_isa_supported(isa))
+		return -1;
+	
+	atomic_store(&cbimage_active_isa, isa);
+	atomic_store_explicit(&cbimage_active_kernels, cbimage_isa_kernels(isa), memory_order_release);
+	return 0;
+}
+
+
+
+int cbimage_get_isa(void)
+{
+	cbimage_kernels();
+	return atomic_load(&cbimage_active_isa);
+}
@@ -0,0 +1,412 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#ifdef CBIMAGE_HAVE_AVX2
+
+#include <string.h>
+#include <immintrin.h>
+
+/** 
+ * \brief Copies bigger than this are done with non-temporal stores
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_STREAM_COPY (1 << 20)
+
+
+
+/** 
+ * \brief Reverses order of 4 byte pixels in the vector
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m256i cbimage_avx2_reverse4(__m256i v)
+{
+	return _mm256_permutevar8x32_epi32(v, _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+/** 
+ * \brief Reverses order of 8 byte pixels in the vector
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m256i cbimage_avx2_reverse8(__m256i v)
+{
+	return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+
+
+static void cbimage_avx2_xor_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN])
+{
+	__m256i	mask0 = _mm256_loadu_si256((const __m256i*)(pattern));
+	__m256i	mask1 = _mm256_loadu_si256((const __m256i*)(pattern + 32));
+	__m256i	mask2 = _mm256_loadu_si256((const __m256i*)(pattern + 64));
+	size_t	i;
+	
+	for(i = 0; i + CBIMAGE_PATTERN <= bytes; i += CBIMAGE_PATTERN)
+	{
+		__m256i *p = (__m256i*)(dst + i);
+		
+		_mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), mask0));
+		_mm256_storeu_si256(p + 1, _mm256_xor_si256(_mm256_loadu_si256(p + 1), mask1));
+		_mm256_storeu_si256(p + 2, _mm256_xor_si256(_mm256_loadu_si256(p + 2), mask2));
+	}
+	
+	cbimage_scalar_xor_bytes(dst + i, bytes - i, pattern);
+}
+
+
+
+static void cbimage_avx2_fill_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN])
+{
+	__m256i	mask0 = _mm256_loadu_si256((const __m256i*)(pattern));
+	__m256i	mask1 = _mm256_loadu_si256((const __m256i*)(pattern + 32));
+	__m256i	mask2 = _mm256_loadu_si256((const __m256i*)(pattern + 64));
+	size_t	i;
+	
+	for(i = 0; i + CBIMAGE_PATTERN <= bytes; i += CBIMAGE_PATTERN)
+	{
+		__m256i *p = (__m256i*)(dst + i);
+		
+		_mm256_storeu_si256(p, mask0);
+		_mm256_storeu_si256(p + 1, mask1);
+		_mm256_storeu_si256(p + 2, mask2);
+	}
+	
+	cbimage_scalar_fill_bytes(dst + i, bytes - i, pattern);
+}
+
+
+
+static void cbimage_avx2_mirror(uint8_t *row, size_t width, size_t size)
+{
+	uint8_t *end = row + width * size;
+	
+	if(size != 4 && size != 8)
+	{
+		cbimage_scalar_mirror(row, width, size);
+		return;
+	}
+	
+	/* Outer vectors are swapped with their lanes reversed, the middle is left to scalar code */
+	while(end - row >= 64)
+	{
+		__m256i left, right;
+		
+		end -= 32;
+		left = _mm256_loadu_si256((const __m256i*)row);
+		right = _mm256_loadu_si256((const __m256i*)end);
+		
+		if(size == 4)
+		{
+			_mm256_storeu_si256((__m256i*)row, cbimage_avx2_reverse4(right));
+			_mm256_storeu_si256((__m256i*)end, cbimage_avx2_reverse4(left));
+		} else {
+			_mm256_storeu_si256((__m256i*)row, cbimage_avx2_reverse8(right));
+			_mm256_storeu_si256((__m256i*)end, cbimage_avx2_reverse8(left));
+		}
+		row += 32;
+	}
+	
+	cbimage_scalar_mirror(row, (end - row) / size, size);
+}
+
+
+
+static void cbimage_avx2_mirror_copy(uint8_t *dst, const uint8_t *src, size_t width, size_t size)
+{
+	const uint8_t *from = src + width * size;
+	
+	if(size != 4 && size != 8)
+	{
+		cbimage_scalar_mirror_copy(dst, src, width, size);
+		return;
+	}
+	
+	while(from - src >= 32)
+	{
+		__m256i v;
+		
+		from -= 32;
+		v = _mm256_loadu_si256((const __m256i*)from);
+		v = (size == 4) ? cbimage_avx2_reverse4(v) : cbimage_avx2_reverse8(v);
+		_mm256_storeu_si256((__m256i*)dst, v);
+		dst += 32;
+	}
+	
+	cbimage_scalar_mirror_copy(dst, src, (from - src) / size, size);
+}
+
+
+
+static void cbimage_avx2_copy(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+	size_t head, i;
+	
+	if(bytes < CBIMAGE_STREAM_COPY)
+	{
+		memcpy(dst, src, bytes);
+		return;
+	}
+	
+	/* Big copies bypass the cache, so they do not evict data that is still needed */
+	head = (32 - ((uintptr_t)dst & 31)) & 31;
+	memcpy(dst, src, head);
+	
+	for(i = head; i + 128 <= bytes; i += 128)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i*)(src + i + 64));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(src + i + 96));
+		
+		_mm256_stream_si256((__m256i*)(dst + i), a);
+		_mm256_stream_si256((__m256i*)(dst + i + 32), b);
+		_mm256_stream_si256((__m256i*)(dst + i + 64), c);
+		_mm256_stream_si256((__m256i*)(dst + i + 96), d);
+	}
+	
+	_mm_sfence();
+	memcpy(dst + i, src + i, bytes - i);
+}
+
+
+
+/** 
+ * \brief Computes (x * (a + 1)) >> 16 on 16 bit lanes
+ * 
+ * Low and high halves of the product are combined with the carry of (low + x),
+ * so the result is exactly the same as in the scalar blend kernel.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m256i cbimage_avx2_mul16(__m256i x, __m256i a)
+{
+	__m256i low = _mm256_mullo_epi16(x, a);
+	__m256i high = _mm256_mulhi_epu16(x, a);
+	__m256i sum = _mm256_add_epi16(low, x);
+	__m256i saturated = _mm256_adds_epu16(low, x);
+	__m256i carry = _mm256_andnot_si256(_mm256_cmpeq_epi16(sum, saturated), _mm256_set1_epi16(1));
+	
+	return _mm256_add_epi16(high, carry);
+}
+
+/** 
+ * \brief Computes (x * (a + 1)) >> 8 for 8 bit values widened to 16 bit lanes
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m256i cbimage_avx2_mul8(__m256i x, __m256i a)
+{
+	return _mm256_srli_epi16(_mm256_mullo_epi16(x, _mm256_add_epi16(a, _mm256_set1_epi16(1))), 8);
+}
+
+/** 
+ * \brief Blends pixels stored as four 16 bit lanes (R, G, B, A)
+ * 
+ * \param d - destination pixels
+ * \param s - source pixels
+ * \param mode - blend mode
+ * \param opaque - all ones to ignore source alpha, zero otherwise
+ * \param alpha - mask of the alpha lanes
+ * \param max - maximal value of the channel in every lane
+ * \param wide - nonzero for 16 bit channels, zero for 8 bit channels
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m256i cbimage_avx2_blend_vector(__m256i d, __m256i s, int mode, __m256i opaque, __m256i alpha, __m256i max, int wide)
+{
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m256i inverse, color;
+	
+	a = _mm256_or_si256(a, opaque);
+	inverse = _mm256_sub_epi16(max, a);
+	
+	switch(mode)
+	{
+		case CBIMAGE_BLEND_SRC_OVER:
+			color = (wide) ? cbimage_avx2_mul16(s, a) : cbimage_avx2_mul8(s, a);
+			color = _mm256_or_si256(_mm256_andnot_si256(alpha, color), _mm256_and_si256(alpha, a));
+			return _mm256_add_epi16(color, (wide) ? cbimage_avx2_mul16(d, inverse) : cbimage_avx2_mul8(d, inverse));
+		case CBIMAGE_BLEND_SRC_OVER_PREMULTIPLIED:
+			color = _mm256_or_si256(_mm256_andnot_si256(alpha, s), _mm256_and_si256(alpha, a));
+			return _mm256_adds_epu16(color, (wide) ? cbimage_avx2_mul16(d, inverse) : cbimage_avx2_mul8(d, inverse));
+		case CBIMAGE_BLEND_ADD:
+			color = _mm256_adds_epu16(d, (wide) ? cbimage_avx2_mul16(s, a) : cbimage_avx2_mul8(s, a));
+			return _mm256_or_si256(_mm256_andnot_si256(alpha, color), _mm256_and_si256(alpha, d));
+		case CBIMAGE_BLEND_MULTIPLY:
+			color = _mm256_add_epi16((wide) ? cbimage_avx2_mul16(s, a) : cbimage_avx2_mul8(s, a), inverse);
+			color = (wide) ? cbimage_avx2_mul16(d, color) : cbimage_avx2_mul8(d, color);
+			return _mm256_or_si256(_mm256_andnot_si256(alpha, color), _mm256_and_si256(alpha, d));
+	}
+	return d;
+}
+
+
+
+static void cbimage_avx2_blend(uint8_t *dst, const uint8_t *src, size_t width, int format, int mode, int opaque)
+{
+	__m256i	zero = _mm256_setzero_si256();
+	__m256i	alpha = _mm256_set1_epi64x((long long)0xFFFF000000000000ULL);
+	__m256i	opaque_mask;
+	size_t	i = 0;
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			opaque_mask = (opaque) ? (_mm256_set1_epi16(-1)) : (zero);
+			
+			for(; i + 4 <= width; i += 4, dst += 32, src += 32)
+			{
+				__m256i d = _mm256_loadu_si256((__m256i*)dst);
+				__m256i s = _mm256_loadu_si256((const __m256i*)src);
+				
+				_mm256_storeu_si256((__m256i*)dst, cbimage_avx2_blend_vector(d, s, mode, opaque_mask, alpha, _mm256_set1_epi16(-1), 1));
+			}
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			opaque_mask = (opaque) ? (_mm256_set1_epi16(0xFF)) : (zero);
+			
+			/* 8 bit channels are widened to 16 bit lanes and packed back with saturation */
+			for(; i + 8 <= width; i += 8, dst += 32, src += 32)
+			{
+				__m256i d = _mm256_loadu_si256((__m256i*)dst);
+				__m256i s = _mm256_loadu_si256((const __m256i*)src);
+				__m256i low = cbimage_avx2_blend_vector(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero), mode, opaque_mask, alpha, _mm256_set1_epi16(0xFF), 0);
+				__m256i high = cbimage_avx2_blend_vector(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero), mode, opaque_mask, alpha, _mm256_set1_epi16(0xFF), 0);
+				
+				_mm256_storeu_si256((__m256i*)dst, _mm256_packus_epi16(low, high));
+			}
+			break;
+	}
+	
+	cbimage_scalar_blend(dst, src, width - i, format, mode, opaque);
+}
+
+
+
+/** 
+ * \brief Horizontal pass of cbimage_resize(), two pixels of 4 channels are computed in one vector
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_avx2_resample_row(float *dst, const float *src, size_t width, const size_t *first, const float *weights, size_t taps)
+{
+	size_t x, k;
+	
+	for(x = 0; x + 2 <= width; x += 2, dst += 8, weights += 2 * taps)
+	{
+		const float	*low = src + 4 * first[x], *high = src + 4 * first[x + 1];
+		__m256			sum = _mm256_setzero_ps();
+		
+		for(k = 0; k < taps; k++, low += 4, high += 4)
+		{
+			__m256 weight = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(weights[k])), _mm_set1_ps(weights[taps + k]), 1);
+			__m256 pixels = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+			
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(weight, pixels));
+		}
+		
+		_mm256_storeu_ps(dst, sum);
+	}
+	
+	cbimage_scalar_resample_row(dst, src, width - x, first + x, weights, taps);
+}
+
+
+
+/** 
+ * \brief Vertical pass of cbimage_resize(), every vector is summed over all lines in the register
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_avx2_resample_lines(float *dst, const float *lines, size_t stride, const float *weights, size_t taps, size_t count)
+{
+	size_t i, k;
+	
+	for(i = 0; i + 8 <= count; i += 8)
+	{
+		const float	*from = lines + i;
+		__m256			sum = _mm256_setzero_ps();
+		
+		for(k = 0; k < taps; k++, from += stride)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(from)));
+		
+		_mm256_storeu_ps(dst + i, sum);
+	}
+	
+	cbimage_scalar_resample_lines(dst + i, lines + i, stride, weights, taps, count - i);
+}
+
+
+
+/** 
+ * \brief Horizontal pass of cbimage_convolve(), 16 floats are summed in two registers, so
+ * every broadcasted weight is used twice
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_avx2_convolve_row(float *dst, const float *src, const float *weights, size_t taps, size_t count)
+{
+	size_t i, k;
+	
+	for(i = 0; i + 16 <= count; i += 16)
+	{
+		const float	*from = src + i;
+		__m256			low = _mm256_loadu_ps(dst + i), high = _mm256_loadu_ps(dst + i + 8);
+		
+		for(k = 0; k < taps; k++, from += 4)
+		{
+			__m256 weight = _mm256_set1_ps(weights[k]);
+			
+			low = _mm256_add_ps(low, _mm256_mul_ps(weight, _mm256_loadu_ps(from)));
+			high = _mm256_add_ps(high, _mm256_mul_ps(weight, _mm256_loadu_ps(from + 8)));
+		}
+		
+		_mm256_storeu_ps(dst + i, low);
+		_mm256_storeu_ps(dst + i + 8, high);
+	}
+	
+	cbimage_scalar_convolve_row(dst + i, src + i, weights, taps, count - i);
+}
+
+
+
+const cbimage_kernels_t cbimage_kernels_avx2 = {
+	cbimage_avx2_xor_bytes,
+	cbimage_avx2_fill_bytes,
+	cbimage_avx2_mirror,
+	cbimage_avx2_mirror_copy,
+	cbimage_avx2_copy,
+	cbimage_avx2_blend,
+	cbimage_avx2_resample_row,
+	cbimage_avx2_resample_lines,
+	cbimage_avx2_convolve_row
+};
+
+#endif /* CBIMAGE_HAVE_AVX2 */
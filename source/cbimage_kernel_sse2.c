@@ -0,0 +1,405 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#ifdef CBIMAGE_HAVE_SSE2
+
+#include <string.h>
+#include <emmintrin.h>
+
+/** 
+ * \brief Copies bigger than this are done with non-temporal stores
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_STREAM_COPY (1 << 20)
+
+
+
+/** 
+ * \brief Reverses order of 4 byte pixels in the vector
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m128i cbimage_sse2_reverse4(__m128i v)
+{
+	return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+/** 
+ * \brief Reverses order of 8 byte pixels in the vector
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m128i cbimage_sse2_reverse8(__m128i v)
+{
+	return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+
+
+static void cbimage_sse2_xor_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN])
+{
+	__m128i	mask[CBIMAGE_PATTERN / 16];
+	size_t	i, t;
+	
+	for(t = 0; t < CBIMAGE_PATTERN / 16; t++)
+		mask[t] = _mm_loadu_si128((const __m128i*)(pattern + t * 16));
+	
+	for(i = 0; i + CBIMAGE_PATTERN <= bytes; i += CBIMAGE_PATTERN)
+	{
+		for(t = 0; t < CBIMAGE_PATTERN / 16; t++)
+		{
+			__m128i *p = (__m128i*)(dst + i + t * 16);
+			
+			_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), mask[t]));
+		}
+	}
+	
+	cbimage_scalar_xor_bytes(dst + i, bytes - i, pattern);
+}
+
+
+
+static void cbimage_sse2_fill_bytes(uint8_t *dst, size_t bytes, const uint8_t pattern[CBIMAGE_PATTERN])
+{
+	__m128i	mask[CBIMAGE_PATTERN / 16];
+	size_t	i, t;
+	
+	for(t = 0; t < CBIMAGE_PATTERN / 16; t++)
+		mask[t] = _mm_loadu_si128((const __m128i*)(pattern + t * 16));
+	
+	for(i = 0; i + CBIMAGE_PATTERN <= bytes; i += CBIMAGE_PATTERN)
+	{
+		for(t = 0; t < CBIMAGE_PATTERN / 16; t++)
+			_mm_storeu_si128((__m128i*)(dst + i + t * 16), mask[t]);
+	}
+	
+	cbimage_scalar_fill_bytes(dst + i, bytes - i, pattern);
+}
+
+
+
+static void cbimage_sse2_mirror(uint8_t *row, size_t width, size_t size)
+{
+	uint8_t *end = row + width * size;
+	
+	if(size != 4 && size != 8)
+	{
+		cbimage_scalar_mirror(row, width, size);
+		return;
+	}
+	
+	/* Outer vectors are swapped with their lanes reversed, the middle is left to scalar code */
+	while(end - row >= 32)
+	{
+		__m128i left, right;
+		
+		end -= 16;
+		left = _mm_loadu_si128((const __m128i*)row);
+		right = _mm_loadu_si128((const __m128i*)end);
+		
+		if(size == 4)
+		{
+			_mm_storeu_si128((__m128i*)row, cbimage_sse2_reverse4(right));
+			_mm_storeu_si128((__m128i*)end, cbimage_sse2_reverse4(left));
+		} else {
+			_mm_storeu_si128((__m128i*)row, cbimage_sse2_reverse8(right));
+			_mm_storeu_si128((__m128i*)end, cbimage_sse2_reverse8(left));
+		}
+		row += 16;
+	}
+	
+	cbimage_scalar_mirror(row, (end - row) / size, size);
+}
+
+
+
+static void cbimage_sse2_mirror_copy(uint8_t *dst, const uint8_t *src, size_t width, size_t size)
+{
+	const uint8_t *from = src + width * size;
+	
+	if(size != 4 && size != 8)
+	{
+		cbimage_scalar_mirror_copy(dst, src, width, size);
+		return;
+	}
+	
+	while(from - src >= 16)
+	{
+		__m128i v;
+		
+		from -= 16;
+		v = _mm_loadu_si128((const __m128i*)from);
+		v = (size == 4) ? cbimage_sse2_reverse4(v) : cbimage_sse2_reverse8(v);
+		_mm_storeu_si128((__m128i*)dst, v);
+		dst += 16;
+	}
+	
+	cbimage_scalar_mirror_copy(dst, src, (from - src) / size, size);
+}
+
+
+
+static void cbimage_sse2_copy(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+	size_t head, i;
+	
+	if(bytes < CBIMAGE_STREAM_COPY)
+	{
+		memcpy(dst, src, bytes);
+		return;
+	}
+	
+	/* Big copies bypass the cache, so they do not evict data that is still needed */
+	head = (16 - ((uintptr_t)dst & 15)) & 15;
+	memcpy(dst, src, head);
+	
+	for(i = head; i + 64 <= bytes; i += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + i + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + i + 48));
+		
+		_mm_stream_si128((__m128i*)(dst + i), a);
+		_mm_stream_si128((__m128i*)(dst + i + 16), b);
+		_mm_stream_si128((__m128i*)(dst + i + 32), c);
+		_mm_stream_si128((__m128i*)(dst + i + 48), d);
+	}
+	
+	_mm_sfence();
+	memcpy(dst + i, src + i, bytes - i);
+}
+
+
+
+/** 
+ * \brief Computes (x * (a + 1)) >> 16 on 16 bit lanes
+ * 
+ * Low and high halves of the product are combined with the carry of (low + x),
+ * so the result is exactly the same as in the scalar blend kernel.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m128i cbimage_sse2_mul16(__m128i x, __m128i a)
+{
+	__m128i low = _mm_mullo_epi16(x, a);
+	__m128i high = _mm_mulhi_epu16(x, a);
+	__m128i sum = _mm_add_epi16(low, x);
+	__m128i saturated = _mm_adds_epu16(low, x);
+	__m128i carry = _mm_andnot_si128(_mm_cmpeq_epi16(sum, saturated), _mm_set1_epi16(1));
+	
+	return _mm_add_epi16(high, carry);
+}
+
+/** 
+ * \brief Computes (x * (a + 1)) >> 8 for 8 bit values widened to 16 bit lanes
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m128i cbimage_sse2_mul8(__m128i x, __m128i a)
+{
+	return _mm_srli_epi16(_mm_mullo_epi16(x, _mm_add_epi16(a, _mm_set1_epi16(1))), 8);
+}
+
+/** 
+ * \brief Blends pixels stored as four 16 bit lanes (R, G, B, A)
+ * 
+ * \param d - destination pixels
+ * \param s - source pixels
+ * \param mode - blend mode
+ * \param opaque - all ones to ignore source alpha, zero otherwise
+ * \param alpha - mask of the alpha lanes
+ * \param max - maximal value of the channel in every lane
+ * \param wide - nonzero for 16 bit channels, zero for 8 bit channels
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline __m128i cbimage_sse2_blend_vector(__m128i d, __m128i s, int mode, __m128i opaque, __m128i alpha, __m128i max, int wide)
+{
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m128i inverse, color;
+	
+	a = _mm_or_si128(a, opaque);
+	inverse = _mm_sub_epi16(max, a);
+	
+	switch(mode)
+	{
+		case CBIMAGE_BLEND_SRC_OVER:
+			color = (wide) ? cbimage_sse2_mul16(s, a) : cbimage_sse2_mul8(s, a);
+			color = _mm_or_si128(_mm_andnot_si128(alpha, color), _mm_and_si128(alpha, a));
+			return _mm_add_epi16(color, (wide) ? cbimage_sse2_mul16(d, inverse) : cbimage_sse2_mul8(d, inverse));
+		case CBIMAGE_BLEND_SRC_OVER_PREMULTIPLIED:
+			color = _mm_or_si128(_mm_andnot_si128(alpha, s), _mm_and_si128(alpha, a));
+			return _mm_adds_epu16(color, (wide) ? cbimage_sse2_mul16(d, inverse) : cbimage_sse2_mul8(d, inverse));
+		case CBIMAGE_BLEND_ADD:
+			color = _mm_adds_epu16(d, (wide) ? cbimage_sse2_mul16(s, a) : cbimage_sse2_mul8(s, a));
+			return _mm_or_si128(_mm_andnot_si128(alpha, color), _mm_and_si128(alpha, d));
+		case CBIMAGE_BLEND_MULTIPLY:
+			color = _mm_add_epi16((wide) ? cbimage_sse2_mul16(s, a) : cbimage_sse2_mul8(s, a), inverse);
+			color = (wide) ? cbimage_sse2_mul16(d, color) : cbimage_sse2_mul8(d, color);
+			return _mm_or_si128(_mm_andnot_si128(alpha, color), _mm_and_si128(alpha, d));
+	}
+	return d;
+}
+
+
+
+static void cbimage_sse2_blend(uint8_t *dst, const uint8_t *src, size_t width, int format, int mode, int opaque)
+{
+	__m128i	zero = _mm_setzero_si128();
+	__m128i	alpha = _mm_set1_epi64x((long long)0xFFFF000000000000ULL);
+	__m128i	opaque_mask;
+	size_t	i = 0;
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			opaque_mask = (opaque) ? (_mm_set1_epi16(-1)) : (zero);
+			
+			for(; i + 2 <= width; i += 2, dst += 16, src += 16)
+			{
+				__m128i d = _mm_loadu_si128((__m128i*)dst);
+				__m128i s = _mm_loadu_si128((const __m128i*)src);
+				
+				_mm_storeu_si128((__m128i*)dst, cbimage_sse2_blend_vector(d, s, mode, opaque_mask, alpha, _mm_set1_epi16(-1), 1));
+			}
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			opaque_mask = (opaque) ? (_mm_set1_epi16(0xFF)) : (zero);
+			
+			/* 8 bit channels are widened to 16 bit lanes and packed back with saturation */
+			for(; i + 4 <= width; i += 4, dst += 16, src += 16)
+			{
+				__m128i d = _mm_loadu_si128((__m128i*)dst);
+				__m128i s = _mm_loadu_si128((const __m128i*)src);
+				__m128i low = cbimage_sse2_blend_vector(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), mode, opaque_mask, alpha, _mm_set1_epi16(0xFF), 0);
+				__m128i high = cbimage_sse2_blend_vector(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), mode, opaque_mask, alpha, _mm_set1_epi16(0xFF), 0);
+				
+				_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(low, high));
+			}
+			break;
+	}
+	
+	cbimage_scalar_blend(dst, src, width - i, format, mode, opaque);
+}
+
+
+
+/** 
+ * \brief Horizontal pass of cbimage_resize(), 4 channels of the pixel are computed in one vector
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_sse2_resample_row(float *dst, const float *src, size_t width, const size_t *first, const float *weights, size_t taps)
+{
+	size_t x, k;
+	
+	for(x = 0; x < width; x++, dst += 4, weights += taps)
+	{
+		const float	*from = src + 4 * first[x];
+		__m128			sum = _mm_setzero_ps();
+		
+		for(k = 0; k < taps; k++, from += 4)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(from)));
+		
+		_mm_storeu_ps(dst, sum);
+	}
+}
+
+
+
+/** 
+ * \brief Vertical pass of cbimage_resize(), every vector is summed over all lines in the register
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_sse2_resample_lines(float *dst, const float *lines, size_t stride, const float *weights, size_t taps, size_t count)
+{
+	size_t i, k;
+	
+	for(i = 0; i + 4 <= count; i += 4)
+	{
+		const float	*from = lines + i;
+		__m128			sum = _mm_setzero_ps();
+		
+		for(k = 0; k < taps; k++, from += stride)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(from)));
+		
+		_mm_storeu_ps(dst + i, sum);
+	}
+	
+	cbimage_scalar_resample_lines(dst + i, lines + i, stride, weights, taps, count - i);
+}
+
+
+
+/** 
+ * \brief Horizontal pass of cbimage_convolve(), 8 floats are summed in two registers, so
+ * every broadcasted weight is used twice
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_sse2_convolve_row(float *dst, const float *src, const float *weights, size_t taps, size_t count)
+{
+	size_t i, k;
+	
+	for(i = 0; i + 8 <= count; i += 8)
+	{
+		const float	*from = src + i;
+		__m128			low = _mm_loadu_ps(dst + i), high = _mm_loadu_ps(dst + i + 4);
+		
+		for(k = 0; k < taps; k++, from += 4)
+		{
+			__m128 weight = _mm_set1_ps(weights[k]);
+			
+			low = _mm_add_ps(low, _mm_mul_ps(weight, _mm_loadu_ps(from)));
+			high = _mm_add_ps(high, _mm_mul_ps(weight, _mm_loadu_ps(from + 4)));
+		}
+		
+		_mm_storeu_ps(dst + i, low);
+		_mm_storeu_ps(dst + i + 4, high);
+	}
+	
+	cbimage_scalar_convolve_row(dst + i, src + i, weights, taps, count - i);
+}
+
+
+
+const cbimage_kernels_t cbimage_kernels_sse2 = {
+	cbimage_sse2_xor_bytes,
+	cbimage_sse2_fill_bytes,
+	cbimage_sse2_mirror,
+	cbimage_sse2_mirror_copy,
+	cbimage_sse2_copy,
+	cbimage_sse2_blend,
+	cbimage_sse2_resample_row,
+	cbimage_sse2_resample_lines,
+	cbimage_sse2_convolve_row
+};
+
+#endif /* CBIMAGE_HAVE_SSE2 */
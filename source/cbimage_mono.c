@@ -0,0 +1,556 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <string.h>
+#include <stddef.h>
+
+/** 
+ * \brief Amount of destination rows written by one item of the transposing orientation
+ * 
+ * Rows of blocks of one item read the same cache lines of the source rows.
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_MONO_TILE 64
+
+
+
+/** 
+ * \brief Reads 8 bytes as big endian word, so the first pixel becomes the most significant bit
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint64_t cbimage_mono_read64(const uint8_t *bytes)
+{
+	uint64_t	value = 0;
+	size_t		i;
+	
+	for(i = 0; i < 8; i++)
+		value = (value << 8) | bytes[i];
+	return value;
+}
+
+
+
+/** 
+ * \brief Writes word as 8 big endian bytes
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_mono_write64(uint8_t *bytes, uint64_t value)
+{
+	size_t i;
+	
+	for(i = 0; i < 8; i++)
+		bytes[i] = (uint8_t)(value >> (56 - 8 * i));
+}
+
+
+
+/** 
+ * \brief Reads *count* (1 to 64) pixels starting from the pixel *x*
+ * 
+ * Pixels are returned in the most significant bits of the word, other bits are zero.
+ * Only bytes that hold the pixels are readed.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint64_t cbimage_mono_load(const uint8_t *row, size_t x, size_t count)
+{
+	const uint8_t	*bytes = row + (x >> 3);
+	size_t				shift = x & 7, length = (shift + count + 7) >> 3, i;
+	uint64_t			value = 0;
+	
+	if(length >= 8)
+	{
+		value = cbimage_mono_read64(bytes) << shift;
+		if(length > 8)
+			value |= bytes[8] >> (8 - shift);
+	} else {
+		for(i = 0; i < length; i++)
+			value |= (uint64_t)bytes[i] << (56 - 8 * i);
+		value <<= shift;
+	}
+	return value & (~(uint64_t)0 << (64 - count));
+}
+
+
+
+/** 
+ * \brief Writes *count* (1 to 64) most significant bits of the *value* starting from the pixel *x*
+ * 
+ * Other pixels of the touched bytes are kept.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_mono_store(uint8_t *row, size_t x, size_t count, uint64_t value)
+{
+	uint8_t		*bytes = row + (x >> 3);
+	size_t		shift = x & 7, length = (shift + count + 7) >> 3, i;
+	uint64_t	mask = ~(uint64_t)0 << (64 - count);
+	
+	value &= mask;
+	
+	if(!shift && count == 64)
+	{
+		cbimage_mono_write64(bytes, value);
+		return;
+	}
+	
+	for(i = 0; i < length && i < 8; i++)
+	{
+		uint8_t byte_mask = (uint8_t)((mask >> shift) >> (56 - 8 * i));
+		
+		bytes[i] = (bytes[i] & ~byte_mask) | (uint8_t)((value >> shift) >> (56 - 8 * i));
+	}
+	
+	/* Bits shifted out of the word land in the ninth byte */
+	if(length > 8)
+	{
+		uint8_t byte_mask = (uint8_t)(mask << (8 - shift));
+		
+		bytes[8] = (bytes[8] & ~byte_mask) | (uint8_t)(value << (8 - shift));
+	}
+}
+
+
+
+/** 
+ * \brief Reverses order of bits in the word
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint64_t cbimage_mono_reverse(uint64_t value)
+{
+	value = ((value >> 1) & 0x5555555555555555ULL) | ((value & 0x5555555555555555ULL) << 1);
+	value = ((value >> 2) & 0x3333333333333333ULL) | ((value & 0x3333333333333333ULL) << 2);
+	value = ((value >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((value & 0x0F0F0F0F0F0F0F0FULL) << 4);
+	value = ((value >> 8) & 0x00FF00FF00FF00FFULL) | ((value & 0x00FF00FF00FF00FFULL) << 8);
+	value = ((value >> 16) & 0x0000FFFF0000FFFFULL) | ((value & 0x0000FFFF0000FFFFULL) << 16);
+	return (value >> 32) | (value << 32);
+}
+
+
+
+/** 
+ * \brief Transposes 8x8 bit matrix
+ * 
+ * Row i of the matrix is byte i of the word (counting from the most significant one),
+ * column j is bit j of the byte (counting from the most significant one).
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint64_t cbimage_mono_transpose(uint64_t value)
+{
+	uint64_t t;
+	
+	t = (value ^ (value >> 7)) & 0x00AA00AA00AA00AAULL;
+	value ^= t ^ (t << 7);
+	t = (value ^ (value >> 14)) & 0x0000CCCC0000CCCCULL;
+	value ^= t ^ (t << 14);
+	t = (value ^ (value >> 28)) & 0x00000000F0F0F0F0ULL;
+	value ^= t ^ (t << 28);
+	return value;
+}
+
+
+
+void cbimage_mono_copy(uint8_t *dst, size_t dst_x, const uint8_t *src, size_t src_x, size_t width)
+{
+	size_t i = 0;
+	
+	/* Byte aligned spans are copied as bytes, only the last partial byte is merged */
+	if(!(dst_x & 7) && !(src_x & 7))
+	{
+		i = width & ~(size_t)7;
+		memcpy(dst + (dst_x >> 3), src + (src_x >> 3), i >> 3);
+	}
+	
+	for(; i < width; i += 64)
+	{
+		size_t count = (width - i < 64) ? (width - i) : (64);
+		
+		cbimage_mono_store(dst, dst_x + i, count, cbimage_mono_load(src, src_x + i, count));
+	}
+}
+
+
+
+void cbimage_mono_fill(uint8_t *row, size_t x, size_t width, int bit)
+{
+	size_t i;
+	
+	for(i = 0; i < width; i += 64)
+		cbimage_mono_store(row, x + i, (width - i < 64) ? (width - i) : (64), (bit) ? (~(uint64_t)0) : (0));
+}
+
+
+
+/** 
+ * \brief Writes *width* pixels of *src* into *dst* in reverse order, word by word
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_mono_mirror_copy(uint8_t *dst, const uint8_t *src, size_t width)
+{
+	size_t i;
+	
+	for(i = 0; i < width; i += 64)
+	{
+		size_t count = (width - i < 64) ? (width - i) : (64);
+		
+		cbimage_mono_store(dst, i, count, cbimage_mono_reverse(cbimage_mono_load(src, width - i - count, count)) << (64 - count));
+	}
+}
+
+
+
+/** 
+ * \brief Reverses order of *width* pixels of the row in place
+ * 
+ * Words from both ends are reversed and swapped, up to 128 pixels in the middle are reversed at once.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_mono_mirror(uint8_t *row, size_t width)
+{
+	size_t		low = 0, high = width, middle;
+	uint64_t	left, right;
+	
+	for(; high - low >= 128; low += 64, high -= 64)
+	{
+		left = cbimage_mono_load(row, low, 64);
+		right = cbimage_mono_load(row, high - 64, 64);
+		cbimage_mono_store(row, low, 64, cbimage_mono_reverse(right));
+		cbimage_mono_store(row, high - 64, 64, cbimage_mono_reverse(left));
+	}
+	
+	middle = high - low;
+	if(middle > 64)
+	{
+		left = cbimage_mono_load(row, low, 64);
+		right = cbimage_mono_load(row, low + 64, middle - 64);
+		cbimage_mono_store(row, low, middle - 64, cbimage_mono_reverse(right) << (128 - middle));
+		cbimage_mono_store(row, high - 64, 64, cbimage_mono_reverse(left));
+	} else if(middle) {
+		left = cbimage_mono_load(row, low, middle);
+		cbimage_mono_store(row, low, middle, cbimage_mono_reverse(left) << (64 - middle));
+	}
+}
+
+
+
+/** 
+ * \brief Swaps *width* pixels of two rows
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_mono_swap(uint8_t *a, uint8_t *b, size_t width)
+{
+	size_t i;
+	
+	for(i = 0; i < width; i += 64)
+	{
+		size_t		count = (width - i < 64) ? (width - i) : (64);
+		uint64_t	word = cbimage_mono_load(a, i, count);
+		
+		cbimage_mono_store(a, i, count, cbimage_mono_load(b, i, count));
+		cbimage_mono_store(b, i, count, word);
+	}
+}
+
+
+
+/** 
+ * Pixels are converted by words of 64 pixels: bits of the word are expanded
+ * into two precomputed pixels or collected from the thresholded pixels.
+ */
+void cbimage_mono_convert(uint8_t *dst, int dst_format, size_t dst_x, const uint8_t *src, int src_format, size_t src_x, size_t width)
+{
+	size_t		i, j;
+	uint8_t		colors[2][sizeof(cbpixel_t)], color[4];
+	
+	if(dst_format == src_format)
+	{
+		cbimage_mono_copy(dst, dst_x, src, src_x, width);
+		return;
+	}
+	
+	if(src_format == CBIMAGE_FORMAT_MONO1)
+	{
+		size_t size = cbimage_pixel_size(dst_format);
+		
+		cbimage_pixel_store8(colors[0], dst_format, 0, 0, 0, 0);
+		cbimage_pixel_store8(colors[1], dst_format, 0xFF, 0xFF, 0xFF, 0);
+		dst += dst_x * size;
+		
+		for(i = 0; i < width; i += 64)
+		{
+			size_t		count = (width - i < 64) ? (width - i) : (64);
+			uint64_t	word = cbimage_mono_load(src, src_x + i, count);
+			
+			for(j = 0; j < count; j++, word <<= 1, dst += size)
+				memcpy(dst, colors[word >> 63], size);
+		}
+		return;
+	}
+	
+	src += src_x * cbimage_pixel_size(src_format);
+	
+	for(i = 0; i < width; i += 64)
+	{
+		size_t		count = (width - i < 64) ? (width - i) : (64);
+		uint64_t	word = 0;
+		
+		for(j = 0; j < count; j++, src += cbimage_pixel_size(src_format))
+		{
+			cbimage_pixel_load8(src, src_format, color);
+			word |= (uint64_t)cbimage_mono_level(color[0], color[1], color[2]) << (63 - j);
+		}
+		cbimage_mono_store(dst, dst_x + i, count, word);
+	}
+}
+
+
+
+/** 
+ * \brief Context of the orientation of the bit packed image
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t	*dst;
+	cbimage_t	*src;
+	int				orientation;
+	int				flip_rows;
+	int				flip_columns;
+	const uint8_t	*origin;
+	ptrdiff_t	step;
+} cbimage_mono_orient_job_t;
+
+
+
+/** 
+ * \brief Processes the band of cbimage_mono_orient() in place
+ * 
+ * For vertical orientations items are pairs of rows (top row and its mirror).
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_mono_orient_band(void *context, size_t begin, size_t end)
+{
+	cbimage_mono_orient_job_t	*job = context;
+	cbimage_t									*image = job->dst;
+	size_t										i;
+	
+	for(i = begin; i < end; i++)
+	{
+		uint8_t *top = cbimage_row(image, i);
+		uint8_t *bottom = cbimage_row(image, image->height - i - 1);
+		
+		switch(job->orientation)
+		{
+			case CBIMAGE_ORIENT_MIRROR_HORIZONTAL:
+				cbimage_mono_mirror(top, image->width);
+				break;
+			case CBIMAGE_ORIENT_MIRROR_VERTICAL:
+				cbimage_mono_swap(top, bottom, image->width);
+				break;
+			case CBIMAGE_ORIENT_ROTATE_180:
+				cbimage_mono_mirror(top, image->width);
+				if(top != bottom)
+				{
+					cbimage_mono_mirror(bottom, image->width);
+					cbimage_mono_swap(top, bottom, image->width);
+				}
+				break;
+		}
+	}
+}
+
+
+
+void cbimage_mono_orient(cbimage_t *image, int orientation)
+{
+	cbimage_mono_orient_job_t job;
+	
+	job.dst = image;
+	job.src = image;
+	job.orientation = orientation;
+	
+	switch(orientation)
+	{
+		case CBIMAGE_ORIENT_MIRROR_HORIZONTAL:
+			cbimage_parallel_rows(image->height, image->width, cbimage_mono_orient_band, &job);
+			break;
+		case CBIMAGE_ORIENT_MIRROR_VERTICAL:
+			cbimage_parallel_rows(image->height >> 1, image->width * 2, cbimage_mono_orient_band, &job);
+			break;
+		case CBIMAGE_ORIENT_ROTATE_180:
+			cbimage_parallel_rows((image->height + 1) >> 1, image->width * 2, cbimage_mono_orient_band, &job);
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Writes block of 8x8 pixels of the transposed image
+ * 
+ * Block is gathered from 8 source rows into one word (a byte per row), transposed
+ * and scattered into 8 destination rows. Blocks at the right and bottom edges may be smaller.
+ * 
+ * \param from - source row, that becomes the first column of the block
+ * \param to - first byte of the block in the destination
+ * \param y - first destination row of the block, it is the source column
+ * \param columns - width of the block
+ * \param rows - height of the block
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cbimage_mono_orient_block(cbimage_mono_orient_job_t *job, const uint8_t *from, uint8_t *to, size_t y, size_t columns, size_t rows)
+{
+	size_t		stride = cbimage_stride(job->dst), i;
+	uint64_t	block = 0, line;
+	
+	for(i = 0; i < columns; i++, from += job->step)
+	{
+		if(job->flip_columns)
+			line = cbimage_mono_reverse(cbimage_mono_load(from, job->src->width - y - rows, rows)) << (64 - rows);
+		else if(rows == 8)
+			line = (uint64_t)from[y >> 3] << 56;
+		else
+			line = cbimage_mono_load(from, y, rows);
+		
+		block |= line >> (8 * i);
+	}
+	
+	block = cbimage_mono_transpose(block);
+	
+	for(i = 0; i < rows; i++, to += stride)
+	{
+		if(columns == 8)
+			*to = (uint8_t)(block >> (56 - 8 * i));
+		else
+			cbimage_mono_store(to, 0, columns, block << (8 * i));
+	}
+}
+
+
+
+/** 
+ * \brief Writes the band of destination rows of cbimage_mono_orient_to()
+ * 
+ * For transposing orientations items are bands of CBIMAGE_MONO_TILE rows, written
+ * by rows of blocks, so destination is written sequentially.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_mono_orient_to_band(void *context, size_t begin, size_t end)
+{
+	cbimage_mono_orient_job_t	*job = context;
+	cbimage_t									*dst = job->dst, *src = job->src;
+	size_t										x, y, last;
+	
+	if(!cbimage_orient_transposed(job->orientation))
+	{
+		for(y = begin; y < end; y++)
+		{
+			const uint8_t *row = cbimage_row(src, (job->flip_rows) ? (src->height - 1 - y) : (y));
+			
+			if(job->flip_columns)
+				cbimage_mono_mirror_copy(cbimage_row(dst, y), row, dst->width);
+			else
+				cbimage_mono_copy(cbimage_row(dst, y), 0, row, 0, dst->width);
+		}
+		return;
+	}
+	
+	last = end * CBIMAGE_MONO_TILE;
+	if(last > dst->height)
+		last = dst->height;
+	
+	for(y = begin * CBIMAGE_MONO_TILE; y < last; y += 8)
+	{
+		size_t				rows = (last - y < 8) ? (last - y) : (8);
+		uint8_t				*to = cbimage_row(dst, y);
+		const uint8_t	*from = job->origin;
+		
+		for(x = 0; x < dst->width; x += 8, from += 8 * job->step)
+			cbimage_mono_orient_block(job, from, to + (x >> 3), y, (dst->width - x < 8) ? (dst->width - x) : (8), rows);
+	}
+}
+
+
+
+/** 
+ * Rows that stay rows are copied or reversed word by word, transposing
+ * orientations are done by 8x8 bit blocks. Flips are applied while blocks
+ * are gathered, so every orientation is done in a single pass.
+ */
+void cbimage_mono_orient_to(cbimage_t *dst, cbimage_t *src, int orientation)
+{
+	cbimage_mono_orient_job_t job;
+	
+	job.dst = dst;
+	job.src = src;
+	job.orientation = orientation;
+	
+	/* Transposing orientations flip source rows, when they flip destination columns and vice versa */
+	switch(orientation)
+	{
+		case CBIMAGE_ORIENT_MIRROR_HORIZONTAL:
+		case CBIMAGE_ORIENT_ROTATE_270:
+			job.flip_rows = 0;
+			job.flip_columns = 1;
+			break;
+		case CBIMAGE_ORIENT_MIRROR_VERTICAL:
+		case CBIMAGE_ORIENT_ROTATE_90:
+			job.flip_rows = 1;
+			job.flip_columns = 0;
+			break;
+		case CBIMAGE_ORIENT_ROTATE_180:
+		case CBIMAGE_ORIENT_TRANSVERSE:
+			job.flip_rows = 1;
+			job.flip_columns = 1;
+			break;
+		default:
+			job.flip_rows = 0;
+			job.flip_columns = 0;
+			break;
+	}
+	
+	/* Source rows are walked from the one, that becomes the first destination column */
+	job.origin = cbimage_row(src, (job.flip_rows && src->height) ? (src->height - 1) : (0));
+	job.step = (job.flip_rows) ? (-(ptrdiff_t)cbimage_stride(src)) : ((ptrdiff_t)cbimage_stride(src));
+	
+	if(cbimage_orient_transposed(orientation))
+		cbimage_parallel_rows((dst->height + CBIMAGE_MONO_TILE - 1) / CBIMAGE_MONO_TILE, dst->width * CBIMAGE_MONO_TILE, cbimage_mono_orient_to_band, &job);
+	else
+		cbimage_parallel_rows(dst->height, dst->width, cbimage_mono_orient_to_band, &job);
+}
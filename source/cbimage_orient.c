@@ -0,0 +1,432 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+/** 
+ * \brief Size of the square tile (in pixels) used for transposing orientations
+ * 
+ * Source rows touched by one tile should stay in L1 cache while the tile is written.
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_ORIENT_TILE 32
+
+/** 
+ * \brief Size of the buffer used to swap rows
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_SWAP_BUFFER 4096
+
+
+
+/** 
+ * \brief Copies block of pixels, reading source with arbitrary steps
+ * 
+ * Destination pixel (x, y) is taken from (src + x * step_x + y * step_y).
+ * Kernel is generated for every pixel size, so the pixel copy is a fixed size move.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_ORIENT_BLOCK(size) \
+static void cbimage_orient_block##size(uint8_t *dst, size_t dst_stride, const uint8_t *src, ptrdiff_t step_x, ptrdiff_t step_y, size_t width, size_t height) \
+{ \
+	size_t x, y; \
+	\
+	for(y = 0; y < height; y++, dst += dst_stride, src += step_y) \
+	{ \
+		const uint8_t	*from = src; \
+		uint8_t				*to = dst; \
+		\
+		for(x = 0; x < width; x++, to += size, from += step_x) \
+			memcpy(to, from, size); \
+	} \
+}
+
+CBIMAGE_ORIENT_BLOCK(3)
+CBIMAGE_ORIENT_BLOCK(4)
+CBIMAGE_ORIENT_BLOCK(8)
+
+typedef void (*cbimage_orient_block_fn)(uint8_t*, size_t, const uint8_t*, ptrdiff_t, ptrdiff_t, size_t, size_t);
+
+
+
+/** 
+ * \brief Selects block kernel for the pixel size
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_orient_block_fn cbimage_orient_block(size_t size)
+{
+	switch(size)
+	{
+		case 3:
+			return cbimage_orient_block3;
+		case 4:
+			return cbimage_orient_block4;
+	}
+	return cbimage_orient_block8;
+}
+
+
+
+/** 
+ * \brief Swaps contents of two rows
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_swap_rows(uint8_t *a, uint8_t *b, size_t bytes)
+{
+	uint8_t buffer[CBIMAGE_SWAP_BUFFER];
+	
+	while(bytes)
+	{
+		size_t chunk = (bytes < CBIMAGE_SWAP_BUFFER) ? (bytes) : (CBIMAGE_SWAP_BUFFER);
+		
+		memcpy(buffer, a, chunk);
+		memcpy(a, b, chunk);
+		memcpy(b, buffer, chunk);
+		
+		a += chunk;
+		b += chunk;
+		bytes -= chunk;
+	}
+}
+
+
+
+int cbimage_orient_transposed(int orientation)
+{
+	return orientation >= CBIMAGE_ORIENT_TRANSPOSE && orientation <= CBIMAGE_ORIENT_ROTATE_270;
+}
+
+
+
+void cbimage_orient_walk(cbimage_t *src, int orientation, const uint8_t **origin, ptrdiff_t *step_x, ptrdiff_t *step_y)
+{
+	ptrdiff_t	size = cbimage_pixel_size(src->format);
+	ptrdiff_t	stride = cbimage_stride(src);
+	size_t		last_x = src->width ? (src->width - 1) : (0);
+	size_t		last_y = src->height ? (src->height - 1) : (0);
+	
+	switch(orientation)
+	{
+		case CBIMAGE_ORIENT_MIRROR_HORIZONTAL:
+			*origin = cbimage_row(src, 0) + last_x * size;
+			*step_x = -size;
+			*step_y = stride;
+			break;
+		case CBIMAGE_ORIENT_ROTATE_180:
+			*origin = cbimage_row(src, last_y) + last_x * size;
+			*step_x = -size;
+			*step_y = -stride;
+			break;
+		case CBIMAGE_ORIENT_MIRROR_VERTICAL:
+			*origin = cbimage_row(src, last_y);
+			*step_x = size;
+			*step_y = -stride;
+			break;
+		case CBIMAGE_ORIENT_TRANSPOSE:
+			*origin = cbimage_row(src, 0);
+			*step_x = stride;
+			*step_y = size;
+			break;
+		case CBIMAGE_ORIENT_ROTATE_90:
+			*origin = cbimage_row(src, last_y);
+			*step_x = -stride;
+			*step_y = size;
+			break;
+		case CBIMAGE_ORIENT_TRANSVERSE:
+			*origin = cbimage_row(src, last_y) + last_x * size;
+			*step_x = -stride;
+			*step_y = -size;
+			break;
+		case CBIMAGE_ORIENT_ROTATE_270:
+			*origin = cbimage_row(src, 0) + last_x * size;
+			*step_x = stride;
+			*step_y = -size;
+			break;
+		default:
+			*origin = cbimage_row(src, 0);
+			*step_x = size;
+			*step_y = stride;
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Context of the parallel orientation
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t								*dst;
+	cbimage_t								*src;
+	int											orientation;
+	const uint8_t						*origin;
+	ptrdiff_t								step_x, step_y;
+	size_t									size;
+	cbimage_orient_block_fn	block;
+} cbimage_orient_job_t;
+
+
+
+/** 
+ * \brief Writes the band of destination rows of cbimage_orient_to()
+ * 
+ * For transposing orientations items are rows of tiles.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_orient_to_band(void *context, size_t begin, size_t end)
+{
+	cbimage_orient_job_t		*job = context;
+	cbimage_t								*dst = job->dst;
+	size_t									size = job->size, x, y;
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	
+	if(!cbimage_orient_transposed(job->orientation))
+	{
+		/* Rows stay rows, so they are copied (or reversed) one by one */
+		for(y = begin; y < end; y++)
+		{
+			if(job->step_x == (ptrdiff_t)size)
+				kernels->copy(cbimage_row(dst, y), job->origin + y * job->step_y, dst->width * size);
+			else
+				kernels->mirror_copy(cbimage_row(dst, y), job->origin + y * job->step_y - (dst->width - 1) * size, dst->width, size);
+		}
+		return;
+	}
+	
+	/* Columns become rows: destination is written by tiles, so source rows of the tile stay in cache */
+	for(y = begin * CBIMAGE_ORIENT_TILE; y < dst->height && y < end * CBIMAGE_ORIENT_TILE; y += CBIMAGE_ORIENT_TILE)
+	{
+		size_t tile_height = (dst->height - y < CBIMAGE_ORIENT_TILE) ? (dst->height - y) : (CBIMAGE_ORIENT_TILE);
+		
+		for(x = 0; x < dst->width; x += CBIMAGE_ORIENT_TILE)
+		{
+			size_t tile_width = (dst->width - x < CBIMAGE_ORIENT_TILE) ? (dst->width - x) : (CBIMAGE_ORIENT_TILE);
+			
+			job->block(cbimage_row(dst, y) + x * size, cbimage_stride(dst), job->origin + x * job->step_x + y * job->step_y, job->step_x, job->step_y, tile_width, tile_height);
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Processes the band of cbimage_orient() in place
+ * 
+ * For vertical orientations items are pairs of rows (top row and its mirror).
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_orient_band(void *context, size_t begin, size_t end)
+{
+	cbimage_orient_job_t		*job = context;
+	cbimage_t								*image = job->dst;
+	size_t									size = job->size, i;
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	
+	for(i = begin; i < end; i++)
+	{
+		uint8_t *top = cbimage_row(image, i);
+		uint8_t *bottom = cbimage_row(image, image->height - i - 1);
+		
+		switch(job->orientation)
+		{
+			case CBIMAGE_ORIENT_MIRROR_HORIZONTAL:
+				kernels->mirror(top, image->width, size);
+				break;
+			case CBIMAGE_ORIENT_MIRROR_VERTICAL:
+				cbimage_swap_rows(top, bottom, image->width * size);
+				break;
+			case CBIMAGE_ORIENT_ROTATE_180:
+				/* Each row is reversed while it is in cache and swapped with its pair */
+				kernels->mirror(top, image->width, size);
+				if(top != bottom)
+				{
+					kernels->mirror(bottom, image->width, size);
+					cbimage_swap_rows(top, bottom, image->width * size);
+				}
+				break;
+		}
+	}
+}
+
+
+
+int cbimage_orient_to(cbimage_t *dst, cbimage_t *src, int orientation)
+{
+	cbimage_orient_job_t job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_ORIENT);
+	assert(dst != NULL);
+	assert(src != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(orientation < CBIMAGE_ORIENT_NORMAL || orientation > CBIMAGE_ORIENT_ROTATE_270 || dst->format != src->format)
+		return -1;
+	
+	if(cbimage_orient_transposed(orientation))
+	{
+		if(dst->width != src->height || dst->height != src->width)
+			return -1;
+	} else {
+		if(dst->width != src->width || dst->height != src->height)
+			return -1;
+	}
+	
+	if(src->format == CBIMAGE_FORMAT_MONO1)
+	{
+		cbimage_mono_orient_to(dst, src, orientation);
+		return 0;
+	}
+	
+	job.dst = dst;
+	job.src = src;
+	job.orientation = orientation;
+	job.size = cbimage_pixel_size(src->format);
+	job.block = cbimage_orient_block(job.size);
+	cbimage_orient_walk(src, orientation, &job.origin, &job.step_x, &job.step_y);
+	
+	if(orientation == CBIMAGE_ORIENT_NORMAL && cbimage_stride(dst) == dst->width * job.size && cbimage_stride(src) == cbimage_stride(dst))
+	{
+		cbimage_kernels()->copy(dst->raw, src->raw, cbimage_stride(dst) * dst->height);
+		return 0;
+	}
+	
+	if(cbimage_orient_transposed(orientation))
+		cbimage_parallel_rows((dst->height + CBIMAGE_ORIENT_TILE - 1) / CBIMAGE_ORIENT_TILE, dst->width * CBIMAGE_ORIENT_TILE, cbimage_orient_to_band, &job);
+	else
+		cbimage_parallel_rows(dst->height, dst->width, cbimage_orient_to_band, &job);
+	return 0;
+}
+
+
+
+int cbimage_orient(cbimage_t *image, int orientation)
+{
+	size_t								size;
+	cbimage_orient_job_t	job;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_ORIENT);
+	assert(image != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
+	
+	if(orientation < CBIMAGE_ORIENT_NORMAL || orientation > CBIMAGE_ORIENT_ROTATE_270)
+		return -1;
+	
+	size = cbimage_pixel_size(image->format);
+	
+	job.dst = image;
+	job.src = image;
+	job.orientation = orientation;
+	job.size = size;
+	
+	if(image->format == CBIMAGE_FORMAT_MONO1 && !cbimage_orient_transposed(orientation))
+	{
+		cbimage_mono_orient(image, orientation);
+		return 0;
+	}
+	
+	switch(orientation)
+	{
+		case CBIMAGE_ORIENT_NORMAL:
+			break;
+		case CBIMAGE_ORIENT_MIRROR_HORIZONTAL:
+			cbimage_parallel_rows(image->height, image->width, cbimage_orient_band, &job);
+			break;
+		case CBIMAGE_ORIENT_MIRROR_VERTICAL:
+			cbimage_parallel_rows(image->height >> 1, image->width * 2, cbimage_orient_band, &job);
+			break;
+		case CBIMAGE_ORIENT_ROTATE_180:
+			/* Middle row of the odd height is its own pair */
+			cbimage_parallel_rows((image->height + 1) >> 1, image->width * 2, cbimage_orient_band, &job);
+			break;
+		default:
+		{
+			/* Transposing orientations need a new buffer */
+			cbimage_t rotated = *image;
+			
+			if(image->view)
+				return -1;
+			
+			rotated.width = image->height;
+			rotated.height = image->width;
+			rotated.stride = cbimage_row_bytes(image->format, rotated.width);
+			rotated.raw = cbimage_pixels_alloc(rotated.stride * rotated.height, 0);
+			
+			if(!rotated.raw)
+				return -1;
+			
+			cbimage_orient_to(&rotated, image, orientation);
+			
+			if(image->pooled)
+				cbimage_pixels_release(image->raw);
+			else
+				free(image->data);
+			rotated.pooled = 1;
+			*image = rotated;
+			break;
+		}
+	}
+	return 0;
+}
+
+
+
+cbimage_t *cbimage_orient_copy(cbimage_t *image, int orientation)
+{
+	cbimage_t *out;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_ORIENT);
+	assert(image != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(image));
+	
+	if(orientation < CBIMAGE_ORIENT_NORMAL || orientation > CBIMAGE_ORIENT_ROTATE_270)
+		return NULL;
+	
+	if(cbimage_orient_transposed(orientation))
+		out = cbimage_create_uninitialized(image->height, image->width, image->type, image->format);
+	else
+		out = cbimage_create_uninitialized(image->width, image->height, image->type, image->format);
+	
+	if(!out)
+		return NULL;
+	
+	cbimage_orient_to(out, image, orientation);
+	return out;
+}
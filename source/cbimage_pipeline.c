@@ -0,0 +1,792 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef CBIMAGE_HAVE_STAT
+#include <sys/stat.h>
+#endif
+
+/** 
+ * \brief Size of the band of rows that is oriented and processed at once
+ * 
+ * Band should stay in L2 cache between the orientation and the following operations.
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_PIPELINE_BAND (256 << 10)
+
+/** 
+ * \brief Minimal amount of rows in the band
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_PIPELINE_MIN_ROWS 16
+
+/** 
+ * \brief Amount of pixels streamed by cbimage_pipeline_run_bmp() at once
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_PIPELINE_STREAM (1 << 18)
+
+/** 
+ * \brief Approximate size of the buffer of the BMP reader or writer
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_PIPELINE_BUFFERS (1 << 20)
+
+/** 
+ * \brief Orientation bits: horizontal flip, vertical flip and transposition
+ * 
+ * Orientation is a transposition (if any) followed by flips of the result.
+ * 
+ * \warning These constants ment to be used *ONLY* internaly.
+ */
+enum {
+	CBIMAGE_PIPELINE_FLIP_X = 1,
+	CBIMAGE_PIPELINE_FLIP_Y = 2,
+	CBIMAGE_PIPELINE_TRANSPOSE = 4
+};
+
+/** 
+ * \brief Kinds of the recorded operations
+ * 
+ * \warning These constants ment to be used *ONLY* internaly.
+ */
+enum {
+	CBIMAGE_PIPELINE_INVERSE = 0,
+	CBIMAGE_PIPELINE_INSERT,
+	CBIMAGE_PIPELINE_BLEND
+};
+
+/** 
+ * \brief Orientation bits of every CBIMAGE_ORIENT_* constant
+ */
+static const uint8_t cbimage_pipeline_bits[CBIMAGE_ORIENT_ROTATE_270 + 1] = {
+	0,
+	0,
+	CBIMAGE_PIPELINE_FLIP_X,
+	CBIMAGE_PIPELINE_FLIP_X | CBIMAGE_PIPELINE_FLIP_Y,
+	CBIMAGE_PIPELINE_FLIP_Y,
+	CBIMAGE_PIPELINE_TRANSPOSE,
+	CBIMAGE_PIPELINE_TRANSPOSE | CBIMAGE_PIPELINE_FLIP_X,
+	CBIMAGE_PIPELINE_TRANSPOSE | CBIMAGE_PIPELINE_FLIP_X | CBIMAGE_PIPELINE_FLIP_Y,
+	CBIMAGE_PIPELINE_TRANSPOSE | CBIMAGE_PIPELINE_FLIP_Y
+};
+
+/** 
+ * \brief Recorded operation
+ * 
+ * *orientation* is the orientation of the image at the moment operation was added,
+ * coordinates are given in the image with this orientation.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	int				kind;
+	int				orientation;
+	int				argument;
+	cbimage_t	*image;
+	int				x, y;
+} cbimage_pipeline_op_t;
+
+struct cbimage_pipeline
+{
+	cbimage_pipeline_op_t	*ops;
+	size_t								count;
+	size_t								capacity;
+	int										orientation;
+};
+
+/** 
+ * \brief Operation prepared for the run, moved into the final orientation
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	int				kind;
+	int				argument;
+	cbimage_t	*image;
+	long long	x, y;
+	int				owned;
+} cbimage_pipeline_step_t;
+
+/** 
+ * \brief Context of one run
+ * 
+ * Rows of *dst* are rows *first*.. of the result. *src* is the part of the source
+ * image, which rows (or columns) produce rows *src_first*.. of the result.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_pipeline_step_t	*steps;
+	size_t									count;
+	int											orientation;
+	cbimage_t								*src;
+	cbimage_t								*dst;
+	size_t									first;
+	size_t									src_first;
+	size_t									band;
+} cbimage_pipeline_job_t;
+
+
+
+/** 
+ * \brief Gets orientation from its bits
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_pipeline_orientation(int bits)
+{
+	int orientation;
+	
+	for(orientation = CBIMAGE_ORIENT_NORMAL; orientation <= CBIMAGE_ORIENT_ROTATE_270; orientation++)
+	{
+		if(cbimage_pipeline_bits[orientation] == bits)
+			return orientation;
+	}
+	return CBIMAGE_ORIENT_NORMAL;
+}
+
+
+
+/** 
+ * \brief Swaps flips, as transposition turns horizontal flip into the vertical one
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_pipeline_swap_flips(int bits)
+{
+	return (bits & CBIMAGE_PIPELINE_TRANSPOSE) | ((bits & CBIMAGE_PIPELINE_FLIP_X) << 1) | ((bits & CBIMAGE_PIPELINE_FLIP_Y) >> 1);
+}
+
+
+
+/** 
+ * \brief Composes orientations: *first* is applied before *second*
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_pipeline_compose(int first, int second)
+{
+	int a = cbimage_pipeline_bits[first];
+	int b = cbimage_pipeline_bits[second];
+	
+	if(b & CBIMAGE_PIPELINE_TRANSPOSE)
+		a = cbimage_pipeline_swap_flips(a);
+	
+	return cbimage_pipeline_orientation(a ^ b);
+}
+
+
+
+/** 
+ * \brief Gets orientation that undoes the given one
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_pipeline_invert(int orientation)
+{
+	int bits = cbimage_pipeline_bits[orientation];
+	
+	if(bits & CBIMAGE_PIPELINE_TRANSPOSE)
+		bits = cbimage_pipeline_swap_flips(bits);
+	
+	return cbimage_pipeline_orientation(bits);
+}
+
+
+
+/** 
+ * \brief Appends operation to the pipeline
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_pipeline_push(cbimage_pipeline_t *pipeline, int kind, int argument, cbimage_t *image, int x, int y)
+{
+	cbimage_pipeline_op_t *op;
+	
+	assert(pipeline != NULL);
+	
+	if(pipeline->count == pipeline->capacity)
+	{
+		size_t									capacity = (pipeline->capacity) ? (pipeline->capacity * 2) : (8);
+		cbimage_pipeline_op_t	*ops = cbimage_alloc(capacity * sizeof(cbimage_pipeline_op_t));
+		
+		if(!ops)
+			return -1;
+		
+		if(pipeline->count)
+			memcpy(ops, pipeline->ops, pipeline->count * sizeof(cbimage_pipeline_op_t));
+		cbimage_release(pipeline->ops);
+		pipeline->ops = ops;
+		pipeline->capacity = capacity;
+	}
+	
+	op = &pipeline->ops[pipeline->count++];
+	op->kind = kind;
+	op->orientation = pipeline->orientation;
+	op->argument = argument;
+	op->image = image;
+	op->x = x;
+	op->y = y;
+	return 0;
+}
+
+
+
+cbimage_pipeline_t *cbimage_pipeline_create(void)
+{
+	cbimage_pipeline_t *pipeline = cbimage_alloc(sizeof(cbimage_pipeline_t));
+	
+	if(!pipeline)
+		return NULL;
+	
+	memset(pipeline, 0, sizeof(cbimage_pipeline_t));
+	pipeline->orientation = CBIMAGE_ORIENT_NORMAL;
+	return pipeline;
+}
+
+
+
+void cbimage_pipeline_destroy(cbimage_pipeline_t *pipeline)
+{
+	if(!pipeline)
+		return;
+	
+	cbimage_release(pipeline->ops);
+	cbimage_release(pipeline);
+}
+
+
+
+int cbimage_pipeline_orient(cbimage_pipeline_t *pipeline, int orientation)
+{
+	assert(pipeline != NULL);
+	
+	if(orientation < CBIMAGE_ORIENT_NORMAL || orientation > CBIMAGE_ORIENT_ROTATE_270)
+		return -1;
+	
+	pipeline->orientation = cbimage_pipeline_compose(pipeline->orientation, orientation);
+	return 0;
+}
+
+
+
+int cbimage_pipeline_rotate(cbimage_pipeline_t *pipeline, int angle)
+{
+	return cbimage_pipeline_orient(pipeline, cbimage_angle_orientation(angle));
+}
+
+
+
+int cbimage_pipeline_mirror(cbimage_pipeline_t *pipeline, int mirror)
+{
+	return cbimage_pipeline_orient(pipeline, cbimage_mirror_orientation(mirror));
+}
+
+
+
+int cbimage_pipeline_inverse(cbimage_pipeline_t *pipeline, int type)
+{
+	return cbimage_pipeline_push(pipeline, CBIMAGE_PIPELINE_INVERSE, type, NULL, 0, 0);
+}
+
+
+
+int cbimage_pipeline_insert(cbimage_pipeline_t *pipeline, cbimage_t *src, int x, int y)
+{
+	assert(src != NULL);
+	return cbimage_pipeline_push(pipeline, CBIMAGE_PIPELINE_INSERT, 0, src, x, y);
+}
+
+
+
+int cbimage_pipeline_blend(cbimage_pipeline_t *pipeline, cbimage_t *src, int x, int y, int mode)
+{
+	assert(src != NULL);
+	return cbimage_pipeline_push(pipeline, CBIMAGE_PIPELINE_BLEND, mode, src, x, y);
+}
+
+
+
+/** 
+ * \brief Frees steps prepared by cbimage_pipeline_prepare()
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pipeline_unprepare(cbimage_pipeline_step_t *steps, size_t count)
+{
+	size_t i;
+	
+	if(!steps)
+		return;
+	
+	for(i = 0; i < count; i++)
+	{
+		if(steps[i].owned)
+			cbimage_destroy(steps[i].image);
+	}
+	cbimage_release(steps);
+}
+
+
+
+/** 
+ * \brief Moves recorded operations into the final orientation of the image
+ * 
+ * Operation added at orientation O is followed by the orientation R = O^-1 * F,
+ * where F is the final one. Its rectangle is moved by R and overlays are reoriented
+ * by R once, so every operation is applied directly to the rows of the result.
+ * 
+ * \param pipeline - pipeline
+ * \param width - width of the source image
+ * \param height - height of the source image
+ * \param failed - set to nonzero if there is not enough memory
+ * \return Returns prepared steps, NULL for the empty pipeline or if failed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_pipeline_step_t *cbimage_pipeline_prepare(cbimage_pipeline_t *pipeline, size_t width, size_t height, int *failed)
+{
+	cbimage_pipeline_step_t	*steps;
+	size_t									i;
+	
+	*failed = 0;
+	if(!pipeline->count)
+		return NULL;
+	
+	steps = cbimage_alloc(pipeline->count * sizeof(cbimage_pipeline_step_t));
+	if(!steps)
+	{
+		*failed = 1;
+		return NULL;
+	}
+	memset(steps, 0, pipeline->count * sizeof(cbimage_pipeline_step_t));
+	
+	for(i = 0; i < pipeline->count; i++)
+	{
+		cbimage_pipeline_op_t		*op = &pipeline->ops[i];
+		cbimage_pipeline_step_t	*step = &steps[i];
+		int											rest = cbimage_pipeline_compose(cbimage_pipeline_invert(op->orientation), pipeline->orientation);
+		int											bits = cbimage_pipeline_bits[rest];
+		long long								frame_width = width, frame_height = height, w, h, t;
+		
+		step->kind = op->kind;
+		step->argument = op->argument;
+		step->image = op->image;
+		
+		if(op->kind == CBIMAGE_PIPELINE_INVERSE)
+			continue;
+		
+		if(cbimage_orient_transposed(op->orientation))
+		{
+			frame_width = height;
+			frame_height = width;
+		}
+		
+		w = op->image->width;
+		h = op->image->height;
+		step->x = op->x;
+		step->y = op->y;
+		
+		if(bits & CBIMAGE_PIPELINE_TRANSPOSE)
+		{
+			t = step->x; step->x = step->y; step->y = t;
+			t = w; w = h; h = t;
+			t = frame_width; frame_width = frame_height; frame_height = t;
+		}
+		if(bits & CBIMAGE_PIPELINE_FLIP_X)
+			step->x = frame_width - step->x - w;
+		if(bits & CBIMAGE_PIPELINE_FLIP_Y)
+			step->y = frame_height - step->y - h;
+		
+		if(rest != CBIMAGE_ORIENT_NORMAL)
+		{
+			step->image = cbimage_orient_copy(op->image, rest);
+			step->owned = 1;
+			
+			if(!step->image)
+			{
+				*failed = 1;
+				cbimage_pipeline_unprepare(steps, i);
+				return NULL;
+			}
+		}
+	}
+	
+	return steps;
+}
+
+
+
+/** 
+ * \brief Applies prepared steps to the rows of the result
+ * 
+ * \param rows - rows of the result, starting from row *first*
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pipeline_apply(cbimage_pipeline_step_t *steps, size_t count, cbimage_t *rows, size_t first)
+{
+	size_t i;
+	
+	for(i = 0; i < count; i++)
+	{
+		cbimage_pipeline_step_t	*step = &steps[i];
+		long long								y = step->y - (long long)first;
+		
+		if(step->kind == CBIMAGE_PIPELINE_INVERSE)
+		{
+			cbimage_inverse(rows, step->argument);
+			continue;
+		}
+		
+		/* Overlays that miss the band are skipped, so coordinates always fit into int */
+		if(y >= (long long)rows->height || y + (long long)step->image->height <= 0)
+			continue;
+		if(step->x >= (long long)rows->width || step->x + (long long)step->image->width <= 0)
+			continue;
+		
+		if(step->kind == CBIMAGE_PIPELINE_INSERT)
+			cbimage_insert(rows, step->image, step->x, y);
+		else
+			cbimage_blend(rows, step->image, step->x, y, step->argument);
+	}
+}
+
+
+
+/** 
+ * \brief Produces bands of the result: orientation first, then all other operations
+ * 
+ * Every call made here runs in the calling thread, as it is nested into the parallel loop.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pipeline_band(void *context, size_t begin, size_t end)
+{
+	cbimage_pipeline_job_t	*job = context;
+	int											bits = cbimage_pipeline_bits[job->orientation];
+	size_t									b;
+	
+	for(b = begin; b < end; b++)
+	{
+		size_t		y = b * job->band;
+		size_t		count = (job->dst->height - y < job->band) ? (job->dst->height - y) : (job->band);
+		size_t		from = job->first + y - job->src_first;
+		size_t		length = (bits & CBIMAGE_PIPELINE_TRANSPOSE) ? (job->src->width) : (job->src->height);
+		cbimage_t	rows, region;
+		
+		/* Rows of the result are taken from the rows (or columns) of the source */
+		if(bits & CBIMAGE_PIPELINE_FLIP_Y)
+			from = length - from - count;
+		
+		cbimage_view(&rows, job->dst, 0, y, job->dst->width, count);
+		
+		if(bits & CBIMAGE_PIPELINE_TRANSPOSE)
+			cbimage_view(&region, job->src, from, 0, count, job->src->height);
+		else
+			cbimage_view(&region, job->src, 0, from, job->src->width, count);
+		
+		cbimage_orient_to(&rows, &region, job->orientation);
+		
+		cbimage_pipeline_apply(job->steps, job->count, &rows, job->first + y);
+	}
+}
+
+
+
+/** 
+ * \brief Processes rows of the result in parallel bands
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pipeline_execute(cbimage_pipeline_job_t *job)
+{
+	size_t stride = job->dst->width * cbimage_pixel_size(job->dst->format);
+	
+	/* Bit packed source cannot be cut at arbitrary columns, so the result is produced
+	 * as one band and every operation is parallel by itself */
+	if(job->dst->format == CBIMAGE_FORMAT_MONO1)
+	{
+		job->band = job->dst->height;
+		if(job->band)
+			cbimage_pipeline_band(job, 0, 1);
+		return;
+	}
+	
+	job->band = (stride) ? (CBIMAGE_PIPELINE_BAND / stride) : (CBIMAGE_PIPELINE_MIN_ROWS);
+	if(job->band < CBIMAGE_PIPELINE_MIN_ROWS)
+		job->band = CBIMAGE_PIPELINE_MIN_ROWS;
+	
+	cbimage_parallel_rows((job->dst->height + job->band - 1) / job->band, job->dst->width * job->band, cbimage_pipeline_band, job);
+}
+
+
+
+int cbimage_pipeline_run_to(cbimage_pipeline_t *pipeline, cbimage_t *dst, cbimage_t *src)
+{
+	cbimage_pipeline_job_t	job;
+	int											failed;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_PIPELINE);
+	assert(pipeline != NULL);
+	assert(dst != NULL);
+	assert(src != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(dst->format != src->format)
+		return -1;
+	
+	if(cbimage_orient_transposed(pipeline->orientation))
+	{
+		if(dst->width != src->height || dst->height != src->width)
+			return -1;
+	} else {
+		if(dst->width != src->width || dst->height != src->height)
+			return -1;
+	}
+	
+	job.steps = cbimage_pipeline_prepare(pipeline, src->width, src->height, &failed);
+	if(failed)
+		return -1;
+	
+	job.count = pipeline->count;
+	job.orientation = pipeline->orientation;
+	job.src = src;
+	job.dst = dst;
+	job.first = 0;
+	job.src_first = 0;
+	cbimage_pipeline_execute(&job);
+	
+	cbimage_pipeline_unprepare(job.steps, job.count);
+	return 0;
+}
+
+
+
+cbimage_t *cbimage_pipeline_run(cbimage_pipeline_t *pipeline, cbimage_t *image)
+{
+	cbimage_t *out;
+	
+	assert(pipeline != NULL);
+	assert(image != NULL);
+	
+	if(cbimage_orient_transposed(pipeline->orientation))
+		out = cbimage_create_uninitialized(image->height, image->width, image->type, image->format);
+	else
+		out = cbimage_create_uninitialized(image->width, image->height, image->type, image->format);
+	
+	if(!out)
+		return NULL;
+	
+	if(cbimage_pipeline_run_to(pipeline, out, image))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+
+
+/** 
+ * \brief Gets amount of rows of the result streamed at once
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static size_t cbimage_pipeline_chunk_rows(size_t out_width, size_t out_height)
+{
+	size_t rows = (out_width) ? (CBIMAGE_PIPELINE_STREAM / out_width) : (1);
+	
+	if(!rows)
+		rows = 1;
+	if(rows > out_height)
+		rows = out_height;
+	return rows;
+}
+
+
+
+/** 
+ * Counts the source (if it is loaded), two chunks of pixels and buffers
+ * of the reader and the writer.
+ */
+size_t cbimage_pipeline_bmp_memory(cbimage_pipeline_t *pipeline, size_t width, size_t height)
+{
+	size_t size = cbimage_pixel_size(CBIMAGE_FORMAT_RGBA8);
+	size_t out_width = width, out_height = height;
+	
+	assert(pipeline != NULL);
+	
+	if(cbimage_orient_transposed(pipeline->orientation))
+	{
+		out_width = height;
+		out_height = width;
+	}
+	
+	return 2 * cbimage_pipeline_chunk_rows(out_width, out_height) * width * size + 2 * CBIMAGE_PIPELINE_BUFFERS
+		+ ((cbimage_orient_transposed(pipeline->orientation)) ? (width * height * size) : (0));
+}
+
+
+
+/** 
+ * \brief Checks if both filenames refer to the same existing file
+ * 
+ * Writer truncates the output, while the reader still reads the input,
+ * so running pipeline from the file into itself destroys the file.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_pipeline_same_file(const char *input, const char *output)
+{
+#ifdef CBIMAGE_HAVE_STAT
+	struct stat input_status, output_status;
+	
+	if(stat(input, &input_status) || stat(output, &output_status))
+		return 0;
+	return input_status.st_dev == output_status.st_dev && input_status.st_ino == output_status.st_ino;
+#else
+	return !strcmp(input, output);
+#endif
+}
+
+
+
+/** 
+ * Orientations that keep rows as rows are done chunk by chunk, vertical flips
+ * read chunks from the bottom of the file. Transposing orientations
+ * need whole columns of the source, so the source is loaded, while the result is
+ * still produced and written chunk by chunk.
+ */
+int cbimage_pipeline_run_bmp(cbimage_pipeline_t *pipeline, char *input, char *output, int bpp)
+{
+	cbimage_bmp_reader_t		*reader = NULL;
+	cbimage_bmp_writer_t		*writer = NULL;
+	cbimage_t								*source = NULL, *chunk = NULL, rows, source_rows;
+	cbimage_pipeline_job_t	job;
+	size_t									width, height, out_width, out_height, chunk_rows, y;
+	int											transposed, failed, result = -1;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_PIPELINE);
+	assert(pipeline != NULL);
+	assert(input != NULL);
+	assert(output != NULL);
+	
+	if(cbimage_pipeline_same_file(input, output))
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": output is the input file\n", output);
+		return -1;
+	}
+	
+	transposed = cbimage_orient_transposed(pipeline->orientation);
+	
+	if(transposed)
+	{
+		source = cbimage_load_bmp_format(input, CBIMAGE_FORMAT_RGBA8);
+		if(!source)
+			return -1;
+		width = source->width;
+		height = source->height;
+	} else {
+		reader = cbimage_bmp_reader_open(input);
+		if(!reader)
+			return -1;
+		cbimage_bmp_reader_size(reader, &width, &height);
+	}
+	
+	CBIMAGE_STAT_BYTES(width * height * cbimage_pixel_size(CBIMAGE_FORMAT_RGBA8));
+	
+	out_width = (transposed) ? (height) : (width);
+	out_height = (transposed) ? (width) : (height);
+	
+	job.steps = cbimage_pipeline_prepare(pipeline, width, height, &failed);
+	job.count = pipeline->count;
+	job.orientation = pipeline->orientation;
+	job.src = source;
+	job.src_first = 0;
+	
+	chunk_rows = cbimage_pipeline_chunk_rows(out_width, out_height);
+	
+	if(!failed)
+		chunk = cbimage_create_uninitialized(out_width, chunk_rows, CBIMAGE_RGBA, CBIMAGE_FORMAT_RGBA8);
+	if(chunk && reader)
+		source = cbimage_create_uninitialized(width, chunk_rows, CBIMAGE_RGBA, CBIMAGE_FORMAT_RGBA8);
+	if(chunk && source)
+		writer = cbimage_bmp_writer_open(output, out_width, out_height, bpp);
+	
+	if(writer)
+	{
+		for(y = 0; y < out_height; y += rows.height)
+		{
+			size_t count = (out_height - y < chunk_rows) ? (out_height - y) : (chunk_rows);
+			
+			cbimage_view(&rows, chunk, 0, 0, out_width, count);
+			
+			if(reader)
+			{
+				size_t from = (cbimage_pipeline_bits[pipeline->orientation] & CBIMAGE_PIPELINE_FLIP_Y) ? (height - y - count) : (y);
+				
+				cbimage_view(&source_rows, source, 0, 0, width, count);
+				if(cbimage_bmp_reader_seek(reader, from) || cbimage_bmp_reader_read(reader, &source_rows) != (int)count)
+					break;
+				
+				job.src = &source_rows;
+				job.src_first = y;
+			}
+			
+			job.dst = &rows;
+			job.first = y;
+			cbimage_pipeline_execute(&job);
+			
+			if(cbimage_bmp_writer_write(writer, &rows))
+				break;
+		}
+		
+		if(y >= out_height)
+			result = 0;
+		if(cbimage_bmp_writer_close(writer))
+			result = -1;
+	}
+	
+	cbimage_pipeline_unprepare(job.steps, job.count);
+	cbimage_destroy(chunk);
+	cbimage_destroy(source);
+	cbimage_bmp_reader_close(reader);
+	return result;
+}
@@ -0,0 +1,1080 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+
+/** 
+ * \brief Largest maxval of the PNM file
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CPNM_MAXVAL 65535
+
+/** 
+ * \brief Largest width, height and depth of the PNM file
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CPNM_MAX_SIZE 0x7FFFFFFF
+
+/** 
+ * \brief Largest header written by cpnm_form_header()
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CPNM_HEADER_MAX 160
+
+/** 
+ * \brief Amount of the pixels converted at once through the temporary row
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CPNM_CHUNK 256
+
+/** 
+ * \brief Size of the buffer used by cbimage_save_pnm()
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CPNM_WRITE_BUFFER (4 << 20)
+
+/** 
+ * \brief PNM header
+ * 
+ * 	- magic - digit of the magic number (1 to 7)
+ * 	- width and height
+ * 	- channels - samples per pixel (1 to 4, PAM depth)
+ * 	- maxval - largest value of the sample (1 for PBM)
+ * 	- alpha - last sample is alpha (PAM of depth 2 and 4)
+ * 	- pointer_data - offset of the pixels
+ * 	- valid flag
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	int				magic;
+	size_t		width;
+	size_t		height;
+	size_t		channels;
+	uint32_t	maxval;
+	int				alpha;
+	size_t		pointer_data;
+	int				valid;
+} cpnm_header;
+
+/** 
+ * \brief Context of the band-parallel PNM decoder
+ * 
+ * *offsets* are byte offsets of R, G, B and A samples inside of the pixel (gray
+ * files read one sample three times). *levels* maps samples onto 16 bit
+ * channels when maxval is neither 255 nor 65535, NULL otherwise.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cpnm_header			header;
+	const uint8_t		*pixels;
+	size_t					pnm_row;
+	size_t					sample_bytes;
+	size_t					pixel_bytes;
+	size_t					offsets[4];
+	const uint16_t	*levels;
+	cbimage_t				*image;
+} cpnm_decoder;
+
+/** 
+ * \brief Context of the band-parallel PNM encoder
+ * 
+ * Image row (*image_row* + i) is written at *pixels* + i * *pnm_row*.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cpnm_header	header;
+	uint8_t			*pixels;
+	size_t			pnm_row;
+	size_t			image_row;
+	cbimage_t		*image;
+} cpnm_encoder;
+
+
+
+/** 
+ * \brief Checks whether character is whitespace of the PNM header
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline int cpnm_space(uint8_t c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+
+/** 
+ * \brief Skips whitespace and comments (from '#' to the end of the line)
+ * 
+ * \return Returns 0 if something is left or -1 if the end of the data is reached
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cpnm_skip(const uint8_t *data, size_t size, size_t *pos)
+{
+	while(*pos < size)
+	{
+		if(data[*pos] == '#')
+		{
+			while(*pos < size && data[*pos] != '\n')
+				(*pos)++;
+		} else if(cpnm_space(data[*pos])) {
+			(*pos)++;
+		} else {
+			return 0;
+		}
+	}
+	return -1;
+}
+
+
+
+/** 
+ * \brief Reads decimal number after the whitespace and comments
+ * 
+ * \param limit - largest allowed value
+ * \return Returns 0 if succsesfull or -1 if there is no number or it is larger than *limit*
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cpnm_number(const uint8_t *data, size_t size, size_t *pos, size_t limit, size_t *value)
+{
+	size_t start;
+	
+	if(cpnm_skip(data, size, pos))
+		return -1;
+	
+	*value = 0;
+	for(start = *pos; *pos < size && data[*pos] >= '0' && data[*pos] <= '9'; (*pos)++)
+	{
+		*value = *value * 10 + (data[*pos] - '0');
+		if(*value > limit)
+			return -1;
+	}
+	return (*pos > start) ? (0) : (-1);
+}
+
+
+
+/** 
+ * \brief Parses header of the PAM file, which is the list of "KEYWORD value" lines up to ENDHDR
+ * 
+ * TUPLTYPE is not checked, alpha is taken from the depth (GRAYSCALE_ALPHA and RGB_ALPHA).
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cpnm_header cpnm_parse_pam(const uint8_t *data, size_t size)
+{
+	cpnm_header	header;
+	size_t			pos = 2, maxval = 0, key, length;
+	
+	memset(&header, 0, sizeof(cpnm_header));
+	header.magic = 7;
+	
+	for(;;)
+	{
+		if(cpnm_skip(data, size, &pos))
+			return header;
+		
+		for(key = pos; pos < size && !cpnm_space(data[pos]); pos++);
+		length = pos - key;
+		
+		if(length == 6 && !memcmp(data + key, "ENDHDR", 6))
+			break;
+		
+		if(length == 5 && !memcmp(data + key, "WIDTH", 5))
+		{
+			if(cpnm_number(data, size, &pos, CPNM_MAX_SIZE, &header.width))
+				return header;
+		} else if(length == 6 && !memcmp(data + key, "HEIGHT", 6)) {
+			if(cpnm_number(data, size, &pos, CPNM_MAX_SIZE, &header.height))
+				return header;
+		} else if(length == 5 && !memcmp(data + key, "DEPTH", 5)) {
+			if(cpnm_number(data, size, &pos, CPNM_MAX_SIZE, &header.channels))
+				return header;
+		} else if(length == 6 && !memcmp(data + key, "MAXVAL", 6)) {
+			if(cpnm_number(data, size, &pos, CPNM_MAXVAL, &maxval))
+				return header;
+		} else {
+			/* TUPLTYPE and unknown keywords */
+			while(pos < size && data[pos] != '\n')
+				pos++;
+		}
+	}
+	
+	while(pos < size && data[pos] != '\n')
+		pos++;
+	if(pos >= size)
+		return header;
+	
+	header.maxval = maxval;
+	header.alpha = (header.channels == 2 || header.channels == 4);
+	header.pointer_data = pos + 1;
+	header.valid = header.width && header.height && header.channels >= 1 && header.channels <= 4 && maxval;
+	return header;
+}
+
+
+
+/** 
+ * \brief Parses header of the PNM file
+ * 
+ * Header of P1 to P6 is the magic number, width, height and maxval (except for PBM), separated
+ * by whitespace and comments. Single whitespace character separates header from the pixels.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cpnm_header cpnm_parse_info(const uint8_t *data, size_t size)
+{
+	cpnm_header	header;
+	size_t			pos = 2, maxval = 1;
+	
+	memset(&header, 0, sizeof(cpnm_header));
+	
+	if(size < 3 || data[0] != 'P' || data[1] < '1' || data[1] > '7')
+		return header;
+	
+	if(data[1] == '7')
+		return cpnm_parse_pam(data, size);
+	
+	header.magic = data[1] - '0';
+	header.channels = (header.magic == 3 || header.magic == 6) ? (3) : (1);
+	
+	if(cpnm_number(data, size, &pos, CPNM_MAX_SIZE, &header.width) || cpnm_number(data, size, &pos, CPNM_MAX_SIZE, &header.height))
+		return header;
+	
+	if(header.magic != 1 && header.magic != 4 && cpnm_number(data, size, &pos, CPNM_MAXVAL, &maxval))
+		return header;
+	
+	if(pos >= size || !cpnm_space(data[pos]))
+		return header;
+	
+	header.maxval = maxval;
+	header.pointer_data = pos + 1;
+	header.valid = header.width && header.height && maxval;
+	return header;
+}
+
+
+
+/** 
+ * \brief Reads pixels of the plain text file into the layout of the binary file
+ * 
+ * P1 digits may be not separated, they are packed into the rows of P4 file. Samples of P2 and P3
+ * are stored as binary samples of *sample_bytes*, samples above maxval are clamped.
+ * 
+ * \return Returns 0 if succsesfull or -1 if pixels are truncated or not valid
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cpnm_read_plain(cpnm_decoder *decoder, const uint8_t *data, size_t size, uint8_t *pixels)
+{
+	cpnm_header	*header = &decoder->header;
+	size_t			pos = header->pointer_data, x, y, i, value;
+	
+	if(header->magic == 1)
+	{
+		memset(pixels, 0, decoder->pnm_row * header->height);
+		
+		for(y = 0; y < header->height; y++)
+		{
+			for(x = 0; x < header->width; x++, pos++)
+			{
+				if(cpnm_skip(data, size, &pos) || (data[pos] != '0' && data[pos] != '1'))
+					return -1;
+				if(data[pos] == '1')
+					pixels[y * decoder->pnm_row + (x >> 3)] |= 0x80 >> (x & 7);
+			}
+		}
+		return 0;
+	}
+	
+	for(i = 0; i < header->height * header->width * header->channels; i++)
+	{
+		if(cpnm_number(data, size, &pos, CPNM_MAX_SIZE, &value))
+			return -1;
+		if(value > header->maxval)
+			value = header->maxval;
+		
+		if(decoder->sample_bytes == 2)
+			*pixels++ = value >> 8;
+		*pixels++ = value;
+	}
+	return 0;
+}
+
+
+
+/** 
+ * \brief Builds table that maps samples of the *maxval* range onto 16 bit channels
+ * 
+ * Table covers every value of the sample, values above *maxval* are clamped.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint16_t *cpnm_build_levels(uint32_t maxval, size_t sample_bytes)
+{
+	size_t		count = (size_t)1 << (8 * sample_bytes), value;
+	uint16_t	*levels = cbimage_alloc(count * sizeof(uint16_t));
+	
+	if(!levels)
+		return NULL;
+	
+	for(value = 0; value < count; value++)
+		levels[value] = (value >= maxval) ? (CPNM_MAXVAL) : ((value * CPNM_MAXVAL + maxval / 2) / maxval);
+	return levels;
+}
+
+
+
+/** 
+ * \brief Reads big-endian 16 bit sample
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint16_t cpnm_load16(const uint8_t *src)
+{
+	return (uint16_t)((src[0] << 8) | src[1]);
+}
+
+
+
+/** 
+ * \brief Converts *width* pixels of 8 bit samples (maxval 255)
+ * 
+ * Called with the constant *format*, so the format switch of the store is resolved by the compiler.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cpnm_row8(uint8_t *dst, int format, const uint8_t *src, size_t width, const cpnm_decoder *decoder)
+{
+	size_t		size = cbimage_pixel_size(format), step = decoder->pixel_bytes, x;
+	size_t		r = decoder->offsets[0], g = decoder->offsets[1], b = decoder->offsets[2], a = decoder->offsets[3];
+	
+	if(decoder->header.alpha)
+	{
+		for(x = 0; x < width; x++, dst += size, src += step)
+			cbimage_pixel_store8(dst, format, src[r], src[g], src[b], src[a]);
+	} else {
+		for(x = 0; x < width; x++, dst += size, src += step)
+			cbimage_pixel_store8(dst, format, src[r], src[g], src[b], 0);
+	}
+}
+
+
+
+/** 
+ * \brief Converts *width* pixels of 16 bit samples (maxval 65535)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline void cpnm_row16(uint8_t *dst, int format, const uint8_t *src, size_t width, const cpnm_decoder *decoder)
+{
+	size_t		size = cbimage_pixel_size(format), step = decoder->pixel_bytes, x;
+	size_t		r = decoder->offsets[0], g = decoder->offsets[1], b = decoder->offsets[2], a = decoder->offsets[3];
+	cbpixel_t	pixel;
+	
+	for(x = 0; x < width; x++, dst += size, src += step)
+	{
+		pixel.r = cpnm_load16(src + r);
+		pixel.g = cpnm_load16(src + g);
+		pixel.b = cpnm_load16(src + b);
+		pixel.a = (decoder->header.alpha) ? (cpnm_load16(src + a)) : (0);
+		cbimage_pixel_store(dst, format, pixel);
+	}
+}
+
+
+
+/** 
+ * \brief Converts *width* pixels, which samples are mapped by the levels table
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cpnm_row_levels(uint8_t *dst, int format, const uint8_t *src, size_t width, const cpnm_decoder *decoder)
+{
+	size_t		size = cbimage_pixel_size(format), step = decoder->pixel_bytes, x, c;
+	size_t		wide = (decoder->sample_bytes == 2);
+	uint16_t	sample[4];
+	cbpixel_t	pixel;
+	
+	for(x = 0; x < width; x++, dst += size, src += step)
+	{
+		for(c = 0; c < 4; c++)
+			sample[c] = decoder->levels[(wide) ? (cpnm_load16(src + decoder->offsets[c])) : (src[decoder->offsets[c]])];
+		
+		pixel.r = sample[0];
+		pixel.g = sample[1];
+		pixel.b = sample[2];
+		pixel.a = (decoder->header.alpha) ? (sample[3]) : (0);
+		cbimage_pixel_store(dst, format, pixel);
+	}
+}
+
+
+
+/** 
+ * \brief Converts *width* samples of PNM pixels into the pixels of *format* (except CBIMAGE_FORMAT_MONO1)
+ * 
+ * Rows, which pixels have the layout of the *format*, are copied.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cpnm_convert(uint8_t *dst, int format, const uint8_t *src, size_t width, const cpnm_decoder *decoder)
+{
+	if(decoder->levels)
+	{
+		cpnm_row_levels(dst, format, src, width, decoder);
+		return;
+	}
+	
+	if(decoder->sample_bytes == 1 && ((format == CBIMAGE_FORMAT_RGB8 && decoder->header.channels == 3)
+		|| (format == CBIMAGE_FORMAT_RGBA8 && decoder->header.channels == 4)))
+	{
+		memcpy(dst, src, width * decoder->pixel_bytes);
+		return;
+	}
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			if(decoder->sample_bytes == 1)
+				cpnm_row8(dst, CBIMAGE_FORMAT_RGBA16, src, width, decoder);
+			else
+				cpnm_row16(dst, CBIMAGE_FORMAT_RGBA16, src, width, decoder);
+			break;
+		case CBIMAGE_FORMAT_RGB8:
+			if(decoder->sample_bytes == 1)
+				cpnm_row8(dst, CBIMAGE_FORMAT_RGB8, src, width, decoder);
+			else
+				cpnm_row16(dst, CBIMAGE_FORMAT_RGB8, src, width, decoder);
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			if(decoder->sample_bytes == 1)
+				cpnm_row8(dst, CBIMAGE_FORMAT_RGBA8, src, width, decoder);
+			else
+				cpnm_row16(dst, CBIMAGE_FORMAT_RGBA8, src, width, decoder);
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Decodes band of the rows of the binary pixels
+ * 
+ * PBM rows (1 is black) are inverted into bit packed rows (1 is white), which are copied
+ * into CBIMAGE_FORMAT_MONO1 images or expanded into pixels of other formats. Samples are
+ * thresholded into CBIMAGE_FORMAT_MONO1 images through the temporary 8 bit pixels.
+ * 
+ * \param context - pointer to the cpnm_decoder
+ * \param begin - first row of the band
+ * \param end - row after the last row of the band
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cpnm_decode_band(void *context, size_t begin, size_t end)
+{
+	cpnm_decoder	*decoder = context;
+	size_t				width = decoder->header.width, y, x, i, count;
+	int						format = decoder->image->format;
+	int						bits = (decoder->header.magic == 1 || decoder->header.magic == 4);
+	uint8_t				chunk[CPNM_CHUNK * 4];
+	
+	for(y = begin; y < end; y++)
+	{
+		const uint8_t	*src = decoder->pixels + y * decoder->pnm_row;
+		uint8_t				*dst = cbimage_row(decoder->image, y);
+		
+		if(bits && format == CBIMAGE_FORMAT_MONO1)
+		{
+			for(i = 0; i < (width >> 3); i++)
+				dst[i] = ~src[i];
+			if(width & 7)
+			{
+				chunk[0] = ~src[i];
+				cbimage_mono_copy(dst, width & ~(size_t)7, chunk, 0, width & 7);
+			}
+			continue;
+		}
+		
+		for(x = 0; x < width; x += count)
+		{
+			count = (width - x < CPNM_CHUNK) ? (width - x) : (CPNM_CHUNK);
+			
+			if(bits)
+			{
+				for(i = 0; i < (count + 7) >> 3; i++)
+					chunk[i] = ~src[(x >> 3) + i];
+				cbimage_convert_span(dst, format, x, chunk, CBIMAGE_FORMAT_MONO1, 0, count);
+			} else if(format == CBIMAGE_FORMAT_MONO1) {
+				cpnm_convert(chunk, CBIMAGE_FORMAT_RGBA8, src + x * decoder->pixel_bytes, count, decoder);
+				cbimage_convert_span(dst, format, x, chunk, CBIMAGE_FORMAT_RGBA8, 0, count);
+			} else {
+				/* Whole row is converted at once */
+				cpnm_convert(dst, format, src, width, decoder);
+				break;
+			}
+		}
+	}
+}
+
+
+
+/** 
+ * \brief Decodes PNM file that is already in the memory
+ * 
+ * \param data - whole file
+ * \param size - size of the file in bytes
+ * \param name - name of the file for the error messages
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_t *cpnm_decode(const uint8_t *data, size_t size, int format, const char *name)
+{
+	cpnm_decoder	decoder;
+	cpnm_header		header;
+	cbimage_t			*loaded_image;
+	uint8_t				*plain = NULL;
+	uint16_t			*levels = NULL;
+	int						type, scaled = 0;
+	
+	assert(data != NULL || !size);
+	
+	if(!cbimage_pixel_size(format) && format != CBIMAGE_FORMAT_MONO1)
+	{
+		fprintf(stderr,"[ERROR] pixel format %d is not supported!\n", format);
+		return NULL;
+	}
+	
+	header = cpnm_parse_info(data, size);
+	if(!header.valid) {
+		fprintf(stderr,"[ERROR] file \"%s\": not valid or unsupported\n",name);
+		return NULL;
+	}
+	
+	memset(&decoder, 0, sizeof(cpnm_decoder));
+	decoder.header = header;
+	decoder.sample_bytes = (header.maxval > 255) ? (2) : (1);
+	decoder.pixel_bytes = decoder.sample_bytes * header.channels;
+	decoder.pnm_row = (header.magic == 1 || header.magic == 4) ? ((header.width + 7) >> 3) : (header.width * decoder.pixel_bytes);
+	
+	/* Gray pixels read the same sample as R, G and B */
+	decoder.offsets[0] = 0;
+	decoder.offsets[1] = (header.channels >= 3) ? (decoder.sample_bytes) : (0);
+	decoder.offsets[2] = (header.channels >= 3) ? (2 * decoder.sample_bytes) : (0);
+	decoder.offsets[3] = (header.channels - 1) * decoder.sample_bytes;
+	
+	if(header.height > (SIZE_MAX >> 1) / decoder.pnm_row)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not valid or unsupported\n",name);
+		return NULL;
+	}
+	
+	if(header.magic <= 3)
+	{
+		/* Every sample of the plain file takes at least one character */
+		if(header.pointer_data > size || header.height > (size - header.pointer_data) / header.width / header.channels)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": pixels are truncated or not valid\n",name);
+			return NULL;
+		}
+		
+		plain = cbimage_alloc(decoder.pnm_row * header.height);
+		
+		if(!plain)
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",name);
+			return NULL;
+		}
+		
+		if(cpnm_read_plain(&decoder, data, size, plain))
+		{
+			fprintf(stderr,"[ERROR] file \"%s\": pixels are truncated or not valid\n",name);
+			cbimage_release(plain);
+			return NULL;
+		}
+		decoder.pixels = plain;
+	} else if(header.pointer_data > size || decoder.pnm_row * header.height > size - header.pointer_data) {
+		fprintf(stderr,"[ERROR] file \"%s\": pixel array is truncated\n",name);
+		return NULL;
+	} else {
+		decoder.pixels = data + header.pointer_data;
+	}
+	
+	if(header.magic != 1 && header.magic != 4 && header.maxval != 255 && header.maxval != CPNM_MAXVAL)
+	{
+		levels = cpnm_build_levels(header.maxval, decoder.sample_bytes);
+		decoder.levels = levels;
+		scaled = 1;
+	}
+	
+	if(header.alpha)
+		type = CBIMAGE_RGBA;
+	else if(header.channels == 1 || format == CBIMAGE_FORMAT_MONO1)
+		type = CBIMAGE_MONOCHROME;
+	else
+		type = CBIMAGE_RGB;
+	
+	loaded_image = (!scaled || levels) ? (cbimage_create_uninitialized(header.width, header.height, type, format)) : (NULL);
+	
+	if(!loaded_image)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",name);
+	} else {
+		decoder.image = loaded_image;
+		cbimage_parallel_rows(header.height, header.width, cpnm_decode_band, &decoder);
+	}
+	
+	cbimage_release(levels);
+	cbimage_release(plain);
+	return loaded_image;
+}
+
+
+
+/** 
+ * This function reads PNM file and tries to load it into the memory.
+ */
+cbimage_t *cbimage_load_pnm(char *filename)
+{
+	return cbimage_load_pnm_format(filename, CBIMAGE_FORMAT_RGBA16);
+}
+
+
+
+/** 
+ * Whole file is mapped into the memory (or readed at once if mapping is not
+ * available) and binary pixels are decoded in horizontal bands by several threads.
+ */
+cbimage_t *cbimage_load_pnm_format(char *filename, int format)
+{
+	cbimage_source_t	source;
+	cbimage_t					*loaded_image;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_LOAD_PNM);
+	assert(filename != NULL);
+	
+	if(cbimage_source_open(&source, filename, 3))
+		return NULL;
+	
+	CBIMAGE_STAT_BYTES(source.size);
+	loaded_image = cpnm_decode(source.data, source.size, format, filename);
+	
+	cbimage_source_close(&source);
+	return loaded_image;
+}
+
+
+
+/** 
+ * Pixels are decoded straight from the caller's memory, which is not copied or changed.
+ */
+cbimage_t *cbimage_load_pnm_mem(const void *data, size_t size, int format)
+{
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_LOAD_PNM);
+	CBIMAGE_STAT_BYTES(size);
+	
+	if(!data)
+		size = 0;
+	
+	return cpnm_decode(data, size, format, "(memory)");
+}
+
+
+
+/** 
+ * \brief Chooses layout of the file for cbimage_save_pnm()
+ * 
+ * \return Returns 0 if succsesfull or -1 if *kind* or *bits* is not supported
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cpnm_choose(cpnm_header *header, cbimage_t *image, int kind, int bits)
+{
+	int gray = (image->type == CBIMAGE_MONOCHROME || image->format == CBIMAGE_FORMAT_MONO1);
+	int alpha = (image->type == CBIMAGE_RGBA && (image->format == CBIMAGE_FORMAT_RGBA16 || image->format == CBIMAGE_FORMAT_RGBA8));
+	
+	memset(header, 0, sizeof(cpnm_header));
+	
+	if(!bits)
+		bits = (image->format == CBIMAGE_FORMAT_RGBA16) ? (16) : (8);
+	if(bits != 8 && bits != 16)
+		return -1;
+	
+	if(kind == CBIMAGE_PNM_AUTO)
+	{
+		if(image->format == CBIMAGE_FORMAT_MONO1)
+			kind = CBIMAGE_PNM_PBM;
+		else if(image->type == CBIMAGE_RGBA)
+			kind = CBIMAGE_PNM_PAM;
+		else if(image->type == CBIMAGE_MONOCHROME)
+			kind = CBIMAGE_PNM_PGM;
+		else
+			kind = CBIMAGE_PNM_PPM;
+	}
+	
+	header->width = image->width;
+	header->height = image->height;
+	header->maxval = (bits == 16) ? (CPNM_MAXVAL) : (255);
+	
+	switch(kind)
+	{
+		case CBIMAGE_PNM_PBM:
+			header->magic = 4;
+			header->channels = 1;
+			header->maxval = 1;
+			break;
+		case CBIMAGE_PNM_PGM:
+			header->magic = 5;
+			header->channels = 1;
+			break;
+		case CBIMAGE_PNM_PPM:
+			header->magic = 6;
+			header->channels = 3;
+			break;
+		case CBIMAGE_PNM_PAM:
+			header->magic = 7;
+			header->alpha = alpha;
+			header->channels = ((gray) ? (1) : (3)) + ((alpha) ? (1) : (0));
+			break;
+		default:
+			return -1;
+	}
+	
+	header->valid = 1;
+	return 0;
+}
+
+
+
+/** 
+ * \brief Forms the header of the binary PNM file
+ * 
+ * \return Returns length of the header
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static size_t cpnm_form_header(char form[CPNM_HEADER_MAX], const cpnm_header *header)
+{
+	static const char *tuple_types[] = {"GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA"};
+	
+	switch(header->magic)
+	{
+		case 4:
+			return snprintf(form, CPNM_HEADER_MAX, "P4\n%zu %zu\n", header->width, header->height);
+		case 7:
+			return snprintf(form, CPNM_HEADER_MAX, "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH %zu\nMAXVAL %u\nTUPLTYPE %s\nENDHDR\n",
+				header->width, header->height, header->channels, header->maxval, tuple_types[header->channels - 1]);
+	}
+	return snprintf(form, CPNM_HEADER_MAX, "P%d\n%zu %zu\n%u\n", header->magic, header->width, header->height, header->maxval);
+}
+
+
+
+/** 
+ * \brief Gets size of the PNM row in bytes
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline size_t cpnm_row_bytes(const cpnm_header *header)
+{
+	if(header->magic == 4)
+		return (header->width + 7) >> 3;
+	return header->width * header->channels * ((header->maxval > 255) ? (2) : (1));
+}
+
+
+
+/** 
+ * \brief Encodes *width* pixels of *format* into samples
+ * 
+ * Called with the constant *format*, so the format switch of the load is resolved by the compiler.
+ * 
+ * \return Returns pointer after the last sample
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint8_t *cpnm_encode_row(uint8_t *dst, int format, const cpnm_header *header, const uint8_t *src, size_t width)
+{
+	size_t		size = cbimage_pixel_size(format), x;
+	int				wide = (header->maxval > 255), gray = (header->channels - header->alpha == 1);
+	cbpixel_t	pixel;
+	
+	for(x = 0; x < width; x++, src += size)
+	{
+		pixel = cbimage_pixel_load(src, format);
+		
+		if(gray)
+			pixel.r = ((uint32_t)pixel.r + pixel.g + pixel.b) / 3;
+		
+		if(wide)
+		{
+			*dst++ = pixel.r >> 8;
+			*dst++ = pixel.r;
+			if(!gray)
+			{
+				*dst++ = pixel.g >> 8;
+				*dst++ = pixel.g;
+				*dst++ = pixel.b >> 8;
+				*dst++ = pixel.b;
+			}
+			if(header->alpha)
+			{
+				*dst++ = pixel.a >> 8;
+				*dst++ = pixel.a;
+			}
+		} else {
+			*dst++ = pixel.r >> 8;
+			if(!gray)
+			{
+				*dst++ = pixel.g >> 8;
+				*dst++ = pixel.b >> 8;
+			}
+			if(header->alpha)
+				*dst++ = pixel.a >> 8;
+		}
+	}
+	return dst;
+}
+
+
+
+/** 
+ * \brief Encodes *width* pixels of *format* (except CBIMAGE_FORMAT_MONO1) into samples
+ * 
+ * Pixels, which layout is the layout of the samples, are copied.
+ * 
+ * \return Returns pointer after the last sample
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint8_t *cpnm_encode_pixels(uint8_t *dst, const cpnm_header *header, const uint8_t *src, int format, size_t width)
+{
+	if(header->maxval <= 255 && ((format == CBIMAGE_FORMAT_RGB8 && header->channels == 3) || (format == CBIMAGE_FORMAT_RGBA8 && header->channels == 4)))
+	{
+		memcpy(dst, src, width * header->channels);
+		return dst + width * header->channels;
+	}
+	
+	switch(format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			return cpnm_encode_row(dst, CBIMAGE_FORMAT_RGBA16, header, src, width);
+		case CBIMAGE_FORMAT_RGB8:
+			return cpnm_encode_row(dst, CBIMAGE_FORMAT_RGB8, header, src, width);
+		case CBIMAGE_FORMAT_RGBA8:
+			return cpnm_encode_row(dst, CBIMAGE_FORMAT_RGBA8, header, src, width);
+	}
+	return dst;
+}
+
+
+
+/** 
+ * \brief Encodes band of the rows into the binary pixels
+ * 
+ * PBM rows are thresholded (or copied from CBIMAGE_FORMAT_MONO1 images) and inverted,
+ * pixels of CBIMAGE_FORMAT_MONO1 images are expanded into the temporary 8 bit pixels.
+ * 
+ * \param context - pointer to the cpnm_encoder
+ * \param begin - first row of the band, relatively to the *image_row*
+ * \param end - row after the last row of the band
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cpnm_encode_band(void *context, size_t begin, size_t end)
+{
+	cpnm_encoder	*encoder = context;
+	size_t				width = encoder->image->width, y, x, i, count;
+	int						format = encoder->image->format;
+	uint8_t				chunk[CPNM_CHUNK * 4];
+	
+	for(y = begin; y < end; y++)
+	{
+		const uint8_t	*src = cbimage_row(encoder->image, encoder->image_row + y);
+		uint8_t				*dst = encoder->pixels + y * encoder->pnm_row;
+		
+		if(encoder->header.magic == 4)
+		{
+			memset(dst, 0, encoder->pnm_row);
+			cbimage_convert_span(dst, CBIMAGE_FORMAT_MONO1, 0, src, format, 0, width);
+			for(i = 0; i < encoder->pnm_row; i++)
+				dst[i] = ~dst[i];
+			if(width & 7)
+				dst[encoder->pnm_row - 1] &= 0xFF << (8 - (width & 7));
+			continue;
+		}
+		
+		if(format != CBIMAGE_FORMAT_MONO1)
+		{
+			cpnm_encode_pixels(dst, &encoder->header, src, format, width);
+			continue;
+		}
+		
+		for(x = 0; x < width; x += count)
+		{
+			count = (width - x < CPNM_CHUNK) ? (width - x) : (CPNM_CHUNK);
+			cbimage_convert_span(chunk, CBIMAGE_FORMAT_RGBA8, 0, src, format, x, count);
+			dst = cpnm_encode_pixels(dst, &encoder->header, chunk, CBIMAGE_FORMAT_RGBA8, count);
+		}
+	}
+}
+
+
+
+/** 
+ * Header is written at once, rows are encoded into the large buffer by several threads
+ * and written with one call per buffer.
+ */
+int cbimage_save_pnm(char *filename, cbimage_t image, int kind, int bits)
+{
+	cpnm_encoder	encoder;
+	char					form[CPNM_HEADER_MAX];
+	size_t				length, rows, written;
+	uint8_t				*buffer;
+	FILE					*handle;
+	int						result = 0;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_SAVE_PNM);
+	assert(filename != NULL);
+	
+	if(cpnm_choose(&encoder.header, &image, kind, bits))
+	{
+		fprintf(stderr,"[ERROR] PNM kind %d with %d bits is not supported!\n", kind, bits);
+		return -1;
+	}
+	
+	encoder.image = &image;
+	encoder.pnm_row = cpnm_row_bytes(&encoder.header);
+	length = cpnm_form_header(form, &encoder.header);
+	CBIMAGE_STAT_BYTES(length + encoder.pnm_row * image.height);
+	
+	/* Rows of the image without columns are empty, only the header is written */
+	rows = (encoder.pnm_row) ? (CPNM_WRITE_BUFFER / encoder.pnm_row) : (image.height);
+	if(rows < 1)
+		rows = 1;
+	if(rows > image.height)
+		rows = image.height;
+	
+	buffer = cbimage_alloc(rows * encoder.pnm_row + 1);
+	if(!buffer)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": not enough memory\n",filename);
+		return -1;
+	}
+	
+	handle = fopen(filename, "wb");
+	if(!handle)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
+		perror("");
+		cbimage_release(buffer);
+		return -1;
+	}
+	
+	if(fwrite(form, sizeof(char), length, handle) != length)
+		result = -1;
+	
+	encoder.pixels = buffer;
+	
+	for(written = 0; !result && written < image.height; written += rows)
+	{
+		size_t chunk = (image.height - written < rows) ? (image.height - written) : (rows);
+		
+		encoder.image_row = written;
+		cbimage_parallel_rows(chunk, image.width, cpnm_encode_band, &encoder);
+		
+		if(fwrite(buffer, sizeof(uint8_t), encoder.pnm_row * chunk, handle) != encoder.pnm_row * chunk)
+			result = -1;
+	}
+	
+	if(fclose(handle))
+		result = -1;
+	cbimage_release(buffer);
+	
+	if(result)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": write failed\n",filename);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+/** 
+ * Buffer is grown once to the exact size of the file, then rows are encoded into it by several threads.
+ */
+int cbimage_save_pnm_buffer(cbimage_buffer_t *buffer, cbimage_t image, int kind, int bits)
+{
+	cpnm_encoder	encoder;
+	char					form[CPNM_HEADER_MAX];
+	size_t				length;
+	uint8_t				*data;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_SAVE_PNM);
+	assert(buffer != NULL);
+	
+	if(cpnm_choose(&encoder.header, &image, kind, bits))
+	{
+		fprintf(stderr,"[ERROR] PNM kind %d with %d bits is not supported!\n", kind, bits);
+		return -1;
+	}
+	
+	encoder.image = &image;
+	encoder.pnm_row = cpnm_row_bytes(&encoder.header);
+	encoder.image_row = 0;
+	length = cpnm_form_header(form, &encoder.header);
+	CBIMAGE_STAT_BYTES(length + encoder.pnm_row * image.height);
+	
+	data = cbimage_buffer_append(buffer, length + encoder.pnm_row * image.height);
+	if(!data)
+	{
+		fprintf(stderr,"[ERROR] not enough memory\n");
+		return -1;
+	}
+	
+	memcpy(data, form, length);
+	encoder.pixels = data + length;
+	cbimage_parallel_rows(image.height, image.width, cpnm_encode_band, &encoder);
+	return 0;
+}
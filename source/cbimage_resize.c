@@ -0,0 +1,566 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <math.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/** 
+ * \brief Size of the intermediate rows of one tile of cbimage_resize_to()
+ * 
+ * Tile of the destination rows is computed from the horizontally filtered source
+ * rows, that are kept in the cache while vertical pass reads them.
+ */
+#define CBIMAGE_RESIZE_CACHE (256 * 1024)
+
+/** 
+ * \brief Weights of one axis of the separable resampling
+ * 
+ * Destination pixel *i* is the sum of *taps* source pixels starting from *first[i]*
+ * multiplied by *weights[i * taps]*.. Every window fits into the source, so no
+ * bounds are checked while filtering.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	size_t	*first;
+	float		*weights;
+	size_t	taps;
+} cbimage_resize_axis_t;
+
+/** 
+ * \brief Context of cbimage_resize_to()
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_t							*dst;
+	cbimage_t							*src;
+	cbimage_resize_axis_t	horizontal;
+	cbimage_resize_axis_t	vertical;
+	size_t								*columns;
+	size_t								tile;
+	size_t								lines;
+	atomic_int						failed;
+} cbimage_resize_job_t;
+
+
+
+/** 
+ * \brief Gets radius of the filter in source pixels (when image is not reduced)
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static double cbimage_resize_support(int filter)
+{
+	switch(filter)
+	{
+		case CBIMAGE_FILTER_BICUBIC:
+			return 2.0;
+		case CBIMAGE_FILTER_LANCZOS:
+			return 3.0;
+	}
+	return 1.0;
+}
+
+
+
+/** 
+ * \brief Normalized sinc function
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static double cbimage_resize_sinc(double x)
+{
+	if(x == 0.0)
+		return 1.0;
+	x *= M_PI;
+	return sin(x) / x;
+}
+
+
+
+/** 
+ * \brief Gets weight of the source pixel at the distance *x*
+ * 
+ * Bicubic filter is the Keys cubic with a = -0.5, Lanczos filter has 3 lobes.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static double cbimage_resize_filter(int filter, double x)
+{
+	const double a = -0.5;
+	
+	if(x < 0.0)
+		x = -x;
+	
+	switch(filter)
+	{
+		case CBIMAGE_FILTER_BICUBIC:
+			if(x < 1.0)
+				return ((a + 2.0) * x - (a + 3.0)) * x * x + 1.0;
+			if(x < 2.0)
+				return (((x - 5.0) * x + 8.0) * x - 4.0) * a;
+			return 0.0;
+		case CBIMAGE_FILTER_LANCZOS:
+			return (x < 3.0) ? (cbimage_resize_sinc(x) * cbimage_resize_sinc(x / 3.0)) : (0.0);
+	}
+	return (x < 1.0) ? (1.0 - x) : (0.0);
+}
+
+
+
+/** 
+ * \brief Computes weights of one axis
+ * 
+ * Pixel centers of both images are aligned, so the image keeps its position.
+ * When the image is reduced, filter is stretched by the scale, so every source
+ * pixel contributes to the result. Weights of the source pixels outside of the image
+ * are dropped and the rest are normalized.
+ * 
+ * \param axis - receives weights, must be released by cbimage_resize_axis_release()
+ * \param in - size of the source
+ * \param out - size of the destination
+ * \return Returns 0 if succsesfull or -1 if there is not enough memory
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static int cbimage_resize_axis(cbimage_resize_axis_t *axis, size_t in, size_t out, int filter)
+{
+	double	scale = (double)in / out, stretch = (scale > 1.0) ? (scale) : (1.0);
+	double	support = cbimage_resize_support(filter) * stretch;
+	size_t	i, x;
+	
+	axis->taps = 0;
+	axis->weights = NULL;
+	axis->first = cbimage_alloc(out * sizeof(size_t));
+	if(!axis->first)
+		return -1;
+	
+	/* Windows are found first, all of them get the size of the largest one */
+	for(i = 0; i < out; i++)
+	{
+		double	center = (i + 0.5) * scale;
+		double	low = floor(center - support + 0.5), high = floor(center + support + 0.5);
+		size_t	begin = (low > 0.0) ? ((size_t)low) : (0), end = (high < (double)in) ? ((size_t)high) : (in);
+		
+		if(end <= begin)
+			end = begin + 1;
+		if(end - begin > axis->taps)
+			axis->taps = end - begin;
+		axis->first[i] = begin;
+	}
+	
+	axis->weights = cbimage_alloc(out * axis->taps * sizeof(float));
+	if(!axis->weights)
+	{
+		cbimage_release(axis->first);
+		return -1;
+	}
+	
+	for(i = 0; i < out; i++)
+	{
+		double	center = (i + 0.5) * scale, total = 0.0;
+		size_t	begin = axis->first[i], end = begin + axis->taps;
+		float		*weights = axis->weights + i * axis->taps;
+		
+		if(end > in)
+			end = in;
+		
+		/* Window is moved back from the end of the source, pixels out of the filter get zero weight */
+		if(begin + axis->taps > in)
+			axis->first[i] = in - axis->taps;
+		
+		memset(weights, 0, axis->taps * sizeof(float));
+		
+		for(x = begin; x < end; x++)
+		{
+			double weight = cbimage_resize_filter(filter, (x + 0.5 - center) / stretch);
+			
+			weights[x - axis->first[i]] = (float)weight;
+			total += weight;
+		}
+		
+		if(total == 0.0)
+		{
+			weights[begin - axis->first[i]] = 1.0f;
+			continue;
+		}
+		
+		for(x = 0; x < axis->taps; x++)
+			weights[x] = (float)(weights[x] / total);
+	}
+	
+	return 0;
+}
+
+
+
+/** 
+ * \brief Releases weights of one axis
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_resize_axis_release(cbimage_resize_axis_t *axis)
+{
+	cbimage_release(axis->first);
+	cbimage_release(axis->weights);
+}
+
+
+
+void cbimage_scalar_resample_row(float *dst, const float *src, size_t width, const size_t *first, const float *weights, size_t taps)
+{
+	size_t x, k, c;
+	
+	for(x = 0; x < width; x++, dst += 4, weights += taps)
+	{
+		const float	*from = src + 4 * first[x];
+		float				sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+		
+		for(k = 0; k < taps; k++, from += 4)
+		{
+			for(c = 0; c < 4; c++)
+				sum[c] += weights[k] * from[c];
+		}
+		
+		for(c = 0; c < 4; c++)
+			dst[c] = sum[c];
+	}
+}
+
+
+
+void cbimage_scalar_resample_lines(float *dst, const float *lines, size_t stride, const float *weights, size_t taps, size_t count)
+{
+	size_t i, k;
+	
+	for(i = 0; i < count; i++)
+	{
+		const float	*from = lines + i;
+		float				sum = 0.0f;
+		
+		for(k = 0; k < taps; k++, from += stride)
+			sum += weights[k] * *from;
+		
+		dst[i] = sum;
+	}
+}
+
+
+
+/** 
+ * Rows are converted into floats (16 bit channels are exact in floats), 8 bit
+ * channels are expanded the same way as cbimage_pixel_load() does.
+ */
+void cbimage_float_row_load(float *dst, const cbimage_t *image, size_t y, cbpixel_t *pixels)
+{
+	const uint8_t	*row = cbimage_row(image, y);
+	size_t				width = image->width, x;
+	
+	switch(image->format)
+	{
+		case CBIMAGE_FORMAT_RGBA8:
+			for(x = 0; x < 4 * width; x++)
+				dst[x] = row[x] * 256.0f;
+			break;
+		case CBIMAGE_FORMAT_RGB8:
+			for(x = 0; x < width; x++, row += 3)
+			{
+				dst[4 * x] = row[0] * 256.0f;
+				dst[4 * x + 1] = row[1] * 256.0f;
+				dst[4 * x + 2] = row[2] * 256.0f;
+				dst[4 * x + 3] = 0.0f;
+			}
+			break;
+		default:
+			if(image->format != CBIMAGE_FORMAT_RGBA16)
+			{
+				cbimage_convert_span((uint8_t*)pixels, CBIMAGE_FORMAT_RGBA16, 0, row, image->format, 0, width);
+				row = (const uint8_t*)pixels;
+			}
+			for(x = 0; x < 4 * width; x++)
+				dst[x] = ((const uint16_t*)row)[x];
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Rounds the filtered channel to 16 bits
+ * 
+ * Overshoots of the filters are clamped. Clamping is done by selects and the value is
+ * converted through int32_t, so loops over the channels are vectorized.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static inline uint16_t cbimage_float_clamp(float value)
+{
+	value += 0.5f;
+	value = (value > 0.0f) ? (value) : (0.0f);
+	value = (value < 65535.0f) ? (value) : (65535.0f);
+	return (uint16_t)(int32_t)value;
+}
+
+
+
+/** 
+ * 8 bit channels are truncated the same way as cbimage_pixel_store() does.
+ */
+void cbimage_float_row_store(cbimage_t *image, size_t y, const float *src, cbpixel_t *pixels)
+{
+	uint8_t	*row = cbimage_row(image, y);
+	size_t	width = image->width, x;
+	
+	switch(image->format)
+	{
+		case CBIMAGE_FORMAT_RGBA16:
+			for(x = 0; x < 4 * width; x++)
+				((uint16_t*)row)[x] = cbimage_float_clamp(src[x]);
+			break;
+		case CBIMAGE_FORMAT_RGBA8:
+			for(x = 0; x < 4 * width; x++)
+				row[x] = cbimage_float_clamp(src[x]) >> 8;
+			break;
+		case CBIMAGE_FORMAT_RGB8:
+			for(x = 0; x < width; x++, row += 3, src += 4)
+			{
+				row[0] = cbimage_float_clamp(src[0]) >> 8;
+				row[1] = cbimage_float_clamp(src[1]) >> 8;
+				row[2] = cbimage_float_clamp(src[2]) >> 8;
+			}
+			break;
+		default:
+			for(x = 0; x < 4 * width; x++)
+				((uint16_t*)pixels)[x] = cbimage_float_clamp(src[x]);
+			cbimage_convert_span(row, image->format, 0, (const uint8_t*)pixels, CBIMAGE_FORMAT_RGBA16, 0, width);
+			break;
+	}
+}
+
+
+
+/** 
+ * \brief Resamples band of the tiles of the destination rows
+ * 
+ * Source rows of the tile are converted into floats and filtered horizontally into
+ * the intermediate lines, then every destination row is the weighted sum of the lines.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_resize_band(void *context, size_t begin, size_t end)
+{
+	cbimage_resize_job_t		*job = context;
+	cbimage_resize_axis_t		*axis = &job->vertical;
+	cbimage_t								*dst = job->dst;
+	const cbimage_kernels_t	*kernels = cbimage_kernels();
+	size_t									values = 4 * dst->width, tile, y;
+	cbpixel_t								*pixels;
+	float										*source, *lines, *sum;
+	
+	/* Buffer of 16 bit channels is used both for the source and for the destination rows */
+	pixels = cbimage_alloc(((job->src->width > dst->width) ? (job->src->width) : (dst->width)) * sizeof(cbpixel_t)
+		+ (4 * job->src->width + values * (job->lines + 1)) * sizeof(float));
+	if(!pixels)
+	{
+		atomic_store(&job->failed, 1);
+		return;
+	}
+	source = (float*)(pixels + ((job->src->width > dst->width) ? (job->src->width) : (dst->width)));
+	sum = source + 4 * job->src->width;
+	lines = sum + values;
+	
+	for(tile = begin; tile < end; tile++)
+	{
+		size_t first = tile * job->tile, last = (first + job->tile < dst->height) ? (first + job->tile) : (dst->height);
+		size_t top = axis->first[first], bottom = axis->first[last - 1] + axis->taps;
+		
+		for(y = top; y < bottom; y++)
+		{
+			cbimage_float_row_load(source, job->src, y, pixels);
+			kernels->resample_row(lines + (y - top) * values, source, dst->width, job->horizontal.first, job->horizontal.weights, job->horizontal.taps);
+		}
+		
+		for(y = first; y < last; y++)
+		{
+			kernels->resample_lines(sum, lines + (axis->first[y] - top) * values, values, axis->weights + y * axis->taps, axis->taps, values);
+			cbimage_float_row_store(dst, y, sum, pixels);
+		}
+	}
+	
+	cbimage_release(pixels);
+}
+
+
+
+/** 
+ * \brief Copies nearest source pixels into the band of the destination rows
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_resize_nearest_band(void *context, size_t begin, size_t end)
+{
+	cbimage_resize_job_t	*job = context;
+	cbimage_t							*dst = job->dst, *src = job->src;
+	size_t								size = cbimage_pixel_size(dst->format), x, y;
+	
+	for(y = begin; y < end; y++)
+	{
+		size_t				row = (size_t)((y + 0.5) * src->height / dst->height);
+		const uint8_t	*from = cbimage_row(src, (row < src->height) ? (row) : (src->height - 1));
+		uint8_t				*to = cbimage_row(dst, y);
+		
+		switch(size)
+		{
+			case 0:
+				for(x = 0; x < dst->width; x++)
+					cbimage_mono_set(to, x, cbimage_mono_get(from, job->columns[x]));
+				break;
+			case 3:
+				for(x = 0; x < dst->width; x++, to += 3)
+					memcpy(to, from + 3 * job->columns[x], 3);
+				break;
+			case 4:
+				for(x = 0; x < dst->width; x++, to += 4)
+					memcpy(to, from + 4 * job->columns[x], 4);
+				break;
+			default:
+				for(x = 0; x < dst->width; x++, to += size)
+					memcpy(to, from + size * job->columns[x], size);
+				break;
+		}
+	}
+}
+
+
+
+/** 
+ * Nearest filter copies pixels (formats must match), other filters are separable:
+ * weights of both axes are computed once, then tiles of the destination rows are
+ * resampled in parallel.
+ */
+int cbimage_resize_to(cbimage_t *dst, cbimage_t *src, int filter)
+{
+	cbimage_resize_job_t	job;
+	size_t								x, lines;
+	
+	CBIMAGE_STAT_SCOPE(CBIMAGE_STAT_RESIZE);
+	assert(dst != NULL);
+	assert(src != NULL);
+	CBIMAGE_STAT_BYTES(cbimage_bytes(src));
+	
+	if(filter < CBIMAGE_FILTER_NEAREST || filter > CBIMAGE_FILTER_LANCZOS)
+		return -1;
+	if(!dst->width || !dst->height || !src->width || !src->height)
+		return -1;
+	
+	job.dst = dst;
+	job.src = src;
+	
+	if(filter == CBIMAGE_FILTER_NEAREST)
+	{
+		if(dst->format != src->format)
+			return -1;
+		
+		job.columns = cbimage_alloc(dst->width * sizeof(size_t));
+		if(!job.columns)
+			return -1;
+		
+		for(x = 0; x < dst->width; x++)
+		{
+			job.columns[x] = (size_t)((x + 0.5) * src->width / dst->width);
+			if(job.columns[x] >= src->width)
+				job.columns[x] = src->width - 1;
+		}
+		
+		cbimage_parallel_rows(dst->height, dst->width, cbimage_resize_nearest_band, &job);
+		cbimage_release(job.columns);
+		return 0;
+	}
+	
+	if(cbimage_resize_axis(&job.horizontal, src->width, dst->width, filter))
+		return -1;
+	if(cbimage_resize_axis(&job.vertical, src->height, dst->height, filter))
+	{
+		cbimage_resize_axis_release(&job.horizontal);
+		return -1;
+	}
+	
+	/* Tile is as high as the lines of its source rows fit into the cache, but
+	 * there are always several times more lines than taps, so few of them are filtered twice */
+	lines = CBIMAGE_RESIZE_CACHE / (4 * dst->width * sizeof(float));
+	if(lines < 4 * job.vertical.taps)
+		lines = 4 * job.vertical.taps;
+	job.tile = (size_t)((lines - job.vertical.taps) * (double)dst->height / src->height) + 1;
+	if(job.tile > dst->height)
+		job.tile = dst->height;
+	
+	job.lines = 0;
+	for(x = 0; x < dst->height; x += job.tile)
+	{
+		size_t last = (x + job.tile < dst->height) ? (x + job.tile) : (dst->height);
+		
+		if(job.vertical.first[last - 1] + job.vertical.taps - job.vertical.first[x] > job.lines)
+			job.lines = job.vertical.first[last - 1] + job.vertical.taps - job.vertical.first[x];
+	}
+	
+	atomic_init(&job.failed, 0);
+	cbimage_parallel_rows((dst->height + job.tile - 1) / job.tile, dst->width * job.tile, cbimage_resize_band, &job);
+	
+	cbimage_resize_axis_release(&job.horizontal);
+	cbimage_resize_axis_release(&job.vertical);
+	return (atomic_load(&job.failed)) ? (-1) : (0);
+}
+
+
+
+cbimage_t *cbimage_resize(cbimage_t *image, size_t width, size_t height, int filter)
+{
+	cbimage_t *out;
+	
+	assert(image != NULL);
+	
+	out = cbimage_create_uninitialized(width, height, image->type, image->format);
+	if(!out)
+		return NULL;
+	
+	if(cbimage_resize_to(out, image, filter))
+	{
+		cbimage_destroy(out);
+		return NULL;
+	}
+	return out;
+}
@@ -0,0 +1,262 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef CBIMAGE_STATS
+#include <time.h>
+#include <stdatomic.h>
+#endif
+
+/** 
+ * \brief Names of the operations, as they appear in statistics and traces
+ */
+static const char *cbimage_stat_names[CBIMAGE_STAT_COUNT] = {
+	"cbimage_load_bmp",
+	"cbimage_save_bmp",
+	"cbimage_bmp_reader_read",
+	"cbimage_bmp_writer_write",
+	"cbimage_create",
+	"cbimage_free",
+	"cbimage_inverse",
+	"cbimage_fill",
+	"cbimage_mirror",
+	"cbimage_rotate",
+	"cbimage_orient",
+	"cbimage_insert",
+	"cbimage_bond",
+	"cbimage_blend",
+	"cbimage_pipeline_run",
+	"cbimage_resize",
+	"cbimage_load_pnm",
+	"cbimage_save_pnm",
+	"cbimage_convolve",
+	"cbimage_box_blur"
+};
+
+
+
+#ifdef CBIMAGE_STATS
+/** 
+ * \brief Counters of one operation
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	atomic_uint_fast64_t	calls;
+	atomic_uint_fast64_t	bytes;
+	atomic_uint_fast64_t	nanoseconds;
+	atomic_uint_fast64_t	allocated;
+} cbimage_stat_counters_t;
+
+static cbimage_stat_counters_t cbimage_stat_counters[CBIMAGE_STAT_COUNT];
+
+/** 
+ * \brief Operation that is currently executed by the thread, allocations are accounted to it
+ */
+static _Thread_local int cbimage_stat_current = -1;
+
+/** 
+ * \brief Thread identifier used in the trace, 0 means "not assigned yet"
+ */
+static _Thread_local int cbimage_stat_thread = 0;
+static atomic_int cbimage_stat_threads = 0;
+
+/** 
+ * \brief Trace file, events are written only while it is open
+ */
+static FILE *_Atomic	cbimage_trace_file = NULL;
+static atomic_flag		cbimage_trace_lock = ATOMIC_FLAG_INIT;
+static int						cbimage_trace_first = 1;
+
+
+
+/** 
+ * \brief Gets monotonic time in nanoseconds
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static uint64_t cbimage_stats_now(void)
+{
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+
+
+void cbimage_stats_enter(cbimage_stat_scope_t *scope, int operation)
+{
+	scope->operation = operation;
+	scope->outer = cbimage_stat_current;
+	scope->bytes = 0;
+	scope->start = cbimage_stats_now();
+	cbimage_stat_current = operation;
+}
+
+
+
+void cbimage_stats_leave(cbimage_stat_scope_t *scope)
+{
+	cbimage_stat_counters_t	*counters = &cbimage_stat_counters[scope->operation];
+	uint64_t								end = cbimage_stats_now();
+	FILE										*trace;
+	
+	cbimage_stat_current = scope->outer;
+	
+	atomic_fetch_add_explicit(&counters->calls, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&counters->bytes, scope->bytes, memory_order_relaxed);
+	atomic_fetch_add_explicit(&counters->nanoseconds, end - scope->start, memory_order_relaxed);
+	
+	trace = atomic_load_explicit(&cbimage_trace_file, memory_order_acquire);
+	if(!trace)
+		return;
+	
+	if(!cbimage_stat_thread)
+		cbimage_stat_thread = atomic_fetch_add(&cbimage_stat_threads, 1) + 1;
+	
+	while(atomic_flag_test_and_set_explicit(&cbimage_trace_lock, memory_order_acquire));
+	
+	/* File may be closed while this thread was waiting for the lock */
+	if(atomic_load_explicit(&cbimage_trace_file, memory_order_relaxed) == trace)
+	{
+		fprintf(trace, "%s{\"name\": \"%s\", \"cat\": \"cbimage\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"bytes\": %llu}}",
+			(cbimage_trace_first) ? ("") : (",\n"), cbimage_stat_names[scope->operation],
+			scope->start / 1e3, (end - scope->start) / 1e3, cbimage_stat_thread, (unsigned long long)scope->bytes);
+		cbimage_trace_first = 0;
+	}
+	
+	atomic_flag_clear_explicit(&cbimage_trace_lock, memory_order_release);
+}
+
+
+
+void cbimage_stats_alloc(size_t bytes)
+{
+	if(cbimage_stat_current >= 0)
+		atomic_fetch_add_explicit(&cbimage_stat_counters[cbimage_stat_current].allocated, bytes, memory_order_relaxed);
+}
+#endif
+
+
+
+int cbimage_stats_get(cbimage_stat_t stats[CBIMAGE_STAT_COUNT])
+{
+	int i;
+	
+	memset(stats, 0, sizeof(cbimage_stat_t) * CBIMAGE_STAT_COUNT);
+	
+	for(i = 0; i < CBIMAGE_STAT_COUNT; i++)
+	{
+		stats[i].name = cbimage_stat_names[i];
+#ifdef CBIMAGE_STATS
+		stats[i].calls = atomic_load_explicit(&cbimage_stat_counters[i].calls, memory_order_relaxed);
+		stats[i].bytes = atomic_load_explicit(&cbimage_stat_counters[i].bytes, memory_order_relaxed);
+		stats[i].nanoseconds = atomic_load_explicit(&cbimage_stat_counters[i].nanoseconds, memory_order_relaxed);
+		stats[i].allocated = atomic_load_explicit(&cbimage_stat_counters[i].allocated, memory_order_relaxed);
+#endif
+	}
+	
+#ifdef CBIMAGE_STATS
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+
+
+void cbimage_stats_reset(void)
+{
+#ifdef CBIMAGE_STATS
+	int i;
+	
+	for(i = 0; i < CBIMAGE_STAT_COUNT; i++)
+	{
+		atomic_store_explicit(&cbimage_stat_counters[i].calls, 0, memory_order_relaxed);
+		atomic_store_explicit(&cbimage_stat_counters[i].bytes, 0, memory_order_relaxed);
+		atomic_store_explicit(&cbimage_stat_counters[i].nanoseconds, 0, memory_order_relaxed);
+		atomic_store_explicit(&cbimage_stat_counters[i].allocated, 0, memory_order_relaxed);
+	}
+#endif
+}
+
+
+
+int cbimage_trace_start(char *filename)
+{
+#ifdef CBIMAGE_STATS
+	FILE *handle;
+	
+	if(atomic_load(&cbimage_trace_file))
+	{
+		fprintf(stderr,"[ERROR] trace is already started\n");
+		return -1;
+	}
+	
+	handle = fopen(filename, "w");
+	if(!handle)
+	{
+		fprintf(stderr,"[ERROR] file \"%s\": ",filename);
+		perror("");
+		return -1;
+	}
+	
+	fputs("{\"traceEvents\": [\n", handle);
+	cbimage_trace_first = 1;
+	atomic_store(&cbimage_trace_file, handle);
+	return 0;
+#else
+	(void)filename;
+	fprintf(stderr,"[ERROR] library is built without CBIMAGE_STATS\n");
+	return -1;
+#endif
+}
+
+
+
+int cbimage_trace_stop(void)
+{
+#ifdef CBIMAGE_STATS
+	FILE *handle;
+	
+	while(atomic_flag_test_and_set_explicit(&cbimage_trace_lock, memory_order_acquire));
+	handle = atomic_exchange(&cbimage_trace_file, NULL);
+	atomic_flag_clear_explicit(&cbimage_trace_lock, memory_order_release);
+	
+	if(!handle)
+		return -1;
+	
+	fputs("\n], \"displayTimeUnit\": \"ms\"}\n", handle);
+	return (fclose(handle)) ? (-1) : (0);
+#else
+	return -1;
+#endif
+}
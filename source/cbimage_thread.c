@@ -0,0 +1,459 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file */ 
+
+#include "cbimage_internal.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/** 
+ * \brief Maximal amount of threads taking part in one operation
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_MAX_THREADS 256
+
+/** 
+ * \brief Amount of pixels, that one claim of the parallel loop should contain
+ * 
+ * \warning This constant ment to be used *ONLY* internaly.
+ */
+#define CBIMAGE_GRAIN_PIXELS 16384
+
+/** 
+ * \brief Thread count set by cbimage_set_threads(), 0 means "all processors"
+ */
+static atomic_int cbimage_threads = 0;
+
+/** 
+ * \brief Images with less pixels are processed by the calling thread
+ */
+static atomic_size_t cbimage_threshold = CBIMAGE_DEFAULT_THRESHOLD;
+
+/** 
+ * \brief Nonzero while the thread takes part in a parallel loop, nested loops are not split
+ */
+static _Thread_local int cbimage_in_parallel = 0;
+
+
+
+/** 
+ * \brief Range of items, that initially belongs to one participant
+ * 
+ * Every participant claims grains from its own range first and then from
+ * the ranges of others, so threads that finished early take over the work
+ * of the slow ones.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	atomic_size_t	next;
+	size_t				end;
+} cbimage_range_t;
+
+/** 
+ * \brief Single parallel loop
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	cbimage_band_fn	band;
+	void						*context;
+	size_t					grain;
+	int							participants;
+	atomic_int			joined;
+	cbimage_range_t	ranges[CBIMAGE_MAX_THREADS];
+} cbimage_job_t;
+
+
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+/** 
+ * \brief Library-owned thread pool
+ * 
+ * *busy* is held by the thread that runs a loop on the pool, so loops started
+ * concurrently by other threads are run by their callers instead of waiting.
+ * 
+ * \warning This structure ment to be used *ONLY* internaly.
+ */
+typedef struct
+{
+	pthread_mutex_t	busy;
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	pthread_cond_t	done;
+	pthread_t				threads[CBIMAGE_MAX_THREADS];
+	int							workers;
+	int							running;
+	int							shutdown;
+	unsigned long		generation;
+	cbimage_job_t		*job;
+} cbimage_pool_t;
+
+static cbimage_pool_t cbimage_pool = {
+	.busy = PTHREAD_MUTEX_INITIALIZER,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.workers = 0,
+	.running = 0,
+	.shutdown = 0,
+	.generation = 0,
+	.job = NULL
+};
+#endif
+
+/** 
+ * \brief Caller-supplied executor (see cbimage_set_executor())
+ * 
+ * Executor and its context are changed and readed together under *cbimage_executor_lock*,
+ * so a loop never pairs the new executor with the old context.
+ */
+static cbimage_executor_t	cbimage_executor = NULL;
+static void								*cbimage_executor_context = NULL;
+#ifdef CBIMAGE_HAVE_PTHREAD
+static pthread_mutex_t		cbimage_executor_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+
+/** 
+ * \brief Gets the executor together with its context
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static cbimage_executor_t cbimage_executor_get(void **context)
+{
+	cbimage_executor_t executor;
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&cbimage_executor_lock);
+#endif
+	executor = cbimage_executor;
+	*context = cbimage_executor_context;
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_unlock(&cbimage_executor_lock);
+#endif
+	return executor;
+}
+
+
+
+/** 
+ * \brief Claims grains from ranges until everything is processed
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_job_participate(void *argument)
+{
+	cbimage_job_t	*job = argument;
+	int						self = atomic_fetch_add(&job->joined, 1) % job->participants;
+	int						i, outer = cbimage_in_parallel;
+	
+	cbimage_in_parallel = 1;
+	
+	for(i = 0; i < job->participants; i++)
+	{
+		cbimage_range_t *range = &job->ranges[(self + i) % job->participants];
+		
+		for(;;)
+		{
+			size_t begin = atomic_fetch_add(&range->next, job->grain);
+			
+			if(begin >= range->end)
+				break;
+			
+			job->band(job->context, begin, (range->end - begin < job->grain) ? (range->end) : (begin + job->grain));
+		}
+	}
+	
+	cbimage_in_parallel = outer;
+}
+
+
+
+#ifdef CBIMAGE_HAVE_PTHREAD
+/** 
+ * \brief Pool worker, takes part in every loop started on the pool
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void *cbimage_pool_worker(void *argument)
+{
+	unsigned long seen = (unsigned long)(uintptr_t)argument;
+	
+	pthread_mutex_lock(&cbimage_pool.lock);
+	
+	for(;;)
+	{
+		cbimage_job_t *job;
+		
+		while(!cbimage_pool.shutdown && cbimage_pool.generation == seen)
+			pthread_cond_wait(&cbimage_pool.wake, &cbimage_pool.lock);
+		
+		if(cbimage_pool.shutdown)
+			break;
+		
+		seen = cbimage_pool.generation;
+		job = cbimage_pool.job;
+		pthread_mutex_unlock(&cbimage_pool.lock);
+		
+		cbimage_job_participate(job);
+		
+		pthread_mutex_lock(&cbimage_pool.lock);
+		if(!--cbimage_pool.running)
+			pthread_cond_signal(&cbimage_pool.done);
+	}
+	
+	pthread_mutex_unlock(&cbimage_pool.lock);
+	return NULL;
+}
+
+
+
+/** 
+ * \brief Stops all workers of the pool, *busy* must be held
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pool_stop(void)
+{
+	int i;
+	
+	pthread_mutex_lock(&cbimage_pool.lock);
+	cbimage_pool.shutdown = 1;
+	pthread_cond_broadcast(&cbimage_pool.wake);
+	pthread_mutex_unlock(&cbimage_pool.lock);
+	
+	for(i = 0; i < cbimage_pool.workers; i++)
+		pthread_join(cbimage_pool.threads[i], NULL);
+	
+	cbimage_pool.workers = 0;
+	cbimage_pool.shutdown = 0;
+}
+
+
+
+/** 
+ * \brief Starts workers, so the pool (with the calling thread) has *threads* threads
+ * 
+ * *busy* must be held.
+ * 
+ * \warning This function ment to be used *ONLY* internaly.
+ */
+static void cbimage_pool_start(int threads)
+{
+	unsigned long generation;
+	
+	pthread_mutex_lock(&cbimage_pool.lock);
+	generation = cbimage_pool.generation;
+	pthread_mutex_unlock(&cbimage_pool.lock);
+	
+	/* Workers wait for the next generation, so new workers must not take the finished loop */
+	while(cbimage_pool.workers < threads - 1)
+	{
+		if(pthread_create(&cbimage_pool.threads[cbimage_pool.workers], NULL, cbimage_pool_worker, (void *)(uintptr_t)generation))
+			break;
+		cbimage_pool.workers++;
+	}
+}
+#endif
+
+
+
+void cbimage_set_threads(int threads)
+{
+	if(threads < 0)
+		threads = 0;
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&cbimage_pool.busy);
+	atomic_store(&cbimage_threads, threads);
+	cbimage_pool_stop();
+	pthread_mutex_unlock(&cbimage_pool.busy);
+#else
+	atomic_store(&cbimage_threads, threads);
+#endif
+}
+
+
+
+int cbimage_get_threads(void)
+{
+	int threads = atomic_load(&cbimage_threads);
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	if(threads == 0)
+	{
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (online > 0) ? (int)online : 1;
+	}
+#else
+	if(threads == 0 || !cbimage_executor)
+		threads = 1;
+#endif
+	
+	if(threads > CBIMAGE_MAX_THREADS)
+		threads = CBIMAGE_MAX_THREADS;
+	
+	return threads;
+}
+
+
+
+void cbimage_set_executor(cbimage_executor_t executor, void *context)
+{
+#ifdef CBIMAGE_HAVE_PTHREAD
+	pthread_mutex_lock(&cbimage_pool.busy);
+	pthread_mutex_lock(&cbimage_executor_lock);
+	cbimage_executor = executor;
+	cbimage_executor_context = context;
+	pthread_mutex_unlock(&cbimage_executor_lock);
+	
+	/* Own workers are not needed while caller's pool is used */
+	if(executor)
+		cbimage_pool_stop();
+	pthread_mutex_unlock(&cbimage_pool.busy);
+#else
+	cbimage_executor = executor;
+	cbimage_executor_context = context;
+#endif
+}
+
+
+
+void cbimage_set_parallel_threshold(size_t pixels)
+{
+	atomic_store(&cbimage_threshold, pixels);
+}
+
+
+
+void cbimage_parallel_for(size_t count, size_t grain, cbimage_band_fn band, void *context)
+{
+	cbimage_job_t				job;
+	cbimage_executor_t	executor;
+	void								*executor_context;
+	int									threads, i;
+	
+	assert(band != NULL);
+	
+	if(!count)
+		return;
+	
+	if(!grain)
+		grain = 1;
+	
+	threads = cbimage_get_threads();
+	if((size_t)threads > (count + grain - 1) / grain)
+		threads = (count + grain - 1) / grain;
+	
+	if(threads <= 1 || cbimage_in_parallel)
+	{
+		band(context, 0, count);
+		return;
+	}
+	
+	job.band = band;
+	job.context = context;
+	job.grain = grain;
+	job.participants = threads;
+	atomic_init(&job.joined, 0);
+	
+	for(i = 0; i < threads; i++)
+	{
+		atomic_init(&job.ranges[i].next, count * i / threads);
+		job.ranges[i].end = count * (i + 1) / threads;
+	}
+	
+	executor = cbimage_executor_get(&executor_context);
+	if(executor)
+	{
+		executor(executor_context, cbimage_job_participate, &job, threads);
+		
+		/* Executor may run less tasks than asked, the rest is done here */
+		cbimage_job_participate(&job);
+		return;
+	}
+	
+#ifdef CBIMAGE_HAVE_PTHREAD
+	/* Pool is already used by another thread, so this loop is done by the caller */
+	if(pthread_mutex_trylock(&cbimage_pool.busy))
+	{
+		band(context, 0, count);
+		return;
+	}
+	
+	cbimage_pool_start(cbimage_get_threads());
+	
+	pthread_mutex_lock(&cbimage_pool.lock);
+	cbimage_pool.job = &job;
+	cbimage_pool.running = cbimage_pool.workers;
+	cbimage_pool.generation++;
+	pthread_cond_broadcast(&cbimage_pool.wake);
+	pthread_mutex_unlock(&cbimage_pool.lock);
+	
+	cbimage_job_participate(&job);
+	
+	pthread_mutex_lock(&cbimage_pool.lock);
+	while(cbimage_pool.running)
+		pthread_cond_wait(&cbimage_pool.done, &cbimage_pool.lock);
+	cbimage_pool.job = NULL;
+	pthread_mutex_unlock(&cbimage_pool.lock);
+	
+	pthread_mutex_unlock(&cbimage_pool.busy);
+#else
+	cbimage_job_participate(&job);
+#endif
+}
+
+
+
+void cbimage_parallel_rows(size_t rows, size_t row_pixels, cbimage_band_fn band, void *context)
+{
+	size_t grain;
+	
+	if(!row_pixels)
+		row_pixels = 1;
+	
+	if(rows * row_pixels < atomic_load(&cbimage_threshold))
+	{
+		if(rows)
+			band(context, 0, rows);
+		return;
+	}
+	
+	grain = CBIMAGE_GRAIN_PIXELS / row_pixels;
+	cbimage_parallel_for(rows, (grain) ? (grain) : (1), band, context);
+}
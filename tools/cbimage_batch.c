@@ -0,0 +1,244 @@
+/*
+ * MIT License
+ * Copyright (c) 2017 Romanko Mikhail
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file 
+ * 
+ * \brief Applies the same chain of operations to many BMP files
+ * 
+ * Usage:
+ * 	- cbimage_batch -d output_directory [-b 24|32] [-m memory_MiB] [-j threads] [-p operation]... input.bmp...
+ * 
+ * Operations are applied in the given order:
+ * 	- rotate:90, rotate:180, rotate:270
+ * 	- mirror:h, mirror:v, mirror:hv
+ * 	- orient:N - EXIF orientation (1-8)
+ * 	- inverse, inverse:all
+ * 	- insert:file.bmp:x:y
+ * 	- blend:file.bmp:x:y[:over|premultiplied|add|multiply]
+ * 
+ * Result of every file is written into the output directory under the same name,
+ * files which output would overwrite their input are skipped and reported as failed.
+ * Status of every file is printed, exit status is 1 if any file failed.
+ */
+
+#include <cbimage.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef CBIMAGE_HAVE_STAT
+#include <sys/stat.h>
+#endif
+
+#define BATCH_MAX_OVERLAYS 64
+
+static const char *batch_blend_names[] = {"over", "premultiplied", "add", "multiply"};
+
+
+
+static void batch_usage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s -d output_directory [-b 24|32] [-m memory_MiB] [-j threads] [-p operation]... input.bmp...\n"
+		"Operations: rotate:90|180|270, mirror:h|v|hv, orient:1-8, inverse, inverse:all,\n"
+		"            insert:file.bmp:x:y, blend:file.bmp:x:y[:over|premultiplied|add|multiply]\n", program);
+}
+
+
+
+/** 
+ * \brief Checks if the output filename refers to the input file
+ */
+static int batch_same_file(const char *input, const char *output)
+{
+#ifdef CBIMAGE_HAVE_STAT
+	struct stat input_status, output_status;
+	
+	if(stat(input, &input_status) || stat(output, &output_status))
+		return 0;
+	return input_status.st_dev == output_status.st_dev && input_status.st_ino == output_status.st_ino;
+#else
+	return !strcmp(input, output);
+#endif
+}
+
+
+
+/** 
+ * \brief Parses "file.bmp:x:y[:mode]" and loads the overlay
+ */
+static cbimage_t *batch_overlay(const char *argument, int *x, int *y, int *mode)
+{
+	char	filename[4096], mode_name[32] = "over";
+	int		i;
+	
+	if(sscanf(argument, "%4095[^:]:%d:%d:%31s", filename, x, y, mode_name) < 3)
+		return NULL;
+	
+	for(i = 0; i < 4 && strcmp(mode_name, batch_blend_names[i]); i++);
+	if(i == 4)
+		return NULL;
+	*mode = i;
+	
+	return cbimage_load_bmp_format(filename, CBIMAGE_FORMAT_RGBA8);
+}
+
+
+
+/** 
+ * \brief Adds operation to the pipeline, loaded overlays are stored in *overlays*
+ * 
+ * \return Returns 0 if succsesfull or -1 if operation is not valid
+ */
+static int batch_operation(cbimage_pipeline_t *pipeline, const char *operation, cbimage_t **overlays, int *overlay_count)
+{
+	cbimage_t	*overlay;
+	int				x, y, mode;
+	
+	if(!strcmp(operation, "rotate:90"))
+		return cbimage_pipeline_rotate(pipeline, CBIMAGE_90_DEG);
+	if(!strcmp(operation, "rotate:180"))
+		return cbimage_pipeline_rotate(pipeline, CBIMAGE_180_DEG);
+	if(!strcmp(operation, "rotate:270"))
+		return cbimage_pipeline_rotate(pipeline, CBIMAGE_M90_DEG);
+	if(!strcmp(operation, "mirror:h"))
+		return cbimage_pipeline_mirror(pipeline, CBIMAGE_MIRROR_HORIZONTALY);
+	if(!strcmp(operation, "mirror:v"))
+		return cbimage_pipeline_mirror(pipeline, CBIMAGE_MIRROR_VERTICALY);
+	if(!strcmp(operation, "mirror:hv"))
+		return cbimage_pipeline_mirror(pipeline, CBIMAGE_MIRROR_HORIZONTALY | CBIMAGE_MIRROR_VERTICALY);
+	if(!strncmp(operation, "orient:", 7))
+		return cbimage_pipeline_orient(pipeline, atoi(operation + 7));
+	if(!strcmp(operation, "inverse"))
+		return cbimage_pipeline_inverse(pipeline, CBIMAGE_INVERSE_WITHOUT_ALPHA);
+	if(!strcmp(operation, "inverse:all"))
+		return cbimage_pipeline_inverse(pipeline, CBIMAGE_INVERSE_ALL);
+	
+	if((strncmp(operation, "insert:", 7) && strncmp(operation, "blend:", 6)) || *overlay_count == BATCH_MAX_OVERLAYS)
+		return -1;
+	
+	overlay = batch_overlay(strchr(operation, ':') + 1, &x, &y, &mode);
+	if(!overlay)
+		return -1;
+	overlays[(*overlay_count)++] = overlay;
+	
+	if(operation[0] == 'i')
+		return cbimage_pipeline_insert(pipeline, overlay, x, y);
+	
+	/* Alpha of the overlay is used by blending */
+	overlay->type = CBIMAGE_RGBA;
+	return cbimage_pipeline_blend(pipeline, overlay, x, y, mode);
+}
+
+
+
+int main(int argc, char **argv)
+{
+	cbimage_pipeline_t		*pipeline = cbimage_pipeline_create();
+	cbimage_batch_item_t	*items;
+	cbimage_t							*overlays[BATCH_MAX_OVERLAYS];
+	int										overlay_count = 0, bpp = CBIMAGE_24BPP, count = 0, i;
+	char									*directory = NULL;
+	size_t								memory = 0, failed;
+	
+	if(!pipeline)
+		return 2;
+	
+	items = calloc(argc, sizeof(cbimage_batch_item_t));
+	if(!items)
+		return 2;
+	
+	for(i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-d") && i + 1 < argc) {
+			directory = argv[++i];
+		} else if(!strcmp(argv[i], "-b") && i + 1 < argc) {
+			bpp = atoi(argv[++i]);
+			if(bpp != CBIMAGE_24BPP && bpp != CBIMAGE_32BPP)
+			{
+				batch_usage(argv[0]);
+				return 2;
+			}
+		} else if(!strcmp(argv[i], "-m") && i + 1 < argc) {
+			memory = (size_t)atol(argv[++i]) << 20;
+		} else if(!strcmp(argv[i], "-j") && i + 1 < argc) {
+			cbimage_set_threads(atoi(argv[++i]));
+		} else if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+			if(batch_operation(pipeline, argv[++i], overlays, &overlay_count))
+			{
+				fprintf(stderr, "[ERROR] operation \"%s\" is not valid\n", argv[i]);
+				batch_usage(argv[0]);
+				return 2;
+			}
+		} else if(argv[i][0] == '-') {
+			batch_usage(argv[0]);
+			return 2;
+		} else {
+			items[count++].input = argv[i];
+		}
+	}
+	
+	if(!directory || !count)
+	{
+		batch_usage(argv[0]);
+		return 2;
+	}
+	
+	for(i = 0; i < count; i++)
+	{
+		const char	*name = strrchr(items[i].input, '/');
+		size_t			length;
+		
+		name = (name) ? (name + 1) : (items[i].input);
+		length = strlen(directory) + strlen(name) + 2;
+		items[i].output = malloc(length);
+		if(items[i].output)
+			snprintf(items[i].output, length, "%s/%s", directory, name);
+		
+		if(items[i].output && batch_same_file(items[i].input, items[i].output))
+		{
+			fprintf(stderr, "[ERROR] output \"%s\" is the input file, skipped\n", items[i].output);
+			free(items[i].output);
+			items[i].output = NULL;
+		}
+	}
+	
+	failed = cbimage_batch_bmp(pipeline, items, count, bpp, memory);
+	
+	for(i = 0; i < count; i++)
+	{
+		if(items[i].status)
+			printf("[FAILED] %s\n", items[i].input);
+		else
+			printf("[OK] %s -> %s\n", items[i].input, items[i].output);
+		free(items[i].output);
+	}
+	printf("%d files, %zu failed\n", count, failed);
+	
+	for(i = 0; i < overlay_count; i++)
+		cbimage_destroy(overlays[i]);
+	cbimage_pipeline_destroy(pipeline);
+	free(items);
+	return (failed) ? (1) : (0);
+}